@@ -0,0 +1,145 @@
+#include "Aov.h"
+#include "Parallel.h"
+#include <cmath>
+
+static const char* cAovLayoutNames[AovLayout::Count] = { "off", "full", "compact" };
+
+uint aovPixelSize(AovLayout::Type layout)
+{
+	switch (layout)
+	{
+	case AovLayout::Off:
+		return 0;
+	case AovLayout::Full:
+		return 36;
+	case AovLayout::Compact:
+		return 16;
+	default:
+		throw Error("Unknown AOV layout.");
+	}
+}
+
+const char* aovLayoutName(AovLayout::Type layout)
+{
+	return layout < AovLayout::Count ? cAovLayoutNames[layout] : "unknown";
+}
+
+AovLayout::Type aovLayoutFromName(const char* name)
+{
+	for (uint i = 0; i < AovLayout::Count; ++i)
+		if (strcmp(name, cAovLayoutNames[i]) == 0)
+			return (AovLayout::Type)i;
+
+	throw Error((string("Unknown AOV layout: ") + name).c_str());
+}
+
+static float signNotZero(float v)
+{
+	return v >= 0.f ? 1.f : -1.f;
+}
+
+static uint toSnorm16(float v)
+{
+	return uint(int(floorf(_min(_max(v, -1.f), 1.f) * 32767.f + 0.5f)) & 0xffff);
+}
+
+static float fromSnorm16(uint v)
+{
+	return _max(float(short(v & 0xffff)) / 32767.f, -1.f);
+}
+
+uint packOctNormal(const float3& n)
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 == 0.f)
+		return 0;
+
+	float u = n.x / l1;
+	float v = n.y / l1;
+	if (n.z < 0.f)
+	{
+		float fu = (1.f - fabsf(v)) * signNotZero(u);
+		float fv = (1.f - fabsf(u)) * signNotZero(v);
+		u = fu;
+		v = fv;
+	}
+
+	return toSnorm16(u) | (toSnorm16(v) << 16);
+}
+
+float3 unpackOctNormal(uint packed)
+{
+	float u = fromSnorm16(packed);
+	float v = fromSnorm16(packed >> 16);
+	float3 n(u, v, 1.f - fabsf(u) - fabsf(v));
+	if (n.z < 0.f)
+	{
+		n.x = (1.f - fabsf(v)) * signNotZero(u);
+		n.y = (1.f - fabsf(u)) * signNotZero(v);
+	}
+
+	float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+	return float3(n.x / len, n.y / len, n.z / len);
+}
+
+static float asFloat(uint bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+
+AovSample readAov(const AovImage& image, uint x, uint y)
+{
+	if (image.layout == AovLayout::Off || image.data == nullptr)
+		throw Error("No AOVs were rendered.");
+
+	uint words[9];
+	uint pixelSize = aovPixelSize(image.layout);
+	memcpy(words, (const uint8*)image.data + (uint64(y) * image.width + x) * pixelSize, pixelSize);
+
+	AovSample s;
+	if (image.layout == AovLayout::Full)
+	{
+		s.albedo = float3(asFloat(words[0]), asFloat(words[1]), asFloat(words[2]));
+		s.depth = asFloat(words[3]);
+		s.normal = float3(asFloat(words[4]), asFloat(words[5]), asFloat(words[6]));
+		s.objectIdx = words[7];
+		s.materialIdx = words[8];
+	}
+	else
+	{
+		s.albedo = float3((words[0] & 0xff) / 255.f, ((words[0] >> 8) & 0xff) / 255.f, ((words[0] >> 16) & 0xff) / 255.f);
+		s.depth = asFloat(words[2]);
+		//Misses pack a zero normal, which decodes like +z
+		s.normal = s.depth > 0.f ? unpackOctNormal(words[1]) : float3(0.f);
+		uint objectIdx = words[3] & 0xffff;
+		uint materialIdx = words[3] >> 16;
+		s.objectIdx = objectIdx == 0xffff ? cAovNoHit : objectIdx;
+		s.materialIdx = materialIdx == 0xffff ? cAovNoHit : materialIdx;
+	}
+
+	return s;
+}
+
+void readAovPlanes(const AovImage& image, float3* albedo, float3* normal, float* depth, uint* objectIdx, uint* materialIdx)
+{
+	parallelFor(image.height, [&](uint y)
+	{
+		for (uint x = 0; x < image.width; ++x)
+		{
+			uint64 i = uint64(y) * image.width + x;
+			AovSample s = readAov(image, x, y);
+			if (albedo)
+				albedo[i] = s.albedo;
+			if (normal)
+				normal[i] = s.normal;
+			if (depth)
+				depth[i] = s.depth;
+			if (objectIdx)
+				objectIdx[i] = s.objectIdx;
+			if (materialIdx)
+				materialIdx[i] = s.materialIdx;
+		}
+	});
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "dxHelper.h"
+
+//First-hit feature buffers written by rayGen next to the radiance. Each holds the average of
+//the frame's samples for albedo and normal, and the first sample's depth and ids; they are
+//not accumulated across frames.
+namespace AovLayout
+{
+	enum Type
+	{
+		Off,
+		Full,		//36 bytes: float3 albedo, float depth, float3 normal, uint objectIdx, uint materialIdx
+		Compact,	//16 bytes: RGBA8 albedo, 16:16 octahedral normal, float depth, 16:16 object/material ids
+
+		Count
+	};
+}
+
+static const uint cAovNoHit = 0xffffffff;
+
+struct AovSample
+{
+	float3 albedo;
+	float3 normal;			//world space, facing the camera; zero on a miss
+	float depth;			//distance along the camera's forward axis; 0 on a miss
+	uint objectIdx;			//cAovNoHit on a miss
+	uint materialIdx;
+};
+
+struct AovImage
+{
+	const void* data = nullptr;
+	uint width = 0;
+	uint height = 0;
+	AovLayout::Type layout = AovLayout::Off;
+};
+
+uint aovPixelSize(AovLayout::Type layout);
+const char* aovLayoutName(AovLayout::Type layout);
+AovLayout::Type aovLayoutFromName(const char* name);
+
+//Octahedral normal encoding shared with DXRShader.hlsl
+uint packOctNormal(const float3& n);
+float3 unpackOctNormal(uint packed);
+
+AovSample readAov(const AovImage& image, uint x, uint y);
+//Whole image into planes; any pointer may be null to skip that plane
+void readAovPlanes(const AovImage& image, float3* albedo, float3* normal, float* depth, uint* objectIdx, uint* materialIdx);
@@ -0,0 +1,362 @@
+#include "Benchmark.h"
+#include "Scene.h"
+#include "Error.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+
+static const uint cMathCount = 1 << 20;
+static const uint cMaxIterations = 1 << 16;
+
+//Every benchmark folds a bit of its output in here, so the compiler cannot drop the work
+static volatile float gSink;
+
+//Reaches the private steps of SceneLoader the way its push_* functions use them
+class SceneBenchmark
+{
+public:
+	static void initializeGeometry(Scene* scene, const vector<Mesh*>& meshes)
+	{
+		SceneLoader loader;
+		loader.initializeGeometryFromMeshes(scene, meshes);
+	}
+	static void computeModelMatrices(Scene* scene)
+	{
+		SceneLoader loader;
+		loader.computeModelMatrices(scene);
+	}
+	static vector<SceneObject>& objects(Scene* scene) { return scene->objArr; }
+	static uint64 geometryBytes(const Scene* scene)
+	{
+		return scene->vtxArr.size() * sizeof(Vertex) + scene->tdxArr.size() * sizeof(Tridex) + scene->objArr.size() * sizeof(SceneObject);
+	}
+};
+
+class BenchmarkRunner
+{
+	const BenchmarkSettings& settings;
+
+public:
+	vector<BenchmarkResult> results;
+
+	BenchmarkRunner(const BenchmarkSettings& settings) : settings(settings) {}
+
+	bool wanted(const string& name) const
+	{
+		return settings.filter.empty() || name.find(settings.filter) != string::npos;
+	}
+
+	void run(const string& name, uint64 bytes, uint64 items, const function<void()>& body)
+	{
+		if (!wanted(name))
+			return;
+
+		//The untimed first run warms caches and the allocator, and sizes the repetitions
+		auto start = chrono::steady_clock::now();
+		body();
+		double once = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		uint iterations = (uint)_clamp(settings.minRepetitionSeconds / _max(once, 1e-9), 1.0, (double)cMaxIterations);
+
+		vector<double> perRun(_max(settings.repetitions, 1u));
+		for (double& seconds : perRun)
+		{
+			start = chrono::steady_clock::now();
+			for (uint i = 0; i < iterations; ++i)
+				body();
+			seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / iterations;
+		}
+
+		BenchmarkResult r;
+		r.name = name;
+		r.repetitions = (uint)perRun.size();
+		r.iterations = iterations;
+		r.bytes = bytes;
+		r.items = items;
+
+		double sum = 0.0;
+		for (double s : perRun)
+			sum += s;
+		r.meanSeconds = sum / perRun.size();
+		double var = 0.0;
+		for (double s : perRun)
+			var += (s - r.meanSeconds) * (s - r.meanSeconds);
+		r.stddevSeconds = perRun.size() > 1 ? sqrt(var / (perRun.size() - 1)) : 0.0;
+
+		sort(perRun.begin(), perRun.end());
+		r.minSeconds = perRun.front();
+		size_t mid = perRun.size() / 2;
+		r.medianSeconds = (perRun.size() % 2) ? perRun[mid] : 0.5 * (perRun[mid - 1] + perRun[mid]);
+
+		printf("%-36s %12.3f %12.3f %7.2f%% %10.1f %10.2f\n", r.name.c_str(), r.minSeconds * 1e6, r.medianSeconds * 1e6,
+			100.0 * r.stddevSeconds / r.medianSeconds, r.bytesPerSecond() / (1 << 20), r.itemsPerSecond() * 1e-6);
+		fflush(stdout);
+		results.push_back(r);
+	}
+};
+
+static vector<string> listObjFiles(const string& dir)
+{
+	vector<string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((dir + "/*.obj").c_str(), &data);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+			names.push_back(data.cFileName);
+		while (FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	if (DIR* d = opendir(dir.c_str()))
+	{
+		while (dirent* e = readdir(d))
+		{
+			string name = e->d_name;
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0)
+				names.push_back(name);
+		}
+		closedir(d);
+	}
+#endif
+	sort(names.begin(), names.end());
+	return names;
+}
+
+static uint64 fileSize(const string& path)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	return file ? (uint64)file.tellg() : 0;
+}
+
+static uint64 meshBytes(const Mesh& mesh)
+{
+	return mesh.vtxArr.size() * sizeof(Vertex) + mesh.tdxArr.size() * sizeof(Tridex);
+}
+
+static void benchmarkMeshes(BenchmarkRunner& runner, const BenchmarkSettings& settings)
+{
+	const uint tessellations[][2] = { { 32, 16 }, { 180, 100 }, { 720, 400 } };
+	for (auto& t : tessellations)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "sphere/%ux%u", t[0], t[1]);
+		if (!runner.wanted(name))
+			continue;
+
+		Mesh probe = generateSphereMesh(float3(0.f), 1.f, t[0], t[1]);
+		runner.run(name, meshBytes(probe), probe.vtxArr.size(), [&]()
+		{
+			Mesh mesh = generateSphereMesh(float3(0.f), 1.f, t[0], t[1]);
+			gSink = mesh.vtxArr.back().position.y;
+		});
+	}
+
+	vector<string> files = listObjFiles(settings.meshDir);
+	if (files.empty())
+		printf("No .obj files in %s, skipping the OBJ benchmarks\n", settings.meshDir.c_str());
+
+	for (const string& file : files)
+	{
+		string path = settings.meshDir + "/" + file;
+		string stem = file.substr(0, file.size() - 4);
+		for (bool optimize : { true, false })
+		{
+			string name = "obj/" + stem + (optimize ? "/optimized" : "/raw");
+			if (!runner.wanted(name))
+				continue;
+
+			Mesh probe;
+			try
+			{
+				probe = loadMeshFromOBJFile(path.c_str(), optimize);
+			}
+			catch (Error&)
+			{
+				printf("Skipping %s\n", path.c_str());
+				break;
+			}
+
+			//Input bytes: the rate is how fast the loader gets through the file
+			runner.run(name, fileSize(path), probe.vtxArr.size(), [&]()
+			{
+				Mesh mesh = loadMeshFromOBJFile(path.c_str(), optimize);
+				gSink = mesh.vtxArr.back().position.x;
+			});
+		}
+	}
+}
+
+static void benchmarkScene(BenchmarkRunner& runner)
+{
+	//Each setup is only built when the filter matches the full name of the benchmark that uses it
+	const uint numSpheres = 64;
+	const string geometryName = "scene/initializeGeometry/64x180x100";
+	if (runner.wanted(geometryName))
+	{
+		vector<Mesh> meshes(numSpheres);
+		vector<Mesh*> meshPtrs(numSpheres);
+		for (uint i = 0; i < numSpheres; ++i)
+		{
+			meshes[i] = generateSphereMesh(float3(float(i), 0.f, 0.f), 0.4f);
+			meshPtrs[i] = &meshes[i];
+		}
+
+		Scene probe;
+		SceneBenchmark::initializeGeometry(&probe, meshPtrs);
+		runner.run(geometryName, SceneBenchmark::geometryBytes(&probe), probe.getVertexArray().size(), [&]()
+		{
+			Scene scene;
+			SceneBenchmark::initializeGeometry(&scene, meshPtrs);
+			gSink = scene.getVertexArray().back().position.x;
+		});
+	}
+
+	const uint numObjects = 1 << 20;
+	const string matricesName = "scene/computeModelMatrices/1M";
+	if (runner.wanted(matricesName))
+	{
+		Scene scene;
+		vector<SceneObject>& objArr = SceneBenchmark::objects(&scene);
+		objArr.resize(numObjects);
+
+		mt19937 rng(1);
+		uniform_real_distribution<float> dist(-1.f, 1.f);
+		for (SceneObject& obj : objArr)
+		{
+			obj.translation = float3(dist(rng), dist(rng), dist(rng)) * 100.f;
+			obj.rotation = getRotationAsQuternion(normalize(float3(dist(rng), dist(rng), 1.f)), 180.f * dist(rng));
+			obj.scale = 1.5f + dist(rng);
+		}
+
+		//Reads translation, rotation and scale, writes the matrix
+		runner.run(matricesName, uint64(numObjects) * (sizeof(float3) + sizeof(float4) + sizeof(float) + sizeof(Transform)), numObjects, [&]()
+		{
+			SceneBenchmark::computeModelMatrices(&scene);
+			gSink = objArr.back().modelMatrix.mat[0][3];
+		});
+	}
+}
+
+//The inputs take a few milliseconds, so they are made whatever the filter, and each run filters itself
+static void benchmarkMath(BenchmarkRunner& runner)
+{
+	mt19937 rng(2);
+	uniform_real_distribution<float> dist(-1.f, 1.f);
+	vector<float3> a(cMathCount), b(cMathCount), out3(cMathCount);
+	vector<float4> rot(cMathCount);
+	vector<float> out1(cMathCount);
+	for (uint i = 0; i < cMathCount; ++i)
+	{
+		a[i] = float3(dist(rng), dist(rng), dist(rng));
+		b[i] = float3(dist(rng), dist(rng), dist(rng));
+		rot[i] = getRotationAsQuternion(normalize(b[i] + float3(0.f, 0.f, 2.f)), 180.f * dist(rng));
+	}
+	Transform tm = composeMatrix(float3(1.f, 2.f, 3.f), rot[0], 2.f);
+
+	const uint64 n = cMathCount;
+	const uint64 vec = sizeof(float3);
+
+	runner.run("math/dot/1M", n * (2 * vec + sizeof(float)), n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out1[i] = dot(a[i], b[i]);
+		gSink = out1[cMathCount / 2];
+	});
+	runner.run("math/cross/1M", n * 3 * vec, n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out3[i] = cross(a[i], b[i]);
+		gSink = out3[cMathCount / 2].x;
+	});
+	runner.run("math/length/1M", n * (vec + sizeof(float)), n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out1[i] = length(a[i]);
+		gSink = out1[cMathCount / 2];
+	});
+	runner.run("math/normalize/1M", n * 2 * vec, n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out3[i] = normalize(a[i]);
+		gSink = out3[cMathCount / 2].x;
+	});
+	runner.run("math/add-scale/1M", n * 3 * vec, n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out3[i] = a[i] + 0.5f * b[i];
+		gSink = out3[cMathCount / 2].x;
+	});
+	runner.run("math/transformPoint/1M", n * 2 * vec, n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out3[i] = transformPoint(tm, a[i]);
+		gSink = out3[cMathCount / 2].x;
+	});
+	runner.run("math/transformVector/1M", n * 2 * vec, n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			out3[i] = transformVector(tm, a[i]);
+		gSink = out3[cMathCount / 2].x;
+	});
+
+	vector<Transform> matrices(cMathCount);
+	runner.run("math/composeMatrix/1M", n * (vec + sizeof(float4) + sizeof(Transform)), n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			matrices[i] = composeMatrix(a[i], rot[i], 1.5f);
+		gSink = matrices[cMathCount / 2].mat[1][1];
+	});
+	vector<float> rowMajor(uint64(cMathCount) * 16);
+	runner.run("math/composeMatrix16/1M", n * (vec + sizeof(float4) + 16 * sizeof(float)), n, [&]()
+	{
+		for (uint i = 0; i < cMathCount; ++i)
+			composeMatrix(&rowMajor[uint64(i) * 16], a[i], rot[i], 1.5f);
+		gSink = rowMajor[16 * (cMathCount / 2) + 5];
+	});
+}
+
+vector<BenchmarkResult> runBenchmarks(const BenchmarkSettings& settings)
+{
+	printf("%u repetitions of at least %.0f ms each, times per run\n", settings.repetitions, settings.minRepetitionSeconds * 1e3);
+	printf("%-36s %12s %12s %8s %10s %10s\n", "benchmark", "min us", "median us", "stddev", "MB/s", "M items/s");
+
+	BenchmarkRunner runner(settings);
+	benchmarkMeshes(runner, settings);
+	benchmarkScene(runner);
+	benchmarkMath(runner);
+	return runner.results;
+}
+
+void writeBenchmarks(const string& path, const vector<BenchmarkResult>& results)
+{
+	ofstream file(path, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+
+	char line[512];
+	snprintf(line, sizeof(line), "{\n\t\"time\": %lld,\n\t\"threads\": %u,\n\t\"benchmarks\": [",
+		(long long)time(nullptr), thread::hardware_concurrency());
+	file << line;
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchmarkResult& r = results[i];
+		snprintf(line, sizeof(line), "%s\n\t\t{ \"name\": \"%s\", \"repetitions\": %u, \"iterations\": %u, \"min_ns\": %.1f, \"median_ns\": %.1f, \"mean_ns\": %.1f, \"stddev_ns\": %.1f, "
+			"\"bytes\": %llu, \"items\": %llu, \"bytes_per_second\": %.6g, \"items_per_second\": %.6g }",
+			i > 0 ? "," : "", r.name.c_str(), r.repetitions, r.iterations, r.minSeconds * 1e9, r.medianSeconds * 1e9, r.meanSeconds * 1e9,
+			r.stddevSeconds * 1e9, (unsigned long long)r.bytes, (unsigned long long)r.items, r.bytesPerSecond(), r.itemsPerSecond());
+		file << line;
+	}
+	file << "\n\t]\n}\n";
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
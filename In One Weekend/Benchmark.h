@@ -0,0 +1,36 @@
+#pragma once
+#include "basic_types.h"
+#include <string>
+#include <vector>
+
+//Times per run of one benchmark, over repetitions of iterations runs each
+struct BenchmarkResult
+{
+	std::string name;
+	uint repetitions;
+	uint iterations;
+	double minSeconds;
+	double medianSeconds;
+	double meanSeconds;
+	double stddevSeconds;	//of the repetitions; large against the median means the machine was busy
+	uint64 bytes;			//read or written per run, 0 where no size applies
+	uint64 items;			//vertices, objects or vectors per run
+
+	double bytesPerSecond() const { return medianSeconds > 0.0 ? bytes / medianSeconds : 0.0; }
+	double itemsPerSecond() const { return medianSeconds > 0.0 ? items / medianSeconds : 0.0; }
+};
+
+struct BenchmarkSettings
+{
+	uint repetitions = 10;
+	double minRepetitionSeconds = 0.05;		//fast benchmarks loop until a repetition takes this long
+	std::string filter;						//run only the benchmarks whose name contains it
+	std::string meshDir = "../__data/mesh";
+};
+
+//Mesh generation and OBJ loading, scene assembly, model matrices over 1M objects and the
+//basic_math.h vector ops. Needs no window or device, so it runs on a headless machine.
+//Each result is printed as soon as its benchmark finishes.
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkSettings& settings = BenchmarkSettings());
+//JSON, one object per benchmark, for tracking the numbers from build to build
+void writeBenchmarks(const std::string& path, const std::vector<BenchmarkResult>& results);
@@ -0,0 +1,43 @@
+//The benchmark suite on its own: no window, device or pch.h, so it builds and runs on any
+//machine with a C++14 compiler. See CMakeLists.txt.
+#include "Benchmark.h"
+#include "Error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char* argv[])
+{
+	const char* benchFile = nullptr;
+	BenchmarkSettings settings;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			settings.filter = argv[++i];
+		else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+			settings.repetitions = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--mesh-dir") == 0 && i + 1 < argc)
+			settings.meshDir = argv[++i];
+		else if (argv[i][0] != '-' && !benchFile)
+			benchFile = argv[i];
+		else
+		{
+			printf("Usage: %s [file.json] [--filter text] [--reps n] [--mesh-dir dir]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	try
+	{
+		std::vector<BenchmarkResult> results = runBenchmarks(settings);
+		if (benchFile)
+			writeBenchmarks(benchFile, results);
+	}
+	catch (const Error&)
+	{
+		//Already printed
+		return 1;
+	}
+	return 0;
+}
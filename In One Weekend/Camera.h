@@ -4,6 +4,9 @@
 #include "pch.h"
 #include "dxHelper.h"
 
+//Vertical field of view the tracer starts with
+static const float cStartupFovY = 1.f / 9.f * XM_PI;
+
 class Camera
 {
 public:
@@ -0,0 +1,85 @@
+#include "CameraPath.h"
+#include "Error.h"
+#include <algorithm>
+#include <fstream>
+
+static const char* cCsvHeader = "time,px,py,pz,lx,ly,lz,ux,uy,uz,aperture,focusDist";
+
+void CameraPath::record(const CameraKey& key)
+{
+	if (!mKeys.empty() && key.time < mKeys.back().time)
+		throw Error("Camera keys must be recorded in time order.");
+	mKeys.push_back(key);
+}
+
+CameraKey CameraPath::sample(double time) const
+{
+	if (mKeys.empty())
+		throw Error("Cannot sample an empty camera path.");
+
+	auto next = upper_bound(mKeys.begin(), mKeys.end(), time, [](double t, const CameraKey& k) { return t < k.time; });
+	if (next == mKeys.begin())
+		return mKeys.front();
+	if (next == mKeys.end())
+		return mKeys.back();
+
+	const CameraKey& a = *(next - 1);
+	const CameraKey& b = *next;
+	float f = (b.time > a.time) ? float((time - a.time) / (b.time - a.time)) : 1.f;
+
+	CameraKey key;
+	key.time = time;
+	key.position = a.position + f * (b.position - a.position);
+	key.look = normalize(a.look + f * (b.look - a.look));
+	key.up = normalize(a.up + f * (b.up - a.up));
+	key.aperture = a.aperture + f * (b.aperture - a.aperture);
+	key.focusDist = a.focusDist + f * (b.focusDist - a.focusDist);
+	return key;
+}
+
+void CameraPath::save(const string& path) const
+{
+	ofstream file(path, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+
+	file << "# seed " << sceneSeed << "\n" << cCsvHeader << "\n";
+	char line[512];
+	for (const CameraKey& k : mKeys)
+	{
+		snprintf(line, sizeof(line), "%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", k.time,
+			k.position.x, k.position.y, k.position.z, k.look.x, k.look.y, k.look.z, k.up.x, k.up.y, k.up.z, k.aperture, k.focusDist);
+		file << line;
+	}
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
+
+void CameraPath::load(const string& path)
+{
+	ifstream file(path);
+	if (!file)
+		throw Error(("Cannot open " + path).c_str());
+
+	string line;
+	getline(file, line);
+	if (sscanf(line.c_str(), "# seed %u", &sceneSeed) != 1 || !getline(file, line) || line != cCsvHeader)
+		throw Error((path + " is not a camera path.").c_str());
+
+	mKeys.clear();
+	while (getline(file, line))
+	{
+		if (line.empty())
+			continue;
+
+		CameraKey k;
+		if (sscanf(line.c_str(), "%lf,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f", &k.time,
+			&k.position.x, &k.position.y, &k.position.z, &k.look.x, &k.look.y, &k.look.z, &k.up.x, &k.up.y, &k.up.z, &k.aperture, &k.focusDist) != 12)
+			throw Error(("Bad line in " + path + ": " + line).c_str());
+		record(k);
+	}
+
+	if (mKeys.empty())
+		throw Error((path + " has no camera keys.").c_str());
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "basic_math.h"
+
+//Everything the tracer needs to reproduce a view
+struct CameraKey
+{
+	double time = 0.0;		//seconds from the start of the path
+	float3 position;
+	float3 look;
+	float3 up;
+	float aperture;
+	float focusDist;
+};
+
+//Camera keys over time, recorded once a frame and played back at any rate.
+//Text file: a "# seed n" line with the scene seed, a CSV header, then one key per line.
+class CameraPath
+{
+	vector<CameraKey> mKeys;
+
+public:
+	uint sceneSeed = 0;		//the random scene the path was recorded in
+
+	void clear() { mKeys.clear(); }
+	//Times must not decrease
+	void record(const CameraKey& key);
+	uint numKeys() const { return (uint)mKeys.size(); }
+	const CameraKey& getKey(uint i) const { return mKeys[i]; }
+	double duration() const { return mKeys.empty() ? 0.0 : mKeys.back().time - mKeys.front().time; }
+
+	//Linear in position, aperture and focus distance, normalized linear in the directions.
+	//Times outside the path hold the first or last key.
+	CameraKey sample(double time) const;
+
+	void save(const string& path) const;
+	void load(const string& path);
+};
@@ -0,0 +1,132 @@
+#include "Checkpoint.h"
+#include "basic_random.h"
+#include "Trace.h"
+#include <fstream>
+
+static const uint cCheckpointMagic = 0x31504b43; //"CKP1"
+
+struct CheckpointHeader
+{
+	uint magic;
+	uint stateSize;
+	uint64 radianceSize;
+	uint64 radianceHash;
+	CheckpointState state;
+};
+
+uint64 hashScene(const Scene* scene)
+{
+	const vector<Vertex>& vtxArr = scene->getVertexArray();
+	const vector<Tridex>& tdxArr = scene->getTridexArray();
+	const vector<Material>& mtlArr = scene->getMaterialArray();
+
+	uint64 hash = fnv1a(vtxArr.data(), vtxArr.size() * sizeof(Vertex));
+	hash = fnv1a(tdxArr.data(), tdxArr.size() * sizeof(Tridex), hash);
+	hash = fnv1a(mtlArr.data(), mtlArr.size() * sizeof(Material), hash);
+
+	for (uint objIdx = 0; objIdx < scene->numObjects(); ++objIdx)
+	{
+		const SceneObject& obj = scene->getObject(objIdx);
+		hash = fnv1a(&obj.vertexOffset, sizeof(uint) * 4, hash);
+		hash = fnv1a(&obj.materialIdx, sizeof(uint), hash);
+		hash = fnv1a(&obj.modelMatrix, sizeof(Transform), hash);
+	}
+
+	return hash;
+}
+
+static bool readHeader(ifstream& file, CheckpointHeader& header)
+{
+	file.read((char*)&header, sizeof(header));
+	return file && header.magic == cCheckpointMagic && header.stateSize == sizeof(CheckpointState);
+}
+
+//The writer removes the old file just before renaming the new one into place
+static ifstream openCheckpoint(const string& path)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+		file.open(path + ".tmp", ios::binary);
+	return file;
+}
+
+bool readCheckpointState(const string& path, CheckpointState& state)
+{
+	ifstream file = openCheckpoint(path);
+	CheckpointHeader header;
+	if (!file || !readHeader(file, header))
+		return false;
+
+	state = header.state;
+	return true;
+}
+
+bool readCheckpoint(const string& path, CheckpointState& state, vector<uint8>& radiance)
+{
+	ifstream file = openCheckpoint(path);
+	CheckpointHeader header;
+	if (!file || !readHeader(file, header))
+		return false;
+
+	radiance.resize(header.radianceSize);
+	file.read((char*)radiance.data(), header.radianceSize);
+	if (!file || fnv1a(radiance.data(), radiance.size()) != header.radianceHash)
+		return false;
+
+	state = header.state;
+	return true;
+}
+
+bool CheckpointWriter::writeAsync(const string& path, const CheckpointState& state, const void* radiance, uint64 size)
+{
+	if (busy)
+		return false;
+
+	if (worker.joinable())
+		worker.join();
+
+	radianceCopy.resize(size);
+	memcpy(radianceCopy.data(), radiance, size);
+
+	busy = true;
+	worker = thread([this, path, state]()
+	{
+		traceThreadName("checkpoint writer");
+		TraceScope scope("writeCheckpoint");
+
+		CheckpointHeader header = {};
+		header.magic = cCheckpointMagic;
+		header.stateSize = sizeof(CheckpointState);
+		header.radianceSize = radianceCopy.size();
+		header.radianceHash = fnv1a(radianceCopy.data(), radianceCopy.size());
+		header.state = state;
+
+		string tmpPath = path + ".tmp";
+		bool written;
+		{
+			ofstream file(tmpPath, ios::binary | ios::trunc);
+			file.write((const char*)&header, sizeof(header));
+			file.write((const char*)radianceCopy.data(), radianceCopy.size());
+			written = (bool)file;
+		}
+
+		if (written)
+		{
+			remove(path.c_str());
+			written = rename(tmpPath.c_str(), path.c_str()) == 0;
+		}
+
+		if (!written)
+			printf("Failed to write checkpoint %s\n", path.c_str());
+
+		busy = false;
+	});
+
+	return true;
+}
+
+void CheckpointWriter::wait()
+{
+	if (worker.joinable())
+		worker.join();
+}
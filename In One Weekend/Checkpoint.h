@@ -0,0 +1,44 @@
+#pragma once
+#include "dxHelper.h"
+#include "Scene.h"
+#include <thread>
+#include <atomic>
+
+//Everything needed to continue a progressive render besides the radiance itself
+struct CheckpointState
+{
+	uint width;
+	uint height;
+	uint accumulatedFrames;		//frames already averaged into the radiance buffer
+	uint sceneSeed;
+	uint64 sceneHash;
+	uint renderMode;
+	XMFLOAT3 cameraPos;
+	XMFLOAT3 cameraLook;
+	XMFLOAT3 cameraUp;
+	float aperture;
+	float focusDist;
+};
+
+uint64 hashScene(const Scene* scene);
+
+//Reads only the state, e.g. to rebuild the scene from its seed before the radiance is needed
+bool readCheckpointState(const string& path, CheckpointState& state);
+bool readCheckpoint(const string& path, CheckpointState& state, vector<uint8>& radiance);
+
+//Writes checkpoints on a worker thread. Each one goes to path.tmp first and is renamed
+//over path when complete, so a crash mid-write never leaves a torn checkpoint behind.
+class CheckpointWriter
+{
+	thread worker;
+	atomic<bool> busy{ false };
+	vector<uint8> radianceCopy;
+
+public:
+	~CheckpointWriter() { wait(); }
+
+	bool isBusy() const { return busy; }
+	//Copies the radiance and returns immediately; false if the previous write is still running
+	bool writeAsync(const string& path, const CheckpointState& state, const void* radiance, uint64 size);
+	void wait();
+};
@@ -0,0 +1,304 @@
+#include "CostHeatmap.h"
+#include "basic_random.h"
+#include "ImageWriter.h"
+#include "Error.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+
+static const uint cNoObject = ~0u;
+
+static const char* cMetricNames[CostMetric::Count] = {
+	"nodes",
+	"triangles",
+	"bounces",
+	"time",
+};
+
+const char* costMetricName(CostMetric::Type metric)
+{
+	return cMetricNames[metric];
+}
+
+//The sampling helpers of Helpers.hlsli, drawing the same numbers from the same RngState
+static float3 randomInUnitSphere(RngState& rng)
+{
+	float3 p;
+	do
+	{
+		p.x = rand(rng, -1.f, 1.f);
+		p.y = rand(rng, -1.f, 1.f);
+		p.z = rand(rng, -1.f, 1.f);
+	} while (dot(p, p) >= 1.f);
+	return p;
+}
+
+static float3 reflect(const float3& v, const float3& n)
+{
+	return v - 2.f * dot(v, n) * n;
+}
+
+static float3 refract(const float3& uv, const float3& n, float etaiOverEtat)
+{
+	float cosTheta = _min(dot(-uv, n), 1.f);
+	float3 perp = etaiOverEtat * (uv + cosTheta * n);
+	float3 parallel = -sqrtf(fabsf(1.f - dot(perp, perp))) * n;
+	return perp + parallel;
+}
+
+static float reflectance(float cosine, float refIdx)
+{
+	float r0 = (1.f - refIdx) / (1.f + refIdx);
+	r0 = r0 * r0;
+	return r0 + (1.f - r0) * powf(1.f - cosine, 5.f);
+}
+
+//Polynomial fit of the Turbo colour map (Mikhailov 2019), t in [0, 1]
+static float3 turbo(float t)
+{
+	t = _clamp(t, 0.f, 1.f);
+	float t2 = t * t, t3 = t2 * t, t4 = t3 * t, t5 = t4 * t;
+	float r = 0.13572138f + 4.61539260f * t - 42.66032258f * t2 + 132.13108234f * t3 - 152.94239396f * t4 + 59.28637943f * t5;
+	float g = 0.09140261f + 2.19418839f * t + 4.84296658f * t2 - 14.18503333f * t3 + 4.27729857f * t4 + 2.82956604f * t5;
+	float b = 0.10667330f + 12.64194608f * t - 60.58204836f * t2 + 110.36276771f * t3 - 89.90310912f * t4 + 27.34824973f * t5;
+	return float3(_clamp(r, 0.f, 1.f), _clamp(g, 0.f, 1.f), _clamp(b, 0.f, 1.f));
+}
+
+void CostHeatmap::build(const Scene* scene)
+{
+	this->scene = scene;
+	bvh.build(scene);
+}
+
+//Vertex normals interpolated as computeNormal does on the GPU
+float3 CostHeatmap::shadingNormal(const HitInfo& hit) const
+{
+	const SceneObject& obj = scene->getObject(hit.objIdx);
+	const Tridex& tdx = scene->getTridexArray()[obj.tridexOffset + hit.primIdx];
+	const vector<Vertex>& vtxArr = scene->getVertexArray();
+
+	float3 n0 = vtxArr[obj.vertexOffset + tdx.x].normal;
+	float3 n1 = vtxArr[obj.vertexOffset + tdx.y].normal;
+	float3 n2 = vtxArr[obj.vertexOffset + tdx.z].normal;
+	float3 n = (1.f - hit.u - hit.v) * n0 + hit.u * n1 + hit.v * n2;
+
+	return normalize(transformVector(obj.modelMatrix, n));
+}
+
+//Follows the bounces of closestHit; light sampling and its occlusion rays are left out,
+//so the counts are those of the path rays
+void CostHeatmap::tracePixel(const HeatmapView& view, uint x, uint y)
+{
+	const vector<Material>& mtlArr = scene->getMaterialArray();
+	uint pixelIdx = width * y + x;
+	uint firstHit = cNoObject;
+	double sums[CostMetric::Count] = {};
+
+	for (uint s = 0; s < settings.samplesPerPixel; ++s)
+	{
+		auto start = chrono::steady_clock::now();
+		TraversalStats stats;
+		uint bounces = 0;
+
+		RngState rng = initRng(pixelIdx, 0, s, 0);
+		float u = ((x + rand(rng)) / width) * 2.f - 1.f;
+		float v = -(((y + rand(rng)) / height) * 2.f - 1.f);
+
+		Ray ray;
+		ray.origin = view.position;
+		ray.direction = normalize(view.right * (u * view.tanHalfFovX) + view.up * (v * view.tanHalfFovY) + view.look);
+		ray.tMin = 1e-4f;
+		ray.tMax = 1e27f;
+
+		for (uint depth = 0; depth <= settings.maxPathLength; ++depth)
+		{
+			rng.bounce = depth + 1;
+			rng.dimension = 0;
+
+			HitInfo hit;
+			if (!bvh.intersect(ray, hit, &stats))
+				break;
+			if (depth == 0 && s == 0)
+				firstHit = hit.objIdx;
+			++bounces;
+
+			const Material& mtl = mtlArr[scene->getObject(hit.objIdx).materialIdx];
+			float3 normal = shadingNormal(hit);
+			float3 hitPos = ray.origin + hit.t * ray.direction;
+			float3 dir = ray.direction;
+
+			if (mtl.type == MaterialType::Emissive)
+				break;
+			else if (mtl.type == MaterialType::Lambertian)
+				dir = normal + normalize(randomInUnitSphere(rng));
+			else if (mtl.type == MaterialType::Metal)
+				dir = normalize(reflect(dir, normal) + randomInUnitSphere(rng) * mtl.fuzz);
+			else if (mtl.type == MaterialType::Dielectric)
+			{
+				bool isFrontFace = dot(dir, normal) < 0.f;
+				if (!isFrontFace)
+					normal = -normal;
+
+				float ratio = isFrontFace ? (1.f / mtl.refractionIndex) : mtl.refractionIndex;
+				float cosTheta = _min(dot(-dir, normal), 1.f);
+				float sinTheta = sqrtf(1.f - cosTheta * cosTheta);
+
+				if (ratio * sinTheta > 1.f || reflectance(cosTheta, ratio) > rand(rng))
+					dir = reflect(dir, normal);
+				else
+					dir = refract(dir, normal, ratio);
+			}
+
+			//Back-face cutoff, as on the GPU
+			if (dot(-ray.direction, normal) < 0.f)
+				break;
+
+			ray.origin = hitPos;
+			ray.direction = dir;
+		}
+
+		sums[CostMetric::NodesVisited] += (double)stats.nodesVisited;
+		sums[CostMetric::TrianglesTested] += (double)stats.trianglesTested;
+		sums[CostMetric::Bounces] += bounces;
+		sums[CostMetric::Time] += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+	}
+
+	for (uint m = 0; m < CostMetric::Count; ++m)
+		metricArr[m][pixelIdx] = float(sums[m] / settings.samplesPerPixel);
+	firstHitArr[pixelIdx] = firstHit;
+}
+
+void CostHeatmap::render(const HeatmapView& view, uint width, uint height, const HeatmapSettings& settings)
+{
+	if (!scene)
+		throw Error("CostHeatmap::render called before build");
+	if (width == 0 || height == 0 || settings.samplesPerPixel == 0)
+		throw Error("The heatmap needs a non-empty image and at least one sample per pixel");
+
+	TraceScope scope("cost heatmap");
+	this->width = width;
+	this->height = height;
+	this->settings = settings;
+
+	for (uint m = 0; m < CostMetric::Count; ++m)
+		metricArr[m].assign(width * height, 0.f);
+	firstHitArr.assign(width * height, cNoObject);
+
+	parallelFor(height, [&](uint y)
+	{
+		for (uint x = 0; x < width; ++x)
+			tracePixel(view, x, y);
+	});
+}
+
+float CostHeatmap::colorScale(CostMetric::Type metric) const
+{
+	vector<float> sorted = metricArr[metric];
+	if (sorted.empty())
+		return 1.f;
+
+	size_t k = _min((size_t)(settings.colorPercentile * (sorted.size() - 1) + 0.5f), sorted.size() - 1);
+	nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+	return sorted[k] > 0.f ? sorted[k] : 1.f;
+}
+
+TracedResult CostHeatmap::falseColor(CostMetric::Type metric)
+{
+	const vector<float>& values = metricArr[metric];
+	float invScale = 1.f / colorScale(metric);
+
+	colorArr.resize(values.size() * 4);
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		//PNG stores sqrt of the value, so the squares come out as the map's own colours
+		float3 c = turbo(values[i] * invScale);
+		colorArr[4 * i + 0] = c.x * c.x;
+		colorArr[4 * i + 1] = c.y * c.y;
+		colorArr[4 * i + 2] = c.z * c.z;
+		colorArr[4 * i + 3] = 1.f;
+	}
+
+	TracedResult result;
+	result.data = colorArr.data();
+	result.width = width;
+	result.height = height;
+	result.pixelSize = 4 * sizeof(float);
+	result.format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	return result;
+}
+
+void CostHeatmap::writeImages(const string& prefix)
+{
+	for (uint m = 0; m < CostMetric::Count; ++m)
+	{
+		string path = prefix + "_" + cMetricNames[m] + ".png";
+		writePNG(path, falseColor((CostMetric::Type)m));
+		printf("Heatmap: %s written, full scale %.1f\n", path.c_str(), colorScale((CostMetric::Type)m));
+	}
+}
+
+void CostHeatmap::printSummary(uint numObjects) const
+{
+	uint numPixels = width * height;
+	if (numPixels == 0)
+		return;
+
+	printf("Cost heatmap %ux%u, %u samples per pixel, BVH of %u nodes over %u triangles\n",
+		width, height, settings.samplesPerPixel, bvh.numNodes(), bvh.numTriangles());
+	for (uint m = 0; m < CostMetric::Count; ++m)
+	{
+		const vector<float>& values = metricArr[m];
+		double sum = 0.0;
+		float maxValue = 0.f;
+		for (float v : values)
+		{
+			sum += v;
+			maxValue = _max(maxValue, v);
+		}
+		printf("  %-9s mean %10.2f  p%.0f %10.2f  max %10.2f\n", cMetricNames[m], sum / numPixels,
+			100.f * settings.colorPercentile, colorScale((CostMetric::Type)m), maxValue);
+	}
+
+	//The first camera ray's object takes the pixel's whole cost: what the screen area behind it costs
+	struct ObjectCost
+	{
+		uint objIdx;
+		uint pixels;
+		double nodes;
+		double time;
+	};
+	vector<ObjectCost> costArr(scene->numObjects() + 1);
+	for (uint i = 0; i < (uint)costArr.size(); ++i)
+		costArr[i] = { i, 0, 0.0, 0.0 };
+	for (uint p = 0; p < numPixels; ++p)
+	{
+		uint obj = firstHitArr[p] == cNoObject ? scene->numObjects() : firstHitArr[p];
+		costArr[obj].pixels++;
+		costArr[obj].nodes += metricArr[CostMetric::NodesVisited][p];
+		costArr[obj].time += metricArr[CostMetric::Time][p];
+	}
+
+	sort(costArr.begin(), costArr.end(), [](const ObjectCost& a, const ObjectCost& b) { return a.nodes > b.nodes; });
+	printf("  costliest first hits (object: pixels, nodes per pixel, share of nodes, share of time):\n");
+
+	double totalNodes = 0.0, totalTime = 0.0;
+	for (const ObjectCost& c : costArr)
+	{
+		totalNodes += c.nodes;
+		totalTime += c.time;
+	}
+	for (uint i = 0; i < _min(numObjects, (uint)costArr.size()); ++i)
+	{
+		const ObjectCost& c = costArr[i];
+		if (c.pixels == 0)
+			break;
+		char name[16];
+		if (c.objIdx == scene->numObjects())
+			snprintf(name, sizeof(name), "miss");
+		else
+			snprintf(name, sizeof(name), "%u", c.objIdx);
+		printf("    %-6s %8u %10.1f %6.1f%% %6.1f%%\n", name, c.pixels, c.nodes / c.pixels,
+			totalNodes > 0.0 ? 100.0 * c.nodes / totalNodes : 0.0, totalTime > 0.0 ? 100.0 * c.time / totalTime : 0.0);
+	}
+}
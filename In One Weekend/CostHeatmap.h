@@ -0,0 +1,72 @@
+#pragma once
+#include "SceneBVH.h"
+#include "dxHelper.h"
+
+namespace CostMetric
+{
+	enum Type
+	{
+		NodesVisited,
+		TrianglesTested,
+		Bounces,
+		Time,			//microseconds
+
+		Count
+	};
+}
+
+const char* costMetricName(CostMetric::Type metric);
+
+//Pinhole camera; the depth of field of the GPU camera does not change what a path costs
+struct HeatmapView
+{
+	float3 position;
+	float3 right;
+	float3 up;
+	float3 look;
+	float tanHalfFovX;
+	float tanHalfFovY;
+};
+
+struct HeatmapSettings
+{
+	uint samplesPerPixel = 4;
+	uint maxPathLength = 48;		//as the GPU tracer
+	float colorPercentile = 0.99f;	//the top of the colour scale; the costliest pixels saturate
+};
+
+//Traces the scene's paths through the CPU BVH, with the GPU tracer's bounce rules, and keeps
+//what each pixel cost: BVH nodes visited, triangles tested, bounces and wall time. DXR hides
+//its traversal, so this is the way to see which geometry is expensive to intersect.
+class CostHeatmap
+{
+	const Scene* scene = nullptr;
+	SceneBVH bvh;
+
+	uint width = 0;
+	uint height = 0;
+	HeatmapSettings settings;
+	vector<float> metricArr[CostMetric::Count];		//per pixel, averaged over its samples
+	vector<uint> firstHitArr;						//object of the first sample's camera ray, or ~0
+	vector<float> colorArr;
+
+	float3 shadingNormal(const HitInfo& hit) const;
+	void tracePixel(const HeatmapView& view, uint x, uint y);
+
+public:
+	void build(const Scene* scene);
+	void render(const HeatmapView& view, uint width, uint height, const HeatmapSettings& settings = HeatmapSettings());
+
+	uint getWidth() const { return width; }
+	uint getHeight() const { return height; }
+	const vector<float>& getMetric(CostMetric::Type metric) const { return metricArr[metric]; }
+
+	//Value at the top of the colour scale
+	float colorScale(CostMetric::Type metric) const;
+	//Turbo colours from 0 to colorScale, as linear RGBA32F; valid until the next call
+	TracedResult falseColor(CostMetric::Type metric);
+	//prefix_nodes.png and so on, one per metric
+	void writeImages(const string& prefix);
+	//Means, maxima, and the objects whose camera-ray paths cost the most
+	void printSummary(uint numObjects = 8) const;
+};
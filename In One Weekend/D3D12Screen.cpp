@@ -1,4 +1,6 @@
 #include "D3D12Screen.h"
+#include "Trace.h"
+#include "FramePacing.h"
 
 namespace DescriptorID
 {
@@ -12,6 +14,8 @@ namespace DescriptorID
 D3D12Screen::D3D12Screen(HWND hwnd, uint width, uint height) :
 	mTargetWindow(hwnd), mScreenW(width), mScreenH(height)
 {
+	TraceScope scope("D3D12Screen()");
+
 	mTracerOutW = mScreenW;
 	mTracerOutH = mScreenH;
 	mRenderTargetArr.resize(mBackBufferCount);
@@ -24,7 +28,11 @@ D3D12Screen::D3D12Screen(HWND hwnd, uint width, uint height) :
 
 	declareRootSignature();
 
-	createPipeline();
+	{
+		TraceScope pipelineScope("compile display shaders");
+		mPipeline = createPipeline("PSMain");
+		mDisplayReadyPipeline = createPipeline("PSMainDisplayReady");
+	}
 
 	mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
 }
@@ -93,12 +101,12 @@ void D3D12Screen::initializeResource()
 	if (mTextureUploader != nullptr)
 		mTextureUploader.Reset();
 
-	mTextureUploader = createCommittedBuffer(_textureDataSize(mTracerOutFormat, 1920, 1080));
+	mTextureUploader = createCommittedBuffer(_textureDataSize(mTracerOutFormat, mTracerOutW, mTracerOutH), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, MemoryTag::ScreenUploader);
 
 	if (mTracerOutTexture != nullptr)
 		mTracerOutTexture.Reset();
 
-	mTracerOutTexture = createDefaultTexture(mTracerOutFormat, mTracerOutW, mTracerOutH, D3D12_RESOURCE_STATE_COMMON);
+	mTracerOutTexture = createDefaultTexture(mTracerOutFormat, mTracerOutW, mTracerOutH, D3D12_RESOURCE_STATE_COMMON, MemoryTag::ScreenTexture);
 
 	D3D12_CPU_DESCRIPTOR_HANDLE srvHandleTexture = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
 	srvHandleTexture.ptr += (uint)DescriptorID::tracerOutTextureSRV * mRtvDescriptorSize;
@@ -215,11 +223,11 @@ void D3D12Screen::declareRootSignature()
 	ThrowIfFailed(mDevice_v0->CreateRootSignature(0, blob->GetBufferPointer(), blob->GetBufferSize(), IID_PPV_ARGS(&mRootSig)));
 }
 
-void D3D12Screen::createPipeline()
+ComPtr<ID3D12PipelineState> D3D12Screen::createPipeline(const char* pixelShaderName)
 {
 	D3D12_INPUT_LAYOUT_DESC inputLayout = { nullptr, 0 };
 	dxShader vertexShader(L"D3D12Screen.hlsl", "VSMain", "vs_5_0");
-	dxShader pixelShader(L"D3D12Screen.hlsl", "PSMain", "ps_5_0");
+	dxShader pixelShader(L"D3D12Screen.hlsl", pixelShaderName, "ps_5_0");
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC pipelineDesc = {};
 
@@ -259,12 +267,15 @@ void D3D12Screen::createPipeline()
 	}
 	pipelineDesc.BlendState = blendDesc;
 
-	ThrowIfFailed(mDevice_v0->CreateGraphicsPipelineState(&pipelineDesc, IID_PPV_ARGS(&mPipeline)));
+	ComPtr<ID3D12PipelineState> pipeline;
+	ThrowIfFailed(mDevice_v0->CreateGraphicsPipelineState(&pipelineDesc, IID_PPV_ARGS(&pipeline)));
+	return pipeline;
 }
 
 void D3D12Screen::fillCommandLists()
 {
-	mCmdList_v0->SetPipelineState(mPipeline.Get());
+	bool displayReady = mTracerOutFormat == DXGI_FORMAT_R8G8B8A8_UNORM;
+	mCmdList_v0->SetPipelineState(displayReady ? mDisplayReadyPipeline.Get() : mPipeline.Get());
 
 	mCmdList_v0->SetDescriptorHeaps(1, mSrvUavHeap.GetAddressOf());
 	mCmdList_v0->SetGraphicsRootSignature(mRootSig.Get());
@@ -294,6 +305,16 @@ void D3D12Screen::fillCommandLists()
 
 void D3D12Screen::display(const TracedResult& trResult)
 {
+	//The tracer's output encoding can change between frames
+	if (trResult.format != mTracerOutFormat || trResult.width != mTracerOutW || trResult.height != mTracerOutH)
+	{
+		mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
+		mTracerOutFormat = trResult.format;
+		mTracerOutW = trResult.width;
+		mTracerOutH = trResult.height;
+		initializeResource();
+	}
+
 	ThrowIfFailed(mCmdAllocator_v0->Reset());
 	ThrowIfFailed(mCmdList_v0->Reset(mCmdAllocator_v0.Get(), nullptr));
 
@@ -334,6 +355,7 @@ void D3D12Screen::display(const TracedResult& trResult)
 	mCmdQueue_v0->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
 
 	ThrowIfFailed(mSwapChain_v3->Present(1, 0));
+	markFrame(FrameMark::Present);
 	mCurrentBufferIdx = mSwapChain_v3->GetCurrentBackBufferIndex();
 
 	mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
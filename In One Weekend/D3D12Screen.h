@@ -11,7 +11,7 @@ class D3D12Screen
 	uint mTracerOutW;
 	uint mTracerOutH;
 
-	static const DXGI_FORMAT mTracerOutFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	DXGI_FORMAT mTracerOutFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	static const DXGI_FORMAT mScreenOutFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
 	static const uint mBackBufferCount = 2;
 
@@ -36,7 +36,8 @@ class D3D12Screen
 	void declareRootSignature();
 
 	ComPtr<ID3D12PipelineState> mPipeline;
-	void createPipeline();
+	ComPtr<ID3D12PipelineState> mDisplayReadyPipeline;	//for RGBA8 results that are already tonemapped
+	ComPtr<ID3D12PipelineState> createPipeline(const char* pixelShaderName);
 
 	ComPtr<ID3D12Resource> mTracerOutTexture;
 	ComPtr<ID3D12Resource> mTextureUploader;
@@ -48,3 +48,8 @@ float4 PSMain(PSInput input) : SV_TARGET
 	return outColor;
 }
 
+//RGBA8 results arrive with PSMain's mapping already applied
+float4 PSMainDisplayReady(PSInput input) : SV_TARGET
+{
+	return float4(g_texture.Sample(g_sampler, input.uv).rgb, 1);
+}
@@ -1,15 +1,37 @@
 #include "DXRPathTracer.h"
+#include "basic_random.h"
+#include "timer.h"
+#include "Profiler.h"
+#include "FramePacing.h"
 
 namespace DescriptorID
 {
 	enum
 	{
+		//UAV table (u0..)
 		outUAV = 0,
-
-		sceneObjectBuff = 1,
-		vertexBuff = 2,
-		tridexBuff = 3,
-		materialBuff = 4,
+		guideTrainUAV = 1,
+		encodedUAV = 2,
+		aovUAV = 3,
+		historyUAV = 4,
+		geometryUAV = 5,
+		prevGeometryUAV = 6,
+		rayStatsUAV = 7,
+		numUAVs = 8,
+
+		//SRV table (t0..), starts at a fixed slot so UAVs can be added in front of it
+		sceneObjectBuff = 8,
+		vertexBuff = 9,
+		tridexBuff = 10,
+		materialBuff = 11,
+		lightBuff = 12,
+		lightAliasBuff = 13,
+		envMapBuff = 14,
+		envMarginalBuff = 15,
+		envConditionalBuff = 16,
+		guideNodeBuff = 17,
+		guideCdfBuff = 18,
+		numSRVs = 11,
 
 		maxDescriptors = 32
 	};
@@ -51,7 +73,7 @@ void DXRPathTracer::onMouseUp(WPARAM btnState, int x, int y)
 
 void DXRPathTracer::onMouseMove(WPARAM btnState, int x, int y)
 {
-	if ((btnState & MK_LBUTTON) != 0)
+	if (mCameraInput && (btnState & MK_LBUTTON) != 0)
 	{
 		float dx = XMConvertToRadians(0.25f * static_cast<float>(x - mLastMousePos.x));
 		float dy = XMConvertToRadians(0.25f * static_cast<float>(y - mLastMousePos.y));
@@ -64,6 +86,199 @@ void DXRPathTracer::onMouseMove(WPARAM btnState, int x, int y)
 	mLastMousePos.y = y;
 }
 
+void DXRPathTracer::onKeyDown(WPARAM key)
+{
+	if (key == 'O')
+		setRenderMode(mRenderMode == RenderMode::AmbientOcclusion ? RenderMode::PathTracing : RenderMode::AmbientOcclusion);
+	else if (key == 'G')
+		setPathGuiding(mPathGuide.getPhase() == GuidePhase::Off);
+	else if (key == 'P')
+		mSaveRequested = true;
+	else if (key == 'E')
+		setOutputEncoding(OutputEncoding::Type((mOutputEncoding + 1) % OutputEncoding::Count));
+	else if (key == 'V')
+	{
+		//A key press must not end the app, so a layout the scene does not fit is skipped
+		AovLayout::Type layout = AovLayout::Type((mAovLayout + 1) % AovLayout::Count);
+		if (!aovLayoutFits(layout))
+		{
+			printf("AOVs: skipping %s, the scene has too many objects or materials for it\n", aovLayoutName(layout));
+			layout = AovLayout::Type((layout + 1) % AovLayout::Count);
+		}
+		setAovLayout(layout);
+	}
+	else if (key == 'T')
+		setTemporalReprojection(!mReproject, mReprojectionSettings);
+	else if (key == 'R')
+		setDynamicResolution(!mDynamicResolution, mDynamicResolutionSettings);
+	else if (key == 'N')
+		setDenoising(!mDenoise, mDenoiseSettings);
+	else if (key == 'I')
+		setRayStatistics(!mCollectRayStats);
+	else if (key == 'M')
+		printMemoryReport();
+}
+
+void DXRPathTracer::setRenderMode(RenderMode::Type mode)
+{
+	mRenderMode = mode;
+	mAccumulationDirty = true;
+}
+
+void DXRPathTracer::setOutputEncoding(OutputEncoding::Type encoding)
+{
+	mOutputEncoding = encoding;
+	createTracerOutBuffer(mTracerOutW, mTracerOutH, false);
+	printf("Output encoding: %s, %u bytes per pixel\n", encodingName(encoding), _bpp(encodingFormat(encoding)));
+}
+
+bool DXRPathTracer::aovLayoutFits(AovLayout::Type layout) const
+{
+	//Compact ids are 16 bits with 0xffff meaning a miss
+	return layout != AovLayout::Compact || !mScene || (mScene->numObjects() < 0xffff && mScene->getMaterialArray().size() < 0xffff);
+}
+
+void DXRPathTracer::setAovLayout(AovLayout::Type layout)
+{
+	if (!aovLayoutFits(layout))
+		throw Error("The compact AOV layout holds at most 65534 objects and materials.");
+
+	//The denoiser is guided by the AOVs and cannot run without them
+	if (layout == AovLayout::Off && mDenoise)
+		setDenoising(false);
+
+	mAovLayout = layout;
+	createTracerOutBuffer(mTracerOutW, mTracerOutH, false);
+	printf("AOVs: %s, %u bytes per pixel\n", aovLayoutName(layout), aovPixelSize(layout));
+}
+
+void DXRPathTracer::setTemporalReprojection(bool enable, const ReprojectionSettings& settings)
+{
+	if (enable && mDynamicResolution)
+		setDynamicResolution(false);
+
+	mReproject = enable;
+	mReprojectionSettings = settings;
+	createHistoryBuffers(mTracerOutW, mTracerOutH);
+
+	//The per-pixel lengths start from nothing
+	mAccumulationDirty = true;
+	printf("Temporal reprojection: %s\n", enable ? "on" : "off");
+}
+
+void DXRPathTracer::setDynamicResolution(bool enable, const DynamicResolutionSettings& settings)
+{
+	if (settings.maxScale == 0 || (settings.maxScale & (settings.maxScale - 1)) != 0 || settings.maxScale > 8)
+		throw Error("The maximum render scale must be 1, 2, 4 or 8.");
+
+	if (enable && mReproject)
+		setTemporalReprojection(false);
+
+	mDynamicResolution = enable;
+	mDynamicResolutionSettings = settings;
+	printf("Dynamic resolution: %s\n", enable ? "on" : "off");
+}
+
+//Coarsest power of two that brings a frame under the target, from the last frame's time at its scale
+uint DXRPathTracer::pickRenderScale(double frameTime) const
+{
+	uint lastScale = _max(mGlobalConstants.renderScale, 1u);
+	double fullResTime = frameTime * lastScale * lastScale;
+
+	uint scale = 1;
+	while (scale < mDynamicResolutionSettings.maxScale && fullResTime / (scale * scale) > mDynamicResolutionSettings.targetFrameTime)
+		scale *= 2;
+	return scale;
+}
+
+//Bayer order, so each step fills the largest gap left by the previous ones. Must match DXRShader.hlsl.
+static uint subPixelOrder(uint x, uint y, uint scale)
+{
+	uint bayer = 0;
+	for (uint bit = 1; bit < scale; bit <<= 1)
+		bayer = (bayer << 2) | (((x ^ y) & bit) ? 2 : 0) | ((y & bit) ? 1 : 0);
+	return bayer;
+}
+
+static uint2 subPixelOffset(uint order, uint scale)
+{
+	for (uint y = 0; y < scale; ++y)
+		for (uint x = 0; x < scale; ++x)
+			if (subPixelOrder(x, y, scale) == order)
+				return uint2(x, y);
+	return uint2(0, 0);
+}
+
+void DXRPathTracer::setDenoising(bool enable, const DenoiseSettings& settings)
+{
+	if (enable && mAovLayout == AovLayout::Off)
+		setAovLayout(AovLayout::Full);
+
+	mDenoise = enable;
+	mDenoiseSettings = settings;
+	printf("Denoising: %s\n", enable ? "on" : "off");
+}
+
+void DXRPathTracer::setRayStatistics(bool enable)
+{
+	mCollectRayStats = enable;
+	createRayStatsBuffers();
+	takeRayStats();
+	printf("Ray statistics: %s\n", enable ? "on" : "off");
+}
+
+void DXRPathTracer::setSampling(uint samplesPerFrame, uint maxPathLength)
+{
+	if (samplesPerFrame == 0 || maxPathLength == 0)
+		throw Error("Sampling needs at least one path per frame and one bounce.");
+
+	mSamplesPerFrame = samplesPerFrame;
+	mMaxPathLength = maxPathLength;
+	mAccumulationDirty = true;
+	printf("Sampling: %u paths per pixel per frame, up to %u bounces\n", samplesPerFrame, maxPathLength);
+}
+
+void DXRPathTracer::setRngFrameOffset(uint offset)
+{
+	mRngFrameOffset = offset;
+	mAccumulationDirty = true;
+}
+
+RayStats DXRPathTracer::takeRayStats()
+{
+	double now = getCurrentTime();
+	RayStats stats = mRayStats;
+	stats.seconds = now - mRayStatsStart;
+	mRayStats = RayStats();
+	mRayStatsStart = now;
+	return stats;
+}
+
+void DXRPathTracer::setPathGuiding(bool enable, const PathGuideSettings& settings)
+{
+	if (enable)
+	{
+		if (mScene == nullptr)
+			throw Error("Path guiding needs a scene; call setupScene first.");
+
+		//Buffers are sized for the leaf cap, so they only change with it
+		bool resize = mGuideNodeBuffer == nullptr || mPathGuide.getSettings().maxLeaves != settings.maxLeaves;
+		mPathGuide.initialize(mScene, settings);
+		if (resize)
+			createPathGuideResources();
+		mPathGuide.setPhase(GuidePhase::Training);
+		uploadPathGuide();
+
+		printf("Path guiding: %u leaves max, %.1f MB\n", settings.maxLeaves, mPathGuide.gpuMemorySize() / (1024.0 * 1024.0));
+	}
+	else
+	{
+		mPathGuide.setPhase(GuidePhase::Off);
+	}
+
+	mAccumulationDirty = true;
+}
+
 DXRPathTracer::~DXRPathTracer()
 {
 }
@@ -71,6 +286,8 @@ DXRPathTracer::~DXRPathTracer()
 DXRPathTracer::DXRPathTracer(HWND hwnd, uint width, uint height) :
 	mTargetWindow(hwnd), mTracerOutW(width), mTracerOutH(height)
 {
+	TraceScope scope("DXRPathTracer()");
+
 	initD3D12();
 
 	createSrvUavHeap();
@@ -86,6 +303,8 @@ DXRPathTracer::DXRPathTracer(HWND hwnd, uint width, uint height) :
 
 void DXRPathTracer::initD3D12()
 {
+	TraceScope scope("create device");
+
 	ThrowIfFailed(createDX12Device(getRTXAdapter().Get())->QueryInterface(IID_PPV_ARGS(&mDevice_v5)));
 
 	D3D12_COMMAND_QUEUE_DESC cqDesc = {};
@@ -112,6 +331,10 @@ void DXRPathTracer::createSrvUavHeap()
 
 	mDevice_v5->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mSrvUavHeap));
 	mSrvDescriptorSize = mDevice_v5->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+	//Null views until guiding or statistics are switched on
+	createPathGuideViews();
+	createRayStatsBuffers();
 }
 
 void DXRPathTracer::onSizeChanged(uint width, uint height)
@@ -119,23 +342,169 @@ void DXRPathTracer::onSizeChanged(uint width, uint height)
 	mTracerOutW = width;
 	mTracerOutH = height;
 
-	mCamera.setLens(1.f / 9.f * XM_PI, float(mTracerOutW) / mTracerOutH, 1.0f, 1000.0f);
+	mCamera.setLens(cStartupFovY, float(mTracerOutW) / mTracerOutH, 1.0f, 1000.0f);
+
+	createTracerOutBuffer(mTracerOutW, mTracerOutH);
+	createHistoryBuffers(mTracerOutW, mTracerOutH);
+
+	//The new buffer holds no samples yet
+	mAccumulationDirty = true;
+}
+
+void DXRPathTracer::createTracerOutBuffer(uint width, uint height, bool recreateRadiance)
+{
+	if (recreateRadiance)
+	{
+		if (mTracerOutBuffer != nullptr)
+			mTracerOutBuffer.Reset();
+
+		uint64 bufferSize = uint64(_bpp(mTracerOutFormat)) * width * height;
+		mTracerOutBuffer = createCommittedBuffer(bufferSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::TracerOutput);
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		{
+			uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+			uavDesc.Format = mTracerOutFormat;
+			uavDesc.Buffer.NumElements = width * height;
+		}
+
+		D3D12_CPU_DESCRIPTOR_HANDLE uavDescriptorHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+		uavDescriptorHandle.ptr += ((uint)DescriptorID::outUAV) * mSrvDescriptorSize;
+		mDevice_v5->CreateUnorderedAccessView(mTracerOutBuffer.Get(), nullptr, &uavDesc, uavDescriptorHandle);
+	}
+
+	//The encoded copy is a raw buffer the shader packs into; RGBA32F reads the radiance directly and gets a null view
+	if (mEncodedOutBuffer != nullptr)
+		mEncodedOutBuffer.Reset();
+
+	uint encodedSize = _bpp(encodingFormat(mOutputEncoding));
+	if (mOutputEncoding != OutputEncoding::RGBA32F)
+		mEncodedOutBuffer = createCommittedBuffer(uint64(encodedSize) * width * height, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::TracerOutput);
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC rawDesc = {};
+	{
+		rawDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		rawDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+		rawDesc.Buffer.NumElements = width * height * encodedSize / 4;
+		rawDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE encodedHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	encodedHandle.ptr += ((uint)DescriptorID::encodedUAV) * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mEncodedOutBuffer.Get(), nullptr, &rawDesc, encodedHandle);
+
+	//AOVs follow the same pattern
+	if (mAovBuffer != nullptr)
+		mAovBuffer.Reset();
+
+	uint aovSize = aovPixelSize(mAovLayout);
+	if (mAovLayout != AovLayout::Off)
+		mAovBuffer = createCommittedBuffer(uint64(aovSize) * width * height, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::TracerOutput);
+
+	rawDesc.Buffer.NumElements = width * height * aovSize / 4;
+
+	D3D12_CPU_DESCRIPTOR_HANDLE aovHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	aovHandle.ptr += ((uint)DescriptorID::aovUAV) * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mAovBuffer.Get(), nullptr, &rawDesc, aovHandle);
+}
+
+//A copy of the radiance and two generations of per-pixel first-hit distance, normal, object and
+//history length; null views while reprojection is off
+void DXRPathTracer::createHistoryBuffers(uint width, uint height)
+{
+	mHistoryBuffer.Reset();
+	mGeometryBuffer.Reset();
+	mPrevGeometryBuffer.Reset();
 
-	if (mTracerOutBuffer != nullptr)
-		mTracerOutBuffer.Reset();
+	const uint geometrySize = 16;
+	if (mReproject)
+	{
+		mHistoryBuffer = createCommittedBuffer(uint64(_bpp(mTracerOutFormat)) * width * height, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::History);
+		mGeometryBuffer = createCommittedBuffer(uint64(geometrySize) * width * height, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::History);
+		mPrevGeometryBuffer = createCommittedBuffer(uint64(geometrySize) * width * height, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::History);
+	}
 
-	uint64 bufferSize = _bpp(mTracerOutFormat) * mTracerOutW * mTracerOutH;
-	mTracerOutBuffer = createCommittedBuffer(bufferSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
 	{
 		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
 		uavDesc.Format = mTracerOutFormat;
-		uavDesc.Buffer.NumElements = mTracerOutW * mTracerOutH;
+		uavDesc.Buffer.NumElements = width * height;
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE historyHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	historyHandle.ptr += ((uint)DescriptorID::historyUAV) * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mHistoryBuffer.Get(), nullptr, &uavDesc, historyHandle);
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC rawDesc = {};
+	{
+		rawDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		rawDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+		rawDesc.Buffer.NumElements = width * height * geometrySize / 4;
+		rawDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE geometryHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	geometryHandle.ptr += ((uint)DescriptorID::geometryUAV) * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mGeometryBuffer.Get(), nullptr, &rawDesc, geometryHandle);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE prevGeometryHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	prevGeometryHandle.ptr += ((uint)DescriptorID::prevGeometryUAV) * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mPrevGeometryBuffer.Get(), nullptr, &rawDesc, prevGeometryHandle);
+}
+
+void DXRPathTracer::createRayStatsBuffers()
+{
+	mRayStatsBuffer.Reset();
+	mRayStatsUploadBuffer.Reset();
+
+	uint64 size = RayCounter::Count * sizeof(uint);
+	if (mCollectRayStats)
+	{
+		mRayStatsBuffer = createCommittedBuffer(size, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::RayStats);
+		mRayStatsUploadBuffer = createCommittedBuffer(size, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, MemoryTag::RayStats);
+
+		uint8* pBufs;
+		ThrowIfFailed(mRayStatsUploadBuffer->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs)));
+		memset(pBufs, 0, size);
+		mRayStatsUploadBuffer->Unmap(0, nullptr);
+	}
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC rawDesc = {};
+	{
+		rawDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		rawDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+		rawDesc.Buffer.NumElements = RayCounter::Count;
+		rawDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
 	}
 
-	D3D12_CPU_DESCRIPTOR_HANDLE uavDescriptorHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
-	uavDescriptorHandle.ptr += ((uint)DescriptorID::outUAV) * mSrvDescriptorSize;
-	mDevice_v5->CreateUnorderedAccessView(mTracerOutBuffer.Get(), nullptr, &uavDesc, uavDescriptorHandle);
+	D3D12_CPU_DESCRIPTOR_HANDLE statsHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	statsHandle.ptr += ((uint)DescriptorID::rayStatsUAV) * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mRayStatsBuffer.Get(), nullptr, &rawDesc, statsHandle);
+}
+
+//Reprojection gathers from pixels this dispatch overwrites, so it reads last frame from copies
+void DXRPathTracer::recordHistoryCopy()
+{
+	uint64 radianceSize = mHistoryBuffer->GetDesc().Width;
+	uint64 geometrySize = mGeometryBuffer->GetDesc().Width;
+
+	D3D12_RESOURCE_BARRIER toCopy[] = {
+		CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(mHistoryBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST),
+		CD3DX12_RESOURCE_BARRIER::Transition(mGeometryBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(mPrevGeometryBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST),
+	};
+	mCmdList_v4->ResourceBarrier(_countof(toCopy), toCopy);
+
+	mCmdList_v4->CopyBufferRegion(mHistoryBuffer.Get(), 0, mTracerOutBuffer.Get(), 0, radianceSize);
+	mCmdList_v4->CopyBufferRegion(mPrevGeometryBuffer.Get(), 0, mGeometryBuffer.Get(), 0, geometrySize);
+
+	D3D12_RESOURCE_BARRIER toUav[] = {
+		CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(mHistoryBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(mGeometryBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(mPrevGeometryBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+	};
+	mCmdList_v4->ResourceBarrier(_countof(toUav), toUav);
 }
 
 ComPtr<ID3D12RootSignature> DXRPathTracer::buildRootSignatures(const D3D12_ROOT_SIGNATURE_DESC& desc)
@@ -160,13 +529,13 @@ void DXRPathTracer::declareRootSignatures()
 	globalRange.resize(2);
 
 	globalRange[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
-	globalRange[0].NumDescriptors = 1;
+	globalRange[0].NumDescriptors = DescriptorID::numUAVs;
 	globalRange[0].BaseShaderRegister = 0;
 	globalRange[0].RegisterSpace = 0;
 	globalRange[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
 	globalRange[1].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-	globalRange[1].NumDescriptors = 4;
+	globalRange[1].NumDescriptors = DescriptorID::numSRVs;
 	globalRange[1].BaseShaderRegister = 0;
 	globalRange[1].RegisterSpace = 0;
 	globalRange[1].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
@@ -218,6 +587,8 @@ void DXRPathTracer::declareRootSignatures()
 
 void DXRPathTracer::buildRaytracingPipeline()
 {
+	TraceScope scope("buildRaytracingPipeline");
+
 	vector<D3D12_STATE_SUBOBJECT> subObjects;
 	subObjects.resize(7);
 	uint index = 0;
@@ -271,7 +642,7 @@ void DXRPathTracer::buildRaytracingPipeline()
 	D3D12_STATE_SUBOBJECT subObjShaderCfg = {};
 
 	D3D12_RAYTRACING_SHADER_CONFIG shaderCfg = {};
-	shaderCfg.MaxPayloadSizeInBytes = 56;
+	shaderCfg.MaxPayloadSizeInBytes = sizeof(RayPayload);
 	shaderCfg.MaxAttributeSizeInBytes = 8;
 	subObjShaderCfg.pDesc = (void*)&shaderCfg;
 	subObjShaderCfg.Type = D3D12_STATE_SUBOBJECT_TYPE_RAYTRACING_SHADER_CONFIG;
@@ -320,52 +691,150 @@ void DXRPathTracer::buildRaytracingPipeline()
 
 void DXRPathTracer::initializeApplication()
 {
-	mCamera.setLens(1.f / 9.f * XM_PI, float(mTracerOutW) / mTracerOutH, 1.0f, 1000.0f);
+	mCamera.setLens(cStartupFovY, float(mTracerOutW) / mTracerOutH, 1.0f, 1000.0f);
 	mCamera.lookAt(mCamera.getPosition(), mCamera.getLook(), mCamera.getUp());
 
 	mGlobalConstantsBuffer = createCommittedBuffer(sizeof(GlobalConstants));
 
 	mMaxBufferSize = _bpp(mTracerOutFormat) * 1920 * 1080;
 	mMaxBufferSize = _align(mMaxBufferSize, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
-	mReadBackBuffer = createCommittedBuffer(mMaxBufferSize, D3D12_HEAP_TYPE_READBACK, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST);
+	mReadBackBuffer = createCommittedBuffer(mMaxBufferSize, D3D12_HEAP_TYPE_READBACK, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, MemoryTag::Readback);
 }
 
 void DXRPathTracer::update()
 {
-	mCamera.update();
-
-	if (mCamera.notifyChanged())
+	ProfileScope scope(ProfileZone::TracerUpdate);
 	{
-		mGlobalConstants.cameraPos = mCamera.getPosition3f();
-		mGlobalConstants.backgroundLight = float3(0.8f, 0.1f, 0.5f);
-		mGlobalConstants.maxPathLength = 48;
-		mGlobalConstants.numSamplesPerFrame = 8;
-		mGlobalConstants.aperture = mCamera.getAperture();
-		mGlobalConstants.focusDistance = mCamera.getFocusDist();
-		mGlobalConstants.accumulatedFrame = 0;
+		ProfileScope cameraScope(ProfileZone::CameraUpdate);
+		if (mCameraInput)
+			mCamera.update();
+		else
+			mCamera.updateViewMatrix();
+	}
 
-		XMMATRIX view = mCamera.getView();
-		XMMATRIX proj = mCamera.getProj();
+	double now = getCurrentTime();
+	double frameTime = now - mLastUpdateTime;
+	mLastUpdateTime = now;
 
-		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-		XMStoreFloat4x4(&mGlobalConstants.invView, XMMatrixTranspose(invView));
+	bool cameraChanged = mCamera.notifyChanged();
+	//Anything but a camera move invalidates the history itself
+	bool reproject = mReproject && cameraChanged && !mAccumulationDirty;
+	bool downscale = mDynamicResolution && cameraChanged && !mAccumulationDirty;
+	uint renderScale = 1;
+	HistoryMode::Type historyMode = mReproject ? HistoryMode::Continue : HistoryMode::Off;
 
-		XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-		XMStoreFloat4x4(&mGlobalConstants.invProj, XMMatrixTranspose(invProj));
+	if (cameraChanged || mAccumulationDirty)
+	{
+		mAccumulationDirty = false;
+
+		XMFLOAT4X4 prevViewProj = mViewProj;
+		XMFLOAT3 prevCameraPos = mGlobalConstants.cameraPos;
+
+		updateFrameConstants();
+		mGlobalConstants.tileOffset = uint2(0, 0);
+		mGlobalConstants.imageSize = uint2(mTracerOutW, mTracerOutH);
 
-		XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-		XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
-		XMStoreFloat4x4(&mGlobalConstants.invViewProj, XMMatrixTranspose(invViewProj));
+		if (reproject)
+		{
+			mGlobalConstants.prevViewProj = prevViewProj;
+			mGlobalConstants.prevCameraPos = prevCameraPos;
+			mGlobalConstants.accumulatedFrame++;
+			mStillFrames = 0;
+			historyMode = HistoryMode::Reproject;
+		}
+		else
+		{
+			mGlobalConstants.accumulatedFrame = mResumeFrames;
+			mResumeFrames = 0;
+			mStillFrames = mGlobalConstants.accumulatedFrame;
+			historyMode = mReproject ? HistoryMode::Restart : HistoryMode::Off;
+
+			if (downscale)
+			{
+				//Each moving frame starts the block at a different sub-pixel, so detail shows through
+				renderScale = pickRenderScale(frameTime);
+				mGlobalConstants.subPixelStart++;
+				mGlobalConstants.subPixelFrame = 0;
+			}
+		}
+	}
+	else if (mGlobalConstants.renderScale > 1 && mGlobalConstants.subPixelFrame + 1 < mGlobalConstants.renderScale * mGlobalConstants.renderScale)
+	{
+		//Still at low resolution: trace the next sub-pixel, each exactly once, as frame 0
+		renderScale = mGlobalConstants.renderScale;
+		mGlobalConstants.subPixelFrame++;
+	}
+	else if (mGlobalConstants.renderScale > 1)
+	{
+		//Every pixel now holds one frame; accumulation continues at full resolution
+		mGlobalConstants.accumulatedFrame = 1;
+		mStillFrames = 1;
 	}
 	else
+	{
 		mGlobalConstants.accumulatedFrame++;
+		mStillFrames++;
+	}
+
+	mGlobalConstants.renderScale = renderScale;
+	if (renderScale > 1)
+		mGlobalConstants.subPixelOffset = subPixelOffset((mGlobalConstants.subPixelStart + mGlobalConstants.subPixelFrame) % (renderScale * renderScale), renderScale);
+	else
+		mGlobalConstants.subPixelOffset = uint2(0, 0);
+
+	mGlobalConstants.historyMode = historyMode;
+	mGlobalConstants.maxHistoryLength = mReprojectionSettings.maxHistoryLength;
+	mGlobalConstants.maxGlossyHistoryLength = mReprojectionSettings.maxGlossyHistoryLength;
+	mGlobalConstants.depthTolerance = mReprojectionSettings.depthTolerance;
+	mGlobalConstants.normalTolerance = mReprojectionSettings.normalTolerance;
+
+	//Training ends on its own, so the phase is refreshed every frame
+	mGlobalConstants.guidePhase = (mRenderMode == RenderMode::PathTracing) ? mPathGuide.getPhase() : GuidePhase::Off;
+	mGlobalConstants.outputEncoding = mOutputEncoding;
+	mGlobalConstants.aovLayout = mAovLayout;
+	mGlobalConstants.rayStats = mCollectRayStats ? 1 : 0;
 
+	uploadGlobalConstants();
+}
+
+void DXRPathTracer::updateFrameConstants()
+{
+	mGlobalConstants.cameraPos = mCamera.getPosition3f();
+	mGlobalConstants.backgroundLight = float3(0.8f, 0.1f, 0.5f);
+	mGlobalConstants.maxPathLength = mMaxPathLength;
+	mGlobalConstants.numSamplesPerFrame = mSamplesPerFrame;
+	mGlobalConstants.rngFrameOffset = mRngFrameOffset;
+	mGlobalConstants.aperture = mCamera.getAperture();
+	mGlobalConstants.focusDistance = mCamera.getFocusDist();
+	mGlobalConstants.renderMode = mRenderMode;
+	mGlobalConstants.aoRadius = 1.f;
+	mGlobalConstants.guideBoundsMin = mPathGuide.getBoundsMin();
+	mGlobalConstants.guideBoundsMax = mPathGuide.getBoundsMax();
+	mGlobalConstants.guideFraction = mPathGuide.getSettings().guideFraction;
+
+	XMMATRIX view = mCamera.getView();
+	XMMATRIX proj = mCamera.getProj();
+
+	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+	XMStoreFloat4x4(&mGlobalConstants.invView, XMMatrixTranspose(invView));
+
+	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
+	XMStoreFloat4x4(&mGlobalConstants.invProj, XMMatrixTranspose(invProj));
+
+	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+	XMStoreFloat4x4(&mViewProj, XMMatrixTranspose(viewProj));
+	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMStoreFloat4x4(&mGlobalConstants.invViewProj, XMMatrixTranspose(invViewProj));
+}
+
+void DXRPathTracer::uploadGlobalConstants()
+{
 	uint8* pGlobalConstants;
 	ThrowIfFailed(mGlobalConstantsBuffer->Map(0, nullptr, reinterpret_cast<void**>(&pGlobalConstants)));
 	memcpy(pGlobalConstants, &mGlobalConstants, sizeof(GlobalConstants));
 }
 
-TracedResult DXRPathTracer::shootRays()
+void DXRPathTracer::recordDispatchRays(uint width, uint height)
 {
 	D3D12_DISPATCH_RAYS_DESC desc = {};
 	//rayGen
@@ -382,8 +851,8 @@ TracedResult DXRPathTracer::shootRays()
 	desc.HitGroupTable.StrideInBytes = _align(D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + (uint)sizeof(ObjectConstants), D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
 	desc.HitGroupTable.SizeInBytes = mHitGroupShaderTable->GetDesc().Width;
 
-	desc.Width = mTracerOutW;
-	desc.Height = mTracerOutH;
+	desc.Width = width;
+	desc.Height = height;
 	desc.Depth = 1;
 
 	mCmdList_v4->SetPipelineState1(mRTPipeline.Get());
@@ -408,35 +877,157 @@ TracedResult DXRPathTracer::shootRays()
 	mCmdList_v4->SetComputeRootConstantBufferView((uint)RootParamID::pointerForGlobalConstants, mGlobalConstantsBuffer->GetGPUVirtualAddress());
 
 	mCmdList_v4->DispatchRays(&desc);
+}
 
-	D3D12_RESOURCE_DESC tracerBufferDesc = mTracerOutBuffer->GetDesc();
-	if (tracerBufferDesc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+void DXRPathTracer::reserveReadBackBuffer(uint64 size)
+{
+	if (size > mMaxBufferSize)
 	{
-		if (tracerBufferDesc.Width > mMaxBufferSize)
-		{
-			mMaxBufferSize = _align(tracerBufferDesc.Width * 2, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
-			mReadBackBuffer = createCommittedBuffer(mMaxBufferSize, D3D12_HEAP_TYPE_READBACK, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST);
-		}
+		mMaxBufferSize = _align(size * 2, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+		mReadBackBuffer = createCommittedBuffer(mMaxBufferSize, D3D12_HEAP_TYPE_READBACK, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, MemoryTag::Readback);
+	}
+}
+
+TracedResult DXRPathTracer::shootRays()
+{
+	ProfileScope scope(ProfileZone::ShootRays);
+
+	if (mGlobalConstants.historyMode == HistoryMode::Reproject)
+		recordHistoryCopy();
+
+	if (mCollectRayStats)
+	{
+		uint64 statsSize = mRayStatsBuffer->GetDesc().Width;
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mRayStatsBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+		mCmdList_v4->CopyBufferRegion(mRayStatsBuffer.Get(), 0, mRayStatsUploadBuffer.Get(), 0, statsSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mRayStatsBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
+
+	uint scale = mGlobalConstants.renderScale;
+	recordDispatchRays((mTracerOutW + scale - 1) / scale, (mTracerOutH + scale - 1) / scale);
+
+	bool guideIterationDone = mGlobalConstants.guidePhase == GuidePhase::Training && mPathGuide.endFrame();
+	if (guideIterationDone)
+	{
+		uint64 trainSize = mGuideTrainBuffer->GetDesc().Width;
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideTrainBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		mCmdList_v4->CopyBufferRegion(mGuideReadBackBuffer.Get(), 0, mGuideTrainBuffer.Get(), 0, trainSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideTrainBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
 
+	//Checkpoints and saved images need full precision, so the radiance is read back for them
+	//even when the frame itself goes out encoded. Encoded pixels follow the radiance.
+	bool encoded = mOutputEncoding != OutputEncoding::RGBA32F;
+	bool checkpointDue = !mCheckpointPath.empty() && scale == 1 && !mCheckpointWriter.isBusy() && getCurrentTime() - mLastCheckpointTime >= mCheckpointInterval;
+	bool saveDue = mSaveRequested && !mImageWriter.isBusy();
+	bool needRadiance = !encoded || checkpointDue || saveDue;
+
+	DXGI_FORMAT resultFormat = encodingFormat(mOutputEncoding);
+	uint64 radianceSize = uint64(_bpp(mTracerOutFormat)) * mTracerOutW * mTracerOutH;
+	uint64 encodedSize = encoded ? uint64(_bpp(resultFormat)) * mTracerOutW * mTracerOutH : 0;
+	uint64 encodedOffset = needRadiance ? radianceSize : 0;
+	uint64 aovOffset = encodedOffset + encodedSize;
+	uint64 aovSize = uint64(aovPixelSize(mAovLayout)) * mTracerOutW * mTracerOutH;
+	uint64 statsOffset = aovOffset + aovSize;
+	uint64 statsSize = mCollectRayStats ? RayCounter::Count * sizeof(uint) : 0;
+	reserveReadBackBuffer(statsOffset + statsSize);
+	traceCounter("readback bytes", double(statsOffset + statsSize));
+	traceCounter("accumulated frames", mGlobalConstants.accumulatedFrame + 1);
+
+	if (needRadiance)
+	{
 		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
-		mCmdList_v4->CopyBufferRegion(mReadBackBuffer.Get(), 0, mTracerOutBuffer.Get(), 0, tracerBufferDesc.Width);
+		mCmdList_v4->CopyBufferRegion(mReadBackBuffer.Get(), 0, mTracerOutBuffer.Get(), 0, radianceSize);
 		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
 	}
 
-	ThrowIfFailed(mCmdList_v4->Close());
-	ID3D12CommandList* cmdLists[] = { mCmdList_v4.Get() };
-	mCmdQueue_v0->ExecuteCommandLists(1, cmdLists);
-	mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
-	ThrowIfFailed(mCmdAllocator_v0->Reset());
-	ThrowIfFailed(mCmdList_v4->Reset(mCmdAllocator_v0.Get(), nullptr));
+	if (encoded)
+	{
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mEncodedOutBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		mCmdList_v4->CopyBufferRegion(mReadBackBuffer.Get(), encodedOffset, mEncodedOutBuffer.Get(), 0, encodedSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mEncodedOutBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
+
+	if (aovSize > 0)
+	{
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mAovBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		mCmdList_v4->CopyBufferRegion(mReadBackBuffer.Get(), aovOffset, mAovBuffer.Get(), 0, aovSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mAovBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
+
+	if (statsSize > 0)
+	{
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mRayStatsBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		mCmdList_v4->CopyBufferRegion(mReadBackBuffer.Get(), statsOffset, mRayStatsBuffer.Get(), 0, statsSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mRayStatsBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+	}
+
+	{
+		ProfileScope gpuScope(ProfileZone::GpuWait);
+		ThrowIfFailed(mCmdList_v4->Close());
+		ID3D12CommandList* cmdLists[] = { mCmdList_v4.Get() };
+		mCmdQueue_v0->ExecuteCommandLists(1, cmdLists);
+		mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
+		ThrowIfFailed(mCmdAllocator_v0->Reset());
+		ThrowIfFailed(mCmdList_v4->Reset(mCmdAllocator_v0.Get(), nullptr));
+	}
+	markFrame(FrameMark::TraceEnd);
+
+	//The refreshed guide is recorded now and lands before the next dispatch
+	if (guideIterationDone)
+	{
+		uint* trainData;
+		ThrowIfFailed(mGuideReadBackBuffer->Map(0, nullptr, reinterpret_cast<void**>(&trainData)));
+		mPathGuide.train(trainData);
+		mGuideReadBackBuffer->Unmap(0, &CD3DX12_RANGE(0, 0));
+
+		uploadPathGuide();
+	}
 
+	ProfileScope readbackScope(ProfileZone::Readback);
 	uint8* tracedResultData;
 	ThrowIfFailed(mReadBackBuffer->Map(0, nullptr, reinterpret_cast<void**>(&tracedResultData)));
-	TracedResult result;
-	result.data = tracedResultData;
-	result.width = mTracerOutW;
-	result.height = mTracerOutH;
-	result.pixelSize = _bpp(mTracerOutFormat);
+
+	TracedResult radiance;
+	radiance.data = tracedResultData;
+	radiance.width = mTracerOutW;
+	radiance.height = mTracerOutH;
+	radiance.pixelSize = _bpp(mTracerOutFormat);
+	radiance.format = mTracerOutFormat;
+
+	TracedResult result = radiance;
+	if (encoded)
+	{
+		result.data = tracedResultData + encodedOffset;
+		result.pixelSize = _bpp(resultFormat);
+		result.format = resultFormat;
+	}
+
+	mAovImage.data = aovSize > 0 ? tracedResultData + aovOffset : nullptr;
+	mAovImage.width = mTracerOutW;
+	mAovImage.height = mTracerOutH;
+	mAovImage.layout = mAovLayout;
+
+	if (statsSize > 0)
+		mRayStats.addFrame((const uint*)(tracedResultData + statsOffset));
+
+	if (checkpointDue)
+		writeCheckpoint(tracedResultData);
+
+	//Stays requested while a previous save is still being written
+	if (saveDue)
+	{
+		string name = "frame_" + to_string(mGlobalConstants.accumulatedFrame + 1);
+		mImageWriter.writeAsync({ name + ".exr", name + ".png" }, radiance);
+		mSaveRequested = false;
+	}
+
+	//Saved images stay unfiltered; only what is displayed is denoised
+	if (mDenoise)
+	{
+		ProfileScope denoiseScope(ProfileZone::Denoise);
+		result = mDenoiser.denoise(result, mAovImage, mStillFrames + 1, mDenoiseSettings);
+	}
 
 	mReadBackBuffer->Unmap(0, nullptr);
 
@@ -447,6 +1038,7 @@ void DXRPathTracer::setupShaderTable()
 {
 	void* pRaygenShaderIdentifier;
 	void* pMissShaderIdentifier;
+	void* pOcclusionMissShaderIdentifier;
 	void* pHitGroupShaderIdentifier;
 
 	uint numObjs = mScene->numObjects();
@@ -456,6 +1048,7 @@ void DXRPathTracer::setupShaderTable()
 
 	pRaygenShaderIdentifier = pStateObjectProperties->GetShaderIdentifier(cRayGenShaderName);
 	pMissShaderIdentifier = pStateObjectProperties->GetShaderIdentifier(cMissShaderName);
+	pOcclusionMissShaderIdentifier = pStateObjectProperties->GetShaderIdentifier(cOcclusionMissShaderName);
 	pHitGroupShaderIdentifier = pStateObjectProperties->GetShaderIdentifier(cHitGroupName);
 
 	D3D12_HEAP_DESC uploadHeapDesc = {};
@@ -472,6 +1065,7 @@ void DXRPathTracer::setupShaderTable()
 	uploadHeapDesc.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
 
 	ThrowIfFailed(mDevice_v5->CreateHeap(&uploadHeapDesc, IID_PPV_ARGS(&mShaderTableHeap_v1)));
+	trackDeviceMemory(mShaderTableHeap_v1.Get(), uploadHeapDesc.SizeInBytes, MemoryTag::ShaderTables);
 
 	//rayGen shader table
 	{
@@ -492,10 +1086,10 @@ void DXRPathTracer::setupShaderTable()
 	n64HeapOffset += _align(n64AllocSize, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
 	ThrowIfFalse(n64HeapOffset < n64HeapSize);
 
-	//miss shader table
+	//miss shader table: 0 = radiance, 1 = occlusion
 	{
-		uint nNumShaderRecords = 1;
-		uint nShaderRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
+		uint nNumShaderRecords = 2;
+		uint nShaderRecordSize = _align(D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
 		n64AllocSize = nNumShaderRecords * nShaderRecordSize;
 		n64AllocSize = _align(n64AllocSize, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
 
@@ -504,6 +1098,7 @@ void DXRPathTracer::setupShaderTable()
 		ThrowIfFailed(mMissShaderTable->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs)));
 
 		memcpy(pBufs, pMissShaderIdentifier, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
+		memcpy(pBufs + nShaderRecordSize, pOcclusionMissShaderIdentifier, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
 
 		mMissShaderTable->Unmap(0, nullptr);
 	}
@@ -541,10 +1136,12 @@ ComPtr<ID3D12Resource> DXRPathTracer::createAS(const D3D12_BUILD_RAYTRACING_ACCE
 
 	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
 	mDevice_v5->GetRaytracingAccelerationStructurePrebuildInfo(&buildInput, &info);
+	mAccelStructureBytes += info.ResultDataMaxSizeInBytes + info.ScratchDataSizeInBytes;
 
-	*scrach = createCommittedBuffer(info.ScratchDataSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	*scrach = createCommittedBuffer(info.ScratchDataSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::ASScratch);
 
-	AS = createCommittedBuffer(info.ResultDataMaxSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
+	AS = createCommittedBuffer(info.ResultDataMaxSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+		buildInput.Type == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL ? MemoryTag::TLAS : MemoryTag::BLAS);
 
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
 	asDesc.Inputs = buildInput;
@@ -604,7 +1201,7 @@ void DXRPathTracer::buildTLAS(
 	uint instanceMultiplier,
 	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags)
 {
-	*instanceDescArr = createCommittedBuffer(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numBlas);
+	*instanceDescArr = createCommittedBuffer(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numBlas, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, MemoryTag::ASInstances);
 
 	D3D12_RAYTRACING_INSTANCE_DESC* pInsDescArr;
 	(*instanceDescArr)->Map(0, nullptr, (void**)&pInsDescArr);
@@ -631,6 +1228,8 @@ void DXRPathTracer::buildTLAS(
 
 void DXRPathTracer::buildAccelerationStructure()
 {
+	ProfileScope scope(ProfileZone::AccelBuild);
+
 	uint numObjs = mScene->numObjects();
 	vector<GPUMesh> gpuMeshArr(numObjs);
 	vector<dxTransform> transformArr(numObjs);
@@ -649,7 +1248,10 @@ void DXRPathTracer::buildAccelerationStructure()
 		transformArr[objIdx] = obj.modelMatrix;
 	}
 
-	assert(mTopLevelAccelerationStructure == nullptr);
+	//A later setupScene replaces the structures of the previous scene; the GPU is idle here
+	mTopLevelAccelerationStructure.Reset();
+	mBottomLevelAccelerationStructure.clear();
+	mAccelStructureBytes = 0;
 	assert(gpuMeshArr.size() == transformArr.size());
 
 	uint numObjsPerBlas = 1;
@@ -674,30 +1276,58 @@ void DXRPathTracer::buildAccelerationStructure()
 	mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
 	ThrowIfFailed(mCmdAllocator_v0->Reset());
 	ThrowIfFailed(mCmdList_v4->Reset(mCmdAllocator_v0.Get(), nullptr));
+
+	//Scratch and instance descriptions are only read during the build, which has finished
+	Scratch.clear();
+	InstanceDesc.Reset();
+
+	traceCounter("acceleration structure bytes", double(mAccelStructureBytes));
 }
 
 void DXRPathTracer::setupScene(const Scene* scene)
 {
+	ProfileScope scope(ProfileZone::SceneUpload);
+
 	uint numObjs = scene->numObjects();
 
 	const vector<Vertex> vtxArr = scene->getVertexArray();
 	const vector<Tridex> tdxArr = scene->getTridexArray();
 	const vector<Material> mtlArr = scene->getMaterialArray();
 
+	mSceneHash = hashScene(scene);
+
+	mLightSampler.build(scene);
+	mGlobalConstants.numLights = mLightSampler.numLights();
+	mGlobalConstants.totalLightPower = mLightSampler.getTotalPower();
+
+	//Keep one dummy light so the SRVs stay valid for scenes without emitters
+	vector<LightTriangle> lightArr = mLightSampler.getLightArray();
+	vector<AliasEntry> aliasArr = mLightSampler.getAliasTable();
+	if (lightArr.empty())
+	{
+		lightArr.resize(1);
+		aliasArr.resize(1);
+	}
+
 	uint64 vtxBuffSize = vtxArr.size() * sizeof(Vertex);
 	uint64 tdxBuffSize = tdxArr.size() * sizeof(Tridex);
 	uint64 mtlBuffSize = mtlArr.size() * sizeof(Material);
+	uint64 lightBuffSize = lightArr.size() * sizeof(LightTriangle);
+	uint64 aliasBuffSize = aliasArr.size() * sizeof(AliasEntry);
 	uint64 objBuffSize = numObjs * sizeof(GPUSceneObject);
 
 	ComPtr<ID3D12Resource> uploader = createCommittedBuffer(
-		vtxBuffSize + tdxBuffSize + mtlBuffSize + objBuffSize);
+		vtxBuffSize + tdxBuffSize + mtlBuffSize + lightBuffSize + aliasBuffSize + objBuffSize, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, MemoryTag::SceneUpload);
+	traceCounter("vertices", double(vtxArr.size()));
+	traceCounter("triangles", double(tdxArr.size()));
+	traceCounter("scene bytes uploaded", double(vtxBuffSize + tdxBuffSize + mtlBuffSize + lightBuffSize + aliasBuffSize + objBuffSize));
 	uint64 uploaderOffset = 0;
 
 	auto initBuffer = [&](ComPtr<ID3D12Resource>& buff, uint64 buffSize, void* srcData)
 	{
 		if (buffSize == 0)
 			return;
-		buff = createCommittedBuffer(buffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON);
+		buff = createCommittedBuffer(buffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, MemoryTag::SceneBuffers);
 
 		uint8* pBufs = nullptr;
 		uploader->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs));
@@ -711,8 +1341,10 @@ void DXRPathTracer::setupScene(const Scene* scene)
 	initBuffer(mVertexBuffer, vtxBuffSize, (void*)vtxArr.data());
 	initBuffer(mIndexBuffer, tdxBuffSize, (void*)tdxArr.data());
 	initBuffer(mMaterialBuffer, mtlBuffSize, (void*)mtlArr.data());
+	initBuffer(mLightBuffer, lightBuffSize, (void*)lightArr.data());
+	initBuffer(mLightAliasBuffer, aliasBuffSize, (void*)aliasArr.data());
 
-	mSceneObjectBuffer = createCommittedBuffer(objBuffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON);
+	mSceneObjectBuffer = createCommittedBuffer(objBuffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, MemoryTag::SceneBuffers);
 
 	void* cpuAddress;
 	uploader->Map(0, &CD3DX12_RANGE(0, 0), &cpuAddress);
@@ -792,7 +1424,432 @@ void DXRPathTracer::setupScene(const Scene* scene)
 	cpuMaterialBuffHandle.ptr += (uint)DescriptorID::materialBuff * mSrvDescriptorSize;
 	mDevice_v5->CreateShaderResourceView(mMaterialBuffer.Get(), &srvDesc, cpuMaterialBuffHandle);
 
+	//LightBuffer
+	{
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Buffer.StructureByteStride = sizeof(LightTriangle);
+		srvDesc.Buffer.NumElements = (uint)lightArr.size();
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE lightBuffHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	lightBuffHandle.ptr += (uint)DescriptorID::lightBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mLightBuffer.Get(), &srvDesc, lightBuffHandle);
+
+	//LightAliasBuffer
+	{
+		srvDesc.Buffer.StructureByteStride = sizeof(AliasEntry);
+		srvDesc.Buffer.NumElements = (uint)aliasArr.size();
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE lightAliasBuffHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	lightAliasBuffHandle.ptr += (uint)DescriptorID::lightAliasBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mLightAliasBuffer.Get(), &srvDesc, lightAliasBuffHandle);
+
 	setupShaderTable();
 
 	buildAccelerationStructure();
-}
\ No newline at end of file
+
+	if (mEnvMapBuffer == nullptr)
+		setEnvironmentMap(nullptr);
+}
+
+void DXRPathTracer::setEnvironmentMap(const EnvironmentMap* envMap)
+{
+	//A black 1x1 map keeps the SRVs valid; envWidth == 0 tells the shader to use the sky gradient
+	vector<EnvTexel> texelArr(1);
+	vector<float> marginalCdf(2, 0.f);
+	vector<float> conditionalCdf(2, 0.f);
+	texelArr[0].radiance = float3(0.f);
+	texelArr[0].pdf = 0.f;
+
+	if (envMap)
+	{
+		texelArr = envMap->getTexelArray();
+		marginalCdf = envMap->getMarginalCdf();
+		conditionalCdf = envMap->getConditionalCdf();
+	}
+
+	mEnvHash = envMap ? fnv1a(texelArr.data(), texelArr.size() * sizeof(EnvTexel)) : 0;
+
+	mGlobalConstants.envWidth = envMap ? envMap->getWidth() : 0;
+	mGlobalConstants.envHeight = envMap ? envMap->getHeight() : 0;
+
+	uint64 texelBuffSize = texelArr.size() * sizeof(EnvTexel);
+	uint64 marginalBuffSize = marginalCdf.size() * sizeof(float);
+	uint64 conditionalBuffSize = conditionalCdf.size() * sizeof(float);
+
+	ComPtr<ID3D12Resource> uploader = createCommittedBuffer(texelBuffSize + marginalBuffSize + conditionalBuffSize, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, MemoryTag::EnvironmentMap);
+	uint64 uploaderOffset = 0;
+
+	auto initBuffer = [&](ComPtr<ID3D12Resource>& buff, uint64 buffSize, void* srcData)
+	{
+		buff = createCommittedBuffer(buffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, MemoryTag::EnvironmentMap);
+
+		uint8* pBufs = nullptr;
+		uploader->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs));
+		memcpy(pBufs + uploaderOffset, srcData, buffSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(buff.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+		mCmdList_v4->CopyBufferRegion(buff.Get(), 0, uploader.Get(), uploaderOffset, buffSize);
+		mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(buff.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+		uploaderOffset += buffSize;
+	};
+
+	initBuffer(mEnvMapBuffer, texelBuffSize, (void*)texelArr.data());
+	initBuffer(mEnvMarginalBuffer, marginalBuffSize, (void*)marginalCdf.data());
+	initBuffer(mEnvConditionalBuffer, conditionalBuffSize, (void*)conditionalCdf.data());
+
+	ThrowIfFailed(mCmdList_v4->Close());
+	ID3D12CommandList* cmdLists[] = { mCmdList_v4.Get() };
+	mCmdQueue_v0->ExecuteCommandLists(1, cmdLists);
+	mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
+	ThrowIfFailed(mCmdAllocator_v0->Reset());
+	ThrowIfFailed(mCmdList_v4->Reset(mCmdAllocator_v0.Get(), nullptr));
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	//EnvMapBuffer
+	{
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Buffer.StructureByteStride = sizeof(EnvTexel);
+		srvDesc.Buffer.NumElements = (uint)texelArr.size();
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE envMapHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	envMapHandle.ptr += (uint)DescriptorID::envMapBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mEnvMapBuffer.Get(), &srvDesc, envMapHandle);
+
+	//EnvMarginalBuffer
+	{
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.Buffer.StructureByteStride = 0;
+		srvDesc.Buffer.NumElements = (uint)marginalCdf.size();
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE envMarginalHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	envMarginalHandle.ptr += (uint)DescriptorID::envMarginalBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mEnvMarginalBuffer.Get(), &srvDesc, envMarginalHandle);
+
+	//EnvConditionalBuffer
+	{
+		srvDesc.Buffer.NumElements = (uint)conditionalCdf.size();
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE envConditionalHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	envConditionalHandle.ptr += (uint)DescriptorID::envConditionalBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mEnvConditionalBuffer.Get(), &srvDesc, envConditionalHandle);
+}
+void DXRPathTracer::createPathGuideResources()
+{
+	uint64 nodeBuffSize = uint64(mPathGuide.maxNodes()) * sizeof(GuideNode);
+	uint64 cdfBuffSize = uint64(mPathGuide.getSettings().maxLeaves) * cGuideNumBins * sizeof(float);
+	uint64 trainBuffSize = uint64(mPathGuide.getSettings().maxLeaves) * cGuideTrainStride * sizeof(uint);
+
+	mGuideNodeBuffer = createCommittedBuffer(nodeBuffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, MemoryTag::PathGuide);
+	mGuideCdfBuffer = createCommittedBuffer(cdfBuffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, MemoryTag::PathGuide);
+	mGuideTrainBuffer = createCommittedBuffer(trainBuffSize, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, MemoryTag::PathGuide);
+	mGuideReadBackBuffer = createCommittedBuffer(trainBuffSize, D3D12_HEAP_TYPE_READBACK, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, MemoryTag::PathGuide);
+
+	//Upload layout: nodes | cdf | zeros for clearing the training counters
+	mGuideUploadBuffer = createCommittedBuffer(nodeBuffSize + cdfBuffSize + trainBuffSize, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, MemoryTag::PathGuide);
+	uint8* pBufs = nullptr;
+	ThrowIfFailed(mGuideUploadBuffer->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs)));
+	memset(pBufs + nodeBuffSize + cdfBuffSize, 0, trainBuffSize);
+	mGuideUploadBuffer->Unmap(0, nullptr);
+
+	createPathGuideViews();
+}
+
+void DXRPathTracer::createPathGuideViews()
+{
+	uint maxLeaves = mPathGuide.getSettings().maxLeaves;
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	//GuideNodeBuffer
+	{
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Buffer.StructureByteStride = sizeof(GuideNode);
+		srvDesc.Buffer.NumElements = mGuideNodeBuffer ? mPathGuide.maxNodes() : 0;
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE guideNodeHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	guideNodeHandle.ptr += (uint)DescriptorID::guideNodeBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mGuideNodeBuffer.Get(), &srvDesc, guideNodeHandle);
+
+	//GuideCdfBuffer
+	{
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.Buffer.StructureByteStride = 0;
+		srvDesc.Buffer.NumElements = mGuideCdfBuffer ? maxLeaves * cGuideNumBins : 0;
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE guideCdfHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	guideCdfHandle.ptr += (uint)DescriptorID::guideCdfBuff * mSrvDescriptorSize;
+	mDevice_v5->CreateShaderResourceView(mGuideCdfBuffer.Get(), &srvDesc, guideCdfHandle);
+
+	//GuideTrainBuffer
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	{
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		uavDesc.Format = DXGI_FORMAT_R32_UINT;
+		uavDesc.Buffer.NumElements = mGuideTrainBuffer ? maxLeaves * cGuideTrainStride : 0;
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE guideTrainHandle = mSrvUavHeap->GetCPUDescriptorHandleForHeapStart();
+	guideTrainHandle.ptr += (uint)DescriptorID::guideTrainUAV * mSrvDescriptorSize;
+	mDevice_v5->CreateUnorderedAccessView(mGuideTrainBuffer.Get(), nullptr, &uavDesc, guideTrainHandle);
+}
+
+//Records the copies of the current octree and distributions and clears the training counters.
+//They execute with the next command list submission.
+void DXRPathTracer::uploadPathGuide()
+{
+	const vector<GuideNode>& nodeArr = mPathGuide.getNodeArray();
+	const vector<float>& cdfArr = mPathGuide.getCdfArray();
+
+	uint64 nodeBuffSize = mGuideNodeBuffer->GetDesc().Width;
+	uint64 cdfBuffSize = mGuideCdfBuffer->GetDesc().Width;
+	uint64 trainBuffSize = mGuideTrainBuffer->GetDesc().Width;
+	uint64 nodeDataSize = nodeArr.size() * sizeof(GuideNode);
+	uint64 cdfDataSize = cdfArr.size() * sizeof(float);
+
+	uint8* pBufs = nullptr;
+	ThrowIfFailed(mGuideUploadBuffer->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs)));
+	memcpy(pBufs, nodeArr.data(), nodeDataSize);
+	memcpy(pBufs + nodeBuffSize, cdfArr.data(), cdfDataSize);
+	mGuideUploadBuffer->Unmap(0, nullptr);
+
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideNodeBuffer.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+	mCmdList_v4->CopyBufferRegion(mGuideNodeBuffer.Get(), 0, mGuideUploadBuffer.Get(), 0, nodeDataSize);
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideNodeBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideCdfBuffer.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+	mCmdList_v4->CopyBufferRegion(mGuideCdfBuffer.Get(), 0, mGuideUploadBuffer.Get(), nodeBuffSize, cdfDataSize);
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideCdfBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideTrainBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+	mCmdList_v4->CopyBufferRegion(mGuideTrainBuffer.Get(), 0, mGuideUploadBuffer.Get(), nodeBuffSize + cdfBuffSize, trainBuffSize);
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mGuideTrainBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+}
+
+void DXRPathTracer::setCheckpoint(const string& path, double intervalSeconds, uint sceneSeed)
+{
+	mCheckpointPath = path;
+	mCheckpointInterval = intervalSeconds;
+	mSceneSeed = sceneSeed;
+	mLastCheckpointTime = getCurrentTime();
+}
+
+uint64 DXRPathTracer::checkpointHash() const
+{
+	return fnv1a(&mEnvHash, sizeof(mEnvHash), mSceneHash);
+}
+
+void DXRPathTracer::writeCheckpoint(const void* radiance)
+{
+	CheckpointState state = {};
+	state.width = mTracerOutW;
+	state.height = mTracerOutH;
+	//With reprojection accumulatedFrame keeps counting across camera moves, but only the frames since
+	//the last one are in every pixel; the resumed buffer is weighted as if all of it were that old
+	state.accumulatedFrames = mStillFrames + 1;
+	state.sceneSeed = mSceneSeed;
+	state.sceneHash = checkpointHash();
+	state.renderMode = mRenderMode;
+	state.cameraPos = mCamera.getPosition3f();
+	state.cameraLook = mCamera.getLook3f();
+	state.cameraUp = mCamera.getUp3f();
+	state.aperture = mCamera.getAperture();
+	state.focusDist = mCamera.getFocusDist();
+
+	mCheckpointWriter.writeAsync(mCheckpointPath, state, radiance, uint64(_bpp(mTracerOutFormat)) * mTracerOutW * mTracerOutH);
+	mLastCheckpointTime = getCurrentTime();
+}
+
+bool DXRPathTracer::resumeFromCheckpoint(const string& path)
+{
+	CheckpointState state;
+	vector<uint8> radiance;
+	if (!readCheckpoint(path, state, radiance))
+		return false;
+
+	uint64 bufferSize = uint64(_bpp(mTracerOutFormat)) * mTracerOutW * mTracerOutH;
+	if (state.sceneHash != checkpointHash() || state.width != mTracerOutW || state.height != mTracerOutH || radiance.size() != bufferSize)
+		return false;
+
+	ComPtr<ID3D12Resource> uploader = createCommittedBuffer(bufferSize);
+	uint8* pBufs = nullptr;
+	ThrowIfFailed(uploader->Map(0, &CD3DX12_RANGE(0, 0), reinterpret_cast<void**>(&pBufs)));
+	memcpy(pBufs, radiance.data(), bufferSize);
+	uploader->Unmap(0, nullptr);
+
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+	mCmdList_v4->CopyBufferRegion(mTracerOutBuffer.Get(), 0, uploader.Get(), 0, bufferSize);
+	mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+	ThrowIfFailed(mCmdList_v4->Close());
+	ID3D12CommandList* cmdLists[] = { mCmdList_v4.Get() };
+	mCmdQueue_v0->ExecuteCommandLists(1, cmdLists);
+	mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
+	ThrowIfFailed(mCmdAllocator_v0->Reset());
+	ThrowIfFailed(mCmdList_v4->Reset(mCmdAllocator_v0.Get(), nullptr));
+
+	XMFLOAT3 target(state.cameraPos.x + state.cameraLook.x, state.cameraPos.y + state.cameraLook.y, state.cameraPos.z + state.cameraLook.z);
+	mCamera.lookAt(state.cameraPos, target, state.cameraUp);
+	mCamera.setAperture(state.aperture);
+	mCamera.setFocusDist(state.focusDist);
+	mRenderMode = (RenderMode::Type)state.renderMode;
+
+	//The next update() sees the camera change and continues the average instead of restarting it
+	mResumeFrames = state.accumulatedFrames;
+	mAccumulationDirty = true;
+
+	return true;
+}
+
+void DXRPathTracer::beginOfflineRender(uint width, uint height, uint maxTileW, uint maxTileH)
+{
+	//Tiles trace into a tile-sized output buffer; the window's buffer is recreated afterwards
+	createTracerOutBuffer(maxTileW, maxTileH);
+	reserveReadBackBuffer(uint64(_bpp(mTracerOutFormat)) * maxTileW * maxTileH);
+
+	mCamera.setLens(mCamera.getFovY(), float(width) / height, 1.0f, 1000.0f);
+	updateFrameConstants();
+	mGlobalConstants.imageSize = uint2(width, height);
+	//Sample the guide if there is one, but do not train it: nobody reads the counters back here
+	mGlobalConstants.guidePhase = (mRenderMode == RenderMode::PathTracing && mPathGuide.getPhase() != GuidePhase::Off) ? GuidePhase::Rendering : GuidePhase::Off;
+	//Tiles are read straight from the radiance
+	mGlobalConstants.outputEncoding = OutputEncoding::RGBA32F;
+	mGlobalConstants.aovLayout = AovLayout::Off;
+	mGlobalConstants.historyMode = HistoryMode::Off;
+	mGlobalConstants.renderScale = 1;
+	mGlobalConstants.subPixelOffset = uint2(0, 0);
+}
+
+void DXRPathTracer::traceOfflineTile(uint x, uint y, uint tileW, uint tileH, uint numFrames)
+{
+	uint64 tileSizeInBytes = uint64(_bpp(mTracerOutFormat)) * tileW * tileH;
+	mGlobalConstants.tileOffset = uint2(x, y);
+
+	for (uint frame = 0; frame < numFrames; ++frame)
+	{
+		mGlobalConstants.accumulatedFrame = frame;
+		uploadGlobalConstants();
+
+		recordDispatchRays(tileW, tileH);
+
+		if (frame + 1 == numFrames)
+		{
+			mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+			mCmdList_v4->CopyBufferRegion(mReadBackBuffer.Get(), 0, mTracerOutBuffer.Get(), 0, tileSizeInBytes);
+			mCmdList_v4->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mTracerOutBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+		}
+
+		ThrowIfFailed(mCmdList_v4->Close());
+		ID3D12CommandList* cmdLists[] = { mCmdList_v4.Get() };
+		mCmdQueue_v0->ExecuteCommandLists(1, cmdLists);
+		mFence_v0.waitCommandQueue(mCmdQueue_v0.Get());
+		ThrowIfFailed(mCmdAllocator_v0->Reset());
+		ThrowIfFailed(mCmdList_v4->Reset(mCmdAllocator_v0.Get(), nullptr));
+	}
+}
+
+void DXRPathTracer::endOfflineRender()
+{
+	mCamera.setLens(mCamera.getFovY(), float(mTracerOutW) / mTracerOutH, 1.0f, 1000.0f);
+	createTracerOutBuffer(mTracerOutW, mTracerOutH);
+	mAccumulationDirty = true;
+}
+
+void DXRPathTracer::renderTiled(const string& path, uint width, uint height, uint tileSize, uint numFrames)
+{
+	if (width == 0 || height == 0 || tileSize == 0 || numFrames == 0)
+		throw Error("Tiled rendering needs a non-empty image, tile size and frame count.");
+
+	beginOfflineRender(width, height, _min(tileSize, width), _min(tileSize, height));
+
+	PFMTileWriter writer;
+	writer.open(path, width, height);
+
+	uint numTilesX = (width + tileSize - 1) / tileSize;
+	uint numTilesY = (height + tileSize - 1) / tileSize;
+	double startTime = getCurrentTime();
+
+	for (uint ty = 0; ty < numTilesY; ++ty)
+	{
+		for (uint tx = 0; tx < numTilesX; ++tx)
+		{
+			uint x = tx * tileSize;
+			uint y = ty * tileSize;
+			uint tileW = _min(tileSize, width - x);
+			uint tileH = _min(tileSize, height - y);
+			uint64 tileSizeInBytes = uint64(_bpp(mTracerOutFormat)) * tileW * tileH;
+
+			traceOfflineTile(x, y, tileW, tileH, numFrames);
+
+			uint8* tileData;
+			ThrowIfFailed(mReadBackBuffer->Map(0, &CD3DX12_RANGE(0, tileSizeInBytes), reinterpret_cast<void**>(&tileData)));
+			writer.writeTile(x, y, tileW, tileH, tileData, uint64(_bpp(mTracerOutFormat)) * tileW);
+			mReadBackBuffer->Unmap(0, &CD3DX12_RANGE(0, 0));
+
+			printf("Tile %u/%u done (%.1f s)\n", ty * numTilesX + tx + 1, numTilesX * numTilesY, getCurrentTime() - startTime);
+		}
+	}
+
+	writer.close();
+	endOfflineRender();
+}
+
+void DXRPathTracer::renderImage(uint width, uint height, uint numFrames, vector<float>& pixels)
+{
+	if (width == 0 || height == 0 || numFrames == 0)
+		throw Error("Rendering needs a non-empty image and frame count.");
+
+	beginOfflineRender(width, height, width, height);
+	traceOfflineTile(0, 0, width, height, numFrames);
+
+	uint64 imageSizeInBytes = uint64(_bpp(mTracerOutFormat)) * width * height;
+	pixels.resize(uint64(width) * height * 4);
+	uint8* data;
+	ThrowIfFailed(mReadBackBuffer->Map(0, &CD3DX12_RANGE(0, imageSizeInBytes), reinterpret_cast<void**>(&data)));
+	memcpy(pixels.data(), data, imageSizeInBytes);
+	mReadBackBuffer->Unmap(0, &CD3DX12_RANGE(0, 0));
+
+	endOfflineRender();
+}
+
+void DXRPathTracer::setCamera(const Camera& camera)
+{
+	mCamera = camera;
+	mCamera.setLens(camera.getFovY(), float(mTracerOutW) / mTracerOutH, 1.0f, 1000.0f);
+	mAccumulationDirty = true;
+}
+
+CameraKey DXRPathTracer::getCameraKey() const
+{
+	XMFLOAT3 pos = mCamera.getPosition3f(), look = mCamera.getLook3f(), up = mCamera.getUp3f();
+
+	CameraKey key;
+	key.position = float3(pos.x, pos.y, pos.z);
+	key.look = float3(look.x, look.y, look.z);
+	key.up = float3(up.x, up.y, up.z);
+	key.aperture = mCamera.getAperture();
+	key.focusDist = mCamera.getFocusDist();
+	return key;
+}
+
+static bool sameView(const CameraKey& a, const CameraKey& b)
+{
+	const float eps = 1e-5f;
+	return length(a.position - b.position) <= eps && length(a.look - b.look) <= eps && length(a.up - b.up) <= eps
+		&& fabsf(a.aperture - b.aperture) <= eps && fabsf(a.focusDist - b.focusDist) <= eps;
+}
+
+void DXRPathTracer::setCameraKey(const CameraKey& key)
+{
+	//A path that holds still keeps accumulating
+	if (sameView(key, getCameraKey()))
+		return;
+
+	XMFLOAT3 pos(key.position.x, key.position.y, key.position.z);
+	XMFLOAT3 target(pos.x + key.look.x, pos.y + key.look.y, pos.z + key.look.z);
+	mCamera.lookAt(pos, target, XMFLOAT3(key.up.x, key.up.y, key.up.z));
+	mCamera.setAperture(key.aperture);
+	mCamera.setFocusDist(key.focusDist);
+}
@@ -1,7 +1,25 @@
 #pragma once
 #include "dxHelper.h"
 #include "Camera.h"
+#include "CameraPath.h"
 #include "Scene.h"
+#include "LightSampler.h"
+#include "EnvironmentMap.h"
+#include "PathGuide.h"
+#include "Checkpoint.h"
+#include "ImageWriter.h"
+#include "OutputEncoding.h"
+#include "Aov.h"
+#include "Denoiser.h"
+#include "RayStats.h"
+
+struct GPUMesh
+{
+	uint numVertices;
+	D3D12_GPU_VIRTUAL_ADDRESS vertexBufferVA;
+	uint numTridices;
+	D3D12_GPU_VIRTUAL_ADDRESS tridexBufferVA;
+};
 
 using pFloat4 = float(*)[4];
 struct dxTransform
@@ -41,6 +59,102 @@ struct GlobalConstants
 	float aperture;
 	NextAlignedLine
 	float focusDistance;
+	uint numLights;
+	float totalLightPower;
+	uint envWidth;
+	uint envHeight;
+	uint renderMode;
+	float aoRadius;
+	NextAlignedLine
+	float3 guideBoundsMin;
+	uint guidePhase;
+	NextAlignedLine
+	float3 guideBoundsMax;
+	float guideFraction;
+	NextAlignedLine
+	uint2 tileOffset;
+	uint2 imageSize;
+	NextAlignedLine
+	uint outputEncoding;
+	uint aovLayout;
+	uint historyMode;
+	float maxHistoryLength;
+	NextAlignedLine
+	XMFLOAT4X4 prevViewProj;
+	NextAlignedLine
+	XMFLOAT3 prevCameraPos;
+	float depthTolerance;
+	NextAlignedLine
+	float normalTolerance;
+	float maxGlossyHistoryLength;
+	uint renderScale;
+	uint subPixelFrame;
+	NextAlignedLine
+	uint2 subPixelOffset;
+	uint subPixelStart;
+	uint rayStats;
+	NextAlignedLine
+	uint rngFrameOffset;
+};
+
+//Mirror of RayPayload in DXRShader.hlsl, field for field; only its size is used, as the
+//pipeline's maximum payload. A field added there has to be added here too.
+struct RayPayload
+{
+	float3 radiance;
+	float3 attenuation;
+	float3 hitPos;
+	float3 bounceDir;
+	uint rayDepth;
+	uint rng[5];		//RngState: pixel, frame, sampleIdx, bounce, dimension
+	float bsdfPdf;
+	uint rayStat;
+	float3 hitAlbedo;
+	float3 hitNormal;
+	uint hitObject;
+};
+static_assert(sizeof(RayPayload) == 27 * 4, "RayPayload is packed like HLSL's, four bytes a component");
+
+//An RNG frame offset far beyond any accumulation, for renders that must not share samples with ordinary ones
+static const uint cDecorrelatedFrameOffset = 1u << 30;
+
+namespace RenderMode
+{
+	enum Type
+	{
+		PathTracing,
+		AmbientOcclusion,
+
+		Count
+	};
+}
+
+//How rayGen finds the history a pixel blends into
+namespace HistoryMode
+{
+	enum Type
+	{
+		Off,			//every pixel holds accumulatedFrame frames
+		Restart,		//as Off, but per-pixel lengths are written for later reprojection
+		Continue,		//same view as last frame; each pixel keeps its own length
+		Reproject,		//the camera moved; history is fetched where the first hit was last frame
+
+		Count
+	};
+}
+
+struct ReprojectionSettings
+{
+	float maxHistoryLength = 32.f;			//cap after a move, so stale shading fades out
+	float maxGlossyHistoryLength = 2.f;		//metal and glass look different from every viewpoint
+	float depthTolerance = 0.02f;			//relative difference in distance from the camera
+	float normalTolerance = 0.9f;			//least cosine between the old and new normal
+};
+
+struct DynamicResolutionSettings
+{
+	float targetFrameTime = 1.f / 30.f;		//seconds; the render scale is picked to stay under it while moving
+	uint maxScale = 4;						//power of two; rays are traced for 1 / maxScale^2 of the pixels at most
 };
 
 struct ObjectConstants
@@ -76,17 +190,80 @@ class DXRPathTracer
 	ComPtr<ID3D12StateObject> mRTPipeline;
 	void buildRaytracingPipeline();
 
-	GlobalConstants mGlobalConstants;
+	GlobalConstants mGlobalConstants = {};
 	ComPtr<ID3D12Resource> mGlobalConstantsBuffer;
 	ComPtr<ID3D12Resource> mTracerOutBuffer;
+	ComPtr<ID3D12Resource> mEncodedOutBuffer;
+	OutputEncoding::Type mOutputEncoding = OutputEncoding::RGBA32F;
+	ComPtr<ID3D12Resource> mAovBuffer;
+	AovLayout::Type mAovLayout = AovLayout::Off;
+	AovImage mAovImage;
+	bool aovLayoutFits(AovLayout::Type layout) const;
+	ComPtr<ID3D12Resource> mHistoryBuffer;
+	ComPtr<ID3D12Resource> mGeometryBuffer;
+	ComPtr<ID3D12Resource> mPrevGeometryBuffer;
+	bool mReproject = false;
+	ReprojectionSettings mReprojectionSettings;
+	XMFLOAT4X4 mViewProj = IdentityMatrix4x4();
+	uint mStillFrames = 0;			//frames since the view last changed, the shortest history any pixel has
+	void createHistoryBuffers(uint width, uint height);
+	void recordHistoryCopy();
+	bool mDynamicResolution = false;
+	DynamicResolutionSettings mDynamicResolutionSettings;
+	double mLastUpdateTime = 0.0;
+	uint pickRenderScale(double frameTime) const;
+	Denoiser mDenoiser;
+	bool mDenoise = false;
+	DenoiseSettings mDenoiseSettings;
+	ComPtr<ID3D12Resource> mRayStatsBuffer;
+	ComPtr<ID3D12Resource> mRayStatsUploadBuffer;	//zeros, copied in before each dispatch
+	bool mCollectRayStats = false;
+	RayStats mRayStats;
+	double mRayStatsStart = 0.0;
+	void createRayStatsBuffers();
 	uint64 mMaxBufferSize;
 	ComPtr<ID3D12Resource> mReadBackBuffer;
 	void initializeApplication();
+	void createTracerOutBuffer(uint width, uint height, bool recreateRadiance = true);
+	void reserveReadBackBuffer(uint64 size);
+	void updateFrameConstants();
+	void uploadGlobalConstants();
+	void recordDispatchRays(uint width, uint height);
 
 	ComPtr<ID3D12Resource> mSceneObjectBuffer;
 	ComPtr<ID3D12Resource> mVertexBuffer;
 	ComPtr<ID3D12Resource> mIndexBuffer;
 	ComPtr<ID3D12Resource> mMaterialBuffer;
+	ComPtr<ID3D12Resource> mLightBuffer;
+	ComPtr<ID3D12Resource> mLightAliasBuffer;
+	LightSampler mLightSampler;
+	ComPtr<ID3D12Resource> mEnvMapBuffer;
+	ComPtr<ID3D12Resource> mEnvMarginalBuffer;
+	ComPtr<ID3D12Resource> mEnvConditionalBuffer;
+
+	PathGuide mPathGuide;
+	ComPtr<ID3D12Resource> mGuideNodeBuffer;
+	ComPtr<ID3D12Resource> mGuideCdfBuffer;
+	ComPtr<ID3D12Resource> mGuideTrainBuffer;
+	ComPtr<ID3D12Resource> mGuideUploadBuffer;
+	ComPtr<ID3D12Resource> mGuideReadBackBuffer;
+	void createPathGuideResources();
+	void createPathGuideViews();
+	void uploadPathGuide();
+
+	CheckpointWriter mCheckpointWriter;
+	string mCheckpointPath;
+	double mCheckpointInterval = 0.0;
+	double mLastCheckpointTime = 0.0;
+	uint mSceneSeed = 0;
+	uint64 mSceneHash = 0;
+	uint64 mEnvHash = 0;
+	uint mResumeFrames = 0;
+	uint64 checkpointHash() const;
+	void writeCheckpoint(const void* radiance);
+
+	AsyncImageWriter mImageWriter;
+	bool mSaveRequested = false;
 
 	ComPtr<ID3D12Heap1> mShaderTableHeap_v1;
 	ComPtr<ID3D12Resource> mRayGenShaderTable;
@@ -94,16 +271,18 @@ class DXRPathTracer
 	ComPtr<ID3D12Resource> mHitGroupShaderTable;
 	const wchar* cRayGenShaderName = L"rayGen";
 	const wchar* cMissShaderName = L"missRay";
+	const wchar* cOcclusionMissShaderName = L"missOcclusion";
 	const wchar* cHitGroupName = L"hitGp";
 	const wchar* cClosestHitShaderName = L"closestHit";
 	vector<ObjectConstants> objConsts;
 	void setupShaderTable();
 
-	Scene* mScene;
+	Scene* mScene = nullptr;
 	vector<ComPtr<ID3D12Resource>> mBottomLevelAccelerationStructure;
 	ComPtr<ID3D12Resource> mTopLevelAccelerationStructure;
 	vector<ComPtr<ID3D12Resource>> Scratch;
 	ComPtr<ID3D12Resource> InstanceDesc;
+	uint64 mAccelStructureBytes = 0;	//results and scratch
 	ComPtr<ID3D12Resource> createAS(
 		const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& buildInput,
 		ComPtr<ID3D12Resource>* scrach);
@@ -125,17 +304,79 @@ class DXRPathTracer
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags);
 	void buildAccelerationStructure();
 
+	//Offline renders size the output for tiles of up to maxTileW x maxTileH and trace with the
+	//window's modes off; endOfflineRender puts the window's buffer and lens back
+	void beginOfflineRender(uint width, uint height, uint maxTileW, uint maxTileH);
+	//Accumulates numFrames into the tile and leaves its radiance in the readback buffer
+	void traceOfflineTile(uint x, uint y, uint tileW, uint tileH, uint numFrames);
+	void endOfflineRender();
+
 	int2 mLastMousePos;
 	Camera mCamera;
+	bool mCameraInput = true;
+	uint mSamplesPerFrame = 8;
+	uint mMaxPathLength = 48;
+	uint mRngFrameOffset = 0;
+	RenderMode::Type mRenderMode = RenderMode::PathTracing;
+	bool mAccumulationDirty = false;
 
 public:
 	Camera getCamera() { return mCamera; }
+	//Takes the view and lens angle; the aspect ratio stays the window's
+	void setCamera(const Camera& camera);
+	CameraKey getCameraKey() const;
+	//Moves the camera the way the keyboard and mouse do, so reprojection and dynamic resolution see a move
+	void setCameraKey(const CameraKey& key);
+	//Off while a camera path plays, so the keyboard and mouse cannot move the camera
+	void setCameraInput(bool enable) { mCameraInput = enable; }
 	void onMouseDown(WPARAM btnState, int x, int y);
 	void onMouseUp(WPARAM btnState, int x, int y);
 	void onMouseMove(WPARAM btnState, int x, int y);
+	void onKeyDown(WPARAM key);
+
+	void setRenderMode(RenderMode::Type mode);
+	//Only what is read back changes; the accumulation itself stays RGBA32F and carries on
+	void setOutputEncoding(OutputEncoding::Type encoding);
+	//First-hit albedo, normal, depth and ids, traced in the same pass as the radiance
+	void setAovLayout(AovLayout::Type layout);
+	//The last shootRays' AOVs; valid until the next one
+	const AovImage& getAovs() const { return mAovImage; }
+	//Keeps accumulated samples across camera motion by reprojecting them along the first hits,
+	//instead of starting over whenever the view changes
+	void setTemporalReprojection(bool enable, const ReprojectionSettings& settings = ReprojectionSettings());
+	//Renders at a lower resolution while the camera moves, then traces the skipped sub-pixels
+	//before carrying on at full resolution. Replaces reprojection, which it does not combine with.
+	void setDynamicResolution(bool enable, const DynamicResolutionSettings& settings = DynamicResolutionSettings());
+	//Filters what shootRays returns; needs AOVs, so Full ones are turned on if there are none
+	void setDenoising(bool enable, const DenoiseSettings& settings = DenoiseSettings());
+	void setPathGuiding(bool enable, const PathGuideSettings& settings = PathGuideSettings());
+	//Counts rays, misses, hits per material and back-face cutoffs in every frame
+	void setRayStatistics(bool enable);
+	bool isCollectingRayStats() const { return mCollectRayStats; }
+	//What was counted since the last call, timed from then
+	RayStats takeRayStats();
+	GuidePhase::Type getPathGuidePhase() const { return mPathGuide.getPhase(); }
+	bool isDenoising() const { return mDenoise; }
+	//Paths per pixel each frame and bounces per path; accumulation starts over
+	void setSampling(uint samplesPerFrame, uint maxPathLength);
+	uint getSamplesPerFrame() const { return mSamplesPerFrame; }
+	uint getMaxPathLength() const { return mMaxPathLength; }
+	//Added to the frame number the random numbers are drawn for, so that renders of the same
+	//view, such as a reference and the images graded against it, use independent samples
+	void setRngFrameOffset(uint offset);
+	uint getRngFrameOffset() const { return mRngFrameOffset; }
+
+	//sceneSeed is stored so a later run can rebuild the same scene before resuming
+	void setCheckpoint(const string& path, double intervalSeconds, uint sceneSeed);
+	bool resumeFromCheckpoint(const string& path);
 
 	void setupScene(const Scene* scene);
+	void setEnvironmentMap(const EnvironmentMap* envMap);
 	TracedResult shootRays();
+	//Offline render of an image of any size as tileSize^2 tiles streamed into a PFM file
+	void renderTiled(const string& path, uint width, uint height, uint tileSize, uint numFrames);
+	//Offline render of the whole image in one dispatch per frame, into RGBA32F pixels
+	void renderImage(uint width, uint height, uint numFrames, vector<float>& pixels);
 
 public:
 	~DXRPathTracer();
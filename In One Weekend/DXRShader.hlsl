@@ -2,6 +2,13 @@
 
 RaytracingAccelerationStructure scene : register(t0, space100);
 RWBuffer<float4> tracerOutBuffer : register(u0);
+RWBuffer<uint> guideTrainBuffer : register(u1);
+RWByteAddressBuffer encodedOutBuffer : register(u2);
+RWByteAddressBuffer aovBuffer : register(u3);
+RWBuffer<float4> historyBuffer : register(u4);
+RWByteAddressBuffer geometryBuffer : register(u5);
+RWByteAddressBuffer prevGeometryBuffer : register(u6);
+RWByteAddressBuffer rayStatsBuffer : register(u7);
 
 struct Vertex
 {
@@ -14,7 +21,8 @@ enum MaterialType
 {
 	Lambertian = 0,
 	Metal = 1,
-	Dielectric = 2
+	Dielectric = 2,
+	Emissive = 3
 };
 
 struct Material
@@ -25,6 +33,7 @@ struct Material
 	float3 albedo;
 	float3 opacity;
 	float3 eta;
+	float3 emittance;
 	float fuzz;
 	float refractionIndex;
 
@@ -45,6 +54,44 @@ StructuredBuffer<Vertex> vertexBuffer		  : register(t1);
 Buffer<uint3> tridexBuffer					  : register(t2);
 StructuredBuffer<Material> materialBuffer	  : register(t3);
 
+struct LightTriangle
+{
+	float3 p0;
+	float3 edge1;
+	float3 edge2;
+	float3 normal;
+	float3 emittance;
+	float area;
+};
+
+struct AliasEntry
+{
+	float prob;
+	uint alias;
+};
+
+StructuredBuffer<LightTriangle> lightBuffer	  : register(t4);
+StructuredBuffer<AliasEntry> lightAliasBuffer : register(t5);
+
+struct EnvTexel
+{
+	float3 radiance;
+	float pdf;
+};
+
+StructuredBuffer<EnvTexel> envMapBuffer		  : register(t6);
+Buffer<float> envMarginalCdf				  : register(t7);
+Buffer<float> envConditionalCdf				  : register(t8);
+
+struct GuideNode
+{
+	uint firstChild;
+	uint leafIdx;
+};
+
+StructuredBuffer<GuideNode> guideNodeBuffer	  : register(t9);
+Buffer<float> guideCdfBuffer				  : register(t10);
+
 cbuffer GLOBAL_CONSTANTS : register(b0)
 {
 	float3 backgroundLight;
@@ -57,8 +104,84 @@ cbuffer GLOBAL_CONSTANTS : register(b0)
 	uint maxPathLength;
 	float aperture;
 	float focusDistance;
+	uint numLights;
+	float totalLightPower;
+	uint envWidth;
+	uint envHeight;
+	uint renderMode;
+	float aoRadius;
+	float3 guideBoundsMin;
+	uint guidePhase;
+	float3 guideBoundsMax;
+	float guideFraction;
+	uint2 tileOffset;
+	uint2 imageSize;
+	uint outputEncoding;
+	uint aovLayout;
+	uint historyMode;
+	float maxHistoryLength;
+	float4x4 prevViewProj;
+	float3 prevCameraPos;
+	float depthTolerance;
+	float normalTolerance;
+	float maxGlossyHistoryLength;
+	uint renderScale;
+	uint subPixelFrame;
+	uint2 subPixelOffset;
+	uint subPixelStart;
+	uint rayStats;
+	uint rngFrameOffset;
 }
 
+static const uint RenderMode_PathTracing = 0;
+static const uint RenderMode_AmbientOcclusion = 1;
+
+//Must match PixelEncoding.h
+static const uint OutputEncoding_RGBA32F = 0;
+static const uint OutputEncoding_RGBA16F = 1;
+static const uint OutputEncoding_RGB9E5 = 2;
+static const uint OutputEncoding_R11G11B10 = 3;
+static const uint OutputEncoding_RGBA8 = 4;
+
+//Must match Aov.h
+static const uint AovLayout_Off = 0;
+static const uint AovLayout_Full = 1;
+static const uint AovLayout_Compact = 2;
+static const uint AovNoHit = 0xffffffff;
+
+//Must match HistoryMode in DXRPathTracer.h
+static const uint HistoryMode_Off = 0;
+static const uint HistoryMode_Restart = 1;
+static const uint HistoryMode_Continue = 2;
+static const uint HistoryMode_Reproject = 3;
+
+//Must match RayCounter in RayStats.h
+static const uint RayCounter_Paths = 0;
+static const uint RayCounter_PathRays = 1;
+static const uint RayCounter_OcclusionRays = 2;
+static const uint RayCounter_Misses = 3;
+static const uint RayCounter_HitLambertian = 4;
+static const uint RayCounter_BackFaceCutoffs = 8;
+static const uint RayCounter_Count = 9;
+
+//RayPayload.rayStat: the material type or RayStat_Miss in the low bits, the back-face flag, and
+//the occlusion rays the hit shader traced from bit 8 up
+static const uint RayStat_Miss = 0xf;
+static const uint RayStat_BackFace = 0x10;
+static const uint RayStat_OcclusionShift = 8;
+
+static const uint GuidePhase_Off = 0;
+static const uint GuidePhase_Training = 1;
+static const uint GuidePhase_Rendering = 2;
+
+//Must match PathGuide.h
+static const uint GuideDirRes = 16;
+static const uint GuideNumBins = GuideDirRes * GuideDirRes;
+static const uint GuideTrainStride = GuideNumBins + 1;
+static const float GuideRadianceScale = 16.f;
+static const float GuideMaxRadiance = 100.f;
+static const uint MaxGuideVertices = 4;
+
 cbuffer OBJECT_CONSTANTS : register(b1)
 {
 	uint objIdx;
@@ -71,7 +194,29 @@ struct RayPayload
 	float3 hitPos;
 	float3 bounceDir;
 	uint rayDepth;
-	uint seed;
+	RngState rng;
+	float bsdfPdf;
+	uint rayStat;
+
+	//First-hit features, only written for AOVs and reprojection
+	float3 hitAlbedo;
+	float3 hitNormal;
+	uint hitObject;
+};
+
+struct FirstHit
+{
+	float3 position;
+	float3 albedo;
+	float3 normal;
+	float depth;
+	uint objectIdx;
+};
+
+//Occlusion queries only need a yes/no answer: no closest-hit search, no payload writes
+struct OcclusionPayload
+{
+	uint occluded;
 };
 
 RayDesc Ray(in float3 origin, in float3 direction, in float tMin, in float tMax)
@@ -102,51 +247,587 @@ void computeNormal(out float3 normal, in BuiltInTriangleIntersectionAttributes a
 	normal = normalize(mul(transform, t0 * vtx0.normal + t1 * vtx1.normal + t2 * vtx2.normal));
 }
 
-float3 tracePath(in float3 startPos, in float3 startDir, inout uint seed)
+float powerHeuristic(float pdfA, float pdfB)
+{
+	float a2 = pdfA * pdfA;
+	float b2 = pdfB * pdfB;
+	return a2 / (a2 + b2);
+}
+
+//Solid-angle pdf of reaching an emitter point through light sampling.
+//Selection is power-proportional, so pdfSelect / area == luminance(Le) / totalLightPower.
+float lightPdf(float3 emittance, float dist, float cosLight)
+{
+	return luminance(emittance) / totalLightPower * dist * dist / cosLight;
+}
+
+//Occlusion rays traced by the running hit shader, reported through RayPayload.rayStat
+static uint occlusionRayCount;
+
+bool traceOcclusion(float3 origin, float3 direction, float tMin, float tMax)
+{
+	++occlusionRayCount;
+	RayDesc ray = Ray(origin, direction, tMin, tMax);
+	OcclusionPayload occlusion;
+	occlusion.occluded = 1;
+
+	TraceRay(scene, RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, ~0, 0, 1, 1, ray, occlusion);
+
+	return occlusion.occluded != 0;
+}
+
+//One cosine-distributed probe per hit; averaged over samples and frames it converges to ambient occlusion
+float ambientOcclusion(float3 hitPos, float3 hitNormal, inout RngState rng)
+{
+	float3 dir = normalize(hitNormal + random_unit_vector(rng));
+	return traceOcclusion(hitPos, dir, 1e-4f, aoRadius) ? 0.f : 1.f;
+}
+
+uint guideLeaf(float3 p)
+{
+	float3 lo = guideBoundsMin;
+	float3 hi = guideBoundsMax;
+	GuideNode node = guideNodeBuffer[0];
+
+	while (node.firstChild != 0)
+	{
+		float3 mid = 0.5f * (lo + hi);
+		uint octant = 0;
+		if (p.x >= mid.x) { octant |= 1; lo.x = mid.x; } else hi.x = mid.x;
+		if (p.y >= mid.y) { octant |= 2; lo.y = mid.y; } else hi.y = mid.y;
+		if (p.z >= mid.z) { octant |= 4; lo.z = mid.z; } else hi.z = mid.z;
+		node = guideNodeBuffer[node.firstChild + octant];
+	}
+
+	return node.leafIdx;
+}
+
+//Equal-area (cos theta, phi) grid
+uint guideBin(float3 dir)
+{
+	float cosTheta = clamp(dir.y, -1.f, 1.f);
+	float phi = atan2(dir.z, dir.x);
+	if (phi < 0.f)
+		phi += 2.f * PI;
+
+	uint row = min(uint((cosTheta + 1.f) * 0.5f * GuideDirRes), GuideDirRes - 1);
+	uint col = min(uint(phi / (2.f * PI) * GuideDirRes), GuideDirRes - 1);
+	return row * GuideDirRes + col;
+}
+
+//Every bin spans 4pi / GuideNumBins sr
+float guidePdf(uint leaf, float3 dir)
+{
+	uint offset = leaf * GuideNumBins;
+	uint bin = guideBin(dir);
+	float prob = guideCdfBuffer[offset + bin] - (bin > 0 ? guideCdfBuffer[offset + bin - 1] : 0.f);
+	return prob * GuideNumBins / (4.f * PI);
+}
+
+float3 sampleGuide(uint leaf, inout RngState rng)
+{
+	float u = rand(rng);
+	uint offset = leaf * GuideNumBins;
+
+	//First bin whose cumulative probability exceeds u
+	uint lo = 0;
+	uint hi = GuideNumBins - 1;
+	while (lo < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (guideCdfBuffer[offset + mid] <= u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	float cosTheta = (lo / GuideDirRes + rand(rng)) / GuideDirRes * 2.f - 1.f;
+	float phi = (lo % GuideDirRes + rand(rng)) / GuideDirRes * 2.f * PI;
+	float sinTheta = sqrt(max(1.f - cosTheta * cosTheta, 0.f));
+	return float3(sinTheta * cos(phi), cosTheta, sinTheta * sin(phi));
+}
+
+//Splats one path vertex's incident radiance estimate (radiance / pdf) into its leaf's histogram
+void recordGuideSample(uint leaf, float3 dir, float weight)
+{
+	uint offset = leaf * GuideTrainStride;
+	uint value = uint(min(weight, GuideMaxRadiance) * GuideRadianceScale + 0.5f);
+	if (value > 0)
+		InterlockedAdd(guideTrainBuffer[offset + guideBin(dir)], value);
+	InterlockedAdd(guideTrainBuffer[offset + GuideNumBins], 1);
+}
+
+//Solid-angle pdf of a Lambertian bounce: the cosine lobe, or its one-sample mixture with the guide
+float lambertianPdf(uint leaf, float3 hitNormal, float3 wi)
+{
+	float cosPdf = max(dot(wi, hitNormal), 0.f) / PI;
+	if (guidePhase == GuidePhase_Off)
+		return cosPdf;
+	return guideFraction * guidePdf(leaf, wi) + (1.f - guideFraction) * cosPdf;
+}
+
+//Next-event estimation for a Lambertian vertex, MIS-weighted against cosine sampling
+float3 sampleDirectLight(float3 hitPos, float3 hitNormal, float3 albedo, uint leaf, inout RngState rng)
+{
+	uint idx = min(uint(rand(rng) * numLights), numLights - 1);
+	AliasEntry entry = lightAliasBuffer[idx];
+	if (rand(rng) >= entry.prob)
+		idx = entry.alias;
+
+	LightTriangle light = lightBuffer[idx];
+
+	float su = sqrt(rand(rng));
+	float v = rand(rng);
+	float3 lightPos = light.p0 + light.edge1 * (su * (1.f - v)) + light.edge2 * (su * v);
+
+	float3 toLight = lightPos - hitPos;
+	float dist = length(toLight);
+	float3 wi = toLight / dist;
+
+	float cosSurface = dot(wi, hitNormal);
+	float cosLight = dot(-wi, light.normal);
+	if (cosSurface <= 0.f || cosLight <= 0.f)
+		return 0.f;
+
+	if (traceOcclusion(hitPos, wi, 1e-4f, dist * (1.f - 1e-3f)))
+		return 0.f;
+
+	float pdfLight = lightPdf(light.emittance, dist, cosLight);
+	float pdfBsdf = lambertianPdf(leaf, hitNormal, wi);
+
+	return albedo / PI * cosSurface * light.emittance * powerHeuristic(pdfLight, pdfBsdf) / pdfLight;
+}
+
+//Equirectangular mapping, +y up
+float2 directionToEnvUV(float3 dir)
+{
+	float u = atan2(dir.z, dir.x) / (2.f * PI) + 0.5f;
+	float v = acos(clamp(dir.y, -1.f, 1.f)) / PI;
+	return float2(u, v);
+}
+
+float3 envUVToDirection(float2 uv)
+{
+	float phi = (uv.x - 0.5f) * 2.f * PI;
+	float theta = uv.y * PI;
+	return float3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+EnvTexel envTexel(float2 uv)
+{
+	uint x = min(uint(uv.x * envWidth), envWidth - 1);
+	uint y = min(uint(uv.y * envHeight), envHeight - 1);
+	return envMapBuffer[y * envWidth + x];
+}
+
+//Solid-angle pdf of sampleEnvironment
+float envPdf(float3 dir)
+{
+	float sinTheta = sqrt(max(1.f - dir.y * dir.y, 0.f));
+	if (sinTheta == 0.f)
+		return 0.f;
+	return envTexel(directionToEnvUV(dir)).pdf / (2.f * PI * PI * sinTheta);
+}
+
+//Largest row i with envMarginalCdf[i] <= u
+uint findMarginalInterval(float u)
+{
+	uint lo = 0;
+	uint hi = envHeight;
+	while (lo + 1 < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (envMarginalCdf[mid] <= u)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+uint findConditionalInterval(uint row, float u)
+{
+	uint offset = row * (envWidth + 1);
+	uint lo = 0;
+	uint hi = envWidth;
+	while (lo + 1 < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (envConditionalCdf[offset + mid] <= u)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+float3 sampleEnvironment(inout RngState rng)
+{
+	float u0 = rand(rng);
+	float u1 = rand(rng);
+
+	uint y = findMarginalInterval(u0);
+	float cdf0 = envMarginalCdf[y];
+	float cdf1 = envMarginalCdf[y + 1];
+	float dv = (cdf1 > cdf0) ? (u0 - cdf0) / (cdf1 - cdf0) : 0.5f;
+
+	uint x = findConditionalInterval(y, u1);
+	uint offset = y * (envWidth + 1);
+	cdf0 = envConditionalCdf[offset + x];
+	cdf1 = envConditionalCdf[offset + x + 1];
+	float du = (cdf1 > cdf0) ? (u1 - cdf0) / (cdf1 - cdf0) : 0.5f;
+
+	return envUVToDirection(float2((x + du) / envWidth, (y + dv) / envHeight));
+}
+
+float3 sampleEnvironmentLight(float3 hitPos, float3 hitNormal, float3 albedo, uint leaf, inout RngState rng)
+{
+	float3 wi = sampleEnvironment(rng);
+	float pdfEnv = envPdf(wi);
+	float cosSurface = dot(wi, hitNormal);
+	if (cosSurface <= 0.f || pdfEnv <= 0.f)
+		return 0.f;
+
+	if (traceOcclusion(hitPos, wi, 1e-4f, 1e27f))
+		return 0.f;
+
+	float pdfBsdf = lambertianPdf(leaf, hitNormal, wi);
+
+	return albedo / PI * cosSurface * envTexel(directionToEnvUV(wi)).radiance * powerHeuristic(pdfEnv, pdfBsdf) / pdfEnv;
+}
+
+//The invocation's share of the frame's counters, added to rayStatsBuffer once per wave
+static uint rayCounters[RayCounter_Count];
+
+void countRay(uint rayStat)
+{
+	++rayCounters[RayCounter_PathRays];
+	rayCounters[RayCounter_OcclusionRays] += rayStat >> RayStat_OcclusionShift;
+
+	uint kind = rayStat & RayStat_Miss;
+	if (kind == RayStat_Miss)
+		++rayCounters[RayCounter_Misses];
+	else
+		++rayCounters[RayCounter_HitLambertian + kind];
+
+	if (rayStat & RayStat_BackFace)
+		++rayCounters[RayCounter_BackFaceCutoffs];
+}
+
+void flushRayCounters()
+{
+	for (uint c = 0; c < RayCounter_Count; c++)
+	{
+		uint sum = WaveActiveSum(rayCounters[c]);
+		if (WaveIsFirstLane() && sum > 0)
+			rayStatsBuffer.InterlockedAdd(c * 4, sum);
+	}
+}
+
+float3 tracePath(in float3 startPos, in float3 startDir, in RngState rng, out FirstHit firstHit)
 {
 	float3 radiance = 0.0f;
 	float3 attenuation = 1.0f;
 
 	RayDesc ray = Ray(startPos, startDir, 1e-4f, 1e27f);
 	RayPayload prd;
-	prd.seed = seed;
+	prd.rng = rng;
 	prd.rayDepth = 0;
+	prd.bsdfPdf = 0.f;
+	prd.rayStat = 0;
+	prd.hitAlbedo = 0.f;
+	prd.hitNormal = 0.f;
+	prd.hitObject = AovNoHit;
+
+	firstHit = (FirstHit)0;
+	firstHit.objectIdx = AovNoHit;
+
+	uint guideLeafArr[MaxGuideVertices];
+	float3 guideDirArr[MaxGuideVertices];
+	float3 guideRadianceArr[MaxGuideVertices];
+	float guideNormArr[MaxGuideVertices];
+	uint numGuideVertices = 0;
 
 	while (prd.rayDepth <= maxPathLength)
 	{
+		//bounce 0 is reserved for the camera sample
+		prd.rng.bounce = prd.rayDepth + 1;
+		prd.rng.dimension = 0;
+
 		TraceRay(scene, 0, ~0, 0, 1, 0, ray, prd);
+		if (rayStats != 0)
+			countRay(prd.rayStat);
+
+		if (prd.rayDepth == 0)
+		{
+			firstHit.position = prd.hitPos;
+			firstHit.albedo = prd.hitAlbedo;
+			firstHit.normal = prd.hitNormal;
+			firstHit.objectIdx = prd.hitObject;
+			float3 cameraForward = normalize(mul(float4(0, 0, 1, 0), invView).xyz);
+			firstHit.depth = (prd.hitObject != AovNoHit) ? dot(prd.hitPos - cameraPos, cameraForward) : 0.f;
+		}
 
 		radiance += attenuation * prd.radiance;
 		attenuation *= prd.attenuation;
 
+		//Whatever the rest of the path gathers, divided by the throughput so far, is this vertex's incident radiance
+		if (guidePhase == GuidePhase_Training && prd.bsdfPdf > 0.f && prd.rayDepth < maxPathLength && numGuideVertices < MaxGuideVertices)
+		{
+			float norm = luminance(attenuation) * prd.bsdfPdf;
+			if (norm > 0.f)
+			{
+				guideLeafArr[numGuideVertices] = guideLeaf(prd.hitPos);
+				guideDirArr[numGuideVertices] = normalize(prd.bounceDir);
+				guideRadianceArr[numGuideVertices] = radiance;
+				guideNormArr[numGuideVertices] = norm;
+				++numGuideVertices;
+			}
+		}
+
 		ray.Origin = prd.hitPos;
 		ray.Direction = prd.bounceDir;
 		++prd.rayDepth;
 	}
 
+	for (uint i = 0; i < numGuideVertices; ++i)
+		recordGuideSample(guideLeafArr[i], guideDirArr[i], max(luminance(radiance - guideRadianceArr[i]), 0.f) / guideNormArr[i]);
+
 	return radiance;
 }
 
+//Packers mirrored in OutputEncoding.cpp: powers of two are built from bits and rounding is
+//floor(x + 0.5), so the CPU and GPU agree exactly on the float formats
+float exp2i(int e)
+{
+	return asfloat(uint(e + 127) << 23);
+}
+
+uint packSmallFloat(float v, uint mantissaBits)
+{
+	uint maxPacked = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+	if (!(v > 0.f))
+		return 0;
+
+	if (v < exp2i(-14))
+		return (uint)floor(v * exp2i(14 + (int)mantissaBits) + 0.5f);
+
+	int e = int((asuint(v) >> 23) & 0xff) - 127;
+	if (e > 15)
+		return maxPacked;
+
+	float mantissa = asfloat((asuint(v) & 0x007fffff) | 0x3f800000) - 1.f;
+	uint packed = (uint(e + 15) << mantissaBits) + (uint)floor(mantissa * float(1u << mantissaBits) + 0.5f);
+	return min(packed, maxPacked);
+}
+
+uint packHalf(float v)
+{
+	return ((asuint(v) >> 16) & 0x8000) | packSmallFloat(abs(v), 10);
+}
+
+uint packR11G11B10(float3 c)
+{
+	return packSmallFloat(c.x, 6) | (packSmallFloat(c.y, 6) << 11) | (packSmallFloat(c.z, 5) << 22);
+}
+
+uint packRGB9E5(float3 c)
+{
+	const float maxValue = 511.f / 512.f * 65536.f;
+	c = float3(c.x > 0.f ? min(c.x, maxValue) : 0.f, c.y > 0.f ? min(c.y, maxValue) : 0.f, c.z > 0.f ? min(c.z, maxValue) : 0.f);
+	float maxc = max(c.x, max(c.y, c.z));
+
+	int expShared = max(-16, int((asuint(maxc) >> 23) & 0xff) - 127) + 16;
+	float scale = exp2i(24 - expShared);
+	if (floor(maxc * scale + 0.5f) >= 512.f)
+	{
+		expShared += 1;
+		scale *= 0.5f;
+	}
+
+	uint3 m = (uint3)floor(c * scale + 0.5f);
+	return m.x | (m.y << 9) | (m.z << 18) | (uint(expShared) << 27);
+}
+
+//Same mapping as PSMain
+uint packDisplayRGBA8(float3 c)
+{
+	uint3 m = (uint3)floor(saturate(sqrt(abs(c))) * 255.f + 0.5f);
+	return m.x | (m.y << 8) | (m.z << 16) | 0xff000000;
+}
+
+void storeEncoded(uint pixelIdx, float3 c)
+{
+	if (outputEncoding == OutputEncoding_RGBA16F)
+		encodedOutBuffer.Store2(pixelIdx * 8, uint2(packHalf(c.x) | (packHalf(c.y) << 16), packHalf(c.z) | (packHalf(1.f) << 16)));
+	else if (outputEncoding == OutputEncoding_RGB9E5)
+		encodedOutBuffer.Store(pixelIdx * 4, packRGB9E5(c));
+	else if (outputEncoding == OutputEncoding_R11G11B10)
+		encodedOutBuffer.Store(pixelIdx * 4, packR11G11B10(c));
+	else if (outputEncoding == OutputEncoding_RGBA8)
+		encodedOutBuffer.Store(pixelIdx * 4, packDisplayRGBA8(c));
+}
+
+uint packOctNormal(float3 n)
+{
+	float l1 = abs(n.x) + abs(n.y) + abs(n.z);
+	if (l1 == 0.f)
+		return 0;
+
+	float2 uv = n.xy / l1;
+	if (n.z < 0.f)
+		uv = (1.f - abs(uv.yx)) * float2(uv.x >= 0.f ? 1.f : -1.f, uv.y >= 0.f ? 1.f : -1.f);
+
+	int2 snorm = (int2)floor(clamp(uv, -1.f, 1.f) * 32767.f + 0.5f);
+	return (uint(snorm.x) & 0xffff) | (uint(snorm.y) << 16);
+}
+
+//Layouts match AovLayout in Aov.h
+void storeAov(uint pixelIdx, float3 albedo, float3 normal, float depth, uint objectIdx)
+{
+	uint materialIdx = (objectIdx != AovNoHit) ? objectBuffer[objectIdx].materialIdx : AovNoHit;
+
+	if (aovLayout == AovLayout_Full)
+	{
+		uint offset = pixelIdx * 36;
+		aovBuffer.Store4(offset, uint4(asuint(albedo), asuint(depth)));
+		aovBuffer.Store4(offset + 16, uint4(asuint(normal), objectIdx));
+		aovBuffer.Store(offset + 32, materialIdx);
+	}
+	else if (aovLayout == AovLayout_Compact)
+	{
+		uint3 rgb = (uint3)floor(saturate(albedo) * 255.f + 0.5f);
+		uint ids = min(objectIdx, 0xffff) | (min(materialIdx, 0xffff) << 16);
+		aovBuffer.Store4(pixelIdx * 16, uint4(rgb.x | (rgb.y << 8) | (rgb.z << 16) | 0xff000000, packOctNormal(normal), asuint(depth), ids));
+	}
+}
+
+float3 unpackOctNormal(uint packed)
+{
+	float2 uv = max(float2(int2(packed << 16, packed) >> 16) / 32767.f, -1.f);
+	float3 n = float3(uv, 1.f - abs(uv.x) - abs(uv.y));
+	if (n.z < 0.f)
+		n.xy = (1.f - abs(uv.yx)) * float2(uv.x >= 0.f ? 1.f : -1.f, uv.y >= 0.f ? 1.f : -1.f);
+	return normalize(n);
+}
+
+//Per pixel, 16 bytes: octahedral normal, distance from the camera (0 on a miss), history length, object
+void storeGeometry(uint pixelIdx, FirstHit hit, float historyLength)
+{
+	float distance = (hit.objectIdx != AovNoHit) ? length(hit.position - cameraPos) : 0.f;
+	geometryBuffer.Store4(pixelIdx * 16, uint4(packOctNormal(hit.normal), asuint(distance), asuint(historyLength), hit.objectIdx));
+}
+
+//Finds where the first hit was seen last frame and blends the bilinear taps that saw the same surface.
+//Returns the history length, 0 when the pixel is disoccluded.
+float reprojectHistory(FirstHit hit, float3 primaryDir, out float4 history)
+{
+	history = 0.f;
+
+	//Misses are infinitely far away, so only the direction is projected
+	bool isHit = hit.objectIdx != AovNoHit;
+	float4 clip = mul(isHit ? float4(hit.position, 1.f) : float4(primaryDir, 0.f), prevViewProj);
+	if (clip.w <= 0.f)
+		return 0.f;
+
+	float2 ndc = clip.xy / clip.w;
+	float2 prevPos = float2(ndc.x * 0.5f + 0.5f, 0.5f - ndc.y * 0.5f) * imageSize - 0.5f;
+	int2 base = (int2)floor(prevPos);
+	float2 f = prevPos - base;
+
+	float expectedDistance = isHit ? length(hit.position - prevCameraPos) : 0.f;
+
+	float sumWeight = 0.f;
+	float sumLength = 0.f;
+	float4 sum = 0.f;
+	for (uint i = 0; i < 4; i++)
+	{
+		int2 p = base + int2(i & 1, i >> 1);
+		if (any(p < 0) || any(p >= (int2)imageSize))
+			continue;
+
+		uint idx = p.y * imageSize.x + p.x;
+		uint4 prev = prevGeometryBuffer.Load4(idx * 16);
+		if (prev.w != hit.objectIdx)
+			continue;
+		if (isHit && abs(asfloat(prev.y) - expectedDistance) > depthTolerance * expectedDistance)
+			continue;
+		if (isHit && dot(unpackOctNormal(prev.x), hit.normal) < normalTolerance)
+			continue;
+
+		float weight = ((i & 1) ? f.x : 1.f - f.x) * ((i >> 1) ? f.y : 1.f - f.y);
+		sum += weight * historyBuffer[idx];
+		sumLength += weight * asfloat(prev.z);
+		sumWeight += weight;
+	}
+
+	if (sumWeight < 1e-3f)
+		return 0.f;
+
+	history = sum / sumWeight;
+
+	bool glossy = false;
+	if (isHit)
+	{
+		MaterialType type = materialBuffer[objectBuffer[hit.objectIdx].materialIdx].type;
+		glossy = type == MaterialType::Metal || type == MaterialType::Dielectric;
+	}
+	return min(sumLength / sumWeight, glossy ? maxGlossyHistoryLength : maxHistoryLength);
+}
+
+//Position of a sub-pixel in the order a renderScale x renderScale block is traced, counted from
+//subPixelStart. Must match subPixelOrder in DXRPathTracer.cpp.
+uint subPixelOrder(uint2 o)
+{
+	uint bayer = 0;
+	for (uint bit = 1; bit < renderScale; bit <<= 1)
+		bayer = (bayer << 2) | ((((o.x ^ o.y) & bit) != 0) ? 2 : 0) | (((o.y & bit) != 0) ? 1 : 0);
+
+	uint blockSize = renderScale * renderScale;
+	return (bayer + blockSize - subPixelStart % blockSize) % blockSize;
+}
+
 [shader("raygeneration")]
 void rayGen()
 {
-	float2 launchIdx = DispatchRaysIndex().xy;
-	float2 launchDim = DispatchRaysDimensions().xy;
-	uint bufferOffset = launchDim.x * launchIdx.y + launchIdx.x;
+	//The dispatch may cover one tile of a larger image; the output buffer is tile-local
+	//At a reduced render scale each ray traces one sub-pixel of its block, in the full-size buffer.
+	//Blocks on the right and bottom edges may trace just outside the image to fill the rest.
+	uint2 pixel = DispatchRaysIndex().xy * renderScale + subPixelOffset + tileOffset;
+	bool inside = all(pixel < imageSize);
 
-	uint seed = getNewSeed(bufferOffset, accumulatedFrames, 8);
+	float2 launchIdx = pixel;
+	float2 launchDim = imageSize;
+	uint bufferOffset = DispatchRaysDimensions().x * DispatchRaysIndex().y + DispatchRaysIndex().x;
+	if (renderScale > 1)
+		bufferOffset = imageSize.x * pixel.y + pixel.x;
+	uint pixelIdx = imageSize.x * pixel.y + pixel.x;
 
 	float3 newRadiance = 0.0f;
 	float3 avrRadiance = 0.0f;
 
+	//Albedo and normal are averaged over the frame's samples; depth and ids come from the first
+	float3 albedoSum = 0.f;
+	float3 normalSum = 0.f;
+	FirstHit firstHit;
+	FirstHit primaryHit = (FirstHit)0;
+	float3 primaryDir = 0.f;
+
 	RayPayload payload;
 
+	for (uint c = 0; c < RayCounter_Count; c++)
+		rayCounters[c] = 0;
+	if (rayStats != 0)
+		rayCounters[RayCounter_Paths] = numSamplesPerFrame;
+
 	for (uint i = 0; i < numSamplesPerFrame; i++)
 	{
-		float2 uv = ((launchIdx + float2(rand(seed), rand(seed))) / launchDim) * 2.f - 1.f;
+		RngState rng = initRng(pixelIdx, accumulatedFrames + rngFrameOffset, i, 0);
+
+		float2 uv = ((launchIdx + float2(rand(rng), rand(rng))) / launchDim) * 2.f - 1.f;
 		uv.y = -uv.y;
 
-		float2 offset = aperture / 2.f * random_in_unit_disk(seed).xy;
+		float2 offset = aperture / 2.f * random_in_unit_disk(rng).xy;
 		float4 origin = mul(float4(offset, 0, 1), invView);
 		float4 target = mul(float4(uv, 1, 1), invProj);
 
@@ -154,17 +835,84 @@ void rayGen()
 
 		//float4 world = mul(float4(uv, 1.0f, 1.0f), invViewProj);
 
-		newRadiance += tracePath(origin.xyz, (world).xyz, seed);
+		newRadiance += tracePath(origin.xyz, (world).xyz, rng, firstHit);
+
+		albedoSum += firstHit.albedo;
+		normalSum += firstHit.normal;
+		if (i == 0)
+		{
+			primaryHit = firstHit;
+			primaryDir = normalize(world.xyz);
+		}
 	}
 
 	newRadiance *= 1.0f / float(numSamplesPerFrame);
 
-	if (accumulatedFrames == 0)
+	//Before the branches below, while the whole wave is still active
+	if (rayStats != 0)
+		flushRayCounters();
+
+	//Until the camera moves every pixel has seen the same number of frames
+	float4 history = 0.f;
+	float historyLength = accumulatedFrames;
+	if (historyMode == HistoryMode_Reproject)
+		historyLength = reprojectHistory(primaryHit, primaryDir, history);
+	else if (accumulatedFrames > 0)
+	{
+		history = tracerOutBuffer[bufferOffset];
+		if (historyMode == HistoryMode_Continue)
+			historyLength = asfloat(geometryBuffer.Load(bufferOffset * 16 + 8));
+	}
+
+	//Alpha accumulates the second moment of the frame's luminance, from which the denoiser gets the variance
+	float newMoment = luminance(newRadiance) * luminance(newRadiance);
+	float avrMoment = newMoment;
+
+	if (historyLength == 0.f)
 		avrRadiance = newRadiance;
 	else
-		avrRadiance = lerp(tracerOutBuffer[bufferOffset].xyz, newRadiance, 1.f / (accumulatedFrames + 1.0f));
+	{
+		avrRadiance = lerp(history.xyz, newRadiance, 1.f / (historyLength + 1.0f));
+		avrMoment = lerp(history.w, newMoment, 1.f / (historyLength + 1.0f));
+	}
+
+	float normalLength = length(normalSum);
+	float3 normal = normalLength > 0.f ? normalSum / normalLength : 0.f;
+	float3 albedo = albedoSum / float(numSamplesPerFrame);
+
+	if (inside)
+	{
+		tracerOutBuffer[bufferOffset] = float4(avrRadiance, avrMoment);
+
+		if (historyMode != HistoryMode_Off)
+			storeGeometry(bufferOffset, primaryHit, historyLength + 1.f);
+
+		if (outputEncoding != OutputEncoding_RGBA32F)
+			storeEncoded(bufferOffset, avrRadiance);
+
+		if (aovLayout != AovLayout_Off)
+			storeAov(bufferOffset, albedo, normal, primaryHit.depth, primaryHit.objectIdx);
+	}
 
-	tracerOutBuffer[bufferOffset] = float4(avrRadiance, 1.0f);
+	//Nearest-neighbour upscale: sub-pixels not yet traced since the view changed show this one
+	if (renderScale > 1)
+	{
+		uint2 block = pixel - subPixelOffset;
+		for (uint k = 0; k < renderScale * renderScale; k++)
+		{
+			uint2 o = uint2(k % renderScale, k / renderScale);
+			uint2 q = block + o;
+			if (subPixelOrder(o) <= subPixelFrame || any(q >= imageSize))
+				continue;
+
+			uint qOffset = imageSize.x * q.y + q.x;
+			tracerOutBuffer[qOffset] = float4(avrRadiance, avrMoment);
+			if (outputEncoding != OutputEncoding_RGBA32F)
+				storeEncoded(qOffset, avrRadiance);
+			if (aovLayout != AovLayout_Off)
+				storeAov(qOffset, albedo, normal, primaryHit.depth, primaryHit.objectIdx);
+		}
+	}
 }
 
 [shader("closesthit")]
@@ -181,27 +929,101 @@ void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 	payload.attenuation = 1.f;
 
 	payload.hitPos = WorldRayOrigin() + RayTCurrent() * WorldRayDirection();
+	occlusionRayCount = 0;
+
+	//Reprojection matches history by the first hit's object, depth and normal, so it needs them without AOVs too
+	if ((aovLayout != AovLayout_Off || historyMode != HistoryMode_Off) && payload.rayDepth == 0)
+	{
+		payload.hitAlbedo = (material.type == MaterialType::Emissive) ? saturate(material.emittance) : material.albedo;
+		payload.hitNormal = (dot(WorldRayDirection(), hitNormal) > 0) ? -hitNormal : hitNormal;
+		payload.hitObject = objIdx;
+	}
+
+	if (renderMode == RenderMode_AmbientOcclusion)
+	{
+		if (dot(WorldRayDirection(), hitNormal) > 0)
+			hitNormal = -hitNormal;
+		payload.radiance = ambientOcclusion(payload.hitPos, hitNormal, payload.rng);
+		payload.rayDepth = maxPathLength;
+		payload.rayStat = material.type | (occlusionRayCount << RayStat_OcclusionShift);
+		return;
+	}
 
 	//Lambertian
 	if (material.type == MaterialType::Lambertian)
 	{
 		payload.attenuation = material.albedo;
 
-		float3 target = hitNormal + random_unit_vector(payload.seed);
-		payload.bounceDir = target;
+		uint leaf = (guidePhase != GuidePhase_Off) ? guideLeaf(payload.hitPos) : 0;
+
+		if (dot(-WorldRayDirection(), hitNormal) >= 0)
+		{
+			if (numLights > 0)
+				payload.radiance += sampleDirectLight(payload.hitPos, hitNormal, material.albedo, leaf, payload.rng);
+			if (envWidth > 0)
+				payload.radiance += sampleEnvironmentLight(payload.hitPos, hitNormal, material.albedo, leaf, payload.rng);
+		}
+
+		if (guidePhase == GuidePhase_Off)
+		{
+			float3 target = hitNormal + random_unit_vector(payload.rng);
+			payload.bounceDir = target;
+			payload.bsdfPdf = max(dot(normalize(target), hitNormal), 0.f) / PI;
+		}
+		else
+		{
+			float3 dir;
+			if (rand(payload.rng) < guideFraction)
+				dir = sampleGuide(leaf, payload.rng);
+			else
+				dir = normalize(hitNormal + random_unit_vector(payload.rng));
+
+			float cosTheta = dot(dir, hitNormal);
+			payload.bounceDir = dir;
+			payload.bsdfPdf = lambertianPdf(leaf, hitNormal, dir);
+
+			//Guided directions may point below the surface, where the BSDF is zero
+			if (cosTheta > 0.f && payload.bsdfPdf > 0.f)
+				payload.attenuation = material.albedo / PI * cosTheta / payload.bsdfPdf;
+			else
+				payload.rayDepth = maxPathLength;
+		}
+	}
+	//Emissive
+	else if (material.type == MaterialType::Emissive)
+	{
+		payload.attenuation = 0.f;
+		payload.bounceDir = WorldRayDirection();
+
+		float cosLight = dot(-normalize(WorldRayDirection()), hitNormal);
+		if (cosLight > 0)
+		{
+			//Camera rays and specular bounces (bsdfPdf == 0) cannot be light sampled
+			float weight = 1.f;
+			if (payload.bsdfPdf > 0.f)
+			{
+				float dist = length(payload.hitPos - WorldRayOrigin());
+				weight = powerHeuristic(payload.bsdfPdf, lightPdf(material.emittance, dist, cosLight));
+			}
+			payload.radiance = material.emittance * weight;
+		}
+
+		payload.rayDepth = maxPathLength;
 	}
 	//Metal
 	else if (material.type == MaterialType::Metal)
 	{
 		payload.attenuation = material.albedo;
+		payload.bsdfPdf = 0.f;
 
 		float3 reflected = reflect(WorldRayDirection(), hitNormal);
-		payload.bounceDir = normalize(reflected + random_in_unit_sphere(payload.seed) * material.fuzz);
+		payload.bounceDir = normalize(reflected + random_in_unit_sphere(payload.rng) * material.fuzz);
 	}
 	//Dielectric
 	else if (material.type == MaterialType::Dielectric)
 	{
 		payload.attenuation = 1.f;
+		payload.bsdfPdf = 0.f;
 
 		bool isFrontFace = dot(WorldRayDirection(), hitNormal) < 0;
 		if (!isFrontFace)
@@ -218,7 +1040,7 @@ void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 		float3 direction;
 
 		//if (cannot_refract)
-		if (cannot_refract || reflectance(cos_theta, refraction_ratio) > rand(payload.seed))
+		if (cannot_refract || reflectance(cos_theta, refraction_ratio) > rand(payload.rng))
 			direction = reflect(WorldRayDirection(), hitNormal);
 		else
 			direction = refract(WorldRayDirection(), hitNormal, refraction_ratio);
@@ -227,21 +1049,42 @@ void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 		//payload.bounceDir = refract(WorldRayDirection(), hitNormal, refraction_ratio);
 	}
 
+	payload.rayStat = material.type | (occlusionRayCount << RayStat_OcclusionShift);
 	if (dot(-WorldRayDirection(), hitNormal) < 0)
 	{
 		payload.rayDepth = maxPathLength;
+		payload.rayStat |= RayStat_BackFace;
 	}
 }
 
 [shader("miss")]
 void missRay(inout RayPayload payload)
 {
-	float2 launchIdx = DispatchRaysIndex().xy;
-	float2 launchDim = DispatchRaysDimensions().xy;
+	float3 dir = normalize(WorldRayDirection());
 
-	float2 uv = launchIdx / launchDim;
-	uv.y = 1 - uv.y;
+	if (renderMode == RenderMode_AmbientOcclusion)
+	{
+		payload.radiance = 1.f;
+	}
+	else if (envWidth > 0)
+	{
+		float weight = 1.f;
+		if (payload.bsdfPdf > 0.f)
+			weight = powerHeuristic(payload.bsdfPdf, envPdf(dir));
+		payload.radiance = envTexel(directionToEnvUV(dir)).radiance * weight;
+	}
+	else
+	{
+		float t = 0.5f * (dir.y + 1.f);
+		payload.radiance = (1.0 - t) * float3(1.0, 1.0, 1.0) + t * float3(0.5, 0.7, 1.0);
+	}
 
-	payload.radiance = (1.0 - uv.y) * float3(1.0, 1.0, 1.0) + uv.y * float3(0.5, 0.7, 1.0);
 	payload.rayDepth = maxPathLength;
+	payload.rayStat = RayStat_Miss;
+}
+
+[shader("miss")]
+void missOcclusion(inout OcclusionPayload payload)
+{
+	payload.occluded = 0;
 }
\ No newline at end of file
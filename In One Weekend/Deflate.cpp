@@ -0,0 +1,506 @@
+#include "Deflate.h"
+#include <cstring>
+
+using std::vector;
+
+static const uint cWindowSize = 1 << 15;
+static const uint cWindowMask = cWindowSize - 1;
+static const uint cHashBits = 15;
+static const uint cHashSize = 1 << cHashBits;
+static const uint cMinMatch = 3;
+static const uint cMaxMatch = 258;
+static const uint cMaxChain = 32;
+static const uint64 cNoPos = ~0ull;
+
+static const uint cLengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8 cLengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint cDistBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8 cDistExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+//DEFLATE packs bits LSB first; Huffman codes are defined MSB first
+class BitWriter
+{
+	vector<uint8>& out;
+	uint64 bitBuf = 0;
+	uint bitCount = 0;
+
+public:
+	BitWriter(vector<uint8>& out) : out(out) {}
+
+	void put(uint bits, uint numBits)
+	{
+		bitBuf |= uint64(bits) << bitCount;
+		bitCount += numBits;
+		while (bitCount >= 8)
+		{
+			out.push_back(uint8(bitBuf));
+			bitBuf >>= 8;
+			bitCount -= 8;
+		}
+	}
+
+	void putCode(uint code, uint numBits)
+	{
+		uint reversed = 0;
+		for (uint i = 0; i < numBits; ++i)
+			reversed |= ((code >> i) & 1) << (numBits - 1 - i);
+		put(reversed, numBits);
+	}
+
+	void flush()
+	{
+		if (bitCount > 0)
+			put(0, 8 - bitCount);
+	}
+};
+
+static void putLiteral(BitWriter& bw, uint symbol)
+{
+	if (symbol < 144)
+		bw.putCode(0x30 + symbol, 8);
+	else if (symbol < 256)
+		bw.putCode(0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		bw.putCode(symbol - 256, 7);
+	else
+		bw.putCode(0xc0 + symbol - 280, 8);
+}
+
+static void putMatch(BitWriter& bw, uint length, uint dist)
+{
+	uint lc = 0;
+	while (lc < 28 && cLengthBase[lc + 1] <= length)
+		++lc;
+	putLiteral(bw, 257 + lc);
+	bw.put(length - cLengthBase[lc], cLengthExtra[lc]);
+
+	uint dc = 0;
+	while (dc < 29 && cDistBase[dc + 1] <= dist)
+		++dc;
+	bw.putCode(dc, 5);
+	bw.put(dist - cDistBase[dc], cDistExtra[dc]);
+}
+
+static inline uint hash3(const uint8* p)
+{
+	return ((uint(p[0]) << 16 | uint(p[1]) << 8 | p[2]) * 2654435761u) >> (32 - cHashBits);
+}
+
+void deflateChunk(const uint8* data, uint64 size, bool last, vector<uint8>& out)
+{
+	BitWriter bw(out);
+
+	//One fixed-Huffman block holds the whole chunk
+	bw.put(last ? 1 : 0, 1);
+	bw.put(1, 2);
+
+	vector<uint64> head(cHashSize, cNoPos);
+	vector<uint64> prev(cWindowSize, cNoPos);
+
+	uint64 pos = 0;
+	while (pos < size)
+	{
+		uint bestLen = 0;
+		uint64 bestDist = 0;
+
+		if (pos + cMinMatch <= size)
+		{
+			uint h = hash3(data + pos);
+			uint64 maxLen = size - pos < cMaxMatch ? size - pos : cMaxMatch;
+			uint64 candidate = head[h];
+			for (uint chain = 0; candidate != cNoPos && chain < cMaxChain; ++chain)
+			{
+				uint64 dist = pos - candidate;
+				if (dist > cWindowSize)
+					break;
+
+				const uint8* a = data + candidate;
+				const uint8* b = data + pos;
+				uint len = 0;
+				while (len < maxLen && a[len] == b[len])
+					++len;
+
+				if (len > bestLen)
+				{
+					bestLen = len;
+					bestDist = dist;
+					if (len == maxLen)
+						break;
+				}
+				candidate = prev[candidate & cWindowMask];
+			}
+		}
+
+		uint advance = 1;
+		if (bestLen >= cMinMatch)
+		{
+			putMatch(bw, bestLen, (uint)bestDist);
+			advance = bestLen;
+		}
+		else
+		{
+			putLiteral(bw, data[pos]);
+		}
+
+		for (uint i = 0; i < advance; ++i, ++pos)
+		{
+			if (pos + cMinMatch <= size)
+			{
+				uint h = hash3(data + pos);
+				prev[pos & cWindowMask] = head[h];
+				head[h] = pos;
+			}
+		}
+	}
+
+	putLiteral(bw, 256);
+
+	//Sync flush: an empty stored block brings the stream to a byte boundary
+	if (!last)
+	{
+		bw.put(0, 3);
+		bw.flush();
+		out.push_back(0x00);
+		out.push_back(0x00);
+		out.push_back(0xff);
+		out.push_back(0xff);
+	}
+	bw.flush();
+}
+
+void zlibCompress(const uint8* data, uint64 size, vector<uint8>& out)
+{
+	//CMF: deflate, 32K window; FLG: no dictionary, fastest, header % 31 == 0
+	out.push_back(0x78);
+	out.push_back(0x01);
+
+	deflateChunk(data, size, true, out);
+
+	uint adler = adler32(data, size);
+	out.push_back(uint8(adler >> 24));
+	out.push_back(uint8(adler >> 16));
+	out.push_back(uint8(adler >> 8));
+	out.push_back(uint8(adler));
+}
+
+class BitReader
+{
+	const uint8* data;
+	uint64 size;
+	uint64 pos = 0;
+	uint bitBuf = 0;
+	uint bitCount = 0;
+
+public:
+	bool overrun = false;
+
+	BitReader(const uint8* data, uint64 size) : data(data), size(size) {}
+
+	uint get(uint numBits)
+	{
+		while (bitCount < numBits)
+		{
+			if (pos == size)
+			{
+				overrun = true;
+				return 0;
+			}
+			bitBuf |= uint(data[pos++]) << bitCount;
+			bitCount += 8;
+		}
+		uint bits = bitBuf & ((1u << numBits) - 1);
+		bitBuf = numBits < 32 ? bitBuf >> numBits : 0;
+		bitCount -= numBits;
+		return bits;
+	}
+
+	void alignToByte()
+	{
+		bitBuf = 0;
+		bitCount = 0;
+	}
+
+	bool readBytes(uint64 count, vector<uint8>& out)
+	{
+		if (size - pos < count)
+			return false;
+		out.insert(out.end(), data + pos, data + pos + count);
+		pos += count;
+		return true;
+	}
+
+	uint64 bytePos() const { return pos; }
+};
+
+//Canonical Huffman code as counts per length and symbols in code order
+struct HuffmanTable
+{
+	uint16 count[16];
+	uint16 symbol[288];
+
+	bool build(const uint8* lengths, uint numSymbols)
+	{
+		memset(count, 0, sizeof(count));
+		for (uint i = 0; i < numSymbols; ++i)
+			count[lengths[i]]++;
+		count[0] = 0;
+
+		uint16 offsets[16];
+		offsets[1] = 0;
+		for (uint len = 1; len < 15; ++len)
+			offsets[len + 1] = offsets[len] + count[len];
+
+		for (uint i = 0; i < numSymbols; ++i)
+			if (lengths[i] != 0)
+				symbol[offsets[lengths[i]]++] = uint16(i);
+
+		//Over-subscribed lengths cannot come from a valid encoder
+		int left = 1;
+		for (uint len = 1; len < 16; ++len)
+		{
+			left = (left << 1) - count[len];
+			if (left < 0)
+				return false;
+		}
+		return true;
+	}
+
+	int decode(BitReader& br) const
+	{
+		int code = 0;
+		int first = 0;
+		int index = 0;
+		for (uint len = 1; len < 16; ++len)
+		{
+			code |= br.get(1);
+			if (br.overrun)
+				return -1;
+			int n = count[len];
+			if (code - n < first)
+				return symbol[index + (code - first)];
+			index += n;
+			first = (first + n) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+static bool inflateBlock(BitReader& br, const HuffmanTable& litLen, const HuffmanTable& dist, vector<uint8>& out)
+{
+	for (;;)
+	{
+		int symbol = litLen.decode(br);
+		if (symbol < 0)
+			return false;
+		if (symbol < 256)
+		{
+			out.push_back(uint8(symbol));
+			continue;
+		}
+		if (symbol == 256)
+			return true;
+
+		symbol -= 257;
+		if (symbol >= 29)
+			return false;
+		uint length = cLengthBase[symbol] + br.get(cLengthExtra[symbol]);
+
+		int dc = dist.decode(br);
+		if (dc < 0 || dc >= 30)
+			return false;
+		uint64 d = cDistBase[dc] + br.get(cDistExtra[dc]);
+		if (br.overrun || d > out.size())
+			return false;
+
+		//Byte by byte, since the copy may overlap what it produces
+		uint64 from = out.size() - d;
+		for (uint i = 0; i < length; ++i)
+			out.push_back(out[from + i]);
+	}
+}
+
+bool inflate(const uint8* data, uint64 size, vector<uint8>& out)
+{
+	BitReader br(data, size);
+
+	uint last;
+	do
+	{
+		last = br.get(1);
+		uint type = br.get(2);
+		if (br.overrun)
+			return false;
+
+		if (type == 0)
+		{
+			br.alignToByte();
+			uint len = br.get(16);
+			uint nlen = br.get(16);
+			if (br.overrun || (len ^ 0xffff) != nlen || !br.readBytes(len, out))
+				return false;
+		}
+		else if (type == 1)
+		{
+			uint8 lengths[288 + 30];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+
+			HuffmanTable litLen, dist;
+			litLen.build(lengths, 288);
+			dist.build(lengths + 288, 30);
+			if (!inflateBlock(br, litLen, dist, out))
+				return false;
+		}
+		else if (type == 2)
+		{
+			uint numLitLen = br.get(5) + 257;
+			uint numDist = br.get(5) + 1;
+			uint numCodeLen = br.get(4) + 4;
+			if (numLitLen > 286 || numDist > 30)
+				return false;
+
+			static const uint8 cCodeLenOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+			uint8 codeLenLengths[19] = {};
+			for (uint i = 0; i < numCodeLen; ++i)
+				codeLenLengths[cCodeLenOrder[i]] = uint8(br.get(3));
+
+			HuffmanTable codeLen;
+			if (!codeLen.build(codeLenLengths, 19))
+				return false;
+
+			uint8 lengths[286 + 30] = {};
+			uint n = 0;
+			while (n < numLitLen + numDist)
+			{
+				int symbol = codeLen.decode(br);
+				if (symbol < 0)
+					return false;
+
+				if (symbol < 16)
+				{
+					lengths[n++] = uint8(symbol);
+					continue;
+				}
+
+				uint8 repeated = 0;
+				uint repeat;
+				if (symbol == 16)
+				{
+					if (n == 0)
+						return false;
+					repeated = lengths[n - 1];
+					repeat = 3 + br.get(2);
+				}
+				else if (symbol == 17)
+					repeat = 3 + br.get(3);
+				else
+					repeat = 11 + br.get(7);
+
+				if (n + repeat > numLitLen + numDist)
+					return false;
+				while (repeat-- > 0)
+					lengths[n++] = repeated;
+			}
+
+			HuffmanTable litLen, dist;
+			if (!litLen.build(lengths, numLitLen) || !dist.build(lengths + numLitLen, numDist))
+				return false;
+			if (!inflateBlock(br, litLen, dist, out))
+				return false;
+		}
+		else
+			return false;
+	} while (!last);
+
+	return !br.overrun;
+}
+
+bool zlibDecompress(const uint8* data, uint64 size, vector<uint8>& out)
+{
+	if (size < 6 || (data[0] & 0x0f) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20))
+		return false;
+
+	uint64 start = out.size();
+	if (!inflate(data + 2, size - 6, out))
+		return false;
+
+	const uint8* tail = data + size - 4;
+	uint expected = (uint(tail[0]) << 24) | (uint(tail[1]) << 16) | (uint(tail[2]) << 8) | tail[3];
+	return adler32(out.data() + start, out.size() - start) == expected;
+}
+
+uint adler32(const uint8* data, uint64 size, uint adler)
+{
+	const uint cBase = 65521;
+	uint a = adler & 0xffff;
+	uint b = adler >> 16;
+
+	while (size > 0)
+	{
+		//5552 is the longest run before b can overflow 32 bits
+		uint64 n = size < 5552 ? size : 5552;
+		size -= n;
+		while (n-- > 0)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= cBase;
+		b %= cBase;
+	}
+
+	return (b << 16) | a;
+}
+
+uint adler32Combine(uint adlerA, uint adlerB, uint64 sizeB)
+{
+	const uint64 cBase = 65521;
+	uint64 rem = sizeB % cBase;
+	uint64 sum1 = adlerA & 0xffff;
+	uint64 sum2 = (rem * sum1) % cBase;
+	sum1 += (adlerB & 0xffff) + cBase - 1;
+	sum2 += (adlerA >> 16) + (adlerB >> 16) + cBase - rem;
+	if (sum1 >= cBase) sum1 -= cBase;
+	if (sum1 >= cBase) sum1 -= cBase;
+	if (sum2 >= (cBase << 1)) sum2 -= (cBase << 1);
+	if (sum2 >= cBase) sum2 -= cBase;
+	return uint(sum1 | (sum2 << 16));
+}
+
+struct CrcTable
+{
+	uint entry[256];
+
+	CrcTable()
+	{
+		for (uint n = 0; n < 256; ++n)
+		{
+			uint c = n;
+			for (uint k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			entry[n] = c;
+		}
+	}
+};
+
+uint crc32(const uint8* data, uint64 size, uint crc)
+{
+	static const CrcTable table;
+
+	crc = ~crc;
+	for (uint64 i = 0; i < size; ++i)
+		crc = table.entry[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
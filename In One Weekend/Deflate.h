@@ -0,0 +1,22 @@
+#pragma once
+#include "basic_types.h"
+#include <vector>
+
+//Minimal DEFLATE (RFC 1951) encoder: LZ77 over a 32K window with the fixed Huffman tables.
+//Chunks are compressed independently and end byte aligned (a sync flush unless last),
+//so chunks compressed on different threads concatenate into one valid stream.
+void deflateChunk(const uint8* data, uint64 size, bool last, std::vector<uint8>& out);
+
+//Complete zlib (RFC 1950) stream of one buffer
+void zlibCompress(const uint8* data, uint64 size, std::vector<uint8>& out);
+
+//Full RFC 1951 decoder (stored, fixed and dynamic blocks), appending to out; false on corrupt input
+bool inflate(const uint8* data, uint64 size, std::vector<uint8>& out);
+//Checks the zlib header and Adler-32 as well
+bool zlibDecompress(const uint8* data, uint64 size, std::vector<uint8>& out);
+
+uint adler32(const uint8* data, uint64 size, uint adler = 1);
+//Adler-32 of A followed by B, given adler32(A), adler32(B) and the length of B
+uint adler32Combine(uint adlerA, uint adlerB, uint64 sizeB);
+
+uint crc32(const uint8* data, uint64 size, uint crc = 0);
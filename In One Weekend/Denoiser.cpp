@@ -0,0 +1,291 @@
+#include "Denoiser.h"
+#include "OutputEncoding.h"
+#include "Parallel.h"
+#include <cmath>
+
+static const uint cMinTemporalFrames = 4;
+static const float cMinAlbedo = 1e-3f;
+static const float cKernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+static float lum(float r, float g, float b)
+{
+	return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+void Denoiser::resize(uint w, uint h)
+{
+	if (w == width && h == height)
+		return;
+
+	width = w;
+	height = h;
+	uint64 n = uint64(w) * h;
+
+	for (uint i = 0; i < 2; ++i)
+	{
+		for (uint c = 0; c < 3; ++c)
+			colorArr[i][c].assign(n, 0.f);
+		varianceArr[i].assign(n, 0.f);
+	}
+	for (uint c = 0; c < 3; ++c)
+	{
+		albedoArr[c].assign(n, 0.f);
+		normalArr[c].assign(n, 0.f);
+	}
+	depthArr.assign(n, 0.f);
+	depthGradArr.assign(n, 0.f);
+	outArr.assign(n * 4, 0.f);
+}
+
+void Denoiser::loadInput(const TracedResult& radiance, const AovImage& aovs, uint numFrames, bool demodulate)
+{
+	const float* in = (const float*)radiance.data;
+	bool haveMoments = radiance.format == DXGI_FORMAT_R32G32B32A32_FLOAT;
+	if (!haveMoments)
+	{
+		decodedArr.resize(uint64(width) * height * 4);
+		decodeImage(radiance, decodedArr.data());
+		in = decodedArr.data();
+	}
+
+	bool temporal = haveMoments && numFrames >= cMinTemporalFrames;
+
+	parallelFor(height, [&](uint y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			uint64 i = uint64(y) * width + x;
+			const float* p = in + 4 * i;
+			AovSample s = readAov(aovs, x, y);
+
+			float3 a = s.albedo;
+			if (!demodulate || s.depth <= 0.f)
+				a = float3(1.f);
+			a = float3(_max(a.x, cMinAlbedo), _max(a.y, cMinAlbedo), _max(a.z, cMinAlbedo));
+
+			float3 c(p[0] / a.x, p[1] / a.y, p[2] / a.z);
+			colorArr[0][0][i] = c.x;
+			colorArr[0][1][i] = c.y;
+			colorArr[0][2][i] = c.z;
+			albedoArr[0][i] = a.x;
+			albedoArr[1][i] = a.y;
+			albedoArr[2][i] = a.z;
+			normalArr[0][i] = s.normal.x;
+			normalArr[1][i] = s.normal.y;
+			normalArr[2][i] = s.normal.z;
+			depthArr[i] = s.depth;
+
+			//Variance of the mean of numFrames frames, carried over to the demodulated luminance
+			if (temporal)
+			{
+				float l = lum(p[0], p[1], p[2]);
+				float variance = _max(p[3] - l * l, 0.f) / numFrames;
+				float li = lum(c.x, c.y, c.z);
+				varianceArr[0][i] = l > 0.f ? variance * (li / l) * (li / l) : 0.f;
+			}
+		}
+	});
+
+	if (!temporal)
+		estimateSpatialVariance();
+
+	//Largest central difference of depth, the scale for depth similarity
+	parallelFor(height, [&](uint y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			uint64 i = uint64(y) * width + x;
+			float z = depthArr[i];
+			float gx = 0.f, gy = 0.f;
+			if (x > 0 && x + 1 < width)
+				gx = fabsf(depthArr[i + 1] - depthArr[i - 1]) * 0.5f;
+			if (y > 0 && y + 1 < height)
+				gy = fabsf(depthArr[i + width] - depthArr[i - width]) * 0.5f;
+			depthGradArr[i] = _max(_max(gx, gy), z * 1e-3f);
+		}
+	});
+}
+
+//Luminance variance over a 5x5 neighbourhood on the same surface
+void Denoiser::estimateSpatialVariance()
+{
+	const vector<float>* c = colorArr[0];
+
+	parallelFor(height, [&](uint y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			uint64 i = uint64(y) * width + x;
+			float z = depthArr[i];
+			if (z <= 0.f)
+			{
+				varianceArr[0][i] = 0.f;
+				continue;
+			}
+
+			float sumW = 0.f, sum = 0.f, sumSq = 0.f;
+			for (int dy = -2; dy <= 2; ++dy)
+			{
+				int qy = int(y) + dy;
+				if (qy < 0 || qy >= int(height))
+					continue;
+				for (int dx = -2; dx <= 2; ++dx)
+				{
+					int qx = int(x) + dx;
+					if (qx < 0 || qx >= int(width))
+						continue;
+
+					uint64 q = uint64(qy) * width + qx;
+					float zq = depthArr[q];
+					if (zq <= 0.f || fabsf(zq - z) > 0.05f * z)
+						continue;
+
+					float nDot = normalArr[0][i] * normalArr[0][q] + normalArr[1][i] * normalArr[1][q] + normalArr[2][i] * normalArr[2][q];
+					if (nDot < 0.9f)
+						continue;
+
+					float l = lum(c[0][q], c[1][q], c[2][q]);
+					sumW += 1.f;
+					sum += l;
+					sumSq += l * l;
+				}
+			}
+
+			float mean = sum / sumW;
+			varianceArr[0][i] = _max(sumSq / sumW - mean * mean, 0.f);
+		}
+	});
+}
+
+void Denoiser::filterStep(uint src, uint step, const DenoiseSettings& settings)
+{
+	uint dst = 1 - src;
+	const vector<float>* cIn = colorArr[src];
+	vector<float>* cOut = colorArr[dst];
+	const vector<float>& varIn = varianceArr[src];
+	vector<float>& varOut = varianceArr[dst];
+
+	parallelFor(height, [&](uint y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			uint64 i = uint64(y) * width + x;
+			float z = depthArr[i];
+
+			//Background pixels pass through and are never used as taps
+			if (z <= 0.f)
+			{
+				cOut[0][i] = cIn[0][i];
+				cOut[1][i] = cIn[1][i];
+				cOut[2][i] = cIn[2][i];
+				varOut[i] = varIn[i];
+				continue;
+			}
+
+			//3x3 blurred variance steadies the luminance weight
+			float blurredVar = 0.f, blurW = 0.f;
+			for (int dy = -1; dy <= 1; ++dy)
+			{
+				int qy = int(y) + dy;
+				if (qy < 0 || qy >= int(height))
+					continue;
+				for (int dx = -1; dx <= 1; ++dx)
+				{
+					int qx = int(x) + dx;
+					if (qx < 0 || qx >= int(width))
+						continue;
+					float k = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+					blurredVar += k * varIn[uint64(qy) * width + qx];
+					blurW += k;
+				}
+			}
+
+			float l = lum(cIn[0][i], cIn[1][i], cIn[2][i]);
+			float lumScale = 1.f / (settings.sigmaLuminance * sqrtf(_max(blurredVar / blurW, 0.f)) + 1e-6f);
+			float depthSigma = settings.sigmaDepth * depthGradArr[i];
+			float nx = normalArr[0][i], ny = normalArr[1][i], nz = normalArr[2][i];
+
+			float sumW = 0.f, sumR = 0.f, sumG = 0.f, sumB = 0.f, sumVar = 0.f;
+			for (int ky = -2; ky <= 2; ++ky)
+			{
+				int qy = int(y) + ky * int(step);
+				if (qy < 0 || qy >= int(height))
+					continue;
+				for (int kx = -2; kx <= 2; ++kx)
+				{
+					int qx = int(x) + kx * int(step);
+					if (qx < 0 || qx >= int(width))
+						continue;
+
+					uint64 q = uint64(qy) * width + qx;
+					float zq = depthArr[q];
+					if (zq <= 0.f)
+						continue;
+
+					float nDot = nx * normalArr[0][q] + ny * normalArr[1][q] + nz * normalArr[2][q];
+					if (nDot <= 0.f)
+						continue;
+
+					//All three edge-stopping terms folded into a single exp
+					float dist = sqrtf(float(kx * kx + ky * ky)) * step;
+					float wDepth = fabsf(z - zq) / (depthSigma * dist + 1e-6f);
+					float lq = lum(cIn[0][q], cIn[1][q], cIn[2][q]);
+					float wLum = fabsf(l - lq) * lumScale;
+					float wNormal = settings.sigmaNormal * logf(_min(nDot, 1.f));
+
+					float w = cKernel[kx + 2] * cKernel[ky + 2] * expf(wNormal - wDepth - wLum);
+					sumW += w;
+					sumR += w * cIn[0][q];
+					sumG += w * cIn[1][q];
+					sumB += w * cIn[2][q];
+					sumVar += w * w * varIn[q];
+				}
+			}
+
+			//The centre tap always has weight, so sumW > 0
+			cOut[0][i] = sumR / sumW;
+			cOut[1][i] = sumG / sumW;
+			cOut[2][i] = sumB / sumW;
+			varOut[i] = sumVar / (sumW * sumW);
+		}
+	});
+}
+
+TracedResult Denoiser::denoise(const TracedResult& radiance, const AovImage& aovs, uint numFrames, const DenoiseSettings& settings)
+{
+	if (aovs.layout == AovLayout::Off || aovs.data == nullptr)
+		throw Error("Denoising needs the AOV buffers.");
+	if (aovs.width != radiance.width || aovs.height != radiance.height)
+		throw Error("AOVs and radiance differ in size.");
+
+	resize(radiance.width, radiance.height);
+	loadInput(radiance, aovs, numFrames, settings.demodulateAlbedo);
+
+	uint src = 0;
+	for (uint it = 0; it < settings.numIterations; ++it)
+	{
+		filterStep(src, 1u << it, settings);
+		src = 1 - src;
+	}
+
+	const vector<float>* c = colorArr[src];
+	parallelFor(height, [&](uint y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			uint64 i = uint64(y) * width + x;
+			float* o = &outArr[4 * i];
+			for (uint k = 0; k < 3; ++k)
+				o[k] = c[k][i] * albedoArr[k][i];
+			o[3] = 1.f;
+		}
+	});
+
+	TracedResult result;
+	result.data = outArr.data();
+	result.width = width;
+	result.height = height;
+	result.pixelSize = 4 * sizeof(float);
+	result.format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	return result;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "dxHelper.h"
+#include "Aov.h"
+
+struct DenoiseSettings
+{
+	uint numIterations = 5;			//a-trous steps 1, 2, 4, ... pixels
+	float sigmaLuminance = 4.f;		//in standard deviations of the pixel's luminance
+	float sigmaNormal = 128.f;		//exponent on dot(n, n')
+	float sigmaDepth = 1.f;			//in multiples of the local depth gradient
+	bool demodulateAlbedo = true;	//filter illumination only, so texture and material edges stay sharp
+};
+
+//SVGF-style edge-avoiding a-trous wavelet filter on the CPU. Radiance is demodulated by the first-hit
+//albedo, filtered with weights from normal, depth and luminance relative to the per-pixel standard
+//deviation, and remodulated. Buffers are kept as planes and reused between calls, and rows are
+//spread over all cores.
+class Denoiser
+{
+	uint width = 0;
+	uint height = 0;
+
+	vector<float> colorArr[2][3];	//ping-pong illumination planes
+	vector<float> varianceArr[2];
+	vector<float> albedoArr[3];
+	vector<float> normalArr[3];
+	vector<float> depthArr;
+	vector<float> depthGradArr;
+	vector<float> decodedArr;		//RGBA32F copy of encoded input
+	vector<float> outArr;
+
+	void resize(uint width, uint height);
+	void loadInput(const TracedResult& radiance, const AovImage& aovs, uint numFrames, bool demodulate);
+	void estimateSpatialVariance();
+	void filterStep(uint src, uint step, const DenoiseSettings& settings);
+
+public:
+	//numFrames is how many frames are averaged into radiance. RGBA32F radiance from the tracer carries
+	//the second moment of luminance in alpha, which gives the variance once a few frames are in;
+	//before that, or for encoded input, it is estimated from the neighbourhood.
+	//The result is RGBA32F and stays valid until the next call.
+	TracedResult denoise(const TracedResult& radiance, const AovImage& aovs, uint numFrames, const DenoiseSettings& settings = DenoiseSettings());
+};
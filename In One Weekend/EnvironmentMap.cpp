@@ -0,0 +1,204 @@
+#include "EnvironmentMap.h"
+#include "Error.h"
+#include "basic_random.h"
+#include "Trace.h"
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+static const uint cEnvCacheMagic = 0x31564e45; //"ENV1"
+
+static float3 decodeRGBE(const uint8 rgbe[4])
+{
+	if (rgbe[3] == 0)
+		return float3(0.f);
+	float scale = ldexpf(1.f, (int)rgbe[3] - (128 + 8));
+	return float3(rgbe[0] * scale, rgbe[1] * scale, rgbe[2] * scale);
+}
+
+uint64 EnvironmentMap::loadRadianceHDR(const char* filename)
+{
+	ifstream file(filename, ios::binary);
+	if (!file)
+		throw Error("Cannot open the environment map.");
+
+	vector<uint8> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	const uint8* cur = bytes.data();
+	const uint8* end = cur + bytes.size();
+
+	auto readLine = [&]()
+	{
+		string line;
+		while (cur < end && *cur != '\n')
+			line.push_back((char)*cur++);
+		if (cur < end)
+			++cur;
+		return line;
+	};
+
+	bool isRGBE = false;
+	for (string line = readLine(); !line.empty(); line = readLine())
+	{
+		if (line.compare(0, 22, "FORMAT=32-bit_rle_rgbe") == 0)
+			isRGBE = true;
+	}
+
+	int w = 0, h = 0;
+	string axisY, axisX;
+	istringstream resolution(readLine());
+	resolution >> axisY >> h >> axisX >> w;
+	if (!isRGBE || axisY != "-Y" || axisX != "+X" || w <= 0 || h <= 0)
+		throw Error("Only -Y +X oriented RGBE .hdr files are supported.");
+
+	width = (uint)w;
+	height = (uint)h;
+	texelArr.resize((size_t)width * height);
+
+	vector<uint8> scanline(width * 4);
+	for (uint y = 0; y < height && end - cur >= 4; ++y)
+	{
+		bool isRLE = (cur[0] == 2 && cur[1] == 2 && (uint)((cur[2] << 8) | cur[3]) == width && width >= 8 && width < 32768);
+		if (!isRLE)
+		{
+			if ((size_t)(end - cur) < scanline.size())
+				break;
+			memcpy(scanline.data(), cur, scanline.size());
+			cur += scanline.size();
+		}
+		else
+		{
+			//New-style RLE stores each channel separately
+			cur += 4;
+			for (uint c = 0; c < 4; ++c)
+			{
+				uint x = 0;
+				while (x < width && cur < end)
+				{
+					uint count = *cur++;
+					if (count > 128)
+					{
+						count -= 128;
+						uint8 value = (cur < end) ? *cur++ : 0;
+						for (uint i = 0; i < count && x < width; ++i)
+							scanline[(x++) * 4 + c] = value;
+					}
+					else
+					{
+						for (uint i = 0; i < count && x < width && cur < end; ++i)
+							scanline[(x++) * 4 + c] = *cur++;
+					}
+				}
+			}
+		}
+
+		for (uint x = 0; x < width; ++x)
+			texelArr[y * width + x].radiance = decodeRGBE(&scanline[x * 4]);
+	}
+
+	return fnv1a(bytes.data(), bytes.size());
+}
+
+void EnvironmentMap::buildDistribution()
+{
+	marginalCdf.assign(height + 1, 0.f);
+	conditionalCdf.assign((size_t)height * (width + 1), 0.f);
+	vector<float> rowIntegral(height);
+
+	for (uint y = 0; y < height; ++y)
+	{
+		//Rows near the poles cover less solid angle
+		float sinTheta = sinf(PI * (y + 0.5f) / height);
+		float* cdf = &conditionalCdf[(size_t)y * (width + 1)];
+
+		cdf[0] = 0.f;
+		for (uint x = 0; x < width; ++x)
+			cdf[x + 1] = cdf[x] + luminance(texelArr[y * width + x].radiance) * sinTheta / width;
+
+		rowIntegral[y] = cdf[width];
+		for (uint x = 1; x <= width; ++x)
+			cdf[x] = (rowIntegral[y] > 0.f) ? cdf[x] / rowIntegral[y] : float(x) / width;
+
+		marginalCdf[y + 1] = marginalCdf[y] + rowIntegral[y] / height;
+	}
+
+	float integral = marginalCdf[height];
+	if (integral <= 0.f)
+		throw Error("The environment map is black.");
+
+	for (uint y = 1; y <= height; ++y)
+		marginalCdf[y] /= integral;
+
+	for (uint y = 0; y < height; ++y)
+	{
+		float sinTheta = sinf(PI * (y + 0.5f) / height);
+		for (uint x = 0; x < width; ++x)
+		{
+			EnvTexel& texel = texelArr[y * width + x];
+			texel.pdf = luminance(texel.radiance) * sinTheta / integral;
+		}
+	}
+}
+
+bool EnvironmentMap::loadCache(const string& cacheFile, uint64 sourceStamp)
+{
+	ifstream file(cacheFile, ios::binary);
+	if (!file)
+		return false;
+
+	uint header[3] = {};
+	uint64 stamp = 0;
+	file.read((char*)header, sizeof(header));
+	file.read((char*)&stamp, sizeof(stamp));
+
+	if (!file || header[0] != cEnvCacheMagic || header[1] != width || header[2] != height || stamp != sourceStamp)
+		return false;
+
+	vector<float> pdfArr((size_t)width * height);
+	marginalCdf.resize(height + 1);
+	conditionalCdf.resize((size_t)height * (width + 1));
+
+	file.read((char*)pdfArr.data(), pdfArr.size() * sizeof(float));
+	file.read((char*)marginalCdf.data(), marginalCdf.size() * sizeof(float));
+	file.read((char*)conditionalCdf.data(), conditionalCdf.size() * sizeof(float));
+
+	if (!file)
+		return false;
+
+	for (size_t i = 0; i < pdfArr.size(); ++i)
+		texelArr[i].pdf = pdfArr[i];
+
+	return true;
+}
+
+void EnvironmentMap::saveCache(const string& cacheFile, uint64 sourceStamp) const
+{
+	ofstream file(cacheFile, ios::binary);
+	if (!file)
+		return;
+
+	uint header[3] = { cEnvCacheMagic, width, height };
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)&sourceStamp, sizeof(sourceStamp));
+
+	vector<float> pdfArr(texelArr.size());
+	for (size_t i = 0; i < texelArr.size(); ++i)
+		pdfArr[i] = texelArr[i].pdf;
+
+	file.write((const char*)pdfArr.data(), pdfArr.size() * sizeof(float));
+	file.write((const char*)marginalCdf.data(), marginalCdf.size() * sizeof(float));
+	file.write((const char*)conditionalCdf.data(), conditionalCdf.size() * sizeof(float));
+}
+
+void EnvironmentMap::load(const char* filename)
+{
+	TraceScope scope("EnvironmentMap::load");
+
+	uint64 stamp = loadRadianceHDR(filename);
+	string cacheFile = string(filename) + ".envcache";
+
+	if (!loadCache(cacheFile, stamp))
+	{
+		buildDistribution();
+		saveCache(cacheFile, stamp);
+	}
+}
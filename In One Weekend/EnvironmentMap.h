@@ -0,0 +1,34 @@
+#pragma once
+#include "basic_math.h"
+
+//Matches EnvTexel in DXRShader.hlsl: rgb radiance and the texel's pdf over the unit square
+struct EnvTexel
+{
+	float3 radiance;
+	float pdf;
+};
+
+//Equirectangular HDR environment with a piecewise-constant 2D distribution
+//(marginal over rows, conditional over columns) for importance sampling.
+class EnvironmentMap
+{
+	uint width = 0;
+	uint height = 0;
+	vector<EnvTexel> texelArr;
+	vector<float> marginalCdf;		//height + 1
+	vector<float> conditionalCdf;	//height * (width + 1)
+
+	uint64 loadRadianceHDR(const char* filename);
+	void buildDistribution();
+	bool loadCache(const string& cacheFile, uint64 sourceStamp);
+	void saveCache(const string& cacheFile, uint64 sourceStamp) const;
+
+public:
+	void load(const char* filename);
+
+	uint getWidth() const { return width; }
+	uint getHeight() const { return height; }
+	const vector<EnvTexel>& getTexelArray() const { return texelArr; }
+	const vector<float>& getMarginalCdf() const { return marginalCdf; }
+	const vector<float>& getConditionalCdf() const { return conditionalCdf; }
+};
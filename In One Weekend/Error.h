@@ -1,18 +1,5 @@
 #pragma once
-#include "pch.h"
-
-inline void ThrowIfFailed(HRESULT hr)
-{
-	if (FAILED(hr))
-	{
-		throw hr;
-	}
-}
-
-inline void ThrowIfFalse(bool value)
-{
-	ThrowIfFailed(value ? S_OK : E_FAIL);
-}
+#include <stdio.h>
 
 inline void printError(const char* errorMessage)
 {
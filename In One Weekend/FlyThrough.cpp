@@ -0,0 +1,69 @@
+#include "FlyThrough.h"
+#include "timer.h"
+#include "SampleStats.h"
+#include <algorithm>
+#include <fstream>
+
+struct FlyThroughFrame
+{
+	double pathTime;
+	double updateSeconds;
+	double traceSeconds;	//shootRays: dispatch, GPU wait and readback
+};
+
+void runFlyThrough(DXRPathTracer* tracer, const CameraPath& path, const string& csvPath, const FlyThroughSettings& settings)
+{
+	if (settings.frames == 0)
+		throw Error("A fly-through needs at least one frame.");
+
+	ofstream file(csvPath, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + csvPath).c_str());
+
+	tracer->setCameraInput(false);
+
+	double start = path.getKey(0).time;
+	tracer->setCameraKey(path.sample(start));
+	for (uint i = 0; i < settings.warmupFrames; ++i)
+	{
+		tracer->update();
+		tracer->shootRays();
+	}
+
+	vector<FlyThroughFrame> frames(settings.frames);
+	for (uint i = 0; i < settings.frames; ++i)
+	{
+		FlyThroughFrame& f = frames[i];
+		f.pathTime = settings.frames > 1 ? start + path.duration() * i / (settings.frames - 1) : start;
+		tracer->setCameraKey(path.sample(f.pathTime));
+
+		double t0 = getCurrentTime();
+		tracer->update();
+		double t1 = getCurrentTime();
+		tracer->shootRays();
+		double t2 = getCurrentTime();
+
+		f.updateSeconds = t1 - t0;
+		f.traceSeconds = t2 - t1;
+	}
+
+	tracer->setCameraInput(true);
+
+	file << "frame,path_time,update_ms,trace_ms,frame_ms\n";
+	char line[256];
+	vector<double> frameMs(settings.frames);
+	for (uint i = 0; i < settings.frames; ++i)
+	{
+		const FlyThroughFrame& f = frames[i];
+		frameMs[i] = (f.updateSeconds + f.traceSeconds) * 1e3;
+		snprintf(line, sizeof(line), "%u,%.6f,%.4f,%.4f,%.4f\n", i, f.pathTime, f.updateSeconds * 1e3, f.traceSeconds * 1e3, frameMs[i]);
+		file << line;
+	}
+	if (!file)
+		throw Error(("Failed to write " + csvPath).c_str());
+
+	SampleStats s = sampleStats(frameMs);
+	printf("Fly-through, %u frames over %.2f s of path (%u keys)\n", settings.frames, path.duration(), path.numKeys());
+	printf("  frame ms: mean %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f  (%.1f fps)\n", s.mean, s.p50, s.p95, s.p99, s.max, 1e3 / s.mean);
+	printf("Per-frame times written to %s\n", csvPath.c_str());
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "DXRPathTracer.h"
+
+struct FlyThroughSettings
+{
+	uint frames = 600;
+	uint warmupFrames = 8;		//traced at the first key and not timed
+};
+
+//Plays path through the tracer at frames evenly spaced over its duration, one update and
+//shootRays each, so every run traces the same views whatever its frame rate. Prints the
+//spread of the frame times and writes each frame's to csvPath.
+void runFlyThrough(DXRPathTracer* tracer, const CameraPath& path, const string& csvPath, const FlyThroughSettings& settings = FlyThroughSettings());
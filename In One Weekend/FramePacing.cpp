@@ -0,0 +1,209 @@
+#include "FramePacing.h"
+#include "Error.h"
+#include "SampleStats.h"
+#include "timer.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+static const char* cMarkNames[FrameMark::Count] = {
+	"start",
+	"update_end",
+	"trace_end",
+	"readback_end",
+	"present",
+};
+
+//Seconds, negative where the frame never got there
+struct FrameTimes
+{
+	double mark[FrameMark::Count];
+	double input;
+	double inputQueued;		//seconds, coarse
+};
+
+static bool gPacing = false;
+static FrameTimes gFrames[cFramePacingHistory];
+static uint64 gFrameCount = 0;
+static double gPendingInput = -1.0;
+static double gPendingInputQueued = 0.0;
+
+const char* frameMarkName(FrameMark::Type mark)
+{
+	return cMarkNames[mark];
+}
+
+void setFramePacing(bool enable)
+{
+	gPacing = enable;
+}
+
+bool isFramePacing()
+{
+	return gPacing;
+}
+
+void markFrame(FrameMark::Type mark)
+{
+	if (!gPacing)
+		return;
+
+	double now = getCurrentTime();
+	if (mark == FrameMark::Start)
+	{
+		FrameTimes& frame = gFrames[gFrameCount++ % cFramePacingHistory];
+		fill(frame.mark, frame.mark + FrameMark::Count, -1.0);
+		frame.input = -1.0;
+		frame.inputQueued = 0.0;
+	}
+	if (gFrameCount == 0)
+		return;
+
+	FrameTimes& frame = gFrames[(gFrameCount - 1) % cFramePacingHistory];
+	frame.mark[mark] = now;
+	if (mark == FrameMark::UpdateEnd && gPendingInput >= 0.0)
+	{
+		frame.input = gPendingInput;
+		frame.inputQueued = gPendingInputQueued;
+		gPendingInput = -1.0;
+	}
+}
+
+void markInput(double time, double queued)
+{
+	if (gPacing && (gPendingInput < 0.0 || time < gPendingInput))
+	{
+		gPendingInput = time;
+		gPendingInputQueued = queued;
+	}
+}
+
+//Oldest first
+static vector<FrameTimes> keptFrames()
+{
+	uint64 numKept = min(gFrameCount, uint64(cFramePacingHistory));
+	vector<FrameTimes> frames;
+	frames.reserve((size_t)numKept);
+	for (uint64 i = gFrameCount - numKept; i < gFrameCount; ++i)
+		frames.push_back(gFrames[i % cFramePacingHistory]);
+	return frames;
+}
+
+//Milliseconds from mark a to mark b of the same frame, where both were reached
+static vector<double> spans(const vector<FrameTimes>& frames, FrameMark::Type a, FrameMark::Type b)
+{
+	vector<double> ms;
+	for (const FrameTimes& f : frames)
+		if (f.mark[a] >= 0.0 && f.mark[b] >= 0.0)
+			ms.push_back((f.mark[b] - f.mark[a]) * 1e3);
+	return ms;
+}
+
+//Milliseconds between the same mark of consecutive frames
+static vector<double> intervals(const vector<FrameTimes>& frames, FrameMark::Type mark)
+{
+	vector<double> ms;
+	for (size_t i = 1; i < frames.size(); ++i)
+		if (frames[i - 1].mark[mark] >= 0.0 && frames[i].mark[mark] >= 0.0)
+			ms.push_back((frames[i].mark[mark] - frames[i - 1].mark[mark]) * 1e3);
+	return ms;
+}
+
+static void printDistribution(const char* name, const SampleStats& d)
+{
+	if (d.count == 0)
+		printf("%-22s %8u\n", name, 0u);
+	else
+		printf("%-22s %8u %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, d.count, d.mean, d.p50, d.p95, d.p99, d.max, d.stddev);
+}
+
+void printFramePacing()
+{
+	vector<FrameTimes> frames = keptFrames();
+	printf("Frame pacing, last %u of %llu frames\n", (uint)frames.size(), (unsigned long long)gFrameCount);
+	if (frames.size() < 2)
+		return;
+
+	vector<double> frameMs = intervals(frames, FrameMark::Start);
+	vector<double> presentMs = intervals(frames, FrameMark::Present);
+
+	vector<double> inputMs, queuedMs;
+	for (const FrameTimes& f : frames)
+	{
+		if (f.input >= 0.0 && f.mark[FrameMark::Present] >= 0.0)
+		{
+			inputMs.push_back((f.mark[FrameMark::Present] - f.input) * 1e3);
+			queuedMs.push_back(f.inputQueued * 1e3);
+		}
+	}
+
+	printf("%-22s %8s %9s %9s %9s %9s %9s %9s\n", "ms", "count", "mean", "p50", "p95", "p99", "max", "stddev");
+	printDistribution("frame time", sampleStats(frameMs));
+	printDistribution("present interval", sampleStats(presentMs));
+	printDistribution("  update", sampleStats(spans(frames, FrameMark::Start, FrameMark::UpdateEnd)));
+	printDistribution("  trace", sampleStats(spans(frames, FrameMark::UpdateEnd, FrameMark::TraceEnd)));
+	printDistribution("  readback", sampleStats(spans(frames, FrameMark::TraceEnd, FrameMark::ReadbackEnd)));
+	printDistribution("  display to present", sampleStats(spans(frames, FrameMark::ReadbackEnd, FrameMark::Present)));
+	printDistribution("update to present", sampleStats(spans(frames, FrameMark::UpdateEnd, FrameMark::Present)));
+	printDistribution("input to present", sampleStats(inputMs));
+	//From the message's tick count, which only moves every 10-16 ms
+	printDistribution("  queued before (tick)", sampleStats(queuedMs));
+
+	//Jitter as the change from one frame to the next, which a steady but slow rate does not have
+	for (uint i = 0; i < 2; ++i)
+	{
+		const vector<double>& ms = i == 0 ? frameMs : presentMs;
+		if (ms.size() < 2)
+			continue;
+
+		double meanDelta = 0.0;
+		for (size_t j = 1; j < ms.size(); ++j)
+			meanDelta += fabs(ms[j] - ms[j - 1]) / (ms.size() - 1);
+		double median = sampleStats(ms).p50;
+		uint hitches = (uint)count_if(ms.begin(), ms.end(), [median](double x) { return x > 1.5 * median; });
+		printf("%s jitter: mean |change| %.3f ms, %u over 1.5x the median\n", i == 0 ? "Frame" : "Present", meanDelta, hitches);
+	}
+}
+
+void writeFramePacing(const string& path)
+{
+	ofstream file(path, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+
+	vector<FrameTimes> frames = keptFrames();
+	uint64 first = gFrameCount - frames.size();
+	double origin = frames.empty() ? 0.0 : frames.front().mark[FrameMark::Start];
+
+	file << "frame";
+	for (const char* name : cMarkNames)
+		file << "," << name << "_ms";
+	file << ",input_ms,input_queued_ms\n";
+
+	char value[32];
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		file << first + i;
+		for (double t : frames[i].mark)
+		{
+			value[0] = 0;
+			if (t >= 0.0)
+				snprintf(value, sizeof(value), "%.4f", (t - origin) * 1e3);
+			file << "," << value;
+		}
+		value[0] = 0;
+		if (frames[i].input >= 0.0)
+			snprintf(value, sizeof(value), "%.4f", (frames[i].input - origin) * 1e3);
+		file << "," << value;
+		value[0] = 0;
+		if (frames[i].input >= 0.0)
+			snprintf(value, sizeof(value), "%.0f", frames[i].inputQueued * 1e3);
+		file << "," << value << "\n";
+	}
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "basic_types.h"
+#include <string>
+
+//Points in a frame of the main loop, in the order they happen
+namespace FrameMark
+{
+	enum Type
+	{
+		Start,			//top of the loop
+		UpdateEnd,		//camera and constants updated; input pumped before this is seen
+		TraceEnd,		//the fence after the dispatch and copies has passed
+		ReadbackEnd,	//shootRays returned, denoising included
+		Present,		//Present returned
+
+		Count
+	};
+}
+
+const char* frameMarkName(FrameMark::Type mark);
+
+//Off until enabled, and then a mark is one clock read and a store. Main thread only.
+//The last cFramePacingHistory frames are kept.
+static const uint cFramePacingHistory = 4096;
+
+void setFramePacing(bool enable);
+bool isFramePacing();
+//Start begins a new frame; the other marks go to the current one
+void markFrame(FrameMark::Type mark);
+//An input event handled at time (getCurrentTime's clock) after waiting queued seconds in the
+//message queue. The earliest one since the last UpdateEnd is charged to the next frame, whose
+//present is when it can first be seen. Latency runs from time; queued is reported on its own
+//since it comes from a tick count with 10-16 ms resolution.
+void markInput(double time, double queued);
+
+//Frame time, present interval and stage time distributions, their jitter, and the
+//input-to-present and update-to-present latencies
+void printFramePacing();
+//One line per frame with each mark in ms from the first frame kept
+void writeFramePacing(const std::string& path);
@@ -0,0 +1,365 @@
+#include "FrameStream.h"
+#include "OutputEncoding.h"
+#include "Deflate.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static const uint cAcceptPollMs = 100;
+static const uint cMaxPayloadSize = 64 << 20;
+
+static StreamHeader makeHeader(StreamMessage::Type type, uint width, uint height, uint64 frameId)
+{
+	StreamHeader header = {};
+	header.magic = cStreamMagic;
+	header.type = type;
+	header.width = width;
+	header.height = height;
+	header.frameId = frameId;
+	return header;
+}
+
+static float displayLuminance(uint packed)
+{
+	float3 c = unpackRGB9E5(packed);
+	return sqrtf(0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z);
+}
+
+void FrameStreamServer::start(const StreamSettings& streamSettings)
+{
+	stop();
+
+	settings = streamSettings;
+	if (settings.tileSize == 0)
+		throw Error("The stream tile size must be positive.");
+	if (!listener.listen(settings.port, settings.loopbackOnly))
+		throw Error(("Cannot listen on port " + to_string(settings.port) + ".").c_str());
+
+	running = true;
+	acceptThread = thread(&FrameStreamServer::acceptLoop, this);
+	printf("Streaming on port %u\n", getPort());
+}
+
+void FrameStreamServer::stop()
+{
+	if (!running)
+		return;
+
+	running = false;
+	frameReady.notify_all();
+	acceptThread.join();
+
+	lock_guard<mutex> lock(viewerMutex);
+	for (unique_ptr<Viewer>& viewer : viewers)
+		viewer->worker.join();
+	viewers.clear();
+	listener.close();
+	latest.reset();
+}
+
+uint FrameStreamServer::numViewers()
+{
+	lock_guard<mutex> lock(viewerMutex);
+	return (uint)viewers.size();
+}
+
+void FrameStreamServer::acceptLoop()
+{
+	traceThreadName("stream accept");
+
+	while (running)
+	{
+		TcpSocket client = listener.accept(cAcceptPollMs);
+
+		lock_guard<mutex> lock(viewerMutex);
+		for (auto it = viewers.begin(); it != viewers.end();)
+		{
+			if ((*it)->done)
+			{
+				(*it)->worker.join();
+				it = viewers.erase(it);
+			}
+			else
+				++it;
+		}
+
+		if (client.isOpen())
+		{
+			unique_ptr<Viewer> viewer = make_unique<Viewer>();
+			viewer->socket = move(client);
+			viewer->worker = thread(&FrameStreamServer::serve, this, viewer.get());
+			viewers.push_back(move(viewer));
+		}
+	}
+}
+
+void FrameStreamServer::submit(const TracedResult& frame)
+{
+	if (!running || numViewers() == 0)
+		return;
+
+	shared_ptr<Frame> next = make_shared<Frame>();
+	next->width = frame.width;
+	next->height = frame.height;
+	next->id = latestId + 1;
+	next->pixels.resize(uint64(frame.width) * frame.height);
+
+	if (frame.format == DXGI_FORMAT_R9G9B9E5_SHAREDEXP)
+		memcpy(next->pixels.data(), frame.data, next->pixels.size() * sizeof(uint));
+	else if (frame.format == DXGI_FORMAT_R32G32B32A32_FLOAT)
+		encodeImage(frame, OutputEncoding::RGB9E5, next->pixels.data());
+	else
+	{
+		decodeBuffer.resize(next->pixels.size() * 4);
+		decodeImage(frame, decodeBuffer.data());
+
+		TracedResult decoded = frame;
+		decoded.data = decodeBuffer.data();
+		decoded.pixelSize = 4 * sizeof(float);
+		decoded.format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		encodeImage(decoded, OutputEncoding::RGB9E5, next->pixels.data());
+	}
+
+	{
+		lock_guard<mutex> lock(frameMutex);
+		latest = next;
+		latestId = next->id;
+	}
+	frameReady.notify_all();
+}
+
+bool FrameStreamServer::sendTile(Viewer* viewer, const Frame& frame, uint tileIdx, vector<uint>& sent, vector<uint>& delta, vector<uint8>& compressed)
+{
+	uint tilesX = (frame.width + settings.tileSize - 1) / settings.tileSize;
+	uint x0 = (tileIdx % tilesX) * settings.tileSize;
+	uint y0 = (tileIdx / tilesX) * settings.tileSize;
+	uint tileW = _min(settings.tileSize, frame.width - x0);
+	uint tileH = _min(settings.tileSize, frame.height - y0);
+
+	//Unchanged words XOR to zero, and converging ones differ only in their low mantissa bits
+	delta.resize(uint64(tileW) * tileH);
+	for (uint y = 0; y < tileH; ++y)
+	{
+		uint64 row = uint64(y0 + y) * frame.width + x0;
+		for (uint x = 0; x < tileW; ++x)
+		{
+			delta[y * tileW + x] = frame.pixels[row + x] ^ sent[row + x];
+			sent[row + x] = frame.pixels[row + x];
+		}
+	}
+
+	compressed.clear();
+	zlibCompress((const uint8*)delta.data(), delta.size() * sizeof(uint), compressed);
+
+	StreamHeader header = makeHeader(StreamMessage::Tile, frame.width, frame.height, frame.id);
+	header.x = x0;
+	header.y = y0;
+	header.tileW = tileW;
+	header.tileH = tileH;
+	header.payloadSize = (uint)compressed.size();
+
+	return viewer->socket.send(&header, sizeof(header), running) && viewer->socket.send(compressed.data(), compressed.size(), running);
+}
+
+void FrameStreamServer::serve(Viewer* viewer)
+{
+	traceThreadName("stream viewer");
+
+	StreamHeader hello = makeHeader(StreamMessage::Hello, 0, 0, 0);
+	hello.x = cStreamVersion;
+	hello.tileW = settings.tileSize;
+	if (!viewer->socket.send(&hello, sizeof(hello), running))
+	{
+		viewer->done = true;
+		return;
+	}
+
+	//What the viewer holds; it starts out black like the viewer's own copy
+	vector<uint> sent;
+	uint sentW = 0, sentH = 0;
+	uint64 lastId = 0;
+
+	vector<float> tileChange;
+	vector<uint> order;
+	vector<uint> delta;
+	vector<uint8> compressed;
+
+	auto startTime = chrono::steady_clock::now();
+	uint64 bytesSent = 0;
+
+	while (running)
+	{
+		shared_ptr<const Frame> frame;
+		{
+			unique_lock<mutex> lock(frameMutex);
+			frameReady.wait_for(lock, chrono::milliseconds(cAcceptPollMs), [&]() { return !running || latestId != lastId; });
+			frame = latest;
+		}
+		if (!running)
+			break;
+		if (!frame || frame->id == lastId)
+			continue;
+		lastId = frame->id;
+		TraceScope passScope("stream pass");
+
+		if (frame->width != sentW || frame->height != sentH)
+		{
+			sentW = frame->width;
+			sentH = frame->height;
+			sent.assign(uint64(sentW) * sentH, 0);
+		}
+
+		//Mean change of each tile against what the viewer has, in display units
+		uint tileSize = settings.tileSize;
+		uint tilesX = (sentW + tileSize - 1) / tileSize;
+		uint tilesY = (sentH + tileSize - 1) / tileSize;
+		tileChange.assign(tilesX * tilesY, 0.f);
+		parallelFor(tilesX * tilesY, [&](uint t)
+		{
+			uint x0 = (t % tilesX) * tileSize;
+			uint y0 = (t / tilesX) * tileSize;
+			uint tileW = _min(tileSize, sentW - x0);
+			uint tileH = _min(tileSize, sentH - y0);
+
+			float sum = 0.f;
+			for (uint y = 0; y < tileH; ++y)
+			{
+				uint64 row = uint64(y0 + y) * sentW + x0;
+				for (uint x = 0; x < tileW; ++x)
+					if (frame->pixels[row + x] != sent[row + x])
+						sum += fabsf(displayLuminance(frame->pixels[row + x]) - displayLuminance(sent[row + x]));
+			}
+			tileChange[t] = sum / (tileW * tileH);
+		});
+
+		order.clear();
+		for (uint t = 0; t < tilesX * tilesY; ++t)
+			if (tileChange[t] > settings.minTileChange)
+				order.push_back(t);
+		sort(order.begin(), order.end(), [&](uint a, uint b) { return tileChange[a] > tileChange[b]; });
+
+		//An idle viewer does not save up a burst
+		auto now = chrono::steady_clock::now();
+		if (now > startTime + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(double(bytesSent) / _max(settings.maxBytesPerSecond, 1u))))
+		{
+			startTime = now;
+			bytesSent = 0;
+		}
+
+		//Even a pass with nothing to send ends with FrameEnd, so the viewer knows it is current
+		bool complete = true;
+		for (uint i = 0; i < order.size(); ++i)
+		{
+			if (!sendTile(viewer, *frame, order[i], sent, delta, compressed))
+			{
+				viewer->done = true;
+				return;
+			}
+			bytesSent += sizeof(StreamHeader) + compressed.size();
+
+			if (settings.maxBytesPerSecond > 0)
+			{
+				auto due = startTime + chrono::duration<double>(double(bytesSent) / settings.maxBytesPerSecond);
+				this_thread::sleep_until(chrono::time_point_cast<chrono::steady_clock::duration>(due));
+			}
+
+			//A newer frame reprioritises whatever is left
+			if (latestId != frame->id && i + 1 < order.size())
+			{
+				complete = false;
+				break;
+			}
+		}
+
+		StreamHeader frameEnd = makeHeader(StreamMessage::FrameEnd, frame->width, frame->height, frame->id);
+		frameEnd.x = complete ? 1 : 0;
+		if (!viewer->socket.send(&frameEnd, sizeof(frameEnd), running))
+			break;
+		bytesSent += sizeof(frameEnd);
+	}
+
+	viewer->done = true;
+}
+
+bool FrameStreamClient::connect(const char* host, uint16 port)
+{
+	width = height = 0;
+	frameId = 0;
+	bytesReceived = 0;
+	return socket.connect(host, port);
+}
+
+bool FrameStreamClient::applyTile(const StreamHeader& header, const vector<uint8>& payload)
+{
+	if (header.x >= width || header.y >= height || header.tileW > width - header.x || header.tileH > height - header.y)
+		return false;
+
+	vector<uint8> delta;
+	if (!zlibDecompress(payload.data(), payload.size(), delta) || delta.size() != uint64(header.tileW) * header.tileH * sizeof(uint))
+		return false;
+
+	const uint* words = (const uint*)delta.data();
+	for (uint y = 0; y < header.tileH; ++y)
+	{
+		uint* row = &pixels[uint64(header.y + y) * width + header.x];
+		for (uint x = 0; x < header.tileW; ++x)
+			row[x] ^= words[y * header.tileW + x];
+	}
+	return true;
+}
+
+bool FrameStreamClient::receiveFrame()
+{
+	vector<uint8> payload;
+	for (;;)
+	{
+		StreamHeader header;
+		if (!socket.receive(&header, sizeof(header)) || header.magic != cStreamMagic || header.payloadSize > cMaxPayloadSize)
+			return false;
+
+		payload.resize(header.payloadSize);
+		if (header.payloadSize > 0 && !socket.receive(payload.data(), payload.size()))
+			return false;
+		bytesReceived += sizeof(header) + header.payloadSize;
+
+		if (header.type == StreamMessage::Hello)
+		{
+			if (header.x != cStreamVersion)
+				return false;
+			continue;
+		}
+
+		if (header.width != width || header.height != height)
+		{
+			width = header.width;
+			height = header.height;
+			pixels.assign(uint64(width) * height, 0);
+		}
+
+		if (header.type == StreamMessage::Tile)
+		{
+			if (!applyTile(header, payload))
+				return false;
+		}
+		else if (header.type == StreamMessage::FrameEnd)
+		{
+			frameId = header.frameId;
+			frameComplete = header.x != 0;
+
+			TracedResult packed = { pixels.data(), width, height, sizeof(uint), DXGI_FORMAT_R9G9B9E5_SHAREDEXP };
+			image.resize(pixels.size() * 4);
+			decodeImage(packed, image.data());
+			return true;
+		}
+		else
+			return false;
+	}
+}
+
+TracedResult FrameStreamClient::getFrame() const
+{
+	TracedResult result = { const_cast<float*>(image.data()), width, height, 4 * sizeof(float), DXGI_FORMAT_R32G32B32A32_FLOAT };
+	return result;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include "dxHelper.h"
+#include "Socket.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Wire format, little endian: a StreamHeader, then payloadSize bytes. The server greets with Hello,
+//then sends Tiles whose payload is the zlib-compressed XOR of the tile's RGB9E5 words with the ones
+//sent before, and a FrameEnd after each pass over a frame.
+namespace StreamMessage
+{
+	enum Type
+	{
+		Hello = 1,		//x: protocol version, tileW: tile size
+		Tile,
+		FrameEnd,		//x: 1 if every changed tile was sent, 0 if a newer frame cut the pass short
+
+		Count
+	};
+}
+
+static const uint cStreamMagic = 0x53574f49; //"IOWS"
+static const uint cStreamVersion = 1;
+
+struct StreamHeader
+{
+	uint magic;
+	uint type;
+	uint width;			//frame size; a change starts the viewer over from black
+	uint height;
+	uint x;
+	uint y;
+	uint tileW;
+	uint tileH;
+	uint payloadSize;
+	uint reserved;
+	uint64 frameId;
+};
+
+struct StreamSettings
+{
+	uint16 port = 7420;
+	bool loopbackOnly = true;
+	uint tileSize = 64;
+	uint maxBytesPerSecond = 0;			//per viewer; 0 leaves the pace to TCP
+	float minTileChange = 1.f / 1024.f;	//mean change in display (sqrt) units below which a tile is not resent
+};
+
+//Streams the accumulation to any number of viewers. Each viewer has a thread that keeps its own copy
+//of what it has sent and works through the tiles that differ most from it, so a slow link gets the
+//most visible changes first and blocking sends pace it to the viewer's bandwidth.
+class FrameStreamServer
+{
+	struct Frame
+	{
+		uint width;
+		uint height;
+		uint64 id;
+		vector<uint> pixels;	//RGB9E5
+	};
+
+	struct Viewer
+	{
+		TcpSocket socket;
+		thread worker;
+		atomic<bool> done{ false };
+	};
+
+	StreamSettings settings;
+	TcpSocket listener;
+	thread acceptThread;
+	atomic<bool> running{ false };
+
+	mutex frameMutex;
+	condition_variable frameReady;
+	shared_ptr<const Frame> latest;
+	atomic<uint64> latestId{ 0 };
+	vector<float> decodeBuffer;
+
+	mutex viewerMutex;
+	vector<unique_ptr<Viewer>> viewers;
+
+	void acceptLoop();
+	void serve(Viewer* viewer);
+	bool sendTile(Viewer* viewer, const Frame& frame, uint tileIdx, vector<uint>& sent, vector<uint>& delta, vector<uint8>& compressed);
+
+public:
+	~FrameStreamServer() { stop(); }
+
+	void start(const StreamSettings& settings = StreamSettings());
+	void stop();
+	uint16 getPort() const { return listener.getPort(); }
+	uint numViewers();
+
+	//Snapshots the frame for the viewer threads; does nothing while nobody is connected
+	void submit(const TracedResult& frame);
+};
+
+//Reference viewer: applies the tiles to its copy of the image
+class FrameStreamClient
+{
+	TcpSocket socket;
+	uint width = 0;
+	uint height = 0;
+	vector<uint> pixels;	//RGB9E5
+	vector<float> image;
+	uint64 frameId = 0;
+	bool frameComplete = false;
+	uint64 bytesReceived = 0;
+
+	bool applyTile(const StreamHeader& header, const vector<uint8>& payload);
+
+public:
+	bool connect(const char* host, uint16 port);
+	//Reads until the server ends a pass over a frame; false once the connection is gone or corrupt
+	bool receiveFrame();
+
+	//RGBA32F; valid until the next receiveFrame
+	TracedResult getFrame() const;
+	uint64 getFrameId() const { return frameId; }
+	bool isFrameComplete() const { return frameComplete; }
+	uint64 getBytesReceived() const { return bytesReceived; }
+};
@@ -1,56 +1,87 @@
-uint getNewSeed(uint param1, uint param2, uint numPermutation)
+static const float PI = 3.14159265f;
+
+float luminance(float3 c)
 {
-	uint s0 = 0;
-	uint v0 = param1;
-	uint v1 = param2;
+	return dot(c, float3(0.2126f, 0.7152f, 0.0722f));
+}
 
-	for (uint perm = 0; perm < numPermutation; perm++)
-	{
-		s0 += 0x9e3779b9;
-		v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
-		v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
-	}
+// Counter-based random numbers: every value is a pure function of
+// (pixel, frame, sample, bounce, dimension), so any sample can be regenerated
+// independently of evaluation order. Mirrored bit for bit in basic_random.h.
+struct RngState
+{
+	uint pixel;
+	uint frame;
+	uint sampleIdx;
+	uint bounce;
+	uint dimension;
+};
+
+uint pcgHash(uint v)
+{
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+RngState initRng(uint pixel, uint frame, uint sampleIdx, uint bounce)
+{
+	RngState rng;
+	rng.pixel = pixel;
+	rng.frame = frame;
+	rng.sampleIdx = sampleIdx;
+	rng.bounce = bounce;
+	rng.dimension = 0;
+	return rng;
+}
 
-	return v0;
+uint hashRng(RngState rng)
+{
+	uint h = pcgHash(rng.dimension);
+	h = pcgHash(rng.bounce + h);
+	h = pcgHash(rng.sampleIdx + h);
+	h = pcgHash(rng.frame + h);
+	return pcgHash(rng.pixel + h);
 }
 
-//[0, 1]
-float rand(inout uint seed)
+//[0, 1)
+float rand(inout RngState rng)
 {
-	seed = (1664525u * seed + 1013904223u);
-	return ((float)(seed & 0x00FFFFFF) / (float)0x01000000);
+	uint h = hashRng(rng);
+	rng.dimension++;
+	return float(h >> 8) * (1.f / 16777216.f);
 }
 
-//[min, max]
-float rand(inout uint seed, float min, float max)
+//[min, max)
+float rand(inout RngState rng, float min, float max)
 {
-	return (rand(seed) * (max - min)) + min;
+	return (rand(rng) * (max - min)) + min;
 }
 
-float3 random_in_unit_sphere(inout uint seed)
+float3 random_in_unit_sphere(inout RngState rng)
 {
 	float3 p;
 	do 
 	{
 		p = float3
 			(
-				rand(seed, -1, 1),
-				rand(seed, -1, 1),
-				rand(seed, -1, 1)
+				rand(rng, -1, 1),
+				rand(rng, -1, 1),
+				rand(rng, -1, 1)
 			);
 	} while (dot(p, p) >= 1.0);
 	return p;
 }
 
-float3 random_unit_vector(inout uint seed)
+float3 random_unit_vector(inout RngState rng)
 {
-	float3 v = random_in_unit_sphere(seed);
+	float3 v = random_in_unit_sphere(rng);
 	return normalize(v);
 }
 
-float3 random_in_hemisphere(inout uint seed, float3 normal)
+float3 random_in_hemisphere(inout RngState rng, float3 normal)
 {
-	float3 v = random_in_unit_sphere(seed);
+	float3 v = random_in_unit_sphere(rng);
 	if (dot(v, normal) < 0.0)
 	{
 		v = -v;
@@ -58,11 +89,11 @@ float3 random_in_hemisphere(inout uint seed, float3 normal)
 	return v;
 }
 
-float2 random_in_unit_disk(inout uint seed)
+float2 random_in_unit_disk(inout RngState rng)
 {
 	while (true)
 	{
-		float2 p = float2(rand(seed, -1, 1), rand(seed, -1, 1));
+		float2 p = float2(rand(rng, -1, 1), rand(rng, -1, 1));
 		if (dot(p, p) <= 1.f)
 		{
 			return p;
@@ -0,0 +1,101 @@
+#include "ImageMetrics.h"
+#include <fstream>
+
+//Keeps black reference pixels from dividing by zero
+static const double cRelMSEEpsilon = 0.01;
+
+ImageError compareImages(const TracedResult& image, const TracedResult& reference)
+{
+	if (image.pixelSize != 4 * sizeof(float) || reference.pixelSize != 4 * sizeof(float))
+		throw Error("Image comparison expects RGBA32F pixels.");
+	if (image.width != reference.width || image.height != reference.height)
+		throw Error("Compared images differ in size.");
+
+	const float* a = (const float*)image.data;
+	const float* b = (const float*)reference.data;
+	uint64 numPixels = uint64(image.width) * image.height;
+
+	double sumSq = 0.0;
+	double sumRel = 0.0;
+	double sumRelSq = 0.0;
+	for (uint64 p = 0; p < numPixels; ++p)
+	{
+		double sq = 0.0;
+		double rel = 0.0;
+		for (uint c = 0; c < 3; ++c)
+		{
+			double ref = b[4 * p + c];
+			double d = double(a[4 * p + c]) - ref;
+			sq += d * d;
+			rel += d * d / (ref * ref + cRelMSEEpsilon);
+		}
+		sumSq += sq / 3.0;
+		sumRel += rel / 3.0;
+		sumRelSq += (rel / 3.0) * (rel / 3.0);
+	}
+
+	ImageError e;
+	e.numPixels = (uint)numPixels;
+	if (numPixels == 0)
+		return e;
+
+	e.mse = sumSq / numPixels;
+	e.rmse = sqrt(e.mse);
+	e.relMSE = sumRel / numPixels;
+	double var = sumRelSq / numPixels - e.relMSE * e.relMSE;
+	e.relMSEStdErr = numPixels > 1 ? sqrt(_max(var, 0.0) / (numPixels - 1)) : 0.0;
+	return e;
+}
+
+double costToError(const vector<double>& cost, const vector<double>& relMSE, double target)
+{
+	if (cost.empty() || cost.size() != relMSE.size())
+		return 0.0;
+
+	for (size_t i = 0; i + 1 < cost.size(); ++i)
+	{
+		if (relMSE[i] >= target && relMSE[i + 1] <= target && relMSE[i] > relMSE[i + 1])
+		{
+			double f = log(relMSE[i] / target) / log(relMSE[i] / relMSE[i + 1]);
+			return exp(log(cost[i]) + f * log(cost[i + 1] / cost[i]));
+		}
+	}
+
+	size_t nearest = (relMSE.front() <= target) ? 0 : cost.size() - 1;
+	return cost[nearest] * relMSE[nearest] / target;
+}
+
+void readPFM(const string& path, vector<float>& pixels, uint& width, uint& height)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+		throw Error(("Cannot open " + path).c_str());
+
+	string magic;
+	float scale = 0.f;
+	file >> magic >> width >> height >> scale;
+	file.get();		//the single whitespace before the data
+	if (!file || magic != "PF" || width == 0 || height == 0)
+		throw Error((path + " is not an RGB PFM file.").c_str());
+	if (scale > 0.f)
+		throw Error((path + " is big-endian, which is not supported.").c_str());
+
+	//PFM stores the bottom row first
+	pixels.resize(uint64(width) * height * 4);
+	vector<float> row(uint64(width) * 3);
+	for (uint j = 0; j < height; ++j)
+	{
+		file.read((char*)row.data(), row.size() * sizeof(float));
+		float* dst = &pixels[uint64(height - 1 - j) * width * 4];
+		for (uint i = 0; i < width; ++i)
+		{
+			dst[4 * i + 0] = row[3 * i + 0];
+			dst[4 * i + 1] = row[3 * i + 1];
+			dst[4 * i + 2] = row[3 * i + 2];
+			dst[4 * i + 3] = 1.f;
+		}
+	}
+
+	if (!file)
+		throw Error((path + " is truncated.").c_str());
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "dxHelper.h"
+
+//Error of an RGBA32F image against a reference of the same size, over RGB
+struct ImageError
+{
+	uint numPixels = 0;
+	double mse = 0.0;
+	double rmse = 0.0;
+	//Squared error over the squared reference (plus 0.01), so dark and bright regions count alike
+	double relMSE = 0.0;
+	//Standard error of relMSE as a mean of per-pixel terms; two relMSEs further apart than a few
+	//of these (combined) differ by more than noise
+	double relMSEStdErr = 0.0;
+};
+
+ImageError compareImages(const TracedResult& image, const TracedResult& reference);
+
+//Cost (seconds, rays, frames) at which relMSE falls to target, interpolated on log-log axes between
+//the two points that straddle it. Outside the measured range, error is taken to fall as 1/cost, as
+//unbiased noise does. Points are in order of increasing cost.
+double costToError(const vector<double>& cost, const vector<double>& relMSE, double target);
+
+//Reads a PFM written by writePFM (or any little-endian RGB PFM) into top-down RGBA32F pixels
+void readPFM(const string& path, vector<float>& pixels, uint& width, uint& height);
@@ -0,0 +1,422 @@
+#include "ImageWriter.h"
+#include "Error.h"
+#include "Deflate.h"
+#include "Parallel.h"
+#include "Tonemap.h"
+#include "Trace.h"
+#include <algorithm>
+
+static const uint cEXRLinesPerChunk = 16;		//fixed by the ZIP compression type
+static const uint cPNGLinesPerChunk = 64;
+static const uint cChunksPerBatch = 64;
+
+static const float* pixelRow(const TracedResult& image, uint y)
+{
+	return (const float*)((const uint8*)image.data + uint64(y) * image.width * image.pixelSize);
+}
+
+static void checkImage(const TracedResult& image)
+{
+	if (image.pixelSize != 4 * sizeof(float))
+		throw Error("Image writers expect RGBA32F pixels.");
+}
+
+static ofstream createFile(const string& path)
+{
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+	return file;
+}
+
+static void putLE32(vector<uint8>& out, uint v)
+{
+	for (uint i = 0; i < 4; ++i)
+		out.push_back(uint8(v >> (8 * i)));
+}
+
+static void putBE32(vector<uint8>& out, uint v)
+{
+	for (uint i = 0; i < 4; ++i)
+		out.push_back(uint8(v >> (24 - 8 * i)));
+}
+
+ImageFormat::Type imageFormatFromPath(const string& path)
+{
+	size_t dot = path.find_last_of('.');
+	string ext = dot == string::npos ? "" : path.substr(dot + 1);
+	transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower(c); });
+
+	if (ext == "pfm")
+		return ImageFormat::PFM;
+	if (ext == "exr")
+		return ImageFormat::EXR;
+	if (ext == "png")
+		return ImageFormat::PNG;
+
+	throw Error(("Unknown image extension: " + path).c_str());
+}
+
+void writePFM(const string& path, const TracedResult& image)
+{
+	checkImage(image);
+	ofstream file = createFile(path);
+
+	string header = "PF\n" + to_string(image.width) + " " + to_string(image.height) + "\n-1.0\n";
+	file.write(header.data(), header.size());
+
+	//PFM stores the bottom row first
+	vector<float> row(image.width * 3);
+	for (uint j = 0; j < image.height; ++j)
+	{
+		const float* src = pixelRow(image, image.height - 1 - j);
+		for (uint i = 0; i < image.width; ++i)
+		{
+			row[i * 3 + 0] = src[i * 4 + 0];
+			row[i * 3 + 1] = src[i * 4 + 1];
+			row[i * 3 + 2] = src[i * 4 + 2];
+		}
+		file.write((const char*)row.data(), row.size() * sizeof(float));
+	}
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
+
+static void putAttribute(vector<uint8>& out, const char* name, const char* type, const vector<uint8>& value)
+{
+	out.insert(out.end(), name, name + strlen(name) + 1);
+	out.insert(out.end(), type, type + strlen(type) + 1);
+	putLE32(out, (uint)value.size());
+	out.insert(out.end(), value.begin(), value.end());
+}
+
+//One ZIP chunk: planar B, G, R float lines, bytes split into two halves, delta coded, then zlib
+static void compressEXRChunk(const TracedResult& image, uint y0, uint numLines, vector<uint8>& out)
+{
+	uint64 lineSize = uint64(image.width) * 3 * sizeof(float);
+	vector<uint8> raw(lineSize * numLines);
+	uint8* dst = raw.data();
+	for (uint y = y0; y < y0 + numLines; ++y)
+	{
+		const float* src = pixelRow(image, y);
+		for (int c = 2; c >= 0; --c)
+		{
+			for (uint i = 0; i < image.width; ++i)
+			{
+				memcpy(dst, &src[i * 4 + c], sizeof(float));
+				dst += sizeof(float);
+			}
+		}
+	}
+
+	vector<uint8> tmp(raw.size());
+	uint64 half = (raw.size() + 1) / 2;
+	for (uint64 i = 0; i < raw.size(); ++i)
+		tmp[(i & 1) ? half + i / 2 : i / 2] = raw[i];
+
+	for (uint64 i = tmp.size() - 1; i > 0; --i)
+		tmp[i] = uint8(int(tmp[i]) - int(tmp[i - 1]) + 128);
+
+	vector<uint8> compressed;
+	zlibCompress(tmp.data(), tmp.size(), compressed);
+
+	//Readers take a chunk that did not shrink as stored
+	const vector<uint8>& payload = compressed.size() < raw.size() ? compressed : raw;
+	putLE32(out, y0);
+	putLE32(out, (uint)payload.size());
+	out.insert(out.end(), payload.begin(), payload.end());
+}
+
+void writeEXR(const string& path, const TracedResult& image)
+{
+	checkImage(image);
+	ofstream file = createFile(path);
+
+	vector<uint8> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+
+	vector<uint8> channels;
+	for (const char* name : { "B", "G", "R" })
+	{
+		channels.insert(channels.end(), name, name + 2);
+		putLE32(channels, 2);		//FLOAT
+		putLE32(channels, 0);		//pLinear + reserved
+		putLE32(channels, 1);		//xSampling
+		putLE32(channels, 1);		//ySampling
+	}
+	channels.push_back(0);
+	putAttribute(header, "channels", "chlist", channels);
+
+	putAttribute(header, "compression", "compression", { 3 });		//ZIP
+
+	vector<uint8> window;
+	putLE32(window, 0);
+	putLE32(window, 0);
+	putLE32(window, image.width - 1);
+	putLE32(window, image.height - 1);
+	putAttribute(header, "dataWindow", "box2i", window);
+	putAttribute(header, "displayWindow", "box2i", window);
+
+	putAttribute(header, "lineOrder", "lineOrder", { 0 });			//increasing y
+
+	vector<uint8> value;
+	float one = 1.f;
+	uint oneBits;
+	memcpy(&oneBits, &one, sizeof(float));
+	putLE32(value, oneBits);
+	putAttribute(header, "pixelAspectRatio", "float", value);
+	putAttribute(header, "screenWindowWidth", "float", value);
+
+	putAttribute(header, "screenWindowCenter", "v2f", vector<uint8>(8, 0));
+	header.push_back(0);
+
+	file.write((const char*)header.data(), header.size());
+
+	//The offset table is patched once every chunk's size is known
+	uint numChunks = (image.height + cEXRLinesPerChunk - 1) / cEXRLinesPerChunk;
+	vector<uint64> offsetArr(numChunks, 0);
+	uint64 tableOffset = header.size();
+	file.write((const char*)offsetArr.data(), offsetArr.size() * sizeof(uint64));
+	uint64 offset = tableOffset + offsetArr.size() * sizeof(uint64);
+
+	vector<vector<uint8>> batch;
+	for (uint first = 0; first < numChunks; first += cChunksPerBatch)
+	{
+		uint count = min(cChunksPerBatch, numChunks - first);
+		batch.assign(count, vector<uint8>());
+
+		parallelFor(count, [&](uint i)
+		{
+			uint y0 = (first + i) * cEXRLinesPerChunk;
+			compressEXRChunk(image, y0, min(cEXRLinesPerChunk, image.height - y0), batch[i]);
+		});
+
+		for (uint i = 0; i < count; ++i)
+		{
+			offsetArr[first + i] = offset;
+			file.write((const char*)batch[i].data(), batch[i].size());
+			offset += batch[i].size();
+		}
+	}
+
+	file.seekp(tableOffset);
+	file.write((const char*)offsetArr.data(), offsetArr.size() * sizeof(uint64));
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
+
+static void writePNGChunk(ofstream& file, const char* type, const vector<uint8>& data)
+{
+	vector<uint8> chunk;
+	putBE32(chunk, (uint)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	putBE32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+	file.write((const char*)chunk.data(), chunk.size());
+}
+
+void writePNG(const string& path, const TracedResult& image)
+{
+	checkImage(image);
+	ofstream file = createFile(path);
+
+	const uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file.write((const char*)signature, sizeof(signature));
+
+	vector<uint8> ihdr;
+	putBE32(ihdr, image.width);
+	putBE32(ihdr, image.height);
+	ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 });		//8-bit RGB, deflate, adaptive filtering, no interlace
+	writePNGChunk(file, "IHDR", ihdr);
+
+	//Each chunk of scanlines is deflated on its own and ends byte aligned, so the
+	//compressed chunks join into a single zlib stream; their Adler-32s are combined.
+	uint64 rowSize = 1 + uint64(image.width) * 3;
+	uint numChunks = (image.height + cPNGLinesPerChunk - 1) / cPNGLinesPerChunk;
+	uint adler = 1;
+
+	vector<vector<uint8>> batch;
+	vector<uint> adlerArr;
+	for (uint first = 0; first < numChunks; first += cChunksPerBatch)
+	{
+		uint count = min(cChunksPerBatch, numChunks - first);
+		batch.assign(count, vector<uint8>());
+		adlerArr.assign(count, 1);
+
+		parallelFor(count, [&](uint i)
+		{
+			uint y0 = (first + i) * cPNGLinesPerChunk;
+			uint numLines = min(cPNGLinesPerChunk, image.height - y0);
+
+			//Up filter; the row above the chunk is converted again rather than shared
+			uint firstRow = y0 > 0 ? y0 - 1 : 0;
+			uint64 rgbaPitch = uint64(image.width) * 4;
+			vector<uint8> rgba(rgbaPitch * (y0 + numLines - firstRow));
+			tonemapRows(image, firstRow, y0 + numLines - firstRow, rgba.data(), rgbaPitch);
+
+			vector<uint8> zeroRow(rgbaPitch, 0);
+			vector<uint8> filtered(rowSize * numLines);
+			for (uint j = 0; j < numLines; ++j)
+			{
+				const uint8* cur = &rgba[(y0 + j - firstRow) * rgbaPitch];
+				const uint8* prev = y0 + j > 0 ? cur - rgbaPitch : zeroRow.data();
+
+				uint8* dst = &filtered[j * rowSize];
+				dst[0] = 2;
+				for (uint x = 0; x < image.width; ++x)
+					for (uint c = 0; c < 3; ++c)
+						dst[1 + x * 3 + c] = uint8(cur[x * 4 + c] - prev[x * 4 + c]);
+			}
+
+			adlerArr[i] = adler32(filtered.data(), filtered.size());
+			deflateChunk(filtered.data(), filtered.size(), first + i + 1 == numChunks, batch[i]);
+		});
+
+		vector<uint8> idat;
+		if (first == 0)
+		{
+			idat.push_back(0x78);
+			idat.push_back(0x01);
+		}
+
+		for (uint i = 0; i < count; ++i)
+		{
+			uint y0 = (first + i) * cPNGLinesPerChunk;
+			uint numLines = min(cPNGLinesPerChunk, image.height - y0);
+			adler = adler32Combine(adler, adlerArr[i], rowSize * numLines);
+			idat.insert(idat.end(), batch[i].begin(), batch[i].end());
+		}
+
+		if (first + count == numChunks)
+			putBE32(idat, adler);
+
+		writePNGChunk(file, "IDAT", idat);
+	}
+
+	writePNGChunk(file, "IEND", {});
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
+
+void writeImage(const string& path, const TracedResult& image)
+{
+	switch (imageFormatFromPath(path))
+	{
+	case ImageFormat::PFM:
+		writePFM(path, image);
+		break;
+	case ImageFormat::EXR:
+		writeEXR(path, image);
+		break;
+	case ImageFormat::PNG:
+		writePNG(path, image);
+		break;
+	default:
+		break;
+	}
+}
+
+bool AsyncImageWriter::writeAsync(const vector<string>& paths, const TracedResult& image)
+{
+	if (busy)
+		return false;
+
+	if (worker.joinable())
+		worker.join();
+
+	//Fail on a bad extension here rather than on the worker
+	for (const string& path : paths)
+		imageFormatFromPath(path);
+
+	uint64 size = uint64(image.width) * image.height * image.pixelSize;
+	pixelCopy.resize(size);
+	memcpy(pixelCopy.data(), image.data, size);
+
+	TracedResult copy = image;
+	copy.data = pixelCopy.data();
+
+	busy = true;
+	worker = thread([this, paths, copy]()
+	{
+		traceThreadName("image writer");
+		TraceScope scope("writeImage");
+
+		for (const string& path : paths)
+		{
+			try
+			{
+				writeImage(path, copy);
+				printf("Saved %s\n", path.c_str());
+			}
+			catch (Error&)
+			{
+			}
+		}
+		busy = false;
+	});
+
+	return true;
+}
+
+void AsyncImageWriter::wait()
+{
+	if (worker.joinable())
+		worker.join();
+}
+
+void PFMTileWriter::open(const string& path, uint width, uint height)
+{
+	this->width = width;
+	this->height = height;
+
+	file.open(path, ios::binary | ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+
+	string header = "PF\n" + to_string(width) + " " + to_string(height) + "\n-1.0\n";
+	file.write(header.data(), header.size());
+	dataOffset = header.size();
+
+	//Reserve the whole image so later tiles can land anywhere
+	uint64 dataSize = uint64(width) * height * 3 * sizeof(float);
+	if (dataSize > 0)
+	{
+		file.seekp(dataOffset + dataSize - 1);
+		file.put(0);
+	}
+
+	if (!file)
+		throw Error(("Cannot reserve space for " + path).c_str());
+}
+
+void PFMTileWriter::writeTile(uint x, uint y, uint tileW, uint tileH, const void* pixels, uint64 rowPitch)
+{
+	assert(x + tileW <= width && y + tileH <= height);
+
+	rowBuffer.resize(tileW * 3);
+	for (uint j = 0; j < tileH; ++j)
+	{
+		const float* src = (const float*)((const uint8*)pixels + j * rowPitch);
+		for (uint i = 0; i < tileW; ++i)
+		{
+			rowBuffer[i * 3 + 0] = src[i * 4 + 0];
+			rowBuffer[i * 3 + 1] = src[i * 4 + 1];
+			rowBuffer[i * 3 + 2] = src[i * 4 + 2];
+		}
+
+		//PFM stores the bottom row first
+		uint fileRow = height - 1 - (y + j);
+		file.seekp(dataOffset + (uint64(fileRow) * width + x) * 3 * sizeof(float));
+		file.write((const char*)rowBuffer.data(), rowBuffer.size() * sizeof(float));
+	}
+
+	if (!file)
+		throw Error("Failed to write image tile.");
+}
+
+void PFMTileWriter::close()
+{
+	file.close();
+}
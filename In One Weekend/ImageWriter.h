@@ -0,0 +1,60 @@
+#pragma once
+#include "dxHelper.h"
+#include <fstream>
+#include <thread>
+#include <atomic>
+
+namespace ImageFormat
+{
+	enum Type
+	{
+		PFM,	//float RGB, uncompressed
+		EXR,	//float RGB, ZIP-compressed 16-scanline chunks
+		PNG,	//8-bit RGB with the display's sqrt gamma
+
+		Count
+	};
+}
+
+ImageFormat::Type imageFormatFromPath(const string& path);
+
+//TracedResult holds linear RGBA32F radiance. Scanlines are converted and compressed in
+//batches of chunks spread over all cores, and each batch is written out as soon as it is done.
+void writePFM(const string& path, const TracedResult& image);
+void writeEXR(const string& path, const TracedResult& image);
+void writePNG(const string& path, const TracedResult& image);
+//Picks the format from the extension
+void writeImage(const string& path, const TracedResult& image);
+
+//Saves on a worker thread so the render loop keeps going
+class AsyncImageWriter
+{
+	thread worker;
+	atomic<bool> busy{ false };
+	vector<uint8> pixelCopy;
+
+public:
+	~AsyncImageWriter() { wait(); }
+
+	bool isBusy() const { return busy; }
+	//Copies the image and writes it to every path; false if the previous save is still running
+	bool writeAsync(const vector<string>& paths, const TracedResult& image);
+	void wait();
+};
+
+//Writes a float PFM whose pixels arrive as tiles in any order. The file is sized up front and each
+//tile row is written in place, so memory use does not depend on the image size.
+class PFMTileWriter
+{
+	ofstream file;
+	uint width = 0;
+	uint height = 0;
+	uint64 dataOffset = 0;
+	vector<float> rowBuffer;
+
+public:
+	void open(const string& path, uint width, uint height);
+	//pixels holds tileW x tileH float4s, rowPitch bytes apart
+	void writeTile(uint x, uint y, uint tileW, uint tileH, const void* pixels, uint64 rowPitch);
+	void close();
+};
@@ -0,0 +1,123 @@
+#include "LightSampler.h"
+#include "Error.h"
+#include "Trace.h"
+
+//Vose's alias method: O(n) build, O(1) sampling.
+void buildAliasTable(const vector<float>& weights, vector<AliasEntry>& table)
+{
+	uint n = (uint)weights.size();
+	table.resize(n);
+
+	double sum = 0.0;
+	for (float w : weights)
+		sum += w;
+
+	if (n == 0 || sum <= 0.0)
+		throw Error("Alias table needs at least one positive weight.");
+
+	vector<double> scaled(n);
+	vector<uint> small, large;
+	for (uint i = 0; i < n; ++i)
+	{
+		scaled[i] = weights[i] * n / sum;
+		if (scaled[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		uint s = small.back();
+		small.pop_back();
+		uint l = large.back();
+		large.pop_back();
+
+		table[s].prob = (float)scaled[s];
+		table[s].alias = l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0)
+			small.push_back(l);
+		else
+			large.push_back(l);
+	}
+
+	//Leftovers are 1 up to rounding error
+	for (uint i : large)
+	{
+		table[i].prob = 1.f;
+		table[i].alias = i;
+	}
+	for (uint i : small)
+	{
+		table[i].prob = 1.f;
+		table[i].alias = i;
+	}
+}
+
+void LightSampler::build(const Scene* scene)
+{
+	TraceScope scope("LightSampler::build");
+
+	lightArr.clear();
+	aliasArr.clear();
+	totalPower = 0.f;
+
+	const vector<Vertex>& vtxArr = scene->getVertexArray();
+	const vector<Tridex>& tdxArr = scene->getTridexArray();
+	const vector<Material>& mtlArr = scene->getMaterialArray();
+
+	vector<float> powerArr;
+
+	for (uint objIdx = 0; objIdx < scene->numObjects(); ++objIdx)
+	{
+		const SceneObject& obj = scene->getObject(objIdx);
+		const Material& mtl = mtlArr[obj.materialIdx];
+
+		if (mtl.type != MaterialType::Emissive)
+			continue;
+
+		float radiance = luminance(mtl.emittance);
+		if (radiance <= 0.f)
+			continue;
+
+		for (uint i = 0; i < obj.numTridices; ++i)
+		{
+			const Tridex& tdx = tdxArr[obj.tridexOffset + i];
+			const Vertex& v0 = vtxArr[obj.vertexOffset + tdx.x];
+			const Vertex& v1 = vtxArr[obj.vertexOffset + tdx.y];
+			const Vertex& v2 = vtxArr[obj.vertexOffset + tdx.z];
+			float3 p0 = transformPoint(obj.modelMatrix, v0.position);
+			float3 p1 = transformPoint(obj.modelMatrix, v1.position);
+			float3 p2 = transformPoint(obj.modelMatrix, v2.position);
+
+			float3 n = cross(p1 - p0, p2 - p0);
+			float doubleArea = length(n);
+			if (doubleArea <= 0.f)
+				continue;
+
+			//closestHit shades with vertex normals, so the emitting side follows them rather than the winding
+			float3 shadingNormal = transformVector(obj.modelMatrix, v0.normal + v1.normal + v2.normal);
+			if (dot(n, shadingNormal) < 0.f)
+				n = -n;
+
+			LightTriangle light;
+			light.p0 = p0;
+			light.edge1 = p1 - p0;
+			light.edge2 = p2 - p0;
+			light.normal = n / doubleArea;
+			light.emittance = mtl.emittance;
+			light.area = 0.5f * doubleArea;
+			lightArr.push_back(light);
+
+			//Emitters are one-sided, so power is proportional to radiance * area
+			float power = radiance * light.area;
+			powerArr.push_back(power);
+			totalPower += power;
+		}
+	}
+
+	if (!lightArr.empty())
+		buildAliasTable(powerArr, aliasArr);
+}
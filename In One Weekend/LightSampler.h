@@ -0,0 +1,37 @@
+#pragma once
+#include "Scene.h"
+
+//Matches LightTriangle in DXRShader.hlsl
+struct LightTriangle
+{
+	float3 p0;
+	float3 edge1;
+	float3 edge2;
+	float3 normal;
+	float3 emittance;
+	float area;
+};
+
+//Matches AliasEntry in DXRShader.hlsl
+struct AliasEntry
+{
+	float prob;
+	uint alias;
+};
+
+void buildAliasTable(const vector<float>& weights, vector<AliasEntry>& table);
+
+class LightSampler
+{
+	vector<LightTriangle> lightArr;
+	vector<AliasEntry> aliasArr;
+	float totalPower = 0.f;
+
+public:
+	void build(const Scene* scene);
+
+	const vector<LightTriangle>& getLightArray() const { return lightArr; }
+	const vector<AliasEntry>& getAliasTable() const { return aliasArr; }
+	uint numLights() const { return (uint)lightArr.size(); }
+	float getTotalPower() const { return totalPower; }
+};
@@ -0,0 +1,36 @@
+#include "MemoryCheck.h"
+#include "Scene.h"
+
+//The counters themselves, then a scene's arrays coming and going
+uint checkMemory()
+{
+	uint failures = checkMemoryStats();
+
+	MemoryStats host = memoryStats(MemoryHeap::Host);
+	SceneLoader loader;
+	Scene* scene = loader.push_CornellBox();
+	if (memoryStats(MemoryHeap::Host).current <= host.current)
+	{
+		printf("FAILED: a scene is counted on the host heap\n");
+		failures++;
+	}
+
+	scene->clear();
+	for (MemoryTag::Type tag : { MemoryTag::SceneVertices, MemoryTag::SceneTridices, MemoryTag::SceneMaterials, MemoryTag::SceneObjects })
+	{
+		if (memoryStats(tag).current != 0)
+		{
+			printf("FAILED: Scene::clear leaves %llu bytes of %s\n", (unsigned long long)memoryStats(tag).current, memoryTagName(tag));
+			failures++;
+		}
+	}
+	delete scene;
+	if (memoryStats(MemoryHeap::Host).current != host.current)
+	{
+		printf("FAILED: the host heap does not return to where it was after the scene\n");
+		failures++;
+	}
+
+	printf("Memory accounting: %u check%s failed\n", failures, failures == 1 ? "" : "s");
+	return failures;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include "basic_types.h"
+
+//checkMemoryStats, then a Cornell box built, cleared and deleted: its arrays must be counted on the
+//host heap while they exist and given back by Scene::clear. Prints each failed check and the total,
+//and returns how many failed. Needs only the scene code, so it also runs from SelfTest.
+uint checkMemory();
@@ -0,0 +1,250 @@
+#include "MemoryStats.h"
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <stdio.h>
+
+//Only the standard library here, so host accounting builds and checks anywhere
+
+struct TagInfo
+{
+	const char* name;
+	MemoryHeap::Type heap;
+};
+
+static const TagInfo cTagInfo[MemoryTag::Count] = {
+	{ "scene vertices", MemoryHeap::Host },
+	{ "scene tridices", MemoryHeap::Host },
+	{ "scene materials", MemoryHeap::Host },
+	{ "scene objects", MemoryHeap::Host },
+	{ "meshes", MemoryHeap::Host },
+	{ "scene buffers", MemoryHeap::Device },
+	{ "scene upload", MemoryHeap::Device },
+	{ "BLAS", MemoryHeap::Device },
+	{ "TLAS", MemoryHeap::Device },
+	{ "AS scratch", MemoryHeap::Device },
+	{ "AS instances", MemoryHeap::Device },
+	{ "tracer output", MemoryHeap::Device },
+	{ "history", MemoryHeap::Device },
+	{ "readback", MemoryHeap::Device },
+	{ "path guide", MemoryHeap::Device },
+	{ "shader tables", MemoryHeap::Device },
+	{ "environment map", MemoryHeap::Device },
+	{ "screen texture", MemoryHeap::Device },
+	{ "screen uploader", MemoryHeap::Device },
+	{ "ray stats", MemoryHeap::Device },
+	{ "other", MemoryHeap::Device },
+};
+
+static const char* cHeapNames[MemoryHeap::Count] = { "host", "device" };
+
+struct Counter
+{
+	std::atomic<uint64_t> current{ 0 };
+	std::atomic<uint64_t> peak{ 0 };
+	std::atomic<uint64_t> allocations{ 0 };
+
+	void add(uint64_t bytes)
+	{
+		uint64_t now = current.fetch_add(bytes) + bytes;
+		uint64_t seen = peak.load();
+		while (now > seen && !peak.compare_exchange_weak(seen, now))
+			;
+		allocations++;
+	}
+	void sub(uint64_t bytes)
+	{
+		current.fetch_sub(bytes);
+	}
+	MemoryStats stats() const
+	{
+		return { current.load(), peak.load(), allocations.load() };
+	}
+};
+
+static Counter gTagCounters[MemoryTag::Count];
+static Counter gHeapCounters[MemoryHeap::Count];
+
+const char* memoryTagName(MemoryTag::Type tag)
+{
+	return cTagInfo[tag].name;
+}
+
+MemoryHeap::Type memoryTagHeap(MemoryTag::Type tag)
+{
+	return cTagInfo[tag].heap;
+}
+
+void trackAlloc(MemoryTag::Type tag, uint64_t bytes)
+{
+	gTagCounters[tag].add(bytes);
+	gHeapCounters[cTagInfo[tag].heap].add(bytes);
+}
+
+void trackFree(MemoryTag::Type tag, uint64_t bytes)
+{
+	gTagCounters[tag].sub(bytes);
+	gHeapCounters[cTagInfo[tag].heap].sub(bytes);
+}
+
+MemoryStats memoryStats(MemoryTag::Type tag)
+{
+	return gTagCounters[tag].stats();
+}
+
+MemoryStats memoryStats(MemoryHeap::Type heap)
+{
+	return gHeapCounters[heap].stats();
+}
+
+void resetMemoryPeaks()
+{
+	for (Counter& c : gTagCounters)
+		c.peak = c.current.load();
+	for (Counter& c : gHeapCounters)
+		c.peak = c.current.load();
+}
+
+static double toMB(uint64_t bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
+
+void printMemoryReport()
+{
+	for (unsigned h = 0; h < MemoryHeap::Count; ++h)
+	{
+		MemoryStats heap = memoryStats((MemoryHeap::Type)h);
+		printf("Memory, %s: %.2f MB now, %.2f MB peak\n", cHeapNames[h], toMB(heap.current), toMB(heap.peak));
+
+		std::vector<unsigned> tags;
+		for (unsigned t = 0; t < MemoryTag::Count; ++t)
+			if (cTagInfo[t].heap == h && gTagCounters[t].allocations > 0)
+				tags.push_back(t);
+		std::sort(tags.begin(), tags.end(), [](unsigned a, unsigned b) { return gTagCounters[a].peak > gTagCounters[b].peak; });
+
+		for (unsigned t : tags)
+		{
+			MemoryStats s = memoryStats((MemoryTag::Type)t);
+			printf("  %-16s %10.2f MB now %10.2f MB peak %6.1f%% of heap peak %8llu allocations\n", cTagInfo[t].name,
+				toMB(s.current), toMB(s.peak), heap.peak > 0 ? 100.0 * s.peak / heap.peak : 0.0, (unsigned long long)s.allocations);
+		}
+	}
+}
+
+void writeMemoryReport(const std::string& path)
+{
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+
+	std::ofstream file(path, std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("Cannot create " + path);
+
+	char line[256];
+	if (json)
+		file << "{\n\t\"tags\": [";
+	else
+		file << "tag,heap,current_bytes,peak_bytes,allocations\n";
+
+	for (unsigned t = 0; t < MemoryTag::Count; ++t)
+	{
+		MemoryStats s = memoryStats((MemoryTag::Type)t);
+		if (json)
+			snprintf(line, sizeof(line), "%s\n\t\t{ \"tag\": \"%s\", \"heap\": \"%s\", \"current\": %llu, \"peak\": %llu, \"allocations\": %llu }",
+				t > 0 ? "," : "", cTagInfo[t].name, cHeapNames[cTagInfo[t].heap],
+				(unsigned long long)s.current, (unsigned long long)s.peak, (unsigned long long)s.allocations);
+		else
+			snprintf(line, sizeof(line), "%s,%s,%llu,%llu,%llu\n", cTagInfo[t].name, cHeapNames[cTagInfo[t].heap],
+				(unsigned long long)s.current, (unsigned long long)s.peak, (unsigned long long)s.allocations);
+		file << line;
+	}
+
+	if (json)
+	{
+		file << "\n\t],\n\t\"heaps\": [";
+		for (unsigned h = 0; h < MemoryHeap::Count; ++h)
+		{
+			MemoryStats s = memoryStats((MemoryHeap::Type)h);
+			snprintf(line, sizeof(line), "%s\n\t\t{ \"heap\": \"%s\", \"current\": %llu, \"peak\": %llu }",
+				h > 0 ? "," : "", cHeapNames[h], (unsigned long long)s.current, (unsigned long long)s.peak);
+			file << line;
+		}
+		file << "\n\t]\n}\n";
+	}
+	else
+	{
+		for (unsigned h = 0; h < MemoryHeap::Count; ++h)
+		{
+			MemoryStats s = memoryStats((MemoryHeap::Type)h);
+			snprintf(line, sizeof(line), "total,%s,%llu,%llu,%llu\n", cHeapNames[h],
+				(unsigned long long)s.current, (unsigned long long)s.peak, (unsigned long long)s.allocations);
+			file << line;
+		}
+	}
+
+	if (!file)
+		throw std::runtime_error("Failed to write " + path);
+}
+
+static unsigned gCheckFailures = 0;
+
+static void check(bool ok, const char* what)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s\n", what);
+		gCheckFailures++;
+	}
+}
+
+unsigned checkMemoryStats()
+{
+	gCheckFailures = 0;
+	const MemoryTag::Type tag = MemoryTag::Other;
+	const MemoryHeap::Type heap = memoryTagHeap(tag);
+	MemoryStats tag0 = memoryStats(tag);
+	MemoryStats heap0 = memoryStats(heap);
+
+	trackAlloc(tag, 1000);
+	trackAlloc(tag, 500);
+	check(memoryStats(tag).current == tag0.current + 1500, "allocations add to the tag");
+	check(memoryStats(heap).current == heap0.current + 1500, "allocations add to the heap");
+	check(memoryStats(tag).allocations == tag0.allocations + 2, "allocations are counted");
+	trackFree(tag, 1000);
+	trackFree(tag, 500);
+	check(memoryStats(tag).current == tag0.current, "frees balance allocations");
+	check(memoryStats(heap).current == heap0.current, "frees balance the heap");
+	check(memoryStats(tag).peak >= tag0.current + 1500, "peak holds the most held at once");
+
+	resetMemoryPeaks();
+	check(memoryStats(tag).peak == memoryStats(tag).current, "resetMemoryPeaks restarts the peak from now");
+	check(memoryStats(heap).peak == memoryStats(heap).current, "resetMemoryPeaks restarts the heap peak");
+	trackAlloc(tag, 300);
+	trackFree(tag, 300);
+	check(memoryStats(tag).peak == tag0.current + 300, "peak after a reset");
+
+	{
+		TrackedBytes a(tag);
+		a.set(4096);
+		a.set(1024);
+		check(memoryStats(tag).current == tag0.current + 1024, "TrackedBytes::set shrinks");
+
+		TrackedBytes b(a);
+		check(b.get() == 1024 && memoryStats(tag).current == tag0.current + 2048, "a copy counts its own bytes");
+
+		TrackedBytes c(std::move(b));
+		check(b.get() == 0 && c.get() == 1024 && memoryStats(tag).current == tag0.current + 2048, "a move hands the bytes over");
+
+		TrackedBytes d(tag);
+		d.set(10);
+		d = a;
+		check(d.get() == 1024 && memoryStats(tag).current == tag0.current + 3072, "copy assignment replaces the old size");
+		d = std::move(c);
+		check(c.get() == 0 && d.get() == 1024 && memoryStats(tag).current == tag0.current + 2048, "move assignment frees the old size");
+	}
+	check(memoryStats(tag).current == tag0.current, "TrackedBytes gives everything back when destroyed");
+
+	return gCheckFailures;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+namespace MemoryHeap
+{
+	enum Type
+	{
+		Host,
+		Device,		//D3D12 resources, upload and readback heaps included
+
+		Count
+	};
+}
+
+namespace MemoryTag
+{
+	enum Type
+	{
+		SceneVertices,
+		SceneTridices,
+		SceneMaterials,
+		SceneObjects,
+		Meshes,				//Mesh objects the scene is assembled from
+		SceneBuffers,		//GPU copies of the scene, light tables included
+		SceneUpload,		//staging for SceneBuffers
+		BLAS,
+		TLAS,
+		ASScratch,
+		ASInstances,
+		TracerOutput,		//radiance, encoded output and AOVs
+		History,			//reprojection history and geometry
+		Readback,
+		PathGuide,
+		ShaderTables,
+		EnvironmentMap,
+		ScreenTexture,
+		ScreenUploader,
+		RayStats,			//ray counters and the zeros they are reset from
+		Other,
+
+		Count
+	};
+}
+
+const char* memoryTagName(MemoryTag::Type tag);
+MemoryHeap::Type memoryTagHeap(MemoryTag::Type tag);
+
+struct MemoryStats
+{
+	uint64_t current;
+	uint64_t peak;
+	uint64_t allocations;		//ever made
+};
+
+//Thread-safe counters; every trackAlloc must be matched by a trackFree of the same tag and size
+void trackAlloc(MemoryTag::Type tag, uint64_t bytes);
+void trackFree(MemoryTag::Type tag, uint64_t bytes);
+
+MemoryStats memoryStats(MemoryTag::Type tag);
+//Peak is the most the heap held at once, not the sum of its tags' peaks
+MemoryStats memoryStats(MemoryHeap::Type heap);
+//Peaks restart from what is held now
+void resetMemoryPeaks();
+
+//Current and peak per tag and heap, largest first
+void printMemoryReport();
+//CSV, or JSON for a .json path; throws std::runtime_error if the file cannot be written
+void writeMemoryReport(const std::string& path);
+
+//One tagged size owned by an object, given back when it goes; copies count their own
+class TrackedBytes
+{
+	MemoryTag::Type tag;
+	uint64_t bytes = 0;
+
+public:
+	explicit TrackedBytes(MemoryTag::Type tag) : tag(tag) {}
+	TrackedBytes(const TrackedBytes& other) : tag(other.tag) { set(other.bytes); }
+	TrackedBytes(TrackedBytes&& other) : tag(other.tag), bytes(other.bytes) { other.bytes = 0; }
+	TrackedBytes& operator=(const TrackedBytes& other)
+	{
+		set(other.bytes);
+		return *this;
+	}
+	TrackedBytes& operator=(TrackedBytes&& other)
+	{
+		set(0);
+		bytes = other.bytes;
+		other.bytes = 0;
+		return *this;
+	}
+	~TrackedBytes() { set(0); }
+
+	void set(uint64_t newBytes)
+	{
+		if (newBytes > bytes)
+			trackAlloc(tag, newBytes - bytes);
+		else if (newBytes < bytes)
+			trackFree(tag, bytes - newBytes);
+		bytes = newBytes;
+	}
+	uint64_t get() const { return bytes; }
+};
+
+//Self-test of the counters, peaks and TrackedBytes; prints each failed check and returns how many
+//failed. Works on deltas, so it can run while other memory is tracked, but not concurrently with it.
+unsigned checkMemoryStats();
+
+//What a vector holds on the heap
+template<typename Vector>
+inline uint64_t vectorBytes(const Vector& v)
+{
+	return uint64_t(v.capacity()) * sizeof(typename Vector::value_type);
+}
@@ -0,0 +1,117 @@
+#include "OutputEncoding.h"
+#include "Parallel.h"
+
+DXGI_FORMAT encodingFormat(OutputEncoding::Type encoding)
+{
+	switch (encoding)
+	{
+	case OutputEncoding::RGBA32F:
+		return DXGI_FORMAT_R32G32B32A32_FLOAT;
+	case OutputEncoding::RGBA16F:
+		return DXGI_FORMAT_R16G16B16A16_FLOAT;
+	case OutputEncoding::RGB9E5:
+		return DXGI_FORMAT_R9G9B9E5_SHAREDEXP;
+	case OutputEncoding::R11G11B10:
+		return DXGI_FORMAT_R11G11B10_FLOAT;
+	case OutputEncoding::RGBA8:
+		return DXGI_FORMAT_R8G8B8A8_UNORM;
+	default:
+		throw Error("Unknown output encoding.");
+	}
+}
+
+static float asFloat(uint bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+
+void encodeImage(const TracedResult& src, OutputEncoding::Type encoding, void* dst)
+{
+	if (src.format != DXGI_FORMAT_R32G32B32A32_FLOAT)
+		throw Error("Only RGBA32F images can be encoded.");
+
+	const float* in = (const float*)src.data;
+	uint8* out = (uint8*)dst;
+	uint pixelSize = _bpp(encodingFormat(encoding));
+
+	parallelFor(src.height, [&](uint y)
+	{
+		for (uint x = 0; x < src.width; ++x)
+		{
+			uint64 i = uint64(y) * src.width + x;
+			const float* p = in + 4 * i;
+			float3 c(p[0], p[1], p[2]);
+			uint8* o = out + i * pixelSize;
+
+			uint words[4];
+			switch (encoding)
+			{
+			case OutputEncoding::RGBA32F:
+				memcpy(words, p, 16);
+				break;
+			case OutputEncoding::RGBA16F:
+				words[0] = floatToHalf(c.x) | (floatToHalf(c.y) << 16);
+				words[1] = floatToHalf(c.z) | (floatToHalf(1.f) << 16);
+				break;
+			case OutputEncoding::RGB9E5:
+				words[0] = packRGB9E5(c);
+				break;
+			case OutputEncoding::R11G11B10:
+				words[0] = packR11G11B10(c);
+				break;
+			case OutputEncoding::RGBA8:
+				words[0] = packDisplayRGBA8(c);
+				break;
+			default:
+				break;
+			}
+			memcpy(o, words, pixelSize);
+		}
+	});
+}
+
+void decodeImage(const TracedResult& src, float* dst)
+{
+	const uint8* in = (const uint8*)src.data;
+
+	parallelFor(src.height, [&](uint y)
+	{
+		for (uint x = 0; x < src.width; ++x)
+		{
+			uint64 i = uint64(y) * src.width + x;
+			float* o = dst + 4 * i;
+
+			uint words[4] = {};
+			memcpy(words, in + i * src.pixelSize, src.pixelSize);
+
+			float3 c(0.f);
+			switch (src.format)
+			{
+			case DXGI_FORMAT_R32G32B32A32_FLOAT:
+				c = float3(asFloat(words[0]), asFloat(words[1]), asFloat(words[2]));
+				break;
+			case DXGI_FORMAT_R16G16B16A16_FLOAT:
+				c = float3(halfToFloat(words[0] & 0xffff), halfToFloat(words[0] >> 16), halfToFloat(words[1] & 0xffff));
+				break;
+			case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+				c = unpackRGB9E5(words[0]);
+				break;
+			case DXGI_FORMAT_R11G11B10_FLOAT:
+				c = unpackR11G11B10(words[0]);
+				break;
+			case DXGI_FORMAT_R8G8B8A8_UNORM:
+				c = unpackDisplayRGBA8(words[0]);
+				break;
+			default:
+				break;
+			}
+
+			o[0] = c.x;
+			o[1] = c.y;
+			o[2] = c.z;
+			o[3] = 1.f;
+		}
+	});
+}
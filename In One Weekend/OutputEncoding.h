@@ -0,0 +1,11 @@
+#pragma once
+#include "dxHelper.h"
+#include "PixelEncoding.h"
+
+//The DXGI format each encoding is read back and displayed in
+DXGI_FORMAT encodingFormat(OutputEncoding::Type encoding);
+
+//dst holds width * height pixels of the encoding's format
+void encodeImage(const TracedResult& src, OutputEncoding::Type encoding, void* dst);
+//Back to linear RGBA32F, whatever src.format is
+void decodeImage(const TracedResult& src, float* dst);
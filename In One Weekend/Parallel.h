@@ -0,0 +1,35 @@
+#pragma once
+#include "basic_types.h"
+#include "Trace.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+//Runs body(i) for every i in [0, count) on up to one thread per core; returns when all are done.
+//Indices are handed out one at a time, so uneven work balances itself.
+inline void parallelFor(uint count, const std::function<void(uint)>& body)
+{
+	TraceScope scope("parallelFor");
+
+	uint numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+	if (numThreads > count)
+		numThreads = count;
+
+	std::atomic<uint> next(0);
+	auto worker = [&]()
+	{
+		for (uint i = next++; i < count; i = next++)
+			body(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (uint t = 1; t < numThreads; ++t)
+		threads.emplace_back(worker);
+	worker();
+
+	for (std::thread& t : threads)
+		t.join();
+}
@@ -0,0 +1,210 @@
+#include "PathGuide.h"
+#include "Error.h"
+#include <cfloat>
+
+//Histograms are mixed with a uniform floor so directions the training never saw stay reachable
+static const float cUniformFraction = 0.1f;
+static const uint cMinTrainingSamples = 64;
+
+uint guideDirectionToBin(const float3& dir)
+{
+	float cosTheta = _min(_max(dir.y, -1.f), 1.f);
+	float phi = atan2f(dir.z, dir.x);
+	if (phi < 0.f)
+		phi += 2.f * PI;
+
+	uint row = _min((uint)((cosTheta + 1.f) * 0.5f * cGuideDirRes), cGuideDirRes - 1);
+	uint col = _min((uint)(phi / (2.f * PI) * cGuideDirRes), cGuideDirRes - 1);
+	return row * cGuideDirRes + col;
+}
+
+void PathGuide::initialize(const Scene* scene, const PathGuideSettings& settings)
+{
+	if (settings.maxLeaves == 0)
+		throw Error("Path guide needs room for at least one leaf.");
+
+	this->settings = settings;
+
+	const vector<Vertex>& vtxArr = scene->getVertexArray();
+
+	float3 lo = float3(FLT_MAX);
+	float3 hi = float3(-FLT_MAX);
+	for (uint objIdx = 0; objIdx < scene->numObjects(); ++objIdx)
+	{
+		const SceneObject& obj = scene->getObject(objIdx);
+		for (uint i = 0; i < obj.numVertices; ++i)
+		{
+			float3 p = transformPoint(obj.modelMatrix, vtxArr[obj.vertexOffset + i].position);
+			lo = float3(_min(lo.x, p.x), _min(lo.y, p.y), _min(lo.z, p.z));
+			hi = float3(_max(hi.x, p.x), _max(hi.y, p.y), _max(hi.z, p.z));
+		}
+	}
+
+	if (lo.x > hi.x)
+		lo = hi = float3(0.f);
+
+	//Pad so surfaces lying on the bounds do not straddle the root faces
+	float3 pad = (hi - lo) * 0.01f + float3(1e-3f);
+	boundsMin = lo - pad;
+	boundsMax = hi + pad;
+
+	reset();
+}
+
+void PathGuide::reset()
+{
+	nodeArr.assign(1, GuideNode{ 0, 0 });
+	leafNodeArr.assign(1, 0);
+	leafDepthArr.assign(1, 0);
+
+	cdfArr.resize(cGuideNumBins);
+	for (uint b = 0; b < cGuideNumBins; ++b)
+		cdfArr[b] = float(b + 1) / cGuideNumBins;
+	cdfArr[cGuideNumBins - 1] = 1.f;
+
+	phase = GuidePhase::Off;
+	iteration = 0;
+	iterationFrame = 0;
+}
+
+bool PathGuide::endFrame()
+{
+	if (phase != GuidePhase::Training)
+		return false;
+
+	return ++iterationFrame >= (1u << iteration);
+}
+
+void PathGuide::splitLeaf(uint leafIdx)
+{
+	uint nodeIdx = leafNodeArr[leafIdx];
+	uint firstChild = (uint)nodeArr.size();
+	uint depth = leafDepthArr[leafIdx] + 1;
+
+	nodeArr[nodeIdx].firstChild = firstChild;
+
+	vector<float> parentCdf(cdfArr.begin() + leafIdx * cGuideNumBins, cdfArr.begin() + (leafIdx + 1) * cGuideNumBins);
+
+	//Child 0 keeps the parent's leaf slot; every child starts from the parent's distribution
+	for (uint c = 0; c < 8; ++c)
+	{
+		uint childLeaf = leafIdx;
+		if (c > 0)
+		{
+			childLeaf = (uint)leafNodeArr.size();
+			leafNodeArr.push_back(0);
+			leafDepthArr.push_back(0);
+			cdfArr.insert(cdfArr.end(), parentCdf.begin(), parentCdf.end());
+		}
+
+		leafNodeArr[childLeaf] = firstChild + c;
+		leafDepthArr[childLeaf] = depth;
+		nodeArr.push_back(GuideNode{ 0, childLeaf });
+	}
+}
+
+void PathGuide::train(const uint* trainData)
+{
+	uint numLeavesBefore = numLeaves();
+	float splitThreshold = settings.splitThreshold * sqrtf(float(1u << iteration));
+	vector<uint> splitArr;
+
+	for (uint leaf = 0; leaf < numLeavesBefore; ++leaf)
+	{
+		const uint* record = trainData + leaf * cGuideTrainStride;
+		uint count = record[cGuideNumBins];
+
+		double sum = 0.0;
+		for (uint b = 0; b < cGuideNumBins; ++b)
+			sum += record[b];
+
+		//Too few samples to trust: keep what the previous iteration learned
+		if (count >= cMinTrainingSamples && sum > 0.0)
+		{
+			float* cdf = &cdfArr[leaf * cGuideNumBins];
+			double acc = 0.0;
+			for (uint b = 0; b < cGuideNumBins; ++b)
+			{
+				acc += (1.0 - cUniformFraction) * record[b] / sum + cUniformFraction / cGuideNumBins;
+				cdf[b] = (float)acc;
+			}
+			cdf[cGuideNumBins - 1] = 1.f;
+		}
+
+		if (count > splitThreshold && leafDepthArr[leaf] < settings.maxDepth)
+			splitArr.push_back(leaf);
+	}
+
+	for (uint leaf : splitArr)
+	{
+		if (numLeaves() + 7 > settings.maxLeaves)
+			break;
+		splitLeaf(leaf);
+	}
+
+	++iteration;
+	iterationFrame = 0;
+	if (iteration >= settings.numTrainingIterations)
+		phase = GuidePhase::Rendering;
+}
+
+uint PathGuide::lookup(const float3& p) const
+{
+	float3 lo = boundsMin;
+	float3 hi = boundsMax;
+	GuideNode node = nodeArr[0];
+
+	while (node.firstChild != 0)
+	{
+		float3 mid = (lo + hi) * 0.5f;
+		uint octant = 0;
+		if (p.x >= mid.x) { octant |= 1; lo.x = mid.x; } else hi.x = mid.x;
+		if (p.y >= mid.y) { octant |= 2; lo.y = mid.y; } else hi.y = mid.y;
+		if (p.z >= mid.z) { octant |= 4; lo.z = mid.z; } else hi.z = mid.z;
+		node = nodeArr[node.firstChild + octant];
+	}
+
+	return node.leafIdx;
+}
+
+float PathGuide::pdf(uint leafIdx, const float3& dir) const
+{
+	const float* cdf = &cdfArr[leafIdx * cGuideNumBins];
+	uint bin = guideDirectionToBin(dir);
+	float prob = cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0.f);
+	return prob * cGuideNumBins / (4.f * PI);
+}
+
+float3 PathGuide::sample(uint leafIdx, float u0, float u1, float u2) const
+{
+	const float* cdf = &cdfArr[leafIdx * cGuideNumBins];
+
+	//First bin whose cumulative probability exceeds u0
+	uint lo = 0;
+	uint hi = cGuideNumBins - 1;
+	while (lo < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (cdf[mid] <= u0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	uint row = lo / cGuideDirRes;
+	uint col = lo % cGuideDirRes;
+	float cosTheta = (row + u1) / cGuideDirRes * 2.f - 1.f;
+	float phi = (col + u2) / cGuideDirRes * 2.f * PI;
+	float sinTheta = sqrtf(_max(1.f - cosTheta * cosTheta, 0.f));
+	return float3(sinTheta * cosf(phi), cosTheta, sinTheta * sinf(phi));
+}
+
+uint64 PathGuide::gpuMemorySize() const
+{
+	uint64 nodeSize = uint64(maxNodes()) * sizeof(GuideNode);
+	uint64 cdfSize = uint64(settings.maxLeaves) * cGuideNumBins * sizeof(float);
+	uint64 trainSize = uint64(settings.maxLeaves) * cGuideTrainStride * sizeof(uint);
+
+	//nodes + cdf + training counters, their upload copy (with a zero block to clear the counters) and the readback
+	return 2 * (nodeSize + cdfSize + trainSize) + trainSize;
+}
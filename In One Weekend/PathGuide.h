@@ -0,0 +1,88 @@
+#pragma once
+#include "Scene.h"
+
+namespace GuidePhase
+{
+	enum Type
+	{
+		Off,
+		Training,	//paths sample the current guide and record what they find
+		Rendering,	//the guide is frozen
+
+		Count
+	};
+}
+
+//Matches GuideNode in DXRShader.hlsl
+struct GuideNode
+{
+	uint firstChild;	//0 for leaves; the root is never anyone's child
+	uint leafIdx;
+};
+
+//Directional histograms use an equal-area (cos theta, phi) grid, so every bin spans 4pi / cGuideNumBins sr.
+//The training buffer holds cGuideNumBins fixed-point radiance sums plus one sample count per leaf.
+static const uint cGuideDirRes = 16;
+static const uint cGuideNumBins = cGuideDirRes * cGuideDirRes;
+static const uint cGuideTrainStride = cGuideNumBins + 1;
+static const float cGuideRadianceScale = 16.f;
+static const float cGuideMaxRadiance = 100.f;
+
+struct PathGuideSettings
+{
+	uint maxLeaves = 4096;				//memory cap; every leaf owns a histogram and a training record
+	uint maxDepth = 12;
+	uint numTrainingIterations = 6;		//iteration k lasts 2^k frames
+	uint splitThreshold = 4000;			//samples per iteration before a leaf is subdivided, scaled by sqrt(2^k)
+	float guideFraction = 0.5f;			//probability of sampling the guide instead of the BSDF
+};
+
+//SD-tree style radiance cache: a spatial octree over the scene bounds whose leaves hold
+//directional distributions learned from the GPU's training records.
+class PathGuide
+{
+	PathGuideSettings settings;
+	float3 boundsMin = float3(0.f);
+	float3 boundsMax = float3(0.f);
+
+	vector<GuideNode> nodeArr;
+	vector<uint> leafNodeArr;
+	vector<uint> leafDepthArr;
+	vector<float> cdfArr;		//cGuideNumBins inclusive prefix sums per leaf, last one == 1
+
+	GuidePhase::Type phase = GuidePhase::Off;
+	uint iteration = 0;
+	uint iterationFrame = 0;
+
+	void splitLeaf(uint leafIdx);
+
+public:
+	void initialize(const Scene* scene, const PathGuideSettings& settings = PathGuideSettings());
+	void reset();
+
+	void setPhase(GuidePhase::Type newPhase) { phase = newPhase; }
+	GuidePhase::Type getPhase() const { return phase; }
+
+	//Counts a traced frame; true when it closes a training iteration and train() is due
+	bool endFrame();
+	void train(const uint* trainData);
+
+	uint lookup(const float3& p) const;
+	float pdf(uint leafIdx, const float3& dir) const;
+	float3 sample(uint leafIdx, float u0, float u1, float u2) const;
+
+	const PathGuideSettings& getSettings() const { return settings; }
+	float3 getBoundsMin() const { return boundsMin; }
+	float3 getBoundsMax() const { return boundsMax; }
+	const vector<GuideNode>& getNodeArray() const { return nodeArr; }
+	const vector<float>& getCdfArray() const { return cdfArr; }
+	uint numLeaves() const { return (uint)leafNodeArr.size(); }
+	uint numNodes() const { return (uint)nodeArr.size(); }
+	uint getIteration() const { return iteration; }
+
+	//Capacities the GPU buffers are allocated with
+	uint maxNodes() const { return 1 + 8 * ((settings.maxLeaves - 1) / 7); }
+	uint64 gpuMemorySize() const;
+};
+
+uint guideDirectionToBin(const float3& dir);
@@ -0,0 +1,327 @@
+#include "PixelEncoding.h"
+#include "Error.h"
+#include <cfloat>
+#include <cmath>
+#include <string.h>
+
+static const char* cEncodingNames[OutputEncoding::Count] = { "rgba32f", "rgba16f", "rgb9e5", "r11g11b10", "rgba8" };
+
+const char* encodingName(OutputEncoding::Type encoding)
+{
+	return encoding < OutputEncoding::Count ? cEncodingNames[encoding] : "unknown";
+}
+
+OutputEncoding::Type encodingFromName(const char* name)
+{
+	for (uint i = 0; i < OutputEncoding::Count; ++i)
+		if (strcmp(name, cEncodingNames[i]) == 0)
+			return (OutputEncoding::Type)i;
+
+	throw Error((string("Unknown output encoding: ") + name).c_str());
+}
+
+uint encodingBytesPerPixel(OutputEncoding::Type encoding)
+{
+	static const uint cBytesPerPixel[OutputEncoding::Count] = { 16, 8, 4, 4, 4 };
+	return encoding < OutputEncoding::Count ? cBytesPerPixel[encoding] : 0;
+}
+
+static float asFloat(uint bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+
+static uint asUint(float f)
+{
+	uint bits;
+	memcpy(&bits, &f, sizeof(float));
+	return bits;
+}
+
+//2^e for -126 <= e <= 127, built from the bits so it is exact
+static float exp2i(int e)
+{
+	return asFloat(uint(e + 127) << 23);
+}
+
+//Unsigned float with a 5-bit exponent (bias 15) and mantissaBits of mantissa, as in half,
+//R11G11B10 and friends. Ties round up.
+static uint packSmallFloat(float v, uint mantissaBits)
+{
+	uint maxPacked = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+	if (!(v > 0.f))
+		return 0;
+
+	//Subnormal: a fixed step of 2^-(14 + mantissaBits); rounding up to 1 << mantissaBits is the smallest normal
+	if (v < exp2i(-14))
+		return (uint)floorf(v * exp2i(14 + (int)mantissaBits) + 0.5f);
+
+	int e = int((asUint(v) >> 23) & 0xff) - 127;
+	if (e > 15)
+		return maxPacked;
+
+	float mantissa = asFloat((asUint(v) & 0x007fffff) | 0x3f800000) - 1.f;
+	uint packed = (uint(e + 15) << mantissaBits) + (uint)floorf(mantissa * float(1u << mantissaBits) + 0.5f);
+	return _min(packed, maxPacked);
+}
+
+static float unpackSmallFloat(uint packed, uint mantissaBits)
+{
+	uint e = packed >> mantissaBits;
+	uint m = packed & ((1u << mantissaBits) - 1);
+	if (e == 0)
+		return m * exp2i(-14 - (int)mantissaBits);
+	return (1.f + m * exp2i(-(int)mantissaBits)) * exp2i(int(e) - 15);
+}
+
+uint floatToHalf(float v)
+{
+	uint sign = (asUint(v) >> 16) & 0x8000;
+	return sign | packSmallFloat(fabsf(v), 10);
+}
+
+float halfToFloat(uint h)
+{
+	float v = unpackSmallFloat(h & 0x7fff, 10);
+	return (h & 0x8000) ? -v : v;
+}
+
+uint packR11G11B10(const float3& c)
+{
+	return packSmallFloat(c.x, 6) | (packSmallFloat(c.y, 6) << 11) | (packSmallFloat(c.z, 5) << 22);
+}
+
+float3 unpackR11G11B10(uint packed)
+{
+	return float3(unpackSmallFloat(packed & 0x7ff, 6), unpackSmallFloat((packed >> 11) & 0x7ff, 6), unpackSmallFloat(packed >> 22, 5));
+}
+
+//D3D's shared exponent scheme: the brightest channel picks the exponent, the others lose precision with it
+uint packRGB9E5(const float3& c)
+{
+	const float maxValue = 511.f / 512.f * 65536.f;
+	float r = (c.x > 0.f) ? _min(c.x, maxValue) : 0.f;
+	float g = (c.y > 0.f) ? _min(c.y, maxValue) : 0.f;
+	float b = (c.z > 0.f) ? _min(c.z, maxValue) : 0.f;
+	float maxc = _max(r, _max(g, b));
+
+	int expShared = _max(-16, int((asUint(maxc) >> 23) & 0xff) - 127) + 16;
+	float scale = exp2i(24 - expShared);
+	if (floorf(maxc * scale + 0.5f) >= 512.f)
+	{
+		expShared += 1;
+		scale *= 0.5f;
+	}
+
+	uint rm = (uint)floorf(r * scale + 0.5f);
+	uint gm = (uint)floorf(g * scale + 0.5f);
+	uint bm = (uint)floorf(b * scale + 0.5f);
+	return rm | (gm << 9) | (bm << 18) | (uint(expShared) << 27);
+}
+
+float3 unpackRGB9E5(uint packed)
+{
+	float scale = exp2i(int(packed >> 27) - 24);
+	return float3(float(packed & 0x1ff) * scale, float((packed >> 9) & 0x1ff) * scale, float((packed >> 18) & 0x1ff) * scale);
+}
+
+static uint toUnorm8(float v)
+{
+	return (uint)floorf(_min(_max(v, 0.f), 1.f) * 255.f + 0.5f);
+}
+
+uint packDisplayRGBA8(const float3& c)
+{
+	return toUnorm8(sqrtf(fabsf(c.x))) | (toUnorm8(sqrtf(fabsf(c.y))) << 8) | (toUnorm8(sqrtf(fabsf(c.z))) << 16) | 0xff000000;
+}
+
+float3 unpackDisplayRGBA8(uint packed)
+{
+	float r = (packed & 0xff) / 255.f;
+	float g = ((packed >> 8) & 0xff) / 255.f;
+	float b = ((packed >> 16) & 0xff) / 255.f;
+	return float3(r * r, g * g, b * b);
+}
+
+static float3 roundTrip(OutputEncoding::Type encoding, const float3& c)
+{
+	switch (encoding)
+	{
+	case OutputEncoding::RGBA16F:
+		return float3(halfToFloat(floatToHalf(c.x)), halfToFloat(floatToHalf(c.y)), halfToFloat(floatToHalf(c.z)));
+	case OutputEncoding::RGB9E5:
+		return unpackRGB9E5(packRGB9E5(c));
+	case OutputEncoding::R11G11B10:
+		return unpackR11G11B10(packR11G11B10(c));
+	case OutputEncoding::RGBA8:
+		return unpackDisplayRGBA8(packDisplayRGBA8(c));
+	default:
+		return c;
+	}
+}
+
+float encodingMaxError(OutputEncoding::Type encoding)
+{
+	//Every channel steps through 2^-12 .. 2^14 in 1/16 stops, against a few fixed partners
+	const float partners[] = { 0.f, 0.01f, 1.f, 100.f };
+	float maxError = 0.f;
+
+	for (float partner : partners)
+	{
+		for (int step = -12 * 16; step <= 14 * 16; ++step)
+		{
+			float v = powf(2.f, step / 16.f) * 1.013f;
+			for (uint ch = 0; ch < 3; ++ch)
+			{
+				float3 c(partner);
+				c[ch] = v;
+				float maxc = _max(c.x, _max(c.y, c.z));
+				float3 d = roundTrip(encoding, c);
+
+				for (uint k = 0; k < 3; ++k)
+				{
+					float error;
+					if (encoding == OutputEncoding::RGBA8)
+						error = fabsf(sqrtf(d[k]) - _min(sqrtf(c[k]), 1.f));
+					else
+						error = fabsf(d[k] - c[k]) / _max(maxc, 1e-30f);
+
+					//Values below the smallest normal only keep absolute precision
+					if (encoding != OutputEncoding::RGBA8 && maxc < powf(2.f, -14.f))
+						continue;
+					maxError = _max(maxError, error);
+				}
+			}
+		}
+	}
+
+	return maxError;
+}
+
+float encodingErrorBound(OutputEncoding::Type encoding)
+{
+	//Round to nearest loses at most half a step of the mantissa; RGB9E5's has no implicit bit, so
+	//its step is up to 2^-8 of the brightest channel, and R11G11B10's blue keeps only 5 bits
+	switch (encoding)
+	{
+	case OutputEncoding::RGBA16F:
+		return exp2i(-11);
+	case OutputEncoding::RGB9E5:
+		return exp2i(-9);
+	case OutputEncoding::R11G11B10:
+		return exp2i(-6);
+	case OutputEncoding::RGBA8:
+		return 0.5f / 255.f * 1.0001f;
+	default:
+		return 0.f;
+	}
+}
+
+struct SpecialValue
+{
+	const char* name;
+	float3 in;
+	float3 out;
+};
+
+//Exact results, following the CPU packers' rules: float denormals are below every small format's
+//range, the unsigned formats clamp negatives to 0, and RGBA8 takes |c| like PSMain
+static vector<SpecialValue> specialValues(OutputEncoding::Type encoding)
+{
+	const float nan = asFloat(0x7fc00000);
+	const float inf = asFloat(0x7f800000);
+	const float denormal = asFloat(1);
+	float q;
+
+	switch (encoding)
+	{
+	case OutputEncoding::RGBA32F:
+		return {
+			{ "zero", float3(0.f), float3(0.f) },
+			{ "denormal", float3(denormal), float3(denormal) },
+			{ "largest", float3(FLT_MAX), float3(FLT_MAX) },
+			{ "negative", float3(-1.f, -2.f, -3.f), float3(-1.f, -2.f, -3.f) },
+			{ "NaN", float3(nan), float3(nan) },
+		};
+	case OutputEncoding::RGBA16F:
+		return {
+			{ "zero", float3(0.f), float3(0.f) },
+			{ "denormal", float3(exp2i(-24), 3.f * exp2i(-24), 1023.f * exp2i(-24)), float3(exp2i(-24), 3.f * exp2i(-24), 1023.f * exp2i(-24)) },
+			{ "float denormal", float3(denormal), float3(0.f) },
+			{ "largest", float3(65504.f), float3(65504.f) },
+			{ "beyond largest", float3(65520.f, 1e30f, inf), float3(65504.f) },
+			{ "negative", float3(-1.f, -exp2i(-24), -1e30f), float3(-1.f, -exp2i(-24), -65504.f) },
+			{ "NaN", float3(nan), float3(0.f) },
+		};
+	case OutputEncoding::RGB9E5:
+		return {
+			{ "zero", float3(0.f), float3(0.f) },
+			{ "denormal", float3(exp2i(-24), 3.f * exp2i(-24), 511.f * exp2i(-24)), float3(exp2i(-24), 3.f * exp2i(-24), 511.f * exp2i(-24)) },
+			{ "float denormal", float3(denormal), float3(0.f) },
+			{ "largest", float3(65408.f), float3(65408.f) },
+			{ "beyond largest", float3(65535.f, 1e30f, inf), float3(65408.f) },
+			{ "negative", float3(-1.f, 1.f, -1e30f), float3(0.f, 1.f, 0.f) },
+			{ "NaN", float3(nan, 1.f, nan), float3(0.f, 1.f, 0.f) },
+		};
+	case OutputEncoding::R11G11B10:
+		return {
+			{ "zero", float3(0.f), float3(0.f) },
+			{ "denormal", float3(exp2i(-20), 63.f * exp2i(-20), exp2i(-19)), float3(exp2i(-20), 63.f * exp2i(-20), exp2i(-19)) },
+			{ "float denormal", float3(denormal), float3(0.f) },
+			{ "largest", float3(65024.f, 65024.f, 64512.f), float3(65024.f, 65024.f, 64512.f) },
+			{ "beyond largest", float3(1e30f, inf, 65535.f), float3(65024.f, 65024.f, 64512.f) },
+			{ "negative", float3(-1.f, -exp2i(-20), -1e30f), float3(0.f) },
+			{ "NaN", float3(nan), float3(0.f) },
+		};
+	case OutputEncoding::RGBA8:
+		//A code's own value comes back exactly
+		q = 51.f / 255.f;
+		return {
+			{ "zero", float3(0.f), float3(0.f) },
+			{ "float denormal", float3(denormal), float3(0.f) },
+			{ "largest", float3(1.f), float3(1.f) },
+			{ "beyond largest", float3(1.5f, 1e30f, inf), float3(1.f) },
+			{ "negative", float3(-1.f, -q * q, -1e30f), float3(1.f, q * q, 1.f) },
+			{ "NaN", float3(nan), float3(0.f) },
+		};
+	default:
+		return {};
+	}
+}
+
+static bool sameValue(float a, float b)
+{
+	return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+uint checkEncodings()
+{
+	uint failures = 0;
+	for (uint e = 0; e < OutputEncoding::Count; ++e)
+	{
+		OutputEncoding::Type type = (OutputEncoding::Type)e;
+		float maxError = encodingMaxError(type);
+		float bound = encodingErrorBound(type);
+		printf("%-10s %2u bytes/pixel  max round-trip error %-12g bound %-12g %s\n", encodingName(type), encodingBytesPerPixel(type),
+			maxError, bound, maxError <= bound ? "ok" : "FAILED");
+		if (maxError > bound)
+			failures++;
+
+		for (const SpecialValue& s : specialValues(type))
+		{
+			float3 d = roundTrip(type, s.in);
+			for (uint k = 0; k < 3; ++k)
+			{
+				if (sameValue(d[k], s.out[k]))
+					continue;
+				printf("FAILED: %s %s channel %u: %g gives %g, expected %g\n", encodingName(type), s.name, k, s.in[k], d[k], s.out[k]);
+				failures++;
+			}
+		}
+	}
+
+	printf("Output encodings: %u check%s failed\n", failures, failures == 1 ? "" : "s");
+	return failures;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "basic_math.h"
+
+//How the tracer hands each frame to the CPU. Accumulation always stays RGBA32F on the GPU;
+//the other encodings are written alongside it and only they are read back.
+namespace OutputEncoding
+{
+	enum Type
+	{
+		RGBA32F,
+		RGBA16F,
+		RGB9E5,		//shared 5-bit exponent, 9-bit mantissas
+		R11G11B10,	//unsigned 6/6/5-bit mantissas, 5-bit exponents
+		RGBA8,		//sqrt tonemapped like PSMain, ready for display
+
+		Count
+	};
+}
+
+const char* encodingName(OutputEncoding::Type encoding);
+OutputEncoding::Type encodingFromName(const char* name);
+//_bpp(encodingFormat(encoding)), for code without the DXGI formats
+uint encodingBytesPerPixel(OutputEncoding::Type encoding);
+
+//CPU twins of the packers in DXRShader.hlsl. The float packers round to nearest with exact
+//power-of-two arithmetic, so both sides produce the same bits; NaN packs as 0 and
+//anything beyond the largest finite value is clamped to it.
+uint floatToHalf(float v);
+float halfToFloat(uint h);
+uint packRGB9E5(const float3& c);
+float3 unpackRGB9E5(uint packed);
+uint packR11G11B10(const float3& c);
+float3 unpackR11G11B10(uint packed);
+uint packDisplayRGBA8(const float3& c);
+float3 unpackDisplayRGBA8(uint packed);
+
+//Worst round-trip error over a sweep of colours: relative to the brightest channel for the float
+//encodings, in display units for RGBA8
+float encodingMaxError(OutputEncoding::Type encoding);
+//What encodingMaxError may reach: half a step of the encoding's mantissa, or of 1/255 for RGBA8
+float encodingErrorBound(OutputEncoding::Type encoding);
+//Prints each encoding's error against its bound and checks zero, denormals, the largest finite value,
+//values beyond it, negatives and NaN round-trip exactly as documented above. Returns the failures.
+uint checkEncodings();
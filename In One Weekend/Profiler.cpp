@@ -0,0 +1,138 @@
+#include "Profiler.h"
+#include "Error.h"
+#include "SampleStats.h"
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+static const char* cZoneNames[ProfileZone::Count] = {
+	"Frame",
+	"DXRPathTracer::update",
+	"Camera::update",
+	"shootRays",
+	"GPU wait",
+	"Readback",
+	"Denoise",
+	"D3D12Screen::display",
+	"Stream submit",
+	"Message pump",
+	"Scene build",
+	"setupScene",
+	"SceneBVH::build",
+	"Acceleration structures",
+};
+
+struct ZoneHistory
+{
+	float samples[cProfileHistory];		//ms
+	atomic<uint64> count{ 0 };
+};
+
+static atomic<bool> gProfiling{ false };
+static ZoneHistory gZones[ProfileZone::Count];
+
+const char* profileZoneName(ProfileZone::Type zone)
+{
+	return cZoneNames[zone];
+}
+
+void setProfiling(bool enable)
+{
+	gProfiling = enable;
+}
+
+bool isProfiling()
+{
+	return gProfiling.load(memory_order_relaxed);
+}
+
+void resetProfile()
+{
+	for (ZoneHistory& zone : gZones)
+		zone.count = 0;
+}
+
+//Scene builds may run off the main thread, so the slot is claimed atomically
+void recordZone(ProfileZone::Type zone, double seconds)
+{
+	ZoneHistory& history = gZones[zone];
+	uint64 slot = history.count.fetch_add(1, memory_order_relaxed);
+	history.samples[slot % cProfileHistory] = float(seconds * 1000.0);
+}
+
+ZoneStats zoneStats(ProfileZone::Type zone)
+{
+	const ZoneHistory& history = gZones[zone];
+	ZoneStats stats = {};
+	stats.count = history.count;
+	stats.numSamples = (uint)min(stats.count, uint64(cProfileHistory));
+	if (stats.numSamples == 0)
+		return stats;
+
+	SampleStats s = sampleStats(vector<float>(history.samples, history.samples + stats.numSamples));
+	stats.mean = s.mean;
+	stats.p50 = s.p50;
+	stats.p95 = s.p95;
+	stats.p99 = s.p99;
+	stats.max = s.max;
+	return stats;
+}
+
+void printProfile()
+{
+	double frameMean = zoneStats(ProfileZone::Frame).mean;
+
+	printf("%-24s %8s %9s %9s %9s %9s %9s %7s\n", "zone", "count", "mean ms", "p50", "p95", "p99", "max", "frame%");
+	for (uint z = 0; z < ProfileZone::Count; ++z)
+	{
+		ZoneStats s = zoneStats((ProfileZone::Type)z);
+		if (s.count == 0)
+			continue;
+
+		printf("%-24s %8llu %9.3f %9.3f %9.3f %9.3f %9.3f", cZoneNames[z], (unsigned long long)s.count, s.mean, s.p50, s.p95, s.p99, s.max);
+		//Startup zones run once and are not part of a frame
+		if (frameMean > 0.0 && s.count > 1)
+			printf(" %6.1f%%", 100.0 * s.mean / frameMean);
+		printf("\n");
+	}
+}
+
+void writeProfile(const string& path)
+{
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+
+	ofstream file(path, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+
+	char line[512];
+	if (json)
+		file << "{\n\t\"historySize\": " << cProfileHistory << ",\n\t\"zones\": [";
+	else
+		file << "zone,count,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+
+	bool first = true;
+	for (uint z = 0; z < ProfileZone::Count; ++z)
+	{
+		ZoneStats s = zoneStats((ProfileZone::Type)z);
+		if (s.count == 0)
+			continue;
+
+		if (json)
+			snprintf(line, sizeof(line), "%s\n\t\t{ \"zone\": \"%s\", \"count\": %llu, \"samples\": %u, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+				first ? "" : ",", cZoneNames[z], (unsigned long long)s.count, s.numSamples, s.mean, s.p50, s.p95, s.p99, s.max);
+		else
+			snprintf(line, sizeof(line), "%s,%llu,%u,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+				cZoneNames[z], (unsigned long long)s.count, s.numSamples, s.mean, s.p50, s.p95, s.p99, s.max);
+		file << line;
+		first = false;
+	}
+
+	if (json)
+		file << "\n\t]\n}\n";
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "basic_types.h"
+#include "Trace.h"
+#include <chrono>
+#include <string>
+
+namespace ProfileZone
+{
+	enum Type
+	{
+		Frame,			//one pass of the main loop
+		TracerUpdate,
+		CameraUpdate,
+		ShootRays,
+		GpuWait,		//dispatch and copies executing, up to the fence
+		Readback,		//the mapped readback to the end of shootRays, Denoise included
+		Denoise,
+		Display,
+		StreamSubmit,
+		MessagePump,
+		SceneBuild,
+		SceneUpload,	//setupScene: light tables, buffers and acceleration structures
+		SceneBVH,
+		AccelBuild,
+
+		Count
+	};
+}
+
+const char* profileZoneName(ProfileZone::Type zone);
+
+//Milliseconds over the samples still in a zone's history
+struct ZoneStats
+{
+	uint64 count;		//samples ever recorded
+	uint numSamples;	//samples the percentiles come from
+	double mean;
+	double p50;
+	double p95;
+	double p99;
+	double max;
+};
+
+//Off until enabled, and then a ProfileScope costs two steady_clock reads and a store.
+//Each zone keeps the last cProfileHistory durations in a ring buffer.
+static const uint cProfileHistory = 1024;
+
+void setProfiling(bool enable);
+bool isProfiling();
+void resetProfile();
+void recordZone(ProfileZone::Type zone, double seconds);
+ZoneStats zoneStats(ProfileZone::Type zone);
+
+//Table of every zone that has samples, with its share of the frame
+void printProfile();
+//CSV or JSON by extension
+void writeProfile(const std::string& path);
+
+//While tracing, each scope is also a span named after its zone
+class ProfileScope
+{
+	ProfileZone::Type zone;
+	bool profiled;
+	bool traced;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit ProfileScope(ProfileZone::Type zone) : zone(zone), profiled(isProfiling()), traced(isTracing())
+	{
+		if (profiled || traced)
+			start = std::chrono::steady_clock::now();
+	}
+	~ProfileScope()
+	{
+		if (!profiled && !traced)
+			return;
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		if (profiled)
+			recordZone(zone, std::chrono::duration<double>(end - start).count());
+		if (traced)
+			traceSpan(profileZoneName(zone), start, end);
+	}
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+};
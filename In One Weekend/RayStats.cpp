@@ -0,0 +1,55 @@
+#include "RayStats.h"
+#include <stdio.h>
+
+static const char* cCounterNames[RayCounter::Count] = {
+	"paths",
+	"path rays",
+	"occlusion rays",
+	"misses",
+	"lambertian hits",
+	"metal hits",
+	"dielectric hits",
+	"emissive hits",
+	"back-face cutoffs",
+};
+
+const char* rayCounterName(RayCounter::Type counter)
+{
+	return cCounterNames[counter];
+}
+
+void RayStats::addFrame(const uint* frameCounters)
+{
+	for (uint c = 0; c < RayCounter::Count; ++c)
+		counters[c] += frameCounters[c];
+	++frames;
+}
+
+double RayStats::averagePathLength() const
+{
+	uint64 paths = counters[RayCounter::Paths];
+	return paths > 0 ? double(counters[RayCounter::PathRays]) / paths : 0.0;
+}
+
+double RayStats::missRatio() const
+{
+	uint64 rays = counters[RayCounter::PathRays];
+	return rays > 0 ? double(counters[RayCounter::Misses]) / rays : 0.0;
+}
+
+void RayStats::print() const
+{
+	if (frames == 0)
+		return;
+
+	uint64 pathRays = counters[RayCounter::PathRays];
+	auto share = [&](RayCounter::Type c) { return pathRays > 0 ? 100.0 * counters[c] / pathRays : 0.0; };
+
+	printf("Rays: %.1f M/s over %u frames (%.1f M/frame, %.1f%% occlusion), path length %.2f, misses %.1f%%\n",
+		raysPerSecond() * 1e-6, frames, totalRays() * 1e-6 / frames,
+		totalRays() > 0 ? 100.0 * counters[RayCounter::OcclusionRays] / totalRays() : 0.0,
+		averagePathLength(), 100.0 * missRatio());
+	printf("  hits: lambertian %.1f%%, metal %.1f%%, dielectric %.1f%%, emissive %.1f%%; back-face cutoffs %.2f%%\n",
+		share(RayCounter::HitLambertian), share(RayCounter::HitMetal), share(RayCounter::HitDielectric),
+		share(RayCounter::HitEmissive), share(RayCounter::BackFaceCutoffs));
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "basic_types.h"
+
+//Work counters of the path tracing pass, in the order of the shader's stats UAV (RayCounter_* in DXRShader.hlsl)
+namespace RayCounter
+{
+	enum Type
+	{
+		Paths,				//camera samples
+		PathRays,			//closest-hit rays, camera rays included
+		OcclusionRays,
+		Misses,
+		HitLambertian,		//one per MaterialType, in its order
+		HitMetal,
+		HitDielectric,
+		HitEmissive,
+		BackFaceCutoffs,	//paths ended on hitting a surface from behind
+
+		Count
+	};
+}
+
+const char* rayCounterName(RayCounter::Type counter);
+
+struct RayStats
+{
+	uint64 counters[RayCounter::Count] = {};
+	uint frames = 0;
+	double seconds = 0.0;	//wall time the frames took, set by whoever collects them
+
+	//One frame's 32-bit counters as read back
+	void addFrame(const uint* frameCounters);
+
+	uint64 totalRays() const { return counters[RayCounter::PathRays] + counters[RayCounter::OcclusionRays]; }
+	double raysPerSecond() const { return seconds > 0.0 ? totalRays() / seconds : 0.0; }
+	//Closest-hit rays per camera sample
+	double averagePathLength() const;
+	double missRatio() const;
+
+	void print() const;
+};
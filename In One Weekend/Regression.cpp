@@ -0,0 +1,247 @@
+#include "Regression.h"
+#include "ImageMetrics.h"
+#include "ImageWriter.h"
+#include "timer.h"
+#include <fstream>
+#include <map>
+
+//The RNG seed of push_RayTracingInOneWeekend's random spheres
+static const uint cRegressionSeed = 1;
+
+struct RegressionCase
+{
+	const char* name;
+	Scene* (SceneLoader::*push)();
+	XMFLOAT3 position;
+	XMFLOAT3 target;
+	float aperture;
+	float focusDist;
+};
+
+static const RegressionCase cCases[] = {
+	{ "simpleSphere", &SceneLoader::push_simpleSphere, { 0.f, 0.5f, -2.f }, { 0.f, 0.f, 1.f }, 0.f, 3.f },
+	{ "inOneWeekend", &SceneLoader::push_RayTracingInOneWeekend, { 13.f, 2.f, -3.f }, { 0.f, 0.f, 0.f }, 0.1f, 10.f },
+};
+
+//One scene at one frame count
+struct RegressionPoint
+{
+	uint frames = 0;
+	uint runs = 0;
+	ImageError error;
+	double meanSeconds = 0.0;
+	double stddevSeconds = 0.0;
+};
+
+typedef map<string, vector<RegressionPoint>> RegressionResults;
+
+static const char* cCsvHeader = "scene,frames,runs,relMSE,relMSEStdErr,rmse,meanSeconds,stddevSeconds";
+
+static void writeResults(const string& path, const RegressionResults& results)
+{
+	ofstream file(path, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + path).c_str());
+
+	file << cCsvHeader << "\n";
+	char line[256];
+	for (auto& scene : results)
+	{
+		for (const RegressionPoint& p : scene.second)
+		{
+			snprintf(line, sizeof(line), "%s,%u,%u,%.9g,%.9g,%.9g,%.9g,%.9g\n", scene.first.c_str(), p.frames, p.runs,
+				p.error.relMSE, p.error.relMSEStdErr, p.error.rmse, p.meanSeconds, p.stddevSeconds);
+			file << line;
+		}
+	}
+
+	if (!file)
+		throw Error(("Failed to write " + path).c_str());
+}
+
+static bool readResults(const string& path, RegressionResults& results)
+{
+	ifstream file(path);
+	if (!file)
+		return false;
+
+	string line;
+	getline(file, line);
+	if (line != cCsvHeader)
+		throw Error((path + " is not a regression baseline.").c_str());
+
+	while (getline(file, line))
+	{
+		size_t comma = line.find(',');
+		if (comma == string::npos)
+			continue;
+
+		RegressionPoint p;
+		if (sscanf(line.c_str() + comma + 1, "%u,%u,%lf,%lf,%lf,%lf,%lf", &p.frames, &p.runs, &p.error.relMSE,
+			&p.error.relMSEStdErr, &p.error.rmse, &p.meanSeconds, &p.stddevSeconds) != 7)
+			throw Error(("Bad line in " + path + ": " + line).c_str());
+		results[line.substr(0, comma)].push_back(p);
+	}
+	return true;
+}
+
+static double timeToError(const vector<RegressionPoint>& points, double target)
+{
+	vector<double> seconds, relMSE;
+	for (const RegressionPoint& p : points)
+	{
+		seconds.push_back(p.meanSeconds);
+		relMSE.push_back(p.error.relMSE);
+	}
+	return costToError(seconds, relMSE, target);
+}
+
+static const RegressionPoint* findPoint(const vector<RegressionPoint>& points, uint frames)
+{
+	for (const RegressionPoint& p : points)
+		if (p.frames == frames)
+			return &p;
+	return nullptr;
+}
+
+static void setupCase(DXRPathTracer* tracer, SceneLoader& loader, const RegressionCase& c)
+{
+	seed_random(cRegressionSeed);
+	Scene* scene = (loader.*c.push)();
+	tracer->setupScene(scene);
+
+	Camera camera = tracer->getCamera();
+	camera.lookAt(c.position, c.target, XMFLOAT3(0.f, 1.f, 0.f));
+	camera.setAperture(c.aperture);
+	camera.setFocusDist(c.focusDist);
+	tracer->setCamera(camera);
+}
+
+static TracedResult asImage(vector<float>& pixels, uint width, uint height)
+{
+	TracedResult image;
+	image.data = pixels.data();
+	image.width = width;
+	image.height = height;
+	image.pixelSize = 4 * sizeof(float);
+	image.format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	return image;
+}
+
+uint runRegression(DXRPathTracer* tracer, const string& dir, bool update, const RegressionSettings& settings)
+{
+	RegressionResults baseline;
+	bool haveBaseline = !update && readResults(dir + "/baseline.csv", baseline);
+	if (!update && !haveBaseline)
+		printf("No %s/baseline.csv yet: measuring only. Run with --regress-update to record one.\n", dir.c_str());
+
+	RegressionResults results;
+	SceneLoader loader;
+	vector<float> pixels, refPixels;
+	uint numRegressions = 0;
+
+	for (const RegressionCase& c : cCases)
+	{
+		setupCase(tracer, loader, c);
+
+		string refPath = dir + "/" + c.name + "_reference.pfm";
+		uint refW = 0, refH = 0;
+		bool haveReference = ifstream(refPath).good();
+		if (!haveReference && !update)
+			throw Error(("Missing " + refPath + "; run with --regress-update to render it.").c_str());
+		if (!haveReference)
+		{
+			printf("Rendering %s reference, %u frames\n", c.name, settings.referenceFrames);
+			//Its own samples, not the first frames of the test renders, which would bias the error low
+			tracer->setRngFrameOffset(cDecorrelatedFrameOffset);
+			tracer->renderImage(settings.width, settings.height, settings.referenceFrames, refPixels);
+			tracer->setRngFrameOffset(0);
+			writePFM(refPath, asImage(refPixels, settings.width, settings.height));
+		}
+		readPFM(refPath, refPixels, refW, refH);
+		if (refW != settings.width || refH != settings.height)
+			throw Error((refPath + " does not match the regression image size.").c_str());
+		TracedResult reference = asImage(refPixels, refW, refH);
+
+		printf("%s\n%8s %12s %10s %10s %12s %10s | %9s %6s %9s %6s\n", c.name, "frames", "relMSE", "stderr", "rmse",
+			"time ms", "stddev", "d(error)", "z", "d(time)", "z");
+
+		vector<RegressionPoint>& points = results[c.name];
+		const vector<RegressionPoint>* basePoints = haveBaseline && baseline.count(c.name) ? &baseline[c.name] : nullptr;
+		bool sceneRegressed = false;
+
+		for (uint frames : settings.frameCounts)
+		{
+			//Rendering is deterministic, so only the time varies between runs
+			vector<double> times(_max(settings.timingRuns, 1u));
+			for (double& t : times)
+			{
+				double start = getCurrentTime();
+				tracer->renderImage(settings.width, settings.height, frames, pixels);
+				t = getCurrentTime() - start;
+			}
+
+			RegressionPoint p;
+			p.frames = frames;
+			p.runs = (uint)times.size();
+			p.error = compareImages(asImage(pixels, settings.width, settings.height), reference);
+			for (double t : times)
+				p.meanSeconds += t / times.size();
+			for (double t : times)
+				p.stddevSeconds += (t - p.meanSeconds) * (t - p.meanSeconds);
+			p.stddevSeconds = times.size() > 1 ? sqrt(p.stddevSeconds / (times.size() - 1)) : 0.0;
+			points.push_back(p);
+
+			printf("%8u %12.6g %10.3g %10.5g %12.3f %10.3f", frames, p.error.relMSE, p.error.relMSEStdErr, p.error.rmse,
+				p.meanSeconds * 1e3, p.stddevSeconds * 1e3);
+
+			const RegressionPoint* b = basePoints ? findPoint(*basePoints, frames) : nullptr;
+			if (!b)
+			{
+				printf("\n");
+				continue;
+			}
+
+			//Error: difference of two means of per-pixel terms. Time: Welch's z over the runs.
+			double errorSE = sqrt(p.error.relMSEStdErr * p.error.relMSEStdErr + b->error.relMSEStdErr * b->error.relMSEStdErr);
+			double errorZ = errorSE > 0.0 ? (p.error.relMSE - b->error.relMSE) / errorSE : 0.0;
+			double timeSE = sqrt(p.stddevSeconds * p.stddevSeconds / p.runs + b->stddevSeconds * b->stddevSeconds / _max(b->runs, 1u));
+			double timeZ = timeSE > 0.0 ? (p.meanSeconds - b->meanSeconds) / timeSE : 0.0;
+			double errorChange = p.error.relMSE / b->error.relMSE - 1.0;
+			double timeChange = p.meanSeconds / b->meanSeconds - 1.0;
+
+			bool errorWorse = errorZ > settings.sigmas && errorChange > settings.tolerance;
+			bool timeWorse = timeZ > settings.sigmas && timeChange > settings.tolerance;
+			printf(" | %+8.1f%% %6.1f %+8.1f%% %6.1f%s%s\n", 100.0 * errorChange, errorZ, 100.0 * timeChange, timeZ,
+				errorWorse ? "  ERROR REGRESSION" : "", timeWorse ? "  TIME REGRESSION" : "");
+
+			numRegressions += errorWorse + timeWorse;
+			sceneRegressed |= errorWorse || timeWorse;
+		}
+
+		double tte = timeToError(points, settings.relMSETarget);
+		printf("  time to relMSE %g: %.3f s", settings.relMSETarget, tte);
+		if (basePoints)
+		{
+			double baseTte = timeToError(*basePoints, settings.relMSETarget);
+			double change = tte / baseTte - 1.0;
+			//A slower time to quality counts once its inputs have moved beyond their noise
+			bool worse = sceneRegressed && change > settings.tolerance;
+			printf(" (baseline %.3f s, %+.1f%%)%s", baseTte, 100.0 * change, worse ? "  SLOWER TO QUALITY" : "");
+			numRegressions += worse;
+		}
+		printf("\n\n");
+	}
+
+	writeResults(dir + "/latest.csv", results);
+	if (update)
+	{
+		writeResults(dir + "/baseline.csv", results);
+		printf("Baseline written to %s/baseline.csv\n", dir.c_str());
+		return 0;
+	}
+
+	if (haveBaseline)
+		printf("%u regression%s\n", numRegressions, numRegressions == 1 ? "" : "s");
+	return numRegressions;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "DXRPathTracer.h"
+
+struct RegressionSettings
+{
+	uint width = 400;
+	uint height = 225;
+	vector<uint> frameCounts = { 1, 4, 16, 64 };	//frames of numSamplesPerFrame paths each
+	uint referenceFrames = 4096;
+	uint timingRuns = 5;
+	double relMSETarget = 0.01;		//the error whose time to reach is compared
+	double sigmas = 3.0;			//how far outside the noise a change has to be...
+	double tolerance = 0.05;		//...and how large relative to the baseline, to count
+};
+
+//Renders fixed scenes from fixed cameras at each frame count and measures relMSE against
+//reference images and the time taken, then compares both with dir/baseline.csv.
+//The figure of merit is the time to reach relMSETarget: equal quality in less time.
+//update renders any missing references and makes this run the new baseline.
+//Returns the number of regressions, 0 when updating.
+uint runRegression(DXRPathTracer* tracer, const string& dir, bool update, const RegressionSettings& settings = RegressionSettings());
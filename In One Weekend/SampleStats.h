@@ -0,0 +1,46 @@
+#pragma once
+#include "basic_types.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//Summary of a set of timings or other samples, in their unit
+struct SampleStats
+{
+	uint count = 0;
+	double mean = 0.0;
+	double stddev = 0.0;	//of the samples, 0 with fewer than two
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+};
+
+//Nearest rank, p from 0 to 1; sorted must not be empty
+template<typename T>
+inline double percentile(const std::vector<T>& sorted, double p)
+{
+	size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+template<typename T>
+inline SampleStats sampleStats(std::vector<T> samples)
+{
+	SampleStats s;
+	s.count = (uint)samples.size();
+	if (samples.empty())
+		return s;
+
+	std::sort(samples.begin(), samples.end());
+	for (T x : samples)
+		s.mean += double(x) / samples.size();
+	for (T x : samples)
+		s.stddev += (x - s.mean) * (x - s.mean);
+	s.stddev = samples.size() > 1 ? std::sqrt(s.stddev / (samples.size() - 1)) : 0.0;
+	s.p50 = percentile(samples, 0.50);
+	s.p95 = percentile(samples, 0.95);
+	s.p99 = percentile(samples, 0.99);
+	s.max = samples.back();
+	return s;
+}
@@ -1,8 +1,9 @@
 #include "Scene.h"
-#include "dxHelper.h"
+#include "Error.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 #include <map>
+#include <memory>
 
 class compTynyIdx
 {
@@ -335,6 +336,8 @@ void SceneLoader::initializeGeometryFromMeshes(Scene* scene, const vector<Mesh*>
 
 	for (uint i = 0; i < numObjs; ++i)
 	{
+		meshes[i]->trackMemory();
+
 		uint nowVertices = uint(meshes[i]->vtxArr.size());
 		uint nowTridices = uint(meshes[i]->tdxArr.size());
 
@@ -363,6 +366,7 @@ void SceneLoader::computeModelMatrices(Scene* scene)
 	{
 		obj.modelMatrix = composeMatrix(obj.translation, obj.rotation, obj.scale);
 	}
+	scene->trackMemory();
 }
 
 Scene* SceneLoader::push_simpleSphere()
@@ -423,6 +427,7 @@ Scene* SceneLoader::push_RayTracingInOneWeekend()
 	
 	vector<Mesh*> meshes;
 	meshes.push_back(&ground);
+	vector<unique_ptr<Mesh>> smallSpheres;
 
 	vector<Material>& mtlArr = scene->mtlArr;
 
@@ -442,8 +447,8 @@ Scene* SceneLoader::push_RayTracingInOneWeekend()
 			{
 				if (choose_mat < 0.8)
 				{
-					Mesh* smallSphere = new Mesh(generateSphereMesh(center, 0.2f));
-					meshes.push_back(smallSphere);
+					smallSpheres.emplace_back(new Mesh(generateSphereMesh(center, 0.2f)));
+					meshes.push_back(smallSpheres.back().get());
 					float3 albedo = random3();
 					Material smallSphereMtl;
 					smallSphereMtl.type = MaterialType::Lambertian;
@@ -452,8 +457,8 @@ Scene* SceneLoader::push_RayTracingInOneWeekend()
 				}
 				else if (choose_mat < 0.95)
 				{
-					Mesh* smallSphere = new Mesh(generateSphereMesh(center, 0.2f));
-					meshes.push_back(smallSphere);
+					smallSpheres.emplace_back(new Mesh(generateSphereMesh(center, 0.2f)));
+					meshes.push_back(smallSpheres.back().get());
 					float3 albedo = random3(0.5, 1);
 					float fuzz = random_float(0, 0.5);
 					Material smallSphereMtl;
@@ -464,8 +469,8 @@ Scene* SceneLoader::push_RayTracingInOneWeekend()
 				}
 				else
 				{
-					Mesh* smallSphere = new Mesh(generateSphereMesh(center, 0.2f));
-					meshes.push_back(smallSphere);
+					smallSpheres.emplace_back(new Mesh(generateSphereMesh(center, 0.2f)));
+					meshes.push_back(smallSpheres.back().get());
 					Material smallSphereMtl;
 					smallSphereMtl.type = MaterialType::Dielectric;
 					smallSphereMtl.refractionIndex = 1.5;
@@ -516,4 +521,56 @@ Scene* SceneLoader::push_RayTracingInOneWeekend()
 	computeModelMatrices(scene);
 
 	return scene;
-}
\ No newline at end of file
+}
+
+Scene* SceneLoader::push_CornellBox()
+{
+	Scene* scene = new Scene;
+	sceneArr.push_back(scene);
+
+	//The room is open toward +x, where the default camera sits
+	Mesh floor = generateRectangleMesh(float3(0, 0, 0), float3(4, 0, 4), FaceDir::up);
+	Mesh ceiling = generateRectangleMesh(float3(0, 4, 0), float3(4, 0, 4), FaceDir::down);
+	Mesh backWall = generateRectangleMesh(float3(-2, 2, 0), float3(0, 4, 4), FaceDir::right);
+	Mesh redWall = generateRectangleMesh(float3(0, 2, -2), float3(4, 4, 0), FaceDir::front);
+	Mesh greenWall = generateRectangleMesh(float3(0, 2, 2), float3(4, 4, 0), FaceDir::back);
+	Mesh light = generateRectangleMesh(float3(0, 3.99, 0), float3(1, 0, 1), FaceDir::down);
+	Mesh sphere1 = generateSphereMesh(float3(-0.8, 0.7, -0.7), 0.7f);
+	Mesh sphere2 = generateSphereMesh(float3(0.6, 0.6, 0.8), 0.6f);
+
+	initializeGeometryFromMeshes(scene, { &floor, &ceiling, &backWall, &redWall, &greenWall, &light, &sphere1, &sphere2 });
+
+	vector<Material>& mtlArr = scene->mtlArr;
+	mtlArr.resize(8);
+
+	for (uint i = 0; i < 3; i++)
+	{
+		mtlArr[i].type = MaterialType::Lambertian;
+		mtlArr[i].albedo = float3(0.73, 0.73, 0.73);
+	}
+
+	mtlArr[3].type = MaterialType::Lambertian;
+	mtlArr[3].albedo = float3(0.65, 0.05, 0.05);
+
+	mtlArr[4].type = MaterialType::Lambertian;
+	mtlArr[4].albedo = float3(0.12, 0.45, 0.15);
+
+	mtlArr[5].type = MaterialType::Emissive;
+	mtlArr[5].emittance = float3(15, 15, 15);
+
+	mtlArr[6].type = MaterialType::Lambertian;
+	mtlArr[6].albedo = float3(0.73, 0.73, 0.73);
+
+	mtlArr[7].type = MaterialType::Dielectric;
+	mtlArr[7].refractionIndex = 1.5f;
+
+	for (uint i = 0; i < scene->objArr.size(); i++)
+	{
+		scene->objArr[i].materialIdx = i;
+		scene->objArr[i].translation = float3(0);
+	}
+
+	computeModelMatrices(scene);
+
+	return scene;
+}
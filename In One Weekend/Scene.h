@@ -1,5 +1,6 @@
 #pragma once
 #include "basic_math.h"
+#include "MemoryStats.h"
 
 //Mesh
 struct Vertex
@@ -15,14 +16,9 @@ struct Mesh
 {
 	vector<Vertex> vtxArr;
 	vector<Tridex> tdxArr;
-};
+	TrackedBytes memory{ MemoryTag::Meshes };
 
-struct GPUMesh
-{
-	uint numVertices;
-	D3D12_GPU_VIRTUAL_ADDRESS vertexBufferVA;
-	uint numTridices;
-	D3D12_GPU_VIRTUAL_ADDRESS tridexBufferVA;
+	void trackMemory() { memory.set(vectorBytes(vtxArr) + vectorBytes(tdxArr)); }
 };
 
 Mesh loadMeshFromOBJFile(const char* filename, bool optimizeVertexCount);
@@ -44,6 +40,7 @@ namespace MaterialType
 		Lambertian,
 		Metal,
 		Dielectric,
+		Emissive,
 
 		Count
 	};
@@ -57,6 +54,7 @@ struct Material
 	float3 albedo;
 	float3 opacity;
 	float3 eta;
+	float3 emittance = float3(0.f);
 	float fuzz;
 	float refractionIndex;
 	
@@ -93,16 +91,32 @@ class Scene
 	vector<Vertex> vtxArr;
 	vector<Tridex> tdxArr;
 	vector<Material> mtlArr;
+	TrackedBytes objMemory{ MemoryTag::SceneObjects };
+	TrackedBytes vtxMemory{ MemoryTag::SceneVertices };
+	TrackedBytes tdxMemory{ MemoryTag::SceneTridices };
+	TrackedBytes mtlMemory{ MemoryTag::SceneMaterials };
 
 	friend class SceneLoader;
+	friend class SceneBenchmark;
 
 public:
+	//Gives the memory back too
 	void clear()
 	{
-		objArr.clear();
-		vtxArr.clear();
-		tdxArr.clear();
-		mtlArr.clear();
+		vector<SceneObject>().swap(objArr);
+		vector<Vertex>().swap(vtxArr);
+		vector<Tridex>().swap(tdxArr);
+		vector<Material>().swap(mtlArr);
+		trackMemory();
+	}
+
+	//Brings the memory counters up to date after the arrays change
+	void trackMemory()
+	{
+		objMemory.set(vectorBytes(objArr));
+		vtxMemory.set(vectorBytes(vtxArr));
+		tdxMemory.set(vectorBytes(tdxArr));
+		mtlMemory.set(vectorBytes(mtlArr));
 	}
 
 	const vector<Vertex>& getVertexArray() const { return vtxArr; }
@@ -119,8 +133,11 @@ class SceneLoader
 	void initializeGeometryFromMeshes(Scene* scene, const vector<Mesh*>& meshes);
 	void computeModelMatrices(Scene* scene);
 
+	friend class SceneBenchmark;
+
 public:
 	Scene* getScene(uint sceneIdx) const { return sceneArr[sceneIdx]; }
 	Scene* push_simpleSphere();
 	Scene* push_RayTracingInOneWeekend();
+	Scene* push_CornellBox();
 };
\ No newline at end of file
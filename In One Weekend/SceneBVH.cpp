@@ -0,0 +1,348 @@
+#include "SceneBVH.h"
+#include "Profiler.h"
+#include <assert.h>
+#include <cfloat>
+
+static const uint cNumBins = 12;
+static const uint cMaxLeafSize = 4;
+static const uint cMaxStackDepth = 64;
+
+struct Bounds
+{
+	float3 lo = float3(FLT_MAX);
+	float3 hi = float3(-FLT_MAX);
+
+	void grow(const float3& p)
+	{
+		lo = float3(_min(lo.x, p.x), _min(lo.y, p.y), _min(lo.z, p.z));
+		hi = float3(_max(hi.x, p.x), _max(hi.y, p.y), _max(hi.z, p.z));
+	}
+	void grow(const Bounds& b)
+	{
+		if (b.lo.x > b.hi.x)
+			return;
+		grow(b.lo);
+		grow(b.hi);
+	}
+	float area() const
+	{
+		if (lo.x > hi.x)
+			return 0.f;
+		float3 d = hi - lo;
+		return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+//Slab test, returns the entry distance or FLT_MAX on a miss
+static inline float intersectAABB(const float3& lo, const float3& hi, const float3& origin, const float3& invDir, float tMin, float tMax)
+{
+	float tx1 = (lo.x - origin.x) * invDir.x, tx2 = (hi.x - origin.x) * invDir.x;
+	float ty1 = (lo.y - origin.y) * invDir.y, ty2 = (hi.y - origin.y) * invDir.y;
+	float tz1 = (lo.z - origin.z) * invDir.z, tz2 = (hi.z - origin.z) * invDir.z;
+
+	float tNear = _max(_max(_min(tx1, tx2), _min(ty1, ty2)), _max(_min(tz1, tz2), tMin));
+	float tFar = _min(_min(_max(tx1, tx2), _max(ty1, ty2)), _min(_max(tz1, tz2), tMax));
+
+	return tNear <= tFar ? tNear : FLT_MAX;
+}
+
+//Moller-Trumbore
+static inline bool intersectTriangle(const float3& p0, const float3& edge1, const float3& edge2, const Ray& ray, float tMax, float& t, float& u, float& v)
+{
+	float3 pvec = cross(ray.direction, edge2);
+	float det = dot(edge1, pvec);
+	if (fabsf(det) < 1e-12f)
+		return false;
+
+	float invDet = 1.f / det;
+	float3 tvec = ray.origin - p0;
+	u = dot(tvec, pvec) * invDet;
+	if (u < 0.f || u > 1.f)
+		return false;
+
+	float3 qvec = cross(tvec, edge1);
+	v = dot(ray.direction, qvec) * invDet;
+	if (v < 0.f || u + v > 1.f)
+		return false;
+
+	t = dot(edge2, qvec) * invDet;
+	return t > ray.tMin && t < tMax;
+}
+
+void SceneBVH::build(const Scene* scene)
+{
+	ProfileScope scope(ProfileZone::SceneBVH);
+
+	nodeArr.clear();
+	triArr.clear();
+
+	const vector<Vertex>& vtxArr = scene->getVertexArray();
+	const vector<Tridex>& tdxArr = scene->getTridexArray();
+
+	for (uint objIdx = 0; objIdx < scene->numObjects(); ++objIdx)
+	{
+		const SceneObject& obj = scene->getObject(objIdx);
+		for (uint i = 0; i < obj.numTridices; ++i)
+		{
+			const Tridex& tdx = tdxArr[obj.tridexOffset + i];
+			float3 p0 = transformPoint(obj.modelMatrix, vtxArr[obj.vertexOffset + tdx.x].position);
+			float3 p1 = transformPoint(obj.modelMatrix, vtxArr[obj.vertexOffset + tdx.y].position);
+			float3 p2 = transformPoint(obj.modelMatrix, vtxArr[obj.vertexOffset + tdx.z].position);
+
+			Triangle tri;
+			tri.p0 = p0;
+			tri.edge1 = p1 - p0;
+			tri.edge2 = p2 - p0;
+			tri.objIdx = objIdx;
+			tri.primIdx = i;
+			triArr.push_back(tri);
+		}
+	}
+
+	if (triArr.empty())
+		return;
+
+	vector<float3> centroidArr(triArr.size());
+	for (size_t i = 0; i < triArr.size(); ++i)
+		centroidArr[i] = triArr[i].p0 + (triArr[i].edge1 + triArr[i].edge2) / 3.f;
+
+	nodeArr.reserve(2 * triArr.size());
+	nodeArr.resize(1);
+	nodeArr[0].leftOrFirst = 0;
+	nodeArr[0].count = (uint)triArr.size();
+	subdivide(0, centroidArr);
+}
+
+//Binned SAH split, recursing until leaves are small or splitting stops paying off
+void SceneBVH::subdivide(uint nodeIdx, vector<float3>& centroidArr)
+{
+	uint first = nodeArr[nodeIdx].leftOrFirst;
+	uint count = nodeArr[nodeIdx].count;
+
+	Bounds bounds, centroidBounds;
+	for (uint i = first; i < first + count; ++i)
+	{
+		const Triangle& tri = triArr[i];
+		bounds.grow(tri.p0);
+		bounds.grow(tri.p0 + tri.edge1);
+		bounds.grow(tri.p0 + tri.edge2);
+		centroidBounds.grow(centroidArr[i]);
+	}
+	nodeArr[nodeIdx].boundsMin = bounds.lo;
+	nodeArr[nodeIdx].boundsMax = bounds.hi;
+
+	if (count <= cMaxLeafSize)
+		return;
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint bestSplit = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float lo = centroidBounds.lo[axis];
+		float hi = centroidBounds.hi[axis];
+		if (hi <= lo)
+			continue;
+
+		Bounds binBounds[cNumBins];
+		uint binCount[cNumBins] = {};
+		float scale = cNumBins / (hi - lo);
+
+		for (uint i = first; i < first + count; ++i)
+		{
+			uint b = _min((uint)((centroidArr[i][axis] - lo) * scale), cNumBins - 1);
+			const Triangle& tri = triArr[i];
+			binBounds[b].grow(tri.p0);
+			binBounds[b].grow(tri.p0 + tri.edge1);
+			binBounds[b].grow(tri.p0 + tri.edge2);
+			binCount[b]++;
+		}
+
+		float rightArea[cNumBins - 1];
+		uint rightCount[cNumBins - 1];
+		Bounds acc;
+		uint accCount = 0;
+		for (uint b = cNumBins - 1; b > 0; --b)
+		{
+			acc.grow(binBounds[b]);
+			accCount += binCount[b];
+			rightArea[b - 1] = acc.area();
+			rightCount[b - 1] = accCount;
+		}
+
+		acc = Bounds();
+		accCount = 0;
+		for (uint b = 0; b < cNumBins - 1; ++b)
+		{
+			acc.grow(binBounds[b]);
+			accCount += binCount[b];
+			float cost = accCount * acc.area() + rightCount[b] * rightArea[b];
+			if (accCount > 0 && rightCount[b] > 0 && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	if (bestAxis < 0 || bestCost >= count * bounds.area())
+		return;
+
+	float lo = centroidBounds.lo[bestAxis];
+	float scale = cNumBins / (centroidBounds.hi[bestAxis] - lo);
+
+	uint i = first;
+	uint j = first + count - 1;
+	while (i <= j)
+	{
+		uint b = _min((uint)((centroidArr[i][bestAxis] - lo) * scale), cNumBins - 1);
+		if (b <= bestSplit)
+		{
+			++i;
+		}
+		else
+		{
+			swap(triArr[i], triArr[j]);
+			swap(centroidArr[i], centroidArr[j]);
+			--j;
+		}
+	}
+
+	uint leftCount = i - first;
+	if (leftCount == 0 || leftCount == count)
+		return;
+
+	uint leftIdx = (uint)nodeArr.size();
+	nodeArr.resize(leftIdx + 2);
+
+	nodeArr[leftIdx].leftOrFirst = first;
+	nodeArr[leftIdx].count = leftCount;
+	nodeArr[leftIdx + 1].leftOrFirst = i;
+	nodeArr[leftIdx + 1].count = count - leftCount;
+
+	nodeArr[nodeIdx].leftOrFirst = leftIdx;
+	nodeArr[nodeIdx].count = 0;
+
+	subdivide(leftIdx, centroidArr);
+	subdivide(leftIdx + 1, centroidArr);
+}
+
+static void recordTraversal(TraversalStats* stats, uint nodesVisited, uint trianglesTested, bool hit)
+{
+	if (stats == nullptr)
+		return;
+	stats->rays++;
+	stats->nodesVisited += nodesVisited;
+	stats->trianglesTested += trianglesTested;
+	stats->hits += hit ? 1 : 0;
+}
+
+bool SceneBVH::intersect(const Ray& ray, HitInfo& hit, TraversalStats* stats) const
+{
+	if (nodeArr.empty())
+		return false;
+
+	float3 invDir = float3(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+	float tMax = ray.tMax;
+	bool found = false;
+
+	uint stack[cMaxStackDepth];
+	uint stackSize = 0;
+	stack[stackSize++] = 0;
+	uint nodesVisited = 0, trianglesTested = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodeArr[stack[--stackSize]];
+		++nodesVisited;
+		if (intersectAABB(node.boundsMin, node.boundsMax, ray.origin, invDir, ray.tMin, tMax) == FLT_MAX)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (uint i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+			{
+				const Triangle& tri = triArr[i];
+				float t, u, v;
+				++trianglesTested;
+				if (intersectTriangle(tri.p0, tri.edge1, tri.edge2, ray, tMax, t, u, v))
+				{
+					tMax = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hit.objIdx = tri.objIdx;
+					hit.primIdx = tri.primIdx;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		//Push the far child first so the near one is visited next
+		uint left = node.leftOrFirst;
+		uint right = left + 1;
+		float tLeft = intersectAABB(nodeArr[left].boundsMin, nodeArr[left].boundsMax, ray.origin, invDir, ray.tMin, tMax);
+		float tRight = intersectAABB(nodeArr[right].boundsMin, nodeArr[right].boundsMax, ray.origin, invDir, ray.tMin, tMax);
+		if (tLeft > tRight)
+		{
+			swap(tLeft, tRight);
+			swap(left, right);
+		}
+
+		assert(stackSize + 2 <= cMaxStackDepth);
+		if (tRight != FLT_MAX)
+			stack[stackSize++] = right;
+		if (tLeft != FLT_MAX)
+			stack[stackSize++] = left;
+	}
+
+	recordTraversal(stats, nodesVisited, trianglesTested, found);
+	return found;
+}
+
+bool SceneBVH::occluded(const Ray& ray, TraversalStats* stats) const
+{
+	if (nodeArr.empty())
+		return false;
+
+	float3 invDir = float3(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+
+	uint stack[cMaxStackDepth];
+	uint stackSize = 0;
+	stack[stackSize++] = 0;
+	uint nodesVisited = 0, trianglesTested = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodeArr[stack[--stackSize]];
+		++nodesVisited;
+		if (intersectAABB(node.boundsMin, node.boundsMax, ray.origin, invDir, ray.tMin, ray.tMax) == FLT_MAX)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (uint i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+			{
+				const Triangle& tri = triArr[i];
+				float t, u, v;
+				++trianglesTested;
+				if (intersectTriangle(tri.p0, tri.edge1, tri.edge2, ray, ray.tMax, t, u, v))
+				{
+					recordTraversal(stats, nodesVisited, trianglesTested, true);
+					return true;
+				}
+			}
+			continue;
+		}
+
+		assert(stackSize + 2 <= cMaxStackDepth);
+		stack[stackSize++] = node.leftOrFirst + 1;
+		stack[stackSize++] = node.leftOrFirst;
+	}
+
+	recordTraversal(stats, nodesVisited, trianglesTested, false);
+	return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "Scene.h"
+
+struct Ray
+{
+	float3 origin;
+	float3 direction;
+	float tMin;
+	float tMax;
+};
+
+struct HitInfo
+{
+	float t;
+	float u;
+	float v;
+	uint objIdx;
+	uint primIdx;
+};
+
+//Traversal work; each thread keeps its own and the caller adds them up
+struct TraversalStats
+{
+	uint64 rays = 0;
+	uint64 nodesVisited = 0;
+	uint64 trianglesTested = 0;
+	uint64 hits = 0;
+
+	void add(const TraversalStats& other)
+	{
+		rays += other.rays;
+		nodesVisited += other.nodesVisited;
+		trianglesTested += other.trianglesTested;
+		hits += other.hits;
+	}
+};
+
+//CPU-side BVH over the world-space triangles of a Scene.
+//intersect() finds the closest hit, occluded() stops at the first one.
+class SceneBVH
+{
+	struct Node
+	{
+		float3 boundsMin;
+		float3 boundsMax;
+		uint leftOrFirst;	//left child index for interior nodes, first triangle for leaves
+		uint count;			//0 for interior nodes
+	};
+
+	struct Triangle
+	{
+		float3 p0;
+		float3 edge1;
+		float3 edge2;
+		uint objIdx;
+		uint primIdx;
+	};
+
+	vector<Node> nodeArr;
+	vector<Triangle> triArr;
+
+	void subdivide(uint nodeIdx, vector<float3>& centroidArr);
+
+public:
+	void build(const Scene* scene);
+
+	bool intersect(const Ray& ray, HitInfo& hit, TraversalStats* stats = nullptr) const;
+	bool occluded(const Ray& ray, TraversalStats* stats = nullptr) const;
+
+	uint numNodes() const { return (uint)nodeArr.size(); }
+	uint numTriangles() const { return (uint)triArr.size(); }
+};
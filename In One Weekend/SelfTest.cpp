@@ -0,0 +1,28 @@
+//The self-tests that need no window or device, as one executable for CTest. Each returns its
+//failure count; see CMakeLists.txt.
+#include "MemoryCheck.h"
+#include "PixelEncoding.h"
+#include "Error.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char* argv[])
+{
+	//A name runs just that test
+	const char* only = argc > 1 ? argv[1] : nullptr;
+	uint failures = 0;
+
+	try
+	{
+		if (!only || strcmp(only, "memory") == 0)
+			failures += checkMemory();
+		if (!only || strcmp(only, "encodings") == 0)
+			failures += checkEncodings();
+	}
+	catch (const Error&)
+	{
+		//Already printed
+		return 1;
+	}
+	return failures > 0 ? 1 : 0;
+}
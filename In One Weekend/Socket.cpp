@@ -0,0 +1,197 @@
+#include "Socket.h"
+#include <string>
+
+#ifdef _WIN32
+#include "pch.h"
+typedef int socklen_t;
+static const intptr_t cInvalidSocket = (intptr_t)INVALID_SOCKET;
+static void closeHandle(intptr_t h) { closesocket((SOCKET)h); }
+static bool wouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+static const intptr_t cInvalidSocket = -1;
+static void closeHandle(intptr_t h) { ::close((int)h); }
+static bool wouldBlock() { return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR; }
+#endif
+
+static const uint cPollMs = 100;
+
+//Winsock needs one WSAStartup per process before the first socket
+static void startup()
+{
+#ifdef _WIN32
+	static bool started = false;
+	if (!started)
+	{
+		WSADATA wsaData;
+		started = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+	}
+#endif
+}
+
+//select() on one socket; true when it is ready
+static bool waitFor(intptr_t h, bool write, uint timeoutMs)
+{
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(h, &set);
+
+	timeval tv;
+	tv.tv_sec = timeoutMs / 1000;
+	tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+	return select(int(h + 1), write ? nullptr : &set, write ? &set : nullptr, nullptr, &tv) > 0;
+}
+
+TcpSocket::TcpSocket() : handle(cInvalidSocket)
+{
+}
+
+TcpSocket& TcpSocket::operator=(TcpSocket&& other)
+{
+	if (this != &other)
+	{
+		close();
+		handle = other.handle;
+		other.handle = cInvalidSocket;
+	}
+	return *this;
+}
+
+bool TcpSocket::isOpen() const
+{
+	return handle != cInvalidSocket;
+}
+
+void TcpSocket::close()
+{
+	if (isOpen())
+		closeHandle(handle);
+	handle = cInvalidSocket;
+}
+
+bool TcpSocket::listen(uint16 port, bool loopbackOnly)
+{
+	startup();
+	close();
+
+	handle = (intptr_t)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (!isOpen())
+		return false;
+
+	int reuse = 1;
+	setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+
+	if (::bind(handle, (const sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(handle, 8) != 0)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+uint16 TcpSocket::getPort() const
+{
+	sockaddr_in addr = {};
+	socklen_t len = sizeof(addr);
+	if (getsockname(handle, (sockaddr*)&addr, &len) != 0)
+		return 0;
+	return ntohs(addr.sin_port);
+}
+
+TcpSocket TcpSocket::accept(uint timeoutMs)
+{
+	if (!isOpen() || !waitFor(handle, false, timeoutMs))
+		return TcpSocket();
+
+	TcpSocket client((intptr_t)::accept(handle, nullptr, nullptr));
+	if (!client.isOpen())
+		return client;
+
+#ifdef _WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket((SOCKET)client.handle, FIONBIO, &nonBlocking);
+#else
+	fcntl((int)client.handle, F_SETFL, fcntl((int)client.handle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	//Tiles are written whole; waiting to coalesce them only adds latency
+	int noDelay = 1;
+	setsockopt(client.handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	return client;
+}
+
+bool TcpSocket::connect(const char* host, uint16 port)
+{
+	startup();
+	close();
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* result = nullptr;
+	if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &result) != 0)
+		return false;
+
+	for (addrinfo* ai = result; ai != nullptr && !isOpen(); ai = ai->ai_next)
+	{
+		handle = (intptr_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (isOpen() && ::connect(handle, ai->ai_addr, (socklen_t)ai->ai_addrlen) != 0)
+			close();
+	}
+	freeaddrinfo(result);
+	return isOpen();
+}
+
+bool TcpSocket::send(const void* data, uint64 size, const std::atomic<bool>& keepGoing)
+{
+	const char* p = (const char*)data;
+	while (size > 0)
+	{
+		if (!keepGoing)
+			return false;
+		if (!waitFor(handle, true, cPollMs))
+			continue;
+
+		int chunk = size < (1 << 20) ? (int)size : (1 << 20);
+		int sent = (int)::send(handle, p, chunk, 0);
+		if (sent < 0)
+		{
+			if (wouldBlock())
+				continue;
+			return false;
+		}
+		p += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+bool TcpSocket::receive(void* data, uint64 size)
+{
+	char* p = (char*)data;
+	while (size > 0)
+	{
+		int chunk = size < (1 << 20) ? (int)size : (1 << 20);
+		int received = (int)::recv(handle, p, chunk, 0);
+		if (received <= 0)
+			return false;
+		p += received;
+		size -= received;
+	}
+	return true;
+}
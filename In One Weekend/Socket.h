@@ -0,0 +1,36 @@
+#pragma once
+#include "basic_types.h"
+#include <atomic>
+#include <cstdint>
+
+//TCP socket over Winsock or BSD sockets. Server-side sockets wait with select() and a short timeout,
+//so a worker notices a stop request even while its peer has stalled.
+class TcpSocket
+{
+	intptr_t handle;
+
+public:
+	TcpSocket();
+	explicit TcpSocket(intptr_t handle) : handle(handle) {}
+	~TcpSocket() { close(); }
+	TcpSocket(TcpSocket&& other) : handle(other.handle) { other.handle = TcpSocket().handle; }
+	TcpSocket& operator=(TcpSocket&& other);
+	TcpSocket(const TcpSocket&) = delete;
+	TcpSocket& operator=(const TcpSocket&) = delete;
+
+	bool isOpen() const;
+	void close();
+
+	//port 0 picks a free one, see getPort
+	bool listen(uint16 port, bool loopbackOnly);
+	uint16 getPort() const;
+	//Closed socket if nobody connected within timeoutMs; accepted sockets are non-blocking
+	TcpSocket accept(uint timeoutMs);
+
+	//Blocking client connection
+	bool connect(const char* host, uint16 port);
+
+	//Sends everything unless the connection fails or keepGoing turns false
+	bool send(const void* data, uint64 size, const std::atomic<bool>& keepGoing);
+	bool receive(void* data, uint64 size);
+};
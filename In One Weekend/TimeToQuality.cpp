@@ -0,0 +1,123 @@
+#include "TimeToQuality.h"
+#include "ImageMetrics.h"
+#include "timer.h"
+#include <fstream>
+
+struct QualityPoint
+{
+	uint frames;
+	double seconds;
+	uint64 rays;
+	ImageError error;
+};
+
+static const char* cGuidePhaseNames[GuidePhase::Count] = { "off", "training", "rendering" };
+
+void runTimeToQuality(DXRPathTracer* tracer, const string& referencePath, const string& csvPath, const TimeToQualitySettings& settings)
+{
+	if (settings.relMSETargets.empty() || settings.maxFrames == 0)
+		throw Error("Time to quality needs a relMSE target and at least one frame.");
+
+	vector<float> refPixels;
+	uint refW = 0, refH = 0;
+	readPFM(referencePath, refPixels, refW, refH);
+	TracedResult reference;
+	reference.data = refPixels.data();
+	reference.width = refW;
+	reference.height = refH;
+	reference.pixelSize = 4 * sizeof(float);
+	reference.format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+
+	ofstream file(csvPath, ios::trunc);
+	if (!file)
+		throw Error(("Cannot create " + csvPath).c_str());
+
+	double lowestTarget = settings.relMSETargets[0];
+	for (double target : settings.relMSETargets)
+		lowestTarget = _min(lowestTarget, target);
+
+	//Rays are counted on the GPU; the counting is part of the measured time
+	bool hadRayStats = tracer->isCollectingRayStats();
+	if (!hadRayStats)
+		tracer->setRayStatistics(true);
+	tracer->takeRayStats();
+	//References come from ordinary renders; drawing other random numbers keeps this run's
+	//samples out of them, which would bias relMSE low
+	uint rngFrameOffset = tracer->getRngFrameOffset();
+	tracer->setRngFrameOffset(cDecorrelatedFrameOffset);
+	//Starts the accumulation over from the current camera
+	tracer->setCamera(tracer->getCamera());
+
+	printf("Time to quality against %s: %u paths per pixel per frame, up to %u bounces, path guiding %s, denoiser %s\n",
+		referencePath.c_str(), tracer->getSamplesPerFrame(), tracer->getMaxPathLength(),
+		cGuidePhaseNames[tracer->getPathGuidePhase()], tracer->isDenoising() ? "on" : "off");
+	printf("%8s %10s %12s %12s %10s %14s\n", "frames", "seconds", "Grays", "relMSE", "stderr", "1/(relMSE s)");
+
+	vector<QualityPoint> points;
+	double seconds = 0.0;
+	uint64 rays = 0;
+	uint nextCheckpoint = 1;
+	for (uint frame = 1; frame <= settings.maxFrames; ++frame)
+	{
+		double start = getCurrentTime();
+		tracer->update();
+		TracedResult result = tracer->shootRays();
+		seconds += getCurrentTime() - start;
+		rays += tracer->takeRayStats().totalRays();
+
+		bool last = frame == settings.maxFrames || seconds >= settings.maxSeconds;
+		if (frame < nextCheckpoint && !last)
+			continue;
+		nextCheckpoint = _max(frame + 1, uint(ceil(frame * settings.checkpointGrowth)));
+
+		if (result.format != DXGI_FORMAT_R32G32B32A32_FLOAT)
+			throw Error("Time to quality compares RGBA32F output; leave --encoding at rgba32f.");
+		if (result.width != refW || result.height != refH)
+			throw Error((referencePath + " must be " + to_string(result.width) + "x" + to_string(result.height) + ", the size being traced.").c_str());
+
+		QualityPoint p;
+		p.frames = frame;
+		p.seconds = seconds;
+		p.rays = rays;
+		p.error = compareImages(result, reference);
+		points.push_back(p);
+
+		printf("%8u %10.3f %12.3f %12.6g %10.3g %14.4g\n", p.frames, p.seconds, p.rays * 1e-9, p.error.relMSE,
+			p.error.relMSEStdErr, 1.0 / (p.error.relMSE * p.seconds));
+
+		if (last || p.error.relMSE <= lowestTarget)
+			break;
+	}
+
+	if (!hadRayStats)
+		tracer->setRayStatistics(false);
+	tracer->setRngFrameOffset(rngFrameOffset);
+
+	vector<double> frames, times, grays, relMSE;
+	file << "frames,seconds,rays,relMSE,relMSEStdErr,efficiency\n";
+	char line[256];
+	for (const QualityPoint& p : points)
+	{
+		frames.push_back(p.frames);
+		times.push_back(p.seconds);
+		grays.push_back(p.rays * 1e-9);
+		relMSE.push_back(p.error.relMSE);
+
+		snprintf(line, sizeof(line), "%u,%.6f,%llu,%.9g,%.9g,%.9g\n", p.frames, p.seconds, (unsigned long long)p.rays,
+			p.error.relMSE, p.error.relMSEStdErr, 1.0 / (p.error.relMSE * p.seconds));
+		file << line;
+	}
+	if (!file)
+		throw Error(("Failed to write " + csvPath).c_str());
+
+	//Beyond the measured range the times are extrapolated as 1/cost, and marked so
+	printf("%12s %10s %10s %10s %14s\n", "relMSE", "seconds", "frames", "Grays", "1/(relMSE s)");
+	for (double target : settings.relMSETargets)
+	{
+		double t = costToError(times, relMSE, target);
+		bool measured = relMSE.front() >= target && relMSE.back() <= target;
+		printf("%12g %10.3f %10.1f %10.3f %14.4g%s\n", target, t, costToError(frames, relMSE, target),
+			costToError(grays, relMSE, target), 1.0 / (target * t), measured ? "" : "  (extrapolated)");
+	}
+	printf("Curve written to %s\n", csvPath.c_str());
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "DXRPathTracer.h"
+
+struct TimeToQualitySettings
+{
+	vector<double> relMSETargets = { 0.1, 0.03, 0.01, 0.003 };
+	uint maxFrames = 4096;
+	double maxSeconds = 120.0;		//of tracing; measuring the error is not counted
+	double checkpointGrowth = 1.2;	//frames between error measurements grow by this factor
+};
+
+//Accumulates from the tracer's current view and settings, as the window does, and measures relMSE
+//against the reference at geometrically spaced frame counts, together with the tracing time and the
+//rays traced so far. Stops at the last target, maxFrames or maxSeconds. Prints the time, frames and
+//rays to reach each target and the efficiency 1 / (relMSE x seconds), and writes the curve to csvPath.
+//The reference must be an RGBA PFM of the tracer's output size, e.g. from --render with many frames.
+//The run draws its random numbers at cDecorrelatedFrameOffset, so it shares no samples with such a render.
+void runTimeToQuality(DXRPathTracer* tracer, const string& referencePath, const string& csvPath, const TimeToQualitySettings& settings = TimeToQualitySettings());
@@ -0,0 +1,246 @@
+#include "Tonemap.h"
+#include "Error.h"
+#include "Parallel.h"
+#include <emmintrin.h>
+#include <chrono>
+
+static const uint cRowsPerJob = 16;
+
+//4x4 Bayer thresholds in [0,1), indexed [y & 3][x & 3]
+static const float cBayer[4][4] =
+{
+	{  0 / 16.f,  8 / 16.f,  2 / 16.f, 10 / 16.f },
+	{ 12 / 16.f,  4 / 16.f, 14 / 16.f,  6 / 16.f },
+	{  3 / 16.f, 11 / 16.f,  1 / 16.f,  9 / 16.f },
+	{ 15 / 16.f,  7 / 16.f, 13 / 16.f,  5 / 16.f },
+};
+
+//Polynomial log2/exp2 (degree 5), accurate to well below one 8-bit step
+static inline __m128 log2_ps(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff))), _mm_set1_ps(1.f));
+
+	__m128 p = _mm_set1_ps(-3.4436006e-2f);
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(3.1821337e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.2315303f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(2.5988452f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-3.3241990f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(3.1157899f));
+
+	return _mm_add_ps(_mm_mul_ps(p, _mm_sub_ps(m, _mm_set1_ps(1.f))), e);
+}
+
+static inline __m128 exp2_ps(__m128 x)
+{
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(129.f)), _mm_set1_ps(-126.99999f));
+
+	__m128i ipart = _mm_cvtps_epi32(_mm_sub_ps(x, _mm_set1_ps(0.5f)));
+	__m128 fpart = _mm_sub_ps(x, _mm_cvtepi32_ps(ipart));
+	__m128 expipart = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ipart, _mm_set1_epi32(127)), 23));
+
+	__m128 p = _mm_set1_ps(1.8775767e-3f);
+	p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(8.9893397e-3f));
+	p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(5.5826318e-2f));
+	p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(2.4015361e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(6.9315308e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(9.9999994e-1f));
+
+	return _mm_mul_ps(expipart, p);
+}
+
+struct TonemapConstants
+{
+	__m128 signMask;
+	__m128 exposure;
+	__m128 maxValue;
+	__m128 invGamma;
+};
+
+//Tonemaps one channel of four pixels into [0, 255]
+template<ToneOperator::Type op, TransferCurve::Type curve>
+static inline __m128 tonemapChannel(__m128 v, const TonemapConstants& k)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+
+	//max() returns its second operand for NaN, so NaNs turn into 0 here
+	v = _mm_mul_ps(_mm_andnot_ps(k.signMask, v), k.exposure);
+	v = _mm_min_ps(_mm_max_ps(v, zero), k.maxValue);
+
+	if (op == ToneOperator::Reinhard)
+	{
+		v = _mm_div_ps(v, _mm_add_ps(v, one));
+	}
+	else if (op == ToneOperator::ACES)
+	{
+		__m128 num = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+		__m128 den = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+		v = _mm_div_ps(num, den);
+	}
+	v = _mm_min_ps(v, one);
+
+	if (curve == TransferCurve::Sqrt)
+	{
+		v = _mm_sqrt_ps(v);
+	}
+	else if (curve == TransferCurve::Gamma)
+	{
+		__m128 isZero = _mm_cmple_ps(v, zero);
+		v = exp2_ps(_mm_mul_ps(log2_ps(_mm_max_ps(v, _mm_set1_ps(1e-20f))), k.invGamma));
+		v = _mm_andnot_ps(isZero, v);
+	}
+	else if (curve == TransferCurve::sRGB)
+	{
+		__m128 isLinear = _mm_cmple_ps(v, _mm_set1_ps(0.0031308f));
+		__m128 lin = _mm_mul_ps(v, _mm_set1_ps(12.92f));
+		__m128 pw = exp2_ps(_mm_mul_ps(log2_ps(_mm_max_ps(v, _mm_set1_ps(1e-20f))), _mm_set1_ps(1.f / 2.4f)));
+		pw = _mm_sub_ps(_mm_mul_ps(pw, _mm_set1_ps(1.055f)), _mm_set1_ps(0.055f));
+		v = _mm_or_ps(_mm_and_ps(isLinear, lin), _mm_andnot_ps(isLinear, pw));
+	}
+
+	return _mm_mul_ps(v, _mm_set1_ps(255.f));
+}
+
+//Four pixels at a time: transposed to one register per channel, so alpha costs nothing and
+//the packed result is assembled with shifts
+template<ToneOperator::Type op, TransferCurve::Type curve>
+static inline __m128i tonemapQuad(const float* in, __m128 offset, bool bgra, const TonemapConstants& k)
+{
+	__m128 r = _mm_loadu_ps(in + 0);
+	__m128 g = _mm_loadu_ps(in + 4);
+	__m128 b = _mm_loadu_ps(in + 8);
+	__m128 a = _mm_loadu_ps(in + 12);
+	_MM_TRANSPOSE4_PS(r, g, b, a);
+
+	//Rounding happens in cvtps, so the dither offset is centred on 0 and stays within [0, 255]
+	__m128i ri = _mm_cvtps_epi32(_mm_add_ps(tonemapChannel<op, curve>(r, k), offset));
+	__m128i gi = _mm_cvtps_epi32(_mm_add_ps(tonemapChannel<op, curve>(g, k), offset));
+	__m128i bi = _mm_cvtps_epi32(_mm_add_ps(tonemapChannel<op, curve>(b, k), offset));
+	if (bgra)
+		swap(ri, bi);
+
+	__m128i out = _mm_or_si128(ri, _mm_slli_epi32(gi, 8));
+	out = _mm_or_si128(out, _mm_slli_epi32(bi, 16));
+	return _mm_or_si128(out, _mm_set1_epi32(0xff000000));
+}
+
+template<ToneOperator::Type op, TransferCurve::Type curve>
+static void tonemapRowsT(const TracedResult& src, uint y0, uint numRows, uint8* dst, uint64 dstRowPitch, const TonemapSettings& settings)
+{
+	TonemapConstants k;
+	k.signMask = _mm_set1_ps(-0.f);
+	k.exposure = _mm_set1_ps(settings.exposure);
+	k.maxValue = _mm_set1_ps(65504.f);
+	k.invGamma = _mm_set1_ps(1.f / settings.gamma);
+	bool bgra = settings.layout == PixelLayout::BGRA8;
+
+	uint width = src.width;
+	uint width4 = width & ~3u;
+
+	for (uint j = 0; j < numRows; ++j)
+	{
+		uint y = y0 + j;
+		const float* in = (const float*)((const uint8*)src.data + uint64(y) * width * src.pixelSize);
+		uint8* out = dst + j * dstRowPitch;
+
+		const float* bayer = cBayer[y & 3];
+		__m128 offset = settings.dither ?
+			_mm_sub_ps(_mm_set_ps(bayer[3], bayer[2], bayer[1], bayer[0]), _mm_set1_ps(0.5f - 0.5f / 16.f)) :
+			_mm_setzero_ps();
+
+		uint x = 0;
+		for (; x < width4; x += 4)
+			_mm_storeu_si128((__m128i*)(out + 4 * x), tonemapQuad<op, curve>(in + 4 * x, offset, bgra, k));
+
+		if (x < width)
+		{
+			float tail[16] = {};
+			memcpy(tail, in + 4 * x, (width - x) * 4 * sizeof(float));
+
+			uint8 packed[16];
+			_mm_storeu_si128((__m128i*)packed, tonemapQuad<op, curve>(tail, offset, bgra, k));
+			memcpy(out + 4 * x, packed, (width - x) * 4);
+		}
+	}
+}
+
+template<ToneOperator::Type op>
+static void tonemapRowsOp(const TracedResult& src, uint y0, uint numRows, uint8* dst, uint64 dstRowPitch, const TonemapSettings& settings)
+{
+	switch (settings.curve)
+	{
+	case TransferCurve::Sqrt:
+		tonemapRowsT<op, TransferCurve::Sqrt>(src, y0, numRows, dst, dstRowPitch, settings);
+		break;
+	case TransferCurve::Gamma:
+		tonemapRowsT<op, TransferCurve::Gamma>(src, y0, numRows, dst, dstRowPitch, settings);
+		break;
+	case TransferCurve::sRGB:
+		tonemapRowsT<op, TransferCurve::sRGB>(src, y0, numRows, dst, dstRowPitch, settings);
+		break;
+	default:
+		throw Error("Unknown transfer curve.");
+	}
+}
+
+void tonemapRows(const TracedResult& src, uint y0, uint numRows, uint8* dst, uint64 dstRowPitch, const TonemapSettings& settings)
+{
+	if (src.pixelSize != 4 * sizeof(float))
+		throw Error("Tonemapping expects RGBA32F pixels.");
+
+	switch (settings.toneOperator)
+	{
+	case ToneOperator::Clamp:
+		tonemapRowsOp<ToneOperator::Clamp>(src, y0, numRows, dst, dstRowPitch, settings);
+		break;
+	case ToneOperator::Reinhard:
+		tonemapRowsOp<ToneOperator::Reinhard>(src, y0, numRows, dst, dstRowPitch, settings);
+		break;
+	case ToneOperator::ACES:
+		tonemapRowsOp<ToneOperator::ACES>(src, y0, numRows, dst, dstRowPitch, settings);
+		break;
+	default:
+		throw Error("Unknown tone operator.");
+	}
+}
+
+void tonemap(const TracedResult& src, uint8* dst, uint64 dstRowPitch, const TonemapSettings& settings)
+{
+	if (src.pixelSize != 4 * sizeof(float))
+		throw Error("Tonemapping expects RGBA32F pixels.");
+
+	uint numJobs = (src.height + cRowsPerJob - 1) / cRowsPerJob;
+	parallelFor(numJobs, [&](uint job)
+	{
+		uint y0 = job * cRowsPerJob;
+		uint numRows = _min(cRowsPerJob, src.height - y0);
+		tonemapRows(src, y0, numRows, dst + y0 * dstRowPitch, dstRowPitch, settings);
+	});
+}
+
+double benchmarkTonemap(uint width, uint height, uint iterations, const TonemapSettings& settings)
+{
+	vector<float> pixels(uint64(width) * height * 4);
+	for (uint64 i = 0; i < pixels.size(); ++i)
+		pixels[i] = float(i % 1021) / 256.f;
+	vector<uint8> out(uint64(width) * height * 4);
+
+	TracedResult src;
+	src.data = pixels.data();
+	src.width = width;
+	src.height = height;
+	src.pixelSize = 4 * sizeof(float);
+	src.format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+
+	//One untimed pass to fault the pages in and start the threads warm
+	tonemap(src, out.data(), width * 4, settings);
+
+	auto start = chrono::steady_clock::now();
+	for (uint i = 0; i < iterations; ++i)
+		tonemap(src, out.data(), width * 4, settings);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	return double(width) * height * iterations / seconds;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "dxHelper.h"
+
+namespace ToneOperator
+{
+	enum Type
+	{
+		Clamp,
+		Reinhard,	//x / (1 + x)
+		ACES,		//Narkowicz's fit of the ACES filmic curve
+
+		Count
+	};
+}
+
+namespace TransferCurve
+{
+	enum Type
+	{
+		Sqrt,		//what PSMain shows on screen
+		Gamma,		//x^(1/gamma)
+		sRGB,
+
+		Count
+	};
+}
+
+namespace PixelLayout
+{
+	enum Type
+	{
+		RGBA8,
+		BGRA8,
+
+		Count
+	};
+}
+
+struct TonemapSettings
+{
+	float exposure = 1.f;
+	ToneOperator::Type toneOperator = ToneOperator::Clamp;
+	TransferCurve::Type curve = TransferCurve::Sqrt;
+	float gamma = 2.2f;
+	bool dither = false;		//4x4 ordered dither instead of round to nearest
+	PixelLayout::Type layout = PixelLayout::RGBA8;
+};
+
+//Converts RGBA32F radiance to 8-bit pixels with SSE2, four pixels per step. Alpha is written as 255,
+//negative values are taken by magnitude as in PSMain and NaNs come out black.
+//dst points at the first converted row; rows are dstRowPitch bytes apart.
+void tonemapRows(const TracedResult& src, uint y0, uint numRows, uint8* dst, uint64 dstRowPitch, const TonemapSettings& settings = TonemapSettings());
+//Whole image, rows split across all cores
+void tonemap(const TracedResult& src, uint8* dst, uint64 dstRowPitch, const TonemapSettings& settings = TonemapSettings());
+
+//Converts a synthetic image repeatedly and returns the throughput in pixels per second
+double benchmarkTonemap(uint width, uint height, uint iterations, const TonemapSettings& settings = TonemapSettings());
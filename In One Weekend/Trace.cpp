@@ -0,0 +1,123 @@
+#include "Trace.h"
+#include "Error.h"
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+//A long session would otherwise grow without bound; later events are dropped and counted
+static const size_t cMaxTraceEvents = 1 << 20;
+
+struct TraceEvent
+{
+	const char* name;
+	char phase;		//'X' span, 'C' counter, 'M' thread name
+	uint tid;
+	double ts;		//us since startTrace
+	double value;	//span duration in us, or the counter value
+};
+
+static atomic<bool> gTracing{ false };
+static mutex gTraceMutex;
+static string gTracePath;
+static chrono::steady_clock::time_point gTraceStart;
+static vector<TraceEvent> gTraceEvents;
+static uint64 gDroppedEvents = 0;
+static atomic<uint> gNextTid{ 1 };
+
+static uint traceTid()
+{
+	thread_local uint tid = gNextTid++;
+	return tid;
+}
+
+static void pushEvent(const TraceEvent& e)
+{
+	lock_guard<mutex> lock(gTraceMutex);
+	if (gTraceEvents.size() < cMaxTraceEvents)
+		gTraceEvents.push_back(e);
+	else
+		++gDroppedEvents;
+}
+
+static double sinceStart(chrono::steady_clock::time_point t)
+{
+	return chrono::duration<double, micro>(t - gTraceStart).count();
+}
+
+void startTrace(const string& path)
+{
+	lock_guard<mutex> lock(gTraceMutex);
+	gTracePath = path;
+	gTraceStart = chrono::steady_clock::now();
+	gTraceEvents.clear();
+	gTraceEvents.reserve(4096);
+	gDroppedEvents = 0;
+	gTracing = true;
+}
+
+bool isTracing()
+{
+	return gTracing.load(memory_order_relaxed);
+}
+
+void traceSpan(const char* name, chrono::steady_clock::time_point start, chrono::steady_clock::time_point end)
+{
+	if (!isTracing())
+		return;
+	pushEvent({ name, 'X', traceTid(), sinceStart(start), chrono::duration<double, micro>(end - start).count() });
+}
+
+void traceCounter(const char* name, double value)
+{
+	if (!isTracing())
+		return;
+	pushEvent({ name, 'C', traceTid(), sinceStart(chrono::steady_clock::now()), value });
+}
+
+void traceThreadName(const char* name)
+{
+	if (!isTracing())
+		return;
+	pushEvent({ name, 'M', traceTid(), 0.0, 0.0 });
+}
+
+void stopTrace()
+{
+	if (!gTracing.exchange(false))
+		return;
+
+	lock_guard<mutex> lock(gTraceMutex);
+	//May run from atexit, where throwing would abort, so failures are only reported
+	ofstream file(gTracePath, ios::trunc);
+	if (!file)
+	{
+		printError(("Cannot create " + gTracePath).c_str());
+		return;
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char line[256];
+	for (size_t i = 0; i < gTraceEvents.size(); ++i)
+	{
+		const TraceEvent& e = gTraceEvents[i];
+		if (e.phase == 'X')
+			snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", e.name, e.tid, e.ts, e.value);
+		else if (e.phase == 'C')
+			snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%.17g}}", e.name, e.tid, e.ts, e.value);
+		else
+			snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", e.tid, e.name);
+		file << line << (i + 1 < gTraceEvents.size() ? ",\n" : "\n");
+	}
+	file << "]}\n";
+
+	if (!file)
+		printError(("Failed to write " + gTracePath).c_str());
+	else
+		printf("Trace: %zu events written to %s, %llu dropped\n", gTraceEvents.size(), gTracePath.c_str(), (unsigned long long)gDroppedEvents);
+
+	gTraceEvents.clear();
+	gTraceEvents.shrink_to_fit();
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "basic_types.h"
+#include <chrono>
+#include <string>
+
+//Chrome trace event recorder: the file opens in chrome://tracing or ui.perfetto.dev.
+//Spans on one thread nest by time; each thread gets a small id and an optional name.
+//Until startTrace every call below returns after reading one flag.
+void startTrace(const std::string& path);
+//Writes the file; safe to call more than once and from atexit
+void stopTrace();
+bool isTracing();
+
+//Names must outlive the trace: string literals or static tables
+void traceSpan(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+void traceCounter(const char* name, double value);
+void traceThreadName(const char* name);
+
+class TraceScope
+{
+	const char* name;
+	bool active;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit TraceScope(const char* name) : name(name), active(isTracing())
+	{
+		if (active)
+			start = std::chrono::steady_clock::now();
+	}
+	~TraceScope()
+	{
+		if (active)
+			traceSpan(name, start, std::chrono::steady_clock::now());
+	}
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+};
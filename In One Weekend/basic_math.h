@@ -1,27 +1,35 @@
 #pragma once
-#include "pch.h"
 #include "basic_types.h"
 #include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <time.h>
+
+//No D3D or Windows here: the scene and everything else on the CPU side builds on its own.
+//The DirectXMath helpers are in dxHelper.h.
+using namespace std;
 
 #define PI 3.1415926535f
 #define DEGREE (PI / 180.f)
 
-inline XMFLOAT4X4 IdentityMatrix4x4()
+inline std::mt19937& random_generator()
+{
+	static std::mt19937 generator(static_cast<unsigned int>(time(nullptr)));
+	return generator;
+}
+
+//Scene construction draws from this generator; a fixed seed rebuilds the same scene
+inline void seed_random(uint seed)
 {
-	return XMFLOAT4X4
-	(
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
+	random_generator().seed(seed);
 }
 
 inline float random_float()
 {
 	static std::uniform_real_distribution<float> distribution(0.f, 1.f);
-	static std::mt19937 generator(static_cast<unsigned int>(time(nullptr)));
-	return distribution(generator);
+	return distribution(random_generator());
 }
 
 inline float random_float(float min, float max)
@@ -112,6 +120,27 @@ inline float3 cross(const float3& v, const float3& w)
 	return float3(v.y * w.z - v.z * w.y, v.z * w.x - v.x * w.z, v.x * w.y - v.y * w.x);
 }
 
+inline float luminance(const float3& c)
+{
+	return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+inline float3 transformPoint(const Transform& tm, const float3& p)
+{
+	return float3(
+		tm.mat[0][0] * p.x + tm.mat[0][1] * p.y + tm.mat[0][2] * p.z + tm.mat[0][3],
+		tm.mat[1][0] * p.x + tm.mat[1][1] * p.y + tm.mat[1][2] * p.z + tm.mat[1][3],
+		tm.mat[2][0] * p.x + tm.mat[2][1] * p.y + tm.mat[2][2] * p.z + tm.mat[2][3]);
+}
+
+inline float3 transformVector(const Transform& tm, const float3& v)
+{
+	return float3(
+		tm.mat[0][0] * v.x + tm.mat[0][1] * v.y + tm.mat[0][2] * v.z,
+		tm.mat[1][0] * v.x + tm.mat[1][1] * v.y + tm.mat[1][2] * v.z,
+		tm.mat[2][0] * v.x + tm.mat[2][1] * v.y + tm.mat[2][2] * v.z);
+}
+
 inline Transform composeMatrix(const float3& translation, const float4& rotation, float scale)
 {
 	Transform ret;
@@ -0,0 +1,67 @@
+#pragma once
+#include "basic_types.h"
+
+// C++ mirror of the counter-based generator in Helpers.hlsli. Given the same
+// (pixel, frame, sample, bounce, dimension) key both sides produce the same
+// bits, so CPU tools can regenerate any GPU sample independently.
+struct RngState
+{
+	uint pixel;
+	uint frame;
+	uint sampleIdx;
+	uint bounce;
+	uint dimension;
+};
+
+inline uint pcgHash(uint v)
+{
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+//FNV-1a; pass a previous result as hash to chain several blocks
+inline uint64 fnv1a(const void* data, uint64 size, uint64 hash = 0xcbf29ce484222325ull)
+{
+	const uint8* bytes = (const uint8*)data;
+	for (uint64 i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+inline RngState initRng(uint pixel, uint frame, uint sampleIdx, uint bounce)
+{
+	RngState rng;
+	rng.pixel = pixel;
+	rng.frame = frame;
+	rng.sampleIdx = sampleIdx;
+	rng.bounce = bounce;
+	rng.dimension = 0;
+	return rng;
+}
+
+inline uint hashRng(const RngState& rng)
+{
+	uint h = pcgHash(rng.dimension);
+	h = pcgHash(rng.bounce + h);
+	h = pcgHash(rng.sampleIdx + h);
+	h = pcgHash(rng.frame + h);
+	return pcgHash(rng.pixel + h);
+}
+
+//[0, 1)
+inline float rand(RngState& rng)
+{
+	uint h = hashRng(rng);
+	rng.dimension++;
+	return float(h >> 8) * (1.f / 16777216.f);
+}
+
+//[min, max)
+inline float rand(RngState& rng, float min, float max)
+{
+	return (rand(rng) * (max - min)) + min;
+}
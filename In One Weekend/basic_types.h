@@ -2,6 +2,7 @@
 
 typedef wchar_t wchar;
 typedef unsigned char uint8;
+typedef unsigned short uint16;
 typedef unsigned int uint;
 typedef unsigned long long uint64;
 
@@ -27,15 +28,7 @@ struct float3
 	union
 	{
 		float data[3];
-		struct
-		{
-			union
-			{
-				struct { float x, y; };
-				float2 xy;
-			};
-			float z;
-		};
+		struct { float x, y, z; };
 	};
 
 	float3() {}
@@ -43,7 +36,7 @@ struct float3
 	float3(X x) : x((float)x), y((float)x), z((float)x) {}
 	template<typename X, typename Y, typename Z>
 	float3(X x, Y y, Z z) : x((float)x), y((float)y), z((float)z) {}
-	float3(const float2& xy, float z) : xy(xy), z(z) {}
+	float3(const float2& xy, float z) : x(xy.x), y(xy.y), z(z) {}
 	float& operator[](int order) { return data[order]; }
 	const float operator[](int order) const { return data[order]; }
 };
@@ -53,15 +46,7 @@ struct float4
 	union
 	{
 		float data[4];
-		struct
-		{
-			union
-			{
-				struct { float x, y, z; };
-				float3 xyz;
-			};
-			float w;
-		};
+		struct { float x, y, z, w; };
 	};
 
 	float4() {}
@@ -69,7 +54,7 @@ struct float4
 	float4(X x) : x((float)x), y((float)x), z((float)x), w((float)x) {}
 	template<typename X, typename Y, typename Z, typename W>
 	float4(X x, Y y, Z z, W w) : x((float)x), y((float)y), z((float)z), w((float)w) {}
-	float4(const float3& xyz, float w) : xyz(xyz), w(w) {}
+	float4(const float3& xyz, float w) : x(xyz.x), y(xyz.y), z(xyz.z), w(w) {}
 	float& operator[](int order) { return data[order]; }
 	const float operator[](int order) const { return data[order]; }
 };
@@ -1,4 +1,5 @@
 #include "dxHelper.h"
+#include <atomic>
 
 static ComPtr<IDXGIFactory2> gFactory_v2 = nullptr;
 static ComPtr<ID3D12Device> gDevice_v0 = nullptr;
@@ -56,7 +57,55 @@ ComPtr<ID3D12Device> createDX12Device(IDXGIAdapter* adapter)
 	return gDevice_v0;
 }
 
-ComPtr<ID3D12Resource> createCommittedBuffer(uint64 bufferSize, D3D12_HEAP_TYPE heapType, D3D12_RESOURCE_FLAGS resourceFlags, D3D12_RESOURCE_STATES resourceStates)
+//Lives in a resource's private data, which D3D releases with the resource; that ends the tracking
+class MemoryTracker : public IUnknown
+{
+	atomic<ULONG> refCount{ 1 };
+	MemoryTag::Type tag;
+	uint64 bytes;
+
+public:
+	MemoryTracker(MemoryTag::Type tag, uint64 bytes) : tag(tag), bytes(bytes) { trackAlloc(tag, bytes); }
+	virtual ~MemoryTracker() { trackFree(tag, bytes); }
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+	{
+		if (riid != __uuidof(IUnknown))
+		{
+			*object = nullptr;
+			return E_NOINTERFACE;
+		}
+		*object = this;
+		AddRef();
+		return S_OK;
+	}
+	ULONG STDMETHODCALLTYPE AddRef() override { return ++refCount; }
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		ULONG count = --refCount;
+		if (count == 0)
+			delete this;
+		return count;
+	}
+};
+
+static const GUID cMemoryTrackerGuid = { 0x3f1c7a52, 0x9d4e, 0x4b8a, { 0xa6, 0x1e, 0x5c, 0x27, 0x90, 0xd3, 0x48, 0xb1 } };
+
+void trackDeviceMemory(ID3D12Object* object, uint64 bytes, MemoryTag::Type tag)
+{
+	MemoryTracker* tracker = new MemoryTracker(tag, bytes);
+	ThrowIfFailed(object->SetPrivateDataInterface(cMemoryTrackerGuid, tracker));
+	tracker->Release();
+}
+
+//Counts what the allocation really takes, alignment included
+static void trackResource(ID3D12Resource* resource, MemoryTag::Type tag)
+{
+	D3D12_RESOURCE_DESC desc = resource->GetDesc();
+	trackDeviceMemory(resource, gDevice_v0->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes, tag);
+}
+
+ComPtr<ID3D12Resource> createCommittedBuffer(uint64 bufferSize, D3D12_HEAP_TYPE heapType, D3D12_RESOURCE_FLAGS resourceFlags, D3D12_RESOURCE_STATES resourceStates, MemoryTag::Type tag)
 {
 	ComPtr<ID3D12Resource> resource;
 	ThrowIfFailed(gDevice_v0->CreateCommittedResource(
@@ -65,6 +114,7 @@ ComPtr<ID3D12Resource> createCommittedBuffer(uint64 bufferSize, D3D12_HEAP_TYPE
 		&CD3DX12_RESOURCE_DESC::Buffer(bufferSize, resourceFlags),
 		resourceStates,
 		nullptr, IID_PPV_ARGS(&resource)));
+	trackResource(resource.Get(), tag);
 	return resource;
 }
 
@@ -81,7 +131,7 @@ ComPtr<ID3D12Resource> createPlacedBuffer(ComPtr<ID3D12Heap1> heap, uint64 heapO
 	return resource;
 }
 
-ComPtr<ID3D12Resource> createDefaultTexture(DXGI_FORMAT format, uint width, uint height, D3D12_RESOURCE_STATES state)
+ComPtr<ID3D12Resource> createDefaultTexture(DXGI_FORMAT format, uint width, uint height, D3D12_RESOURCE_STATES state, MemoryTag::Type tag)
 {
 	ComPtr<ID3D12Resource> resource;
 	ThrowIfFailed(gDevice_v0->CreateCommittedResource(
@@ -91,6 +141,7 @@ ComPtr<ID3D12Resource> createDefaultTexture(DXGI_FORMAT format, uint width, uint
 		state,
 		nullptr,
 		IID_PPV_ARGS(&resource)));
+	trackResource(resource.Get(), tag);
 	return resource;
 }
 
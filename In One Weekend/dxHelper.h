@@ -2,6 +2,31 @@
 #include "pch.h"
 #include "basic_math.h"
 #include "Error.h"
+#include "MemoryStats.h"
+
+inline void ThrowIfFailed(HRESULT hr)
+{
+	if (FAILED(hr))
+	{
+		throw hr;
+	}
+}
+
+inline void ThrowIfFalse(bool value)
+{
+	ThrowIfFailed(value ? S_OK : E_FAIL);
+}
+
+inline XMFLOAT4X4 IdentityMatrix4x4()
+{
+	return XMFLOAT4X4
+	(
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f
+	);
+}
 
 struct TracedResult
 {
@@ -9,6 +34,7 @@ struct TracedResult
 	uint width;
 	uint height;
 	uint pixelSize;
+	DXGI_FORMAT format;
 };
 
 inline constexpr uint _bpp(DXGI_FORMAT format)
@@ -17,8 +43,13 @@ inline constexpr uint _bpp(DXGI_FORMAT format)
 	{
 	case DXGI_FORMAT_R8G8B8A8_UNORM:
 	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+	case DXGI_FORMAT_R11G11B10_FLOAT:
 		return 4;
 
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		return 8;
+
 	case DXGI_FORMAT_R32G32B32A32_FLOAT:
 		return 16;
 
@@ -68,12 +99,18 @@ ComPtr<IDXGIFactory2> getFactory();
 ComPtr<IDXGIAdapter> getRTXAdapter();
 ComPtr<ID3D12Device> createDX12Device(IDXGIAdapter* adapter);
 
+//Committed resources are counted under tag in MemoryStats until they are released
 ComPtr<ID3D12Resource> createCommittedBuffer(
 	uint64 bufferSize,
 	D3D12_HEAP_TYPE heapType = D3D12_HEAP_TYPE_UPLOAD,
 	D3D12_RESOURCE_FLAGS resourceFlags = D3D12_RESOURCE_FLAG_NONE,
-	D3D12_RESOURCE_STATES resourceStates = D3D12_RESOURCE_STATE_GENERIC_READ);
+	D3D12_RESOURCE_STATES resourceStates = D3D12_RESOURCE_STATE_GENERIC_READ,
+	MemoryTag::Type tag = MemoryTag::Other);
+
+//For memory made some other way, such as a heap; counted until object is released
+void trackDeviceMemory(ID3D12Object* object, uint64 bytes, MemoryTag::Type tag);
 
+//Placed buffers are counted with their heap
 ComPtr<ID3D12Resource> createPlacedBuffer(
 	ComPtr<ID3D12Heap1> heap,
 	uint64 heapOffset,
@@ -84,7 +121,8 @@ ComPtr<ID3D12Resource> createDefaultTexture(
 	DXGI_FORMAT format,
 	uint width,
 	uint height,
-	D3D12_RESOURCE_STATES state);
+	D3D12_RESOURCE_STATES state,
+	MemoryTag::Type tag = MemoryTag::Other);
 
 class dxShader
 {
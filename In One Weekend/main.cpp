@@ -1,6 +1,19 @@
 #include "D3D12Screen.h"
 #include "DXRPathTracer.h"
 #include "timer.h"
+#include "Tonemap.h"
+#include "FrameStream.h"
+#include "Profiler.h"
+#include "CostHeatmap.h"
+#include "Benchmark.h"
+#include "Regression.h"
+#include "MemoryStats.h"
+#include "MemoryCheck.h"
+#include "FlyThrough.h"
+#include "FramePacing.h"
+#include "TimeToQuality.h"
+#include <chrono>
+#include <stdexcept>
 
 HWND createWindow(const wchar* winTitle, uint width, uint height);
 
@@ -10,34 +23,447 @@ unique_ptr<DXRPathTracer> tracer;
 uint gWidth = 1600;
 uint gHeight = 900;
 bool minimized = false;
+const char* memoryFile = nullptr;
 
-int main()
+//Runs on every exit, so --render, --heatmap and --regress report too
+void reportMemory()
 {
-	HWND hwnd = createWindow(L"In One Weekend", gWidth, gHeight);
-	ShowWindow(hwnd, SW_SHOW);
+	printMemoryReport();
+	try
+	{
+		writeMemoryReport(memoryFile);
+	}
+	catch (const runtime_error& e)
+	{
+		printError(e.what());
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* envFile = nullptr;
+	const char* checkpointFile = nullptr;
+	const char* recordCameraFile = nullptr;
+	const char* playCameraFile = nullptr;
+	const char* flyThroughFile = nullptr;
+	FlyThroughSettings flyThroughSettings;
+	const char* qualityReference = nullptr;
+	const char* qualityFile = nullptr;
+	TimeToQualitySettings qualitySettings;
+	uint samplesPerFrame = 0, maxPathLength = 0;
+	double checkpointInterval = 300.0;
+	const char* renderFile = nullptr;
+	uint renderW = 0, renderH = 0;
+	uint tileSize = 1024;
+	uint renderFrames = 64;
+	bool guide = false;
+	bool benchTonemap = false;
+	const char* benchFile = nullptr;
+	BenchmarkSettings benchSettings;
+	bool checkEncodingErrors = false;
+	bool checkMemoryAccounting = false;
+	bool denoise = false;
+	bool reproject = false;
+	bool dynamicResolution = false;
+	bool rayStats = false;
+	bool stream = false;
+	StreamSettings streamSettings;
+	const char* viewHost = nullptr;
+	uint16 viewPort = 0;
+	const char* viewFile = nullptr;
+	const char* profileFile = nullptr;
+	const char* pacingFile = nullptr;
+	const char* heatmapPrefix = nullptr;
+	const char* regressDir = nullptr;
+	bool regressUpdate = false;
+	uint heatmapW = 0, heatmapH = 0;
+	HeatmapSettings heatmapSettings;
+	const char* traceFile = getenv("IOW_TRACE");
+	OutputEncoding::Type encoding = OutputEncoding::RGBA32F;
+	AovLayout::Type aovLayout = AovLayout::Off;
+	uint sceneSeed = (uint)time(nullptr);
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--render") == 0 && i + 3 < argc)
+		{
+			renderW = (uint)strtoul(argv[++i], nullptr, 10);
+			renderH = (uint)strtoul(argv[++i], nullptr, 10);
+			renderFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+			tileSize = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			renderFrames = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--env") == 0 && i + 1 < argc)
+			envFile = argv[++i];
+		else if (strcmp(argv[i], "--guide") == 0)
+			guide = true;
+		else if (strcmp(argv[i], "--bench-tonemap") == 0)
+			benchTonemap = true;
+		else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+			benchFile = argv[++i];
+		else if (strcmp(argv[i], "--bench-filter") == 0 && i + 1 < argc)
+			benchSettings.filter = argv[++i];
+		else if (strcmp(argv[i], "--bench-reps") == 0 && i + 1 < argc)
+			benchSettings.repetitions = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--encoding") == 0 && i + 1 < argc)
+			encoding = encodingFromName(argv[++i]);
+		else if (strcmp(argv[i], "--aov") == 0 && i + 1 < argc)
+			aovLayout = aovLayoutFromName(argv[++i]);
+		else if (strcmp(argv[i], "--reproject") == 0)
+			reproject = true;
+		else if (strcmp(argv[i], "--dynamic-res") == 0)
+			dynamicResolution = true;
+		else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+		{
+			stream = true;
+			streamSettings.port = (uint16)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--stream-any") == 0)
+			streamSettings.loopbackOnly = false;
+		else if (strcmp(argv[i], "--stream-rate") == 0 && i + 1 < argc)
+			streamSettings.maxBytesPerSecond = (uint)strtoul(argv[++i], nullptr, 10) * 1024;
+		else if (strcmp(argv[i], "--view") == 0 && i + 3 < argc)
+		{
+			viewHost = argv[++i];
+			viewPort = (uint16)strtoul(argv[++i], nullptr, 10);
+			viewFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profileFile = argv[++i];
+		else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc)
+			pacingFile = argv[++i];
+		else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+			memoryFile = argv[++i];
+		else if (strcmp(argv[i], "--heatmap") == 0 && i + 3 < argc)
+		{
+			heatmapW = (uint)strtoul(argv[++i], nullptr, 10);
+			heatmapH = (uint)strtoul(argv[++i], nullptr, 10);
+			heatmapPrefix = argv[++i];
+		}
+		else if (strcmp(argv[i], "--heatmap-spp") == 0 && i + 1 < argc)
+			heatmapSettings.samplesPerPixel = (uint)strtoul(argv[++i], nullptr, 10);
+		else if ((strcmp(argv[i], "--regress") == 0 || strcmp(argv[i], "--regress-update") == 0) && i + 1 < argc)
+		{
+			regressUpdate = strcmp(argv[i], "--regress-update") == 0;
+			regressDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			traceFile = argv[++i];
+		else if (strcmp(argv[i], "--ray-stats") == 0)
+			rayStats = true;
+		else if (strcmp(argv[i], "--denoise") == 0)
+			denoise = true;
+		else if (strcmp(argv[i], "--check-encodings") == 0)
+			checkEncodingErrors = true;
+		else if (strcmp(argv[i], "--check-memory") == 0)
+			checkMemoryAccounting = true;
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			sceneSeed = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--record-camera") == 0 && i + 1 < argc)
+			recordCameraFile = argv[++i];
+		else if (strcmp(argv[i], "--play-camera") == 0 && i + 1 < argc)
+			playCameraFile = argv[++i];
+		else if (strcmp(argv[i], "--fly-through") == 0 && i + 2 < argc)
+		{
+			flyThroughSettings.frames = (uint)strtoul(argv[++i], nullptr, 10);
+			flyThroughFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--quality") == 0 && i + 2 < argc)
+		{
+			qualityReference = argv[++i];
+			qualityFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--quality-seconds") == 0 && i + 1 < argc)
+			qualitySettings.maxSeconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			samplesPerFrame = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--max-path") == 0 && i + 1 < argc)
+			maxPathLength = (uint)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+			checkpointFile = argv[++i];
+		else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+			checkpointInterval = atof(argv[++i]);
+	}
+
+	if (flyThroughFile && !playCameraFile)
+	{
+		printf("--fly-through plays the path given with --play-camera\n");
+		return 1;
+	}
+
+	if (benchTonemap)
+	{
+		const char* curveNames[TransferCurve::Count] = { "sqrt", "gamma", "sRGB" };
+		for (uint curve = 0; curve < TransferCurve::Count; ++curve)
+		{
+			TonemapSettings settings;
+			settings.curve = (TransferCurve::Type)curve;
+			printf("Tonemap 3840x2160 %s: %.2f GPixel/s\n", curveNames[curve], benchmarkTonemap(3840, 2160, 50, settings) * 1e-9);
+		}
+
+		TonemapSettings settings;
+		settings.toneOperator = ToneOperator::ACES;
+		settings.curve = TransferCurve::sRGB;
+		settings.dither = true;
+		printf("Tonemap 3840x2160 ACES sRGB dithered: %.2f GPixel/s\n", benchmarkTonemap(3840, 2160, 50, settings) * 1e-9);
+		return 0;
+	}
+
+	if (benchFile)
+	{
+		writeBenchmarks(benchFile, runBenchmarks(benchSettings));
+		return 0;
+	}
+
+	if (checkMemoryAccounting)
+		return checkMemory() > 0 ? 1 : 0;
+
+	if (checkEncodingErrors)
+		return checkEncodings() > 0 ? 1 : 0;
+
+	//Reference viewer: keeps the latest streamed frame in viewFile, rewritten at most once a second
+	if (viewHost)
+	{
+		FrameStreamClient client;
+		if (!client.connect(viewHost, viewPort))
+		{
+			printf("Cannot connect to %s:%u\n", viewHost, viewPort);
+			return 1;
+		}
+
+		auto lastWrite = chrono::steady_clock::now() - chrono::seconds(1);
+		bool written = true;
+		uint64 lastBytes = 0;
+		while (client.receiveFrame())
+		{
+			written = false;
+			auto now = chrono::steady_clock::now();
+			double elapsed = chrono::duration<double>(now - lastWrite).count();
+			if (elapsed < 1.0)
+				continue;
+
+			writeImage(viewFile, client.getFrame());
+			printf("Frame %llu%s  %.1f KB/s\n", (unsigned long long)client.getFrameId(), client.isFrameComplete() ? "" : " (partial)",
+				(client.getBytesReceived() - lastBytes) / 1024.0 / elapsed);
+			lastWrite = now;
+			lastBytes = client.getBytesReceived();
+			written = true;
+		}
+		if (!written)
+			writeImage(viewFile, client.getFrame());
+		printf("Stream closed\n");
+		return 0;
+	}
+
+	//Startup zones are recorded too
+	if (profileFile)
+		setProfiling(true);
+
+	if (memoryFile)
+		atexit(reportMemory);
+
+	//Written on any exit, including --render's
+	if (traceFile && *traceFile)
+	{
+		startTrace(traceFile);
+		atexit(stopTrace);
+		traceThreadName("main");
+	}
+
+	//An existing checkpoint decides the seed, so the random scene comes out identical
+	CheckpointState checkpoint;
+	bool haveCheckpoint = checkpointFile && readCheckpointState(checkpointFile, checkpoint);
+	if (haveCheckpoint)
+		sceneSeed = checkpoint.sceneSeed;
+	//Likewise a camera path is played in the scene it was recorded in
+	CameraPath playPath;
+	if (playCameraFile)
+	{
+		playPath.load(playCameraFile);
+		sceneSeed = playPath.sceneSeed;
+	}
+
+	//Traversal cost of the startup view, traced on the CPU over the same scene. Needs no window or
+	//device, so it also runs where DXR does not.
+	if (heatmapPrefix)
+	{
+		seed_random(sceneSeed);
+		SceneLoader sceneLoader;
+		Scene* scene;
+		{
+			ProfileScope scope(ProfileZone::SceneBuild);
+			scene = sceneLoader.push_RayTracingInOneWeekend();
+		}
+
+		//The view DXRPathTracer starts from
+		Camera camera;
+		camera.setLens(cStartupFovY, float(heatmapW) / _max(heatmapH, 1u), 1.0f, 1000.0f);
+		camera.lookAt(camera.getPosition(), camera.getLook(), camera.getUp());
+		XMFLOAT3 pos = camera.getPosition3f(), right = camera.getRight3f(), up = camera.getUp3f(), look = camera.getLook3f();
+
+		HeatmapView view;
+		view.position = float3(pos.x, pos.y, pos.z);
+		view.right = float3(right.x, right.y, right.z);
+		view.up = float3(up.x, up.y, up.z);
+		view.look = float3(look.x, look.y, look.z);
+		view.tanHalfFovY = tanf(0.5f * camera.getFovY());
+		view.tanHalfFovX = view.tanHalfFovY * heatmapW / _max(heatmapH, 1u);
+
+		CostHeatmap heatmap;
+		heatmap.build(scene);
+		heatmap.render(view, heatmapW, heatmapH, heatmapSettings);
+		heatmap.printSummary();
+		heatmap.writeImages(heatmapPrefix);
+		return 0;
+	}
+
+	HWND hwnd;
+	{
+		TraceScope scope("createWindow");
+		hwnd = createWindow(L"In One Weekend", gWidth, gHeight);
+	}
+	if (!renderFile && !regressDir && !flyThroughFile && !qualityFile)
+		ShowWindow(hwnd, SW_SHOW);
 
 	tracer = make_unique<DXRPathTracer>(hwnd, gWidth, gHeight);
 	screen = make_unique<D3D12Screen>(hwnd, gWidth, gHeight);
 
+	//Builds its own fixed scenes; any regression fails the run
+	if (regressDir)
+		return runRegression(tracer.get(), regressDir, regressUpdate) > 0 ? 1 : 0;
+
+	seed_random(sceneSeed);
 	SceneLoader sceneLoader;
-	Scene* scene = sceneLoader.push_RayTracingInOneWeekend();
+	Scene* scene;
+	{
+		ProfileScope scope(ProfileZone::SceneBuild);
+		scene = sceneLoader.push_RayTracingInOneWeekend();
+	}
 	tracer->setupScene(scene);
 
+	EnvironmentMap envMap;
+	if (envFile)
+	{
+		envMap.load(envFile);
+		tracer->setEnvironmentMap(&envMap);
+	}
+
+	if (guide)
+		tracer->setPathGuiding(true);
+
+	if (encoding != OutputEncoding::RGBA32F)
+		tracer->setOutputEncoding(encoding);
+
+	if (aovLayout != AovLayout::Off)
+		tracer->setAovLayout(aovLayout);
+
+	if (denoise)
+		tracer->setDenoising(true);
+
+	if (reproject)
+		tracer->setTemporalReprojection(true);
+
+	if (dynamicResolution)
+		tracer->setDynamicResolution(true);
+
+	if (rayStats)
+		tracer->setRayStatistics(true);
+
+	if (samplesPerFrame || maxPathLength)
+		tracer->setSampling(samplesPerFrame ? samplesPerFrame : tracer->getSamplesPerFrame(), maxPathLength ? maxPathLength : tracer->getMaxPathLength());
+
+	if (renderFile)
+	{
+		tracer->renderTiled(renderFile, renderW, renderH, tileSize, renderFrames);
+		return 0;
+	}
+
+	//Headless and with the camera on the path only, so runs can be compared between builds
+	if (flyThroughFile)
+	{
+		runFlyThrough(tracer.get(), playPath, flyThroughFile, flyThroughSettings);
+		return 0;
+	}
+
+	//Also headless: the startup view, accumulated with the settings above
+	if (qualityFile)
+	{
+		runTimeToQuality(tracer.get(), qualityReference, qualityFile, qualitySettings);
+		return 0;
+	}
+
+	if (checkpointFile)
+	{
+		tracer->setCheckpoint(checkpointFile, checkpointInterval, sceneSeed);
+		if (haveCheckpoint)
+		{
+			if (tracer->resumeFromCheckpoint(checkpointFile))
+				printf("Resumed %s at %u frames\n", checkpointFile, checkpoint.accumulatedFrames);
+			else
+				printf("Checkpoint %s does not match this scene or window; starting over\n", checkpointFile);
+		}
+	}
+
+	FrameStreamServer streamer;
+	if (stream)
+		streamer.start(streamSettings);
+
+	//Playback loops over the path in real time; recording keeps a key per frame
+	CameraPath recordPath;
+	recordPath.sceneSeed = sceneSeed;
+	double cameraStartTime = getCurrentTime();
+	if (playCameraFile)
+		tracer->setCameraInput(false);
+
+	//Startup is not part of any frame
+	if (pacingFile)
+		setFramePacing(true);
+
 	double fps, old_fps = 0;
 	while (IsWindow(hwnd))
 	{
+		ProfileScope frameScope(ProfileZone::Frame);
+		markFrame(FrameMark::Start);
 		if (!minimized)
 		{
+			double cameraTime = getCurrentTime() - cameraStartTime;
+			if (playCameraFile)
+			{
+				double duration = playPath.duration();
+				tracer->setCameraKey(playPath.sample(playPath.getKey(0).time + (duration > 0.0 ? fmod(cameraTime, duration) : 0.0)));
+			}
+
 			tracer->update();
+			markFrame(FrameMark::UpdateEnd);
+
+			if (recordCameraFile)
+			{
+				CameraKey key = tracer->getCameraKey();
+				key.time = cameraTime;
+				recordPath.record(key);
+			}
+
 			TracedResult trResult = tracer->shootRays();
-			screen->display(trResult);
+			markFrame(FrameMark::ReadbackEnd);
+			{
+				ProfileScope scope(ProfileZone::Display);
+				screen->display(trResult);
+			}
+			{
+				ProfileScope scope(ProfileZone::StreamSubmit);
+				streamer.submit(trResult);
+			}
 		}
 
-		MSG msg;
-		while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
 		{
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);
+			ProfileScope scope(ProfileZone::MessagePump);
+			MSG msg;
+			while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+			{
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
 		}
 
 		fps = updateFPS(1.0);
@@ -45,14 +471,42 @@ int main()
 		{
 			printf("FPS: %f\n", fps);
 			old_fps = fps;
+
+			//Nothing is printed while statistics are off
+			tracer->takeRayStats().print();
 		}
 	}
 
+	if (pacingFile)
+	{
+		printFramePacing();
+		writeFramePacing(pacingFile);
+	}
+
+	if (recordCameraFile)
+	{
+		recordPath.save(recordCameraFile);
+		printf("Camera path of %u keys written to %s\n", recordPath.numKeys(), recordCameraFile);
+	}
+
+	if (profileFile)
+	{
+		printProfile();
+		writeProfile(profileFile);
+	}
+
 	return 0;
 }
 
 LRESULT CALLBACK msgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
+//Marks the message being handled as input now. How long it waited in the queue is only known
+//from tick counts, so it goes along as a separate coarse figure.
+static void markInputMessage()
+{
+	markInput(getCurrentTime(), (GetTickCount() - (DWORD)GetMessageTime()) * 1e-3);
+}
+
 HWND createWindow(const wchar* winTitle, uint width, uint height)
 {
 	WNDCLASS wc = {};
@@ -87,14 +541,22 @@ LRESULT CALLBACK msgProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 	switch (message)
 	{
 	case WM_LBUTTONDOWN:
+		markInputMessage();
 		tracer->onMouseDown(wParam, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
 		return 0;
 	case WM_LBUTTONUP:
 		tracer->onMouseUp(wParam, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
 		return 0;
 	case WM_MOUSEMOVE:
+		//Only drags move the camera
+		if (wParam & MK_LBUTTON)
+			markInputMessage();
 		tracer->onMouseMove(wParam, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
 		return 0;
+	case WM_KEYDOWN:
+		markInputMessage();
+		tracer->onKeyDown(wParam);
+		return 0;
 
 	case WM_SIZE:
 		if (screen)
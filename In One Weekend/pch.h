@@ -3,7 +3,11 @@
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3d12.lib")
 #pragma comment(lib, "d3dcompiler.lib")
+#pragma comment(lib, "ws2_32.lib")
 
+//Winsock 2 has to come before anything that includes Windows.h, which would pull in the old winsock.h
+#include <WinSock2.h>
+#include <WS2tcpip.h>
 #include <d3d12.h>
 #include <dxgi1_6.h>
 #include <d3dcompiler.h>
@@ -1,23 +1,10 @@
 #pragma once
-#include "pch.h"
+#include <chrono>
 
+//Seconds on the monotonic clock, the same one the profiler reads
 inline double getCurrentTime()
 {
-	static double inv_freq;
-	static bool first = true;
-
-	if (first)
-	{
-		LARGE_INTEGER freq;
-		QueryPerformanceFrequency(&freq);
-		inv_freq = 1.0 / freq.QuadPart;
-		first = false;
-	}
-
-	LARGE_INTEGER c_time;
-	QueryPerformanceCounter(&c_time);
-	
-	return c_time.QuadPart * inv_freq;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 inline double updateFPS(double delta = 1.0)